@@ -23,14 +23,11 @@ int main(int argc, char* argv[])
     //
     msg("Hello, World!\n");
 
-    qstring s;
-    for (size_t i=0, c = get_func_qty(); i<c; ++i)
-    {
-        func_t* f = getn_func(i);
-        if (get_func_name(&s, f->start_ea) == 0)
-            s = "";
-        std::cout << std::hex << f->start_ea << ": function: " << s << std::endl;
-    }
+    bulk_snapshot_t snap;
+    idahost.extract(&snap, BULK_FUNCS);
+    for (size_t i = 0, c = snap.funcs.size(); i < c; ++i)
+        std::cout << std::hex << snap.funcs.start[i] << ": function: " << snap.funcs.name(i) << '\n';
+    std::cout.flush();
 
     idahost.term();
 
@@ -0,0 +1,253 @@
+#pragma once
+
+#include <windows.h>
+#include <errno.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+#include "idahost_arena.h"
+#include "idahost_alloc_trace.h"
+
+// CRT and process heap shims that serve the provider's allocations from an
+// arena_heap_t. Pointers the arena does not own (allocated before the hooks
+// went in, or inside the CRT itself) are handed to the functions the import
+// would have resolved to. Modules that are not hooked must not free arena
+// memory; IDA's qalloc/qfree convention keeps kernel memory with the kernel.
+namespace heap_hooks
+{
+    inline arena_heap_t* g_arena = nullptr;
+    inline HANDLE g_process_heap = nullptr;
+    // Set while heap_options_t::trace_file records the calls
+    inline alloc_trace_writer_t* g_trace = nullptr;
+
+    typedef void* (__cdecl* malloc_fn)(size_t);
+    typedef void (__cdecl* free_fn)(void*);
+    typedef void* (__cdecl* calloc_fn)(size_t, size_t);
+    typedef void* (__cdecl* realloc_fn)(void*, size_t);
+    typedef size_t (__cdecl* msize_fn)(void*);
+    typedef void* (__cdecl* recalloc_fn)(void*, size_t, size_t);
+    typedef void* (__cdecl* expand_fn)(void*, size_t);
+
+    // What the provider's imports resolved to before being hooked
+    inline malloc_fn real_malloc = ::malloc;
+    inline free_fn real_free = ::free;
+    inline realloc_fn real_realloc = ::realloc;
+    inline calloc_fn real_calloc = ::calloc;
+    inline msize_fn real_msize = ::_msize;
+    inline recalloc_fn real_recalloc = ::_recalloc;
+    inline expand_fn real_expand = ::_expand;
+
+    inline void trace(uint32_t op, const void* p, const void* old, size_t n)
+    {
+        alloc_trace_writer_t* t = g_trace;
+        if (t != nullptr && (p != nullptr || op != alloc_trace_rec_t::op_alloc))
+            t->record(op, GetCurrentThreadId(), p, old, n);
+    }
+
+    inline void* __cdecl my_malloc(size_t n)
+    {
+        void* p = g_arena->alloc(n);
+        if (p == nullptr)
+            p = real_malloc(n);
+        trace(alloc_trace_rec_t::op_alloc, p, nullptr, n);
+        return p;
+    }
+
+    inline void __cdecl my_free(void* p)
+    {
+        if (p == nullptr)
+            return;
+        trace(alloc_trace_rec_t::op_free, p, nullptr, 0);
+        if (g_arena->owns(p))
+            g_arena->free(p);
+        else
+            real_free(p);
+    }
+
+    inline void* realloc_impl(void* p, size_t n)
+    {
+        if (!g_arena->owns(p))
+            return real_realloc(p, n);
+        if (n == 0)
+        {
+            g_arena->free(p);
+            return nullptr;
+        }
+        void* q = g_arena->realloc(p, n);
+        if (q != nullptr)
+            return q;
+        // Arena exhausted: move the block to the system heap
+        size_t have = g_arena->usable_size(p);
+        q = real_malloc(n);
+        if (q == nullptr)
+            return nullptr;
+        memcpy(q, p, n < have ? n : have);
+        g_arena->free(p);
+        return q;
+    }
+
+    inline void* __cdecl my_realloc(void* p, size_t n)
+    {
+        if (p == nullptr)
+            return my_malloc(n);
+        void* q = realloc_impl(p, n);
+        if (q != nullptr || n == 0)
+            trace(alloc_trace_rec_t::op_realloc, q, p, n);
+        return q;
+    }
+
+    inline void* __cdecl my_calloc(size_t count, size_t size)
+    {
+        if (size != 0 && count > SIZE_MAX / size)
+        {
+            errno = ENOMEM;
+            return nullptr;
+        }
+        void* p = g_arena->alloc(count * size);
+        if (p == nullptr)
+            p = real_calloc(count, size);
+        else
+            memset(p, 0, g_arena->usable_size(p));
+        trace(alloc_trace_rec_t::op_alloc, p, nullptr, count * size);
+        return p;
+    }
+
+    inline size_t __cdecl my_msize(void* p)
+    {
+        return g_arena->owns(p) ? g_arena->usable_size(p) : real_msize(p);
+    }
+
+    inline void* __cdecl my_recalloc(void* p, size_t count, size_t size)
+    {
+        if (p != nullptr && !g_arena->owns(p))
+            return real_recalloc(p, count, size);
+        if (size != 0 && count > SIZE_MAX / size)
+        {
+            errno = ENOMEM;
+            return nullptr;
+        }
+        size_t n = count * size;
+        size_t have = p != nullptr ? g_arena->usable_size(p) : 0;
+        uint8_t* q = (uint8_t*)my_realloc(p, n);
+        if (q != nullptr && n > have)
+            memset(q + have, 0, n - have);
+        return q;
+    }
+
+    inline void* __cdecl my_expand(void* p, size_t n)
+    {
+        if (!g_arena->owns(p))
+            return real_expand(p, n);
+        return n <= g_arena->usable_size(p) ? p : nullptr;
+    }
+
+    inline LPVOID WINAPI my_HeapAlloc(HANDLE heap, DWORD flags, SIZE_T n)
+    {
+        if (heap != g_process_heap)
+            return ::HeapAlloc(heap, flags, n);
+        void* p = g_arena->alloc(n);
+        if (p == nullptr)
+            p = ::HeapAlloc(heap, flags, n);
+        else if ((flags & HEAP_ZERO_MEMORY) != 0)
+            memset(p, 0, n);
+        trace(alloc_trace_rec_t::op_alloc, p, nullptr, n);
+        return p;
+    }
+
+    inline BOOL WINAPI my_HeapFree(HANDLE heap, DWORD flags, LPVOID p)
+    {
+        if (p != nullptr && heap == g_process_heap)
+            trace(alloc_trace_rec_t::op_free, p, nullptr, 0);
+        if (p == nullptr || !g_arena->owns(p))
+            return ::HeapFree(heap, flags, p);
+        g_arena->free(p);
+        return TRUE;
+    }
+
+    inline LPVOID WINAPI my_HeapReAlloc(HANDLE heap, DWORD flags, LPVOID p, SIZE_T n)
+    {
+        if (!g_arena->owns(p))
+        {
+            LPVOID q = ::HeapReAlloc(heap, flags, p, n);
+            if (q != nullptr && heap == g_process_heap)
+                trace(alloc_trace_rec_t::op_realloc, q, p, n);
+            return q;
+        }
+
+        size_t have = g_arena->usable_size(p);
+        uint8_t* q;
+        if ((flags & HEAP_REALLOC_IN_PLACE_ONLY) != 0)
+        {
+            if (n > have)
+            {
+                SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+                return nullptr;
+            }
+            q = (uint8_t*)p;
+        }
+        else
+        {
+            q = (uint8_t*)g_arena->realloc(p, n);
+            if (q == nullptr)
+            {
+                q = (uint8_t*)::HeapAlloc(heap, flags & ~HEAP_ZERO_MEMORY, n);
+                if (q == nullptr)
+                    return nullptr;
+                memcpy(q, p, n < have ? n : have);
+                g_arena->free(p);
+            }
+        }
+        if ((flags & HEAP_ZERO_MEMORY) != 0 && n > have)
+            memset(q + have, 0, n - have);
+        trace(alloc_trace_rec_t::op_realloc, q, p, n);
+        return q;
+    }
+
+    inline SIZE_T WINAPI my_HeapSize(HANDLE heap, DWORD flags, LPCVOID p)
+    {
+        if (!g_arena->owns(p))
+            return ::HeapSize(heap, flags, p);
+        return g_arena->usable_size(p);
+    }
+
+    // Replaces `*addr` with the shim for `sym_name`, if there is one; the
+    // CRT originals are remembered for pointers the arena does not own
+    inline bool resolve_import(const char* sym_name, uint64_t* addr)
+    {
+        static const struct
+        {
+            const char* name;
+            const void* shim;
+            void** real;
+        } shims[] = {
+            { "malloc",         (const void*)my_malloc,         (void**)&real_malloc },
+            { "_malloc_base",   (const void*)my_malloc,         (void**)&real_malloc },
+            { "free",           (const void*)my_free,           (void**)&real_free },
+            { "_free_base",     (const void*)my_free,           (void**)&real_free },
+            { "realloc",        (const void*)my_realloc,        (void**)&real_realloc },
+            { "_realloc_base",  (const void*)my_realloc,        (void**)&real_realloc },
+            { "calloc",         (const void*)my_calloc,         (void**)&real_calloc },
+            { "_calloc_base",   (const void*)my_calloc,         (void**)&real_calloc },
+            { "_msize",         (const void*)my_msize,          (void**)&real_msize },
+            { "_msize_base",    (const void*)my_msize,          (void**)&real_msize },
+            { "_recalloc",      (const void*)my_recalloc,       (void**)&real_recalloc },
+            { "_expand",        (const void*)my_expand,         (void**)&real_expand },
+            { "HeapAlloc",      (const void*)my_HeapAlloc,      nullptr },
+            { "HeapFree",       (const void*)my_HeapFree,       nullptr },
+            { "HeapReAlloc",    (const void*)my_HeapReAlloc,    nullptr },
+            { "HeapSize",       (const void*)my_HeapSize,       nullptr },
+        };
+        if (g_arena == nullptr)
+            return false;
+        for (const auto& s : shims)
+        {
+            if (strcmp(sym_name, s.name) != 0)
+                continue;
+            if (s.real != nullptr && *addr != 0 && *addr != (uint64_t)s.shim)
+                *s.real = (void*)*addr;
+            *addr = (uint64_t)s.shim;
+            return true;
+        }
+        return false;
+    }
+}
@@ -1,6 +1,30 @@
 #include "idahost.h"
+#include "idahost_ipc.h"
+#include "idahost_decomp_cache.h"
 #include "pe_mapper.hpp"
 #include "win_utils.hpp"
+#include "import_profiler.hpp"
+#include "vfs_hooks.hpp"
+#include "heap_hooks.hpp"
+#include "readahead_hooks.hpp"
+#include "startup_hooks.hpp"
+#include <funcs.hpp>
+#include <segment.hpp>
+#include <xref.hpp>
+#include <bytes.hpp>
+#include <typeinf.hpp>
+#include <loader.hpp>
+#include <idp.hpp>
+#include <name.hpp>
+#include <ua.hpp>
+#include <hexrays.hpp>
+#include <config.hpp>
+
+// Hex-Rays API pointer; hosts that define their own build with
+// IDAHOST_DEFINE_HEXDSP=OFF
+#if IDAHOST_DEFINE_HEXDSP
+hexdsp_t* hexdsp = nullptr;
+#endif
 
 // TODO: test the TVHEADLESS environment variable:
 // - TVHEADLESS disable all output (for i/o redirection)
@@ -11,31 +35,19 @@
 
 struct idahost_cmdline_helper_t: idahost_t::rawoptions_t
 {
-    // Computed
-    std::wstring full_path_;
-    int argc_;
-    wchar_t** argv_;
-    std::vector<wchar_t> cmd_line_;
+    // Computed; reused across init() calls
+    launch_desc_t launch_;
 
     wchar_t* get_commandline() {
-        return &cmd_line_[0];
+        return launch_.command_line();
     }
 
     int* get_p_argc(void) {
-        return &argc_;
+        return launch_.p_argc();
     }
 
     wchar_t*** get_p_argv(void) {
-        return &argv_;
-    }
-
-    void reset()
-    {
-        for (int i = 0; i < argc_; ++i)
-            delete[] argv_[i];
-        delete[] argv_;
-        argc_ = 0;
-        argv_ = nullptr;
+        return launch_.p_argv();
     }
 
     bool auto_detect_idadir()
@@ -72,49 +84,18 @@ struct idahost_cmdline_helper_t: idahost_t::rawoptions_t
             if (idadir.empty())
                 return false;
         }
-
-        reset();
-        argc_ = args.size() + 1;
-        argv_ = new wchar_t* [argc_];
-        if (argv_ == nullptr)
-            return false;
-
-        for (int i = 0; i < argc_; ++i)
-            argv_[i] = nullptr;
-
-        full_path_ = idadir + L"\\" + idabin;
-        argv_[0] = new wchar_t[full_path_.size() + 1];
-        if (argv_[0] == nullptr)
-        {
-            delete[] argv_;
-            return false;
-        }
-
-        wcscpy(argv_[0], full_path_.c_str());
-
-        for (size_t i = 0; i < args.size(); ++i)
-        {
-            argv_[i + 1] = new wchar_t[args[i].size() + 1];
-            if (argv_[i + 1] == nullptr)
-            {
-                reset();
-                return false;
-            }
-            wcscpy(argv_[i + 1], args[i].c_str());
-        }
-
-        // Add command line
-        std::wstring cmd_line = L'"' + full_path_;
-        cmd_line.push_back(L'"');
-        for (const auto& arg : args)
-            cmd_line += L" " + arg;
-        cmd_line_ = std::vector<wchar_t>(cmd_line.begin(), cmd_line.end());
-        cmd_line_.push_back(L'\0');  // Null-terminate the command line    
-        return true;
+        return launch_.build(idadir, idabin, args, env);
     }
 
-    ~idahost_cmdline_helper_t() {
-        reset();
+    // Heap bytes held for the provider's launch arguments
+    size_t storage_bytes() const
+    {
+        size_t n = launch_.capacity_bytes();
+        for (const auto& arg : args)
+            n += sizeof(arg) + arg.capacity() * sizeof(wchar_t);
+        for (const auto& e : env)
+            n += sizeof(e) + (e.first.capacity() + e.second.capacity()) * sizeof(wchar_t);
+        return n;
     }
 
     void set_args(
@@ -139,6 +120,7 @@ struct idahost_cmdline_helper_t: idahost_t::rawoptions_t
 
 idahost_t idahost;
 static idahost_cmdline_helper_t idahost_options;
+static startup_hooks::profile_t s_startup_profile;
 
 static wchar_t*** _my__p___wargv(void) {
     return idahost_options.get_p_argv();
@@ -159,11 +141,10 @@ static DWORD WINAPI _my_GetModuleFileNameW(
 {
     if (hModule == nullptr)
     {
-        DWORD len = idahost_options.full_path_.size();
-        if (nSize < len)
-            return len;
-        wcscpy(lpFilename, idahost_options.full_path_.c_str());
-        return len;
+        bool truncated;
+        DWORD n = idahost_options.launch_.copy_module_path(lpFilename, nSize, &truncated);
+        SetLastError(truncated ? ERROR_INSUFFICIENT_BUFFER : ERROR_SUCCESS);
+        return n;
     }
 
     return GetModuleFileNameW(hModule, lpFilename, nSize);
@@ -174,6 +155,11 @@ extern "C" __declspec(dllexport) IDAHostInterface * __cdecl get_idahost_interfac
     return &idahost;
 }
 
+extern "C" __declspec(dllexport) int __cdecl get_idahost_interface_version()
+{
+    return IDAHOST_INTERFACE_VERSION;
+}
+
 static VOID CALLBACK s_RunProviderFiberProc(LPVOID lpParameter) {
     ((idahost_t*)lpParameter)->internal_run_provider();
 }
@@ -182,34 +168,76 @@ idahost_t::idahost_t()
 {
     cs_ = new ConsoleState();
     options = &idahost_options;
+
+    registry_.add("idahost_fiber_switches_total", "Host to provider switches", &metrics_.switches);
+    registry_.add("idahost_interact_seconds", "Duration of interact() round trips", &metrics_.roundtrip);
+    registry_.add("idahost_provider_seconds", "Time the provider ran before returning to the host", &metrics_.provider);
+    registry_.add("idahost_fiber_switch_seconds", "Provider to host fiber switch latency", &metrics_.fiber_switch);
+    registry_.add("idahost_save_screen_seconds", "Time spent in save_screen()", &metrics_.save_screen);
+    registry_.add("idahost_restore_screen_seconds", "Time spent in restore_screen()", &metrics_.restore_screen);
+    registry_.add("idahost_refresh_idaview_seconds", "Time spent in refresh_idaview_anyway()", &metrics_.refresh_idaview);
+    registry_.add("idahost_startup_seconds", "Time until the provider first returned to the host", &metrics_.startup_seconds);
+    registry_.add("idahost_image_large_page_bytes", "Bytes of the provider image backed by large pages", &metrics_.image_large_page_bytes);
+    registry_.add("idahost_input_resident_ratio", "Share of the input read ahead when the provider opened it", &metrics_.input_resident_ratio);
+    registry_.add("idahost_startup_hidden_total", "Modules a startup profile kept out of directory listings", &metrics_.startup_hidden);
+    registry_.add("idahost_startup_blocked_total", "Module loads a startup profile refused", &metrics_.startup_blocked);
+    registry_.add("idahost_startup_load_seconds", "Loads of plugins, loaders and processor modules", &metrics_.startup_load);
+    registry_.add("idahost_term_seconds", "Duration of the last term(), including a background close", &metrics_.term_seconds);
+    registry_.add("idahost_dispatch_wait_seconds", "Time dispatched requests waited to run", &metrics_.dispatch_wait);
+    registry_.add("idahost_dispatch_run_seconds", "Run time of dispatched requests", &metrics_.dispatch_run);
+    dispatcher_.set_metrics(&metrics_.dispatch_wait, &metrics_.dispatch_run);
 }
 
 idahost_t::~idahost_t() {
     delete provider_pe_;
     delete cs_;
+    delete decomp_cache_;
 }
 
 void idahost_t::save_screen()
 {
+    scoped_latency_t timer(metrics_.save_screen);
     cs_->save();
 }
 
 void idahost_t::restore_screen()
 {
+    scoped_latency_t timer(metrics_.restore_screen);
     cs_->restore();
 }
 
+void idahost_t::start_metrics_dump(const std::filesystem::path& path, std::chrono::milliseconds interval)
+{
+    dumper_.start(&registry_, path, interval);
+}
+
+void idahost_t::stop_metrics_dump()
+{
+    dumper_.stop();
+}
+
 bool idahost_t::init(const rawoptions_t& opt)
 {
     options->set_args(
         opt.idadir.c_str(), 
         opt.idabin.c_str(), 
         opt.args);
+    options->env = opt.env;
+    features_ = opt.features;
     return init_internal();
 }
 
 bool idahost_t::init(const options_t& opt)
 {
+    // Overlap the input's disk I/O with mapping and starting the provider
+    if (opt.features.input_readahead && !opt.input_file.empty())
+    {
+        metrics_.input_resident_ratio.set(-1);
+        readahead_.start(readahead_t::database_files(opt.input_file));
+        readahead_hooks::g_input_resident = &metrics_.input_resident_ratio;
+        readahead_hooks::g_readahead = &readahead_;
+    }
+
     if (!Console::IsConsoleApp())
         Console::SetupNewConsole(true);
 
@@ -225,12 +253,83 @@ bool idahost_t::init(const options_t& opt)
         options->add_arg(dbg_str);
     }
     options->add_arg(opt.input_file);
+    options->env = opt.env;
+    features_ = opt.features;
     return init_internal();
 }
 
+// Reserved and committed bytes of the pages that overlap [p, p + n)
+static void s_query_range(const void* p, size_t n, idahost_t::memory_region_t* r)
+{
+    const BYTE* cur = (const BYTE*)p;
+    const BYTE* end = cur + n;
+    MEMORY_BASIC_INFORMATION mbi;
+    while (cur < end && VirtualQuery(cur, &mbi, sizeof(mbi)) != 0)
+    {
+        const BYTE* rs = (const BYTE*)mbi.BaseAddress;
+        const BYTE* re = (std::min)(rs + mbi.RegionSize, end);
+        uint64_t part = re - (std::max)(rs, (const BYTE*)p);
+        if (mbi.State != MEM_FREE)
+            r->reserved_bytes += part;
+        if (mbi.State == MEM_COMMIT)
+            r->committed_bytes += part;
+        cur = re;
+    }
+}
+
+// Size of the whole VirtualAlloc reservation starting at `base`
+static size_t s_allocation_size(void* base)
+{
+    size_t n = 0;
+    MEMORY_BASIC_INFORMATION mbi;
+    while (VirtualQuery((BYTE*)base + n, &mbi, sizeof(mbi)) != 0 && mbi.AllocationBase == base)
+        n += mbi.RegionSize;
+    return n;
+}
+
+static void s_query_stack(void* base, const char* name, idahost_t::memory_region_t* r)
+{
+    r->name = name;
+    if (base == nullptr)
+        return;
+    size_t n = s_allocation_size(base);
+    s_query_range(base, n, r);
+    shared_region_t::sharing_t pages;
+    if (shared_region_t::query_sharing(base, n, &pages))
+    {
+        r->private_bytes = pages.private_bytes;
+        r->shared_bytes = pages.shared_bytes;
+    }
+}
+
+static void* s_current_stack()
+{
+    MEMORY_BASIC_INFORMATION mbi;
+    return VirtualQuery(&mbi, &mbi, sizeof(mbi)) != 0 ? mbi.AllocationBase : nullptr;
+}
+
+static void s_heap_usage(arena_heap_t* heap, uint64_t* committed, uint64_t* in_use)
+{
+    if (heap != nullptr)
+    {
+        arena_heap_t::stats_t st = heap->stats();
+        *committed = st.spans_used * arena_heap_t::SPAN_SIZE;
+        *in_use = st.bytes_in_use();
+        return;
+    }
+    HEAP_SUMMARY hs = {};
+    hs.cb = sizeof(hs);
+    if (HeapSummary(GetProcessHeap(), 0, &hs))
+    {
+        *committed = hs.cbCommitted;
+        *in_use = hs.cbAllocated;
+    }
+}
+
 bool idahost_t::init_internal()
 {
     options->finalize();
+    changes_.set_capacity(features_.change_feed.capacity_bytes);
     err_.clear();
     if (IsThreadAFiber())
     {
@@ -249,6 +348,8 @@ bool idahost_t::init_internal()
         return false;
     }
 
+    host_stack_ = s_current_stack();
+
     wchar_t cur_dir[MAX_PATH * 4];
     GetCurrentDirectoryW(MAX_PATH * 4, cur_dir);
     // Create the foreign fiber
@@ -263,7 +364,11 @@ bool idahost_t::init_internal()
     }
 
     // Let the provider run up to the appropriate checkpoint
+    uint64_t t0 = metrics_now_ns();
     SwitchToFiber(provider_fiber_);
+    metrics_.startup_seconds.set((metrics_now_ns() - t0) / 1e9);
+    if (provider_pe_ != nullptr)
+        metrics_.image_large_page_bytes.set((double)provider_pe_->LargePageBytes());
     // Restore the working directory
     SetCurrentDirectoryW(cur_dir);
     return true;
@@ -271,9 +376,151 @@ bool idahost_t::init_internal()
 
 void idahost_t::term()
 {
+    term(term_default);
+}
+
+static const char* idaapi s_ignore_cfg_keyword(const char*, int, const void*)
+{
+    return nullptr;
+}
+
+// PACK_DATABASE as ida.cfg sets it, or -1 if that cannot be told
+static int s_configured_pack_level()
+{
+    int level = -1;
+    const cfgopt_t opts[] = { cfgopt_t("PACK_DATABASE", &level, 0, 2) };
+    if (!read_config_file("ida.cfg", opts, qnumber(opts), s_ignore_cfg_keyword))
+        return -1;
+    // Left at -1 when the keyword is missing
+    return level;
+}
+
+void idahost_t::term(term_mode_e mode)
+{
+    if (term_pending_)
+        return;
+
+    term_t0_ = metrics_now_ns();
+    term_report_ = term_report_t();
+    term_report_.mode = mode;
+    term_done_ = false;
+
+    if (mode == term_deferred)
+    {
+        term_pending_ = true;
+        term_report_.blocking_seconds = (metrics_now_ns() - term_t0_) / 1e9;
+        return;
+    }
+    close_for_term();
+}
+
+bool idahost_t::wait_term()
+{
+    if (!term_pending_)
+        return term_done_;
+    term_pending_ = false;
+    close_for_term();
+    return true;
+}
+
+void idahost_t::close_for_term()
+{
+    term_mode_e mode = term_report_.mode;
     save_screen();
-    term_database();
+    int pack_level = -1;
+    switch (mode)
+    {
+        case term_discard:
+            // A temporary database is deleted on close instead of saved
+            set_database_flag(DBFL_TEMP | DBFL_KILL);
+            break;
+        case term_save_unpacked:
+            // Leave the .id0/.id1/.nam/.til files as they are; the setting
+            // is global, so it is put back for later databases
+            pack_level = s_configured_pack_level();
+            process_config_directive("PACK_DATABASE=0");
+            clr_database_flag(DBFL_KILL);
+            break;
+        default:
+            break;
+    }
+
+    uint64_t t1 = metrics_now_ns();
+    if (!db_closed_)
+        term_database();
+    term_report_.close_seconds = (metrics_now_ns() - t1) / 1e9;
+    if (pack_level >= 0)
+    {
+        char directive[32];
+        qsnprintf(directive, sizeof(directive), "PACK_DATABASE=%d", pack_level);
+        process_config_directive(directive);
+    }
     restore_screen();
+    finish_term();
+
+    uint64_t t2 = metrics_now_ns();
+    term_report_.total_seconds = (t2 - term_t0_) / 1e9;
+    if (mode != term_deferred)
+        term_report_.blocking_seconds = term_report_.total_seconds;
+    term_done_ = true;
+    metrics_.term_seconds.set(term_report_.total_seconds);
+}
+
+void idahost_t::set_provider_env(const char* name, const char* value)
+{
+    // Only the first override of a name knows the host's value
+    bool seen = false;
+    for (const saved_env_t& e : saved_env_)
+        seen |= _stricmp(e.name.c_str(), name) == 0;
+    if (!seen)
+    {
+        qstring old;
+        saved_env_t e;
+        e.name = name;
+        e.was_set = qgetenv(name, &old);
+        e.value = old.c_str();
+        saved_env_.push_back(e);
+    }
+    qsetenv(name, value);
+}
+
+void idahost_t::restore_env()
+{
+    for (const saved_env_t& e : saved_env_)
+    {
+        if (e.was_set)
+            qsetenv(e.name.c_str(), e.value.c_str());
+        else
+            _putenv_s(e.name.c_str(), "");    // removes it, from the process block too
+    }
+    saved_env_.clear();
+}
+
+void idahost_t::finish_term()
+{
+    readahead_.stop();
+    restore_env();
+
+    // Nothing the provider frees from here on is worth the time
+    if (heap_ != nullptr && features_.heap.release_at_term)
+        heap_->begin_teardown();
+    if (heap_hooks::g_trace != nullptr)
+    {
+        heap_hooks::g_trace = nullptr;
+        heap_trace_->close();
+    }
+
+    if (profiler_ != nullptr)
+    {
+        const std::wstring& path = features_.import_profiler.report_file;
+        FILE* fp = path.empty() ? stderr : _wfopen(path.c_str(), L"w");
+        if (fp != nullptr)
+        {
+            profiler_->report(fp);
+            if (fp != stderr)
+                fclose(fp);
+        }
+    }
 
     DeleteFiber(provider_fiber_);
     if (host_owns_fiber_ && host_fiber_ != nullptr)
@@ -284,9 +531,132 @@ void idahost_t::term()
     host_fiber_ = nullptr;
 }
 
+bool idahost_t::image_sharing(std::vector<image_sharing_t>* out, bool* shared)
+{
+    std::vector<PEMapper::SectionSharing> secs;
+    if (provider_pe_ == nullptr || !provider_pe_->QuerySharing(&secs))
+        return false;
+    out->clear();
+    for (const PEMapper::SectionSharing& sec : secs)
+    {
+        image_sharing_t is;
+        is.section = sec.name;
+        is.shared_bytes = sec.pages.shared_bytes;
+        is.private_bytes = sec.pages.private_bytes;
+        is.nonresident_bytes = sec.pages.nonresident_bytes;
+        out->push_back(is);
+    }
+    if (shared != nullptr)
+        *shared = provider_pe_->IsShared();
+    return true;
+}
+
+bool idahost_t::heap_stats(heap_stats_t* out) const
+{
+    if (heap_ == nullptr)
+        return false;
+    arena_heap_t::stats_t st = heap_->stats();
+    out->allocs = st.allocs;
+    out->frees = st.frees;
+    out->large_allocs = st.large_allocs;
+    out->bytes_in_use = st.bytes_in_use();
+    out->committed_bytes = st.spans_used * arena_heap_t::SPAN_SIZE;
+    out->teardown_frees = st.teardown_frees;
+    return true;
+}
+
+bool idahost_t::memory_report(memory_report_t* out)
+{
+    *out = memory_report_t();
+
+    std::vector<PEMapper::SectionSharing> secs;
+    if (provider_pe_ != nullptr && provider_pe_->QuerySharing(&secs))
+    {
+        for (const PEMapper::SectionSharing& sec : secs)
+        {
+            memory_region_t r;
+            r.name = sec.name;
+            s_query_range((const void*)sec.address, sec.size, &r);
+            r.private_bytes = sec.pages.private_bytes;
+            r.shared_bytes = sec.pages.shared_bytes;
+            out->image.push_back(r);
+        }
+        out->image_file_bytes = provider_pe_->FileBufferBytes();
+    }
+
+    s_query_stack(provider_stack_, "provider", &out->provider_stack);
+    s_query_stack(host_stack_, "host", &out->host_stack);
+    out->console_buffer_bytes = cs_->buffer_bytes();
+    out->cmdline_bytes = options->storage_bytes();
+    s_heap_usage(heap_, &out->heap_committed_bytes, &out->heap_in_use_bytes);
+    out->vfs_bytes = vfs_.stats().blocks_bytes;
+
+    PROCESS_MEMORY_COUNTERS_EX pmc = {};
+    pmc.cb = sizeof(pmc);
+    if (GetProcessMemoryInfo(GetCurrentProcess(), (PROCESS_MEMORY_COUNTERS*)&pmc, sizeof(pmc)))
+    {
+        out->process_private_bytes = pmc.PrivateUsage;
+        out->process_working_set_bytes = pmc.WorkingSetSize;
+    }
+
+    if (track_peaks_)
+        sample_memory_peaks();
+    return true;
+}
+
+void idahost_t::track_memory_peaks(bool on)
+{
+    track_peaks_ = on;
+    if (on)
+    {
+        peaks_ = memory_peaks_t();
+        sample_memory_peaks();
+    }
+}
+
+void idahost_t::sample_memory_peaks()
+{
+    uint64_t committed = 0, in_use = 0;
+    s_heap_usage(heap_, &committed, &in_use);
+    PROCESS_MEMORY_COUNTERS_EX pmc = {};
+    pmc.cb = sizeof(pmc);
+    GetProcessMemoryInfo(GetCurrentProcess(), (PROCESS_MEMORY_COUNTERS*)&pmc, sizeof(pmc));
+
+    ++peaks_.samples;
+    peaks_.heap_committed_bytes = (std::max)(peaks_.heap_committed_bytes, committed);
+    peaks_.process_private_bytes = (std::max)(peaks_.process_private_bytes, (uint64_t)pmc.PrivateUsage);
+    peaks_.process_working_set_bytes = (std::max)(peaks_.process_working_set_bytes, (uint64_t)pmc.WorkingSetSize);
+}
+
+idahost_t::startup_report_t idahost_t::startup_report() const
+{
+    startup_report_t r;
+    r.startup_seconds = metrics_.startup_seconds.get();
+    r.hidden = metrics_.startup_hidden.get();
+    r.blocked = metrics_.startup_blocked.get();
+    latency_histogram_t::snapshot_t snap;
+    metrics_.startup_load.snapshot(&snap);
+    r.loads = snap.count;
+    r.load_seconds = snap.sum / 1e9;
+    if (r.loads != 0)
+        r.estimated_saved_seconds = (r.hidden + r.blocked) * r.load_seconds / r.loads;
+    return r;
+}
+
 void idahost_t::return_to_host()
 {
+    // The kernel is at a checkpoint: serve the other threads first
+    dispatcher_.pump();
+    changes_.seal();
+    if (track_peaks_)
+        sample_memory_peaks();
+    if (provider_enter_ns_ != 0)
+    {
+        metrics_.provider.record(metrics_now_ns() - provider_enter_ns_);
+        provider_enter_ns_ = 0;
+    }
     restore_screen();
+    host_switch_ns_ = metrics_now_ns();
     SwitchToFiber(host_fiber_);
 }
 
@@ -306,22 +676,91 @@ void idahost_t::ui_msg_(const char* format, va_list args)
 
 void idahost_t::internal_run_provider()
 {
+    provider_stack_ = s_current_stack();
+
     // Set up provider's environment
     //SetDefaultDllDirectories(LOAD_LIBRARY_SEARCH_USER_DIRS);
     SetDllDirectoryW(this->options->idadir.c_str());
     SetCurrentDirectoryW(this->options->idadir.c_str());
     qstring env;
     utf16_utf8(&env, this->options->idadir.c_str());
-    qsetenv("IDADIR", env.c_str());
+    set_provider_env("IDADIR", env.c_str());
+    const launch_desc_t& launch = this->options->launch_;
+    for (size_t i = 0; i < launch.env_count(); ++i)
+    {
+        utf16_utf8(&env, launch.env(i));
+        size_t eq = env.find('=');
+        set_provider_env(env.substr(0, eq).c_str(), env.substr(eq + 1).c_str());
+    }
 
     this->provider_pe_ = PEMapper::CreateFromFile(this->options->idabin.c_str());
     if (this->provider_pe_ == nullptr)
         return;
+    if (features_.shared_image.enabled)
+        provider_pe_->SetSharedImage(features_.shared_image.name.c_str(), features_.shared_image.base);
+    provider_pe_->SetLargePages(features_.large_pages);
+
+    // The profiler's stubs are never freed: the provider may call through
+    // them until the process exits
+    if (features_.import_profiler.enabled && profiler_ == nullptr)
+        profiler_ = new import_profiler_t(features_.import_profiler.only);
+
+    // Like the profiler's stubs, the provider heap outlives the session; a
+    // previous session's term() left it skipping frees
+    if (features_.heap.enabled && heap_ == nullptr)
+    {
+        arena_heap_t::config_t cfg;
+        cfg.reserve_bytes = features_.heap.reserve_bytes;
+        heap_ = new arena_heap_t();
+        if (heap_->init(cfg))
+        {
+            heap_hooks::g_process_heap = GetProcessHeap();
+            heap_hooks::g_arena = heap_;
+        }
+    }
+    else if (heap_ != nullptr)
+        heap_->end_teardown();
+
+    // The writer is never freed either: a provider thread may still be
+    // inside a hook when term() closes it
+    if (heap_hooks::g_arena != nullptr && !features_.heap.trace_file.empty())
+    {
+        if (heap_trace_ == nullptr)
+            heap_trace_ = new alloc_trace_writer_t();
+        if (heap_trace_->open(features_.heap.trace_file.c_str()))
+            heap_hooks::g_trace = heap_trace_;
+    }
+
+    if (features_.startup_profile.enabled)
+    {
+        const startup_profile_t& sp = features_.startup_profile;
+        const std::vector<std::wstring>* lists[startup_hooks::cat_count] = { &sp.plugins, &sp.loaders, &sp.procs };
+        for (int i = 0; i < startup_hooks::cat_count; ++i)
+        {
+            s_startup_profile.allowed[i].clear();
+            for (std::wstring name : *lists[i])
+            {
+                for (wchar_t& c : name)
+                    c = towlower(c);
+                s_startup_profile.allowed[i].push_back(name);
+            }
+        }
+        s_startup_profile.hidden = &metrics_.startup_hidden;
+        s_startup_profile.blocked = &metrics_.startup_blocked;
+        s_startup_profile.loads = &metrics_.startup_load;
+        startup_hooks::g_profile = &s_startup_profile;
+    }
+
+    for (const std::wstring& prefix : features_.vfs_prefixes)
+        vfs_.add_prefix(prefix.c_str());
+    if (!features_.vfs_prefixes.empty())
+        vfs_hooks::g_store = &vfs_;
 
     this->provider_pe_->SetResolveImport(
-        [](void* ud, LPCSTR, HMODULE, LPCSTR sym_name, DWORD64* addr) -> bool {
-            return ((idahost_t*)ud)->CanResolveImport(sym_name, addr);
+        [](void* ud, LPCSTR lib_name, HMODULE, LPCSTR sym_name, DWORD64* addr) -> bool {
+            return ((idahost_t*)ud)->CanResolveImport(lib_name, sym_name, addr, true);
         }, this);
+    hook_provider_modules();
 
     // Save host's screen before handing over to the provider
     this->save_screen();
@@ -338,18 +777,48 @@ void idahost_t::interact()
     if (!is_console)
         Console::Show(true);
 
+    uint64_t t0 = metrics_now_ns();
     save_screen();
-    refresh_idaview_anyway();
+    {
+        scoped_latency_t timer(metrics_.refresh_idaview);
+        refresh_idaview_anyway();
+    }
+    metrics_.switches.add();
+    provider_enter_ns_ = metrics_now_ns();
     SwitchToFiber(provider_fiber_);
+    if (host_switch_ns_ != 0)
+    {
+        metrics_.fiber_switch.record(metrics_now_ns() - host_switch_ns_);
+        host_switch_ns_ = 0;
+    }
     restore_screen();
     if (!is_console)
         Console::Show(false);
+    metrics_.roundtrip.record(metrics_now_ns() - t0);
+}
+
+void idahost_t::hook_provider_modules()
+{
+    for (const std::wstring& name : features_.hook_modules)
+    {
+        HMODULE mod = GetModuleHandleW(name.c_str());
+        if (mod == nullptr)
+            continue;
+        PEMapper::HookModuleImports(
+            mod,
+            [](void* ud, LPCSTR lib_name, HMODULE, LPCSTR sym_name, DWORD64* addr) -> bool {
+                return ((idahost_t*)ud)->CanResolveImport(lib_name, sym_name, addr, false);
+            }, this);
+    }
 }
 
-bool idahost_t::CanResolveImport(const char *sym_name, uint64_t* addr)
+bool idahost_t::CanResolveImport(const char* lib_name, const char *sym_name, uint64_t* addr, bool provider_image)
 {
+    // The launch environment is only faked for the provider image itself
     do
     {
+        if (!provider_image)
+            break;
         if (strcmp(sym_name, "__p___argc") == 0)
             *addr = (DWORD64)_my__p___argc;
         else if (strcmp(sym_name, "__p___wargv") == 0)
@@ -362,5 +831,508 @@ bool idahost_t::CanResolveImport(const char *sym_name, uint64_t* addr)
             break;
         return true;
     } while (false);
-    return false;
+
+    // Feature hooks stack: a profiled import measures the shim it ends up at
+    bool replaced = vfs_hooks::resolve_import(sym_name, addr)
+        || heap_hooks::resolve_import(sym_name, addr);
+    replaced = readahead_hooks::resolve_import(sym_name, addr) || replaced;
+    replaced = startup_hooks::resolve_import(sym_name, addr) || replaced;
+    if (profiler_ != nullptr)
+        replaced = profiler_->wrap(lib_name, sym_name, addr) || replaced;
+    return replaced;
+}
+
+
+bool idahost_t::extract(bulk_snapshot_t* out, uint32 what, const bulk_bytes_options_t& bytes_opt)
+{
+    qstring name;
+    if ((what & (BULK_FUNCS | BULK_XREFS)) != 0)
+    {
+        bulk_functions_t& fs = out->funcs;
+        bulk_xrefs_t& xs = out->xrefs;
+        size_t qty = get_func_qty();
+
+        // Columns that were not asked for keep their contents
+        if ((what & BULK_FUNCS) != 0)
+        {
+            fs.clear();
+            fs.start.reserve(qty);
+            fs.end.reserve(qty);
+            fs.flags.reserve(qty);
+            fs.name_offs.reserve(qty);
+            fs.names.reserve(qty * 24);
+        }
+        if ((what & BULK_XREFS) != 0)
+            xs.clear();
+
+        // Row of the function in `funcs`, whether or not it is extracted
+        uint32 row = 0;
+        for (size_t i = 0; i < qty; ++i)
+        {
+            func_t* f = getn_func(i);
+            if (f == nullptr)
+                continue;
+
+            if ((what & BULK_FUNCS) != 0)
+            {
+                if (get_func_name(&name, f->start_ea) <= 0)
+                    name.qclear();
+                fs.start.push_back(f->start_ea);
+                fs.end.push_back(f->end_ea);
+                fs.flags.push_back(f->flags);
+                fs.add_name(name.c_str(), name.length());
+            }
+
+            if ((what & BULK_XREFS) != 0)
+            {
+                func_item_iterator_t fii;
+                for (bool ok = fii.set(f); ok; ok = fii.next_code())
+                {
+                    ea_t ea = fii.current();
+                    xrefblk_t xb;
+                    for (bool x = xb.first_from(ea, XREF_FAR); x; x = xb.next_from())
+                    {
+                        xs.from.push_back(ea);
+                        xs.to.push_back(xb.to);
+                        xs.type.push_back(xb.type);
+                        xs.iscode.push_back(xb.iscode);
+                        xs.func.push_back(row);
+                    }
+                }
+            }
+            ++row;
+        }
+    }
+
+    if ((what & BULK_SEGMENTS) != 0)
+    {
+        bulk_segments_t& ss = out->segs;
+        int qty = get_segm_qty();
+        ss.clear();
+        ss.start.reserve(qty);
+        ss.end.reserve(qty);
+        ss.perm.reserve(qty);
+        ss.bitness.reserve(qty);
+        ss.type.reserve(qty);
+        ss.name_offs.reserve(qty);
+        for (int i = 0; i < qty; ++i)
+        {
+            segment_t* seg = getnseg(i);
+            if (seg == nullptr)
+                continue;
+            if (get_segm_name(&name, seg) < 0)
+                name.qclear();
+            ss.start.push_back(seg->start_ea);
+            ss.end.push_back(seg->end_ea);
+            ss.perm.push_back(seg->perm);
+            ss.bitness.push_back(seg->bitness);
+            ss.type.push_back(seg->type);
+            ss.add_name(name.c_str(), name.length());
+        }
+    }
+
+    if ((what & BULK_BYTES) != 0)
+    {
+        bulk_bytes_t& bs = out->bytes;
+        int qty = get_segm_qty();
+        bs.clear();
+        uint64 total = 0;
+        for (int i = 0; i < qty; ++i)
+        {
+            segment_t* seg = getnseg(i);
+            if (seg == nullptr)
+                continue;
+            const std::vector<ea_t>& only = bytes_opt.segments;
+            if (!only.empty() && std::find(only.begin(), only.end(), seg->start_ea) == only.end())
+                continue;
+            // Compared against the room left instead of added up: a segment
+            // can span most of the 64-bit address space
+            uint64 size = seg->size();
+            uint64 room = bytes_opt.max_bytes - total;
+            uint64 pad = (8 - (size & 7)) & 7;
+            if (size > room || room - size < pad)
+            {
+                bs.skipped.push_back(seg->start_ea);
+                continue;
+            }
+            bs.seg_start.push_back(seg->start_ea);
+            bs.seg_off.push_back(total);
+            bs.seg_size.push_back(size);
+            total += (size + 7) & ~(uint64)7;
+        }
+        bs.bytes.resize(total);
+        bs.loaded.assign(total / 8, 0);
+        bs.kind.assign(total, BULK_BYTE_UNKNOWN);
+
+        for (size_t i = 0; i < bs.seg_start.size(); ++i)
+        {
+            ea_t start = bs.seg_start[i];
+            ea_t end = start + (ea_t)bs.seg_size[i];
+            uint64 off = bs.seg_off[i];
+            if (bs.seg_size[i] == 0
+                || get_bytes(&bs.bytes[off], bs.seg_size[i], start, GMB_READALL, &bs.loaded[off / 8]) < 0)
+            {
+                continue;
+            }
+
+            uint8* kind = &bs.kind[off];
+            ea_t ea = start;
+            if (!is_head(get_flags(ea)))
+                ea = next_head(ea, end);
+            for (; ea != BADADDR && ea < end; ea = next_head(ea, end))
+            {
+                flags64_t F = get_flags(ea);
+                uint8 k = is_code(F) ? BULK_BYTE_CODE : is_data(F) ? BULK_BYTE_DATA : BULK_BYTE_UNKNOWN;
+                if (k == BULK_BYTE_UNKNOWN)
+                    continue;
+                asize_t n = qmin(get_item_size(ea), end - ea);
+                memset(kind + (ea - start), k, n);
+            }
+        }
+    }
+    return true;
+}
+
+//-------------------------------------------------------------------------
+// Decompilation cache
+
+// Address operands are masked out of the code and keyed by the name of
+// their target instead, so the same code linked at a different address
+// yields the same key unless an unnamed target's address would be printed.
+// Targets inside the function are keyed by their offset from its start.
+static hash128_t s_function_key(func_t* f, const std::string& context, decomp_key_t& key)
+{
+    key.clear();
+    key.add(decomp_key_t::part_context, context.data(), context.size());
+
+    qstring ctx;
+    tinfo_t tif;
+    if (get_tinfo(&tif, f->start_ea))
+        tif.print(&ctx);
+    key.add_str(decomp_key_t::part_prototype, ctx.c_str());
+    if (get_func_name(&ctx, f->start_ea) <= 0)
+        ctx.qclear();
+    key.add_str(decomp_key_t::part_name, ctx.c_str());
+
+    insn_t insn;
+    uchar bytes[64];
+    func_item_iterator_t fii;
+    for (bool ok = fii.set(f); ok; ok = fii.next_code())
+    {
+        ea_t ea = fii.current();
+        if (decode_insn(&insn, ea) <= 0)
+            continue;
+        size_t size = qmin((size_t)insn.size, sizeof(bytes));
+        ssize_t got = get_bytes(bytes, size, ea);
+        if (got < (ssize_t)size)
+        {
+            // Unloaded bytes: hash zeros, tied to this address
+            size_t have = got > 0 ? (size_t)got : 0;
+            memset(bytes + have, 0, size - have);
+            key.add_u64(decomp_key_t::part_ref, ea);
+        }
+
+        flags64_t F = get_flags(ea);
+        for (int i = 0; i < UA_MAXOP && insn.ops[i].type != o_void; ++i)
+        {
+            const op_t& op = insn.ops[i];
+            bool is_addr = op.type == o_mem || op.type == o_near || op.type == o_far
+                || ((op.type == o_imm || op.type == o_displ) && is_off(F, i));
+            if (!is_addr || op.offb == 0 || op.offb >= size)
+                continue;
+
+            // The operand ends where the next encoded field starts
+            size_t end = size;
+            for (int j = 0; j < UA_MAXOP && insn.ops[j].type != o_void; ++j)
+            {
+                if (insn.ops[j].offb > op.offb && insn.ops[j].offb < end)
+                    end = insn.ops[j].offb;
+            }
+            memset(bytes + op.offb, 0, end - op.offb);
+
+            // Targets inside the function print as labels, but which
+            // instruction they point at still shapes the output
+            ea_t target = op.type == o_imm ? op.value : op.addr;
+            if (func_contains(f, target))
+                key.add_u64(decomp_key_t::part_ref, target - f->start_ea);
+            else if (get_name(&ctx, target) > 0)
+                key.add_str(decomp_key_t::part_ref, ctx.c_str());
+            else
+                key.add_u64(decomp_key_t::part_ref, target);
+        }
+        key.add(decomp_key_t::part_code, bytes, size);
+    }
+    return key.hash();
+}
+
+bool idahost_t::open_decomp_cache(const wchar_t* path, uint32_t slots, uint64_t data_bytes, const char* config_tag)
+{
+    decomp_tag_ = config_tag;
+    if (decomp_cache_ == nullptr)
+        decomp_cache_ = new decomp_cache_t();
+
+    decomp_cache_t::config_t cfg;
+    cfg.slots = slots;
+    cfg.data_bytes = data_bytes;
+    if (!decomp_cache_->open(path, cfg))
+    {
+        err_ = "Failed to open the decompilation cache";
+        return false;
+    }
+    return true;
+}
+
+bool idahost_t::decompile_batch(
+    const ea_t* funcs,
+    size_t count,
+    std::vector<decomp_result_t>* out,
+    decomp_stats_t* stats)
+{
+    decomp_stats_t st;
+    decomp_key_t key_buf;
+    qstring line;
+    char summary[MAXSTR];
+
+    // The decompiler's version is part of every key
+    if (!init_hexrays_plugin())
+    {
+        err_ = "Hex-Rays decompiler is not available";
+        return false;
+    }
+    char procname[IDAINFO_PROCNAME_SIZE];
+    inf_get_procname(procname, sizeof(procname));
+    std::string context = get_hexrays_version();
+    context += '\0';
+    context += procname;
+    context += '\0';
+    context += std::to_string(inf_get_cc_id()) + '\0' + decomp_tag_;
+
+    out->resize(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        decomp_result_t& r = (*out)[i];
+        r = decomp_result_t();
+        r.ea = funcs[i];
+
+        func_t* f = get_func(funcs[i]);
+        if (f == nullptr)
+        {
+            ++st.failures;
+            continue;
+        }
+
+        hash128_t key = s_function_key(f, context, key_buf);
+        decomp_cache_t::entry_t e;
+        if (decomp_cache_ != nullptr && decomp_cache_->lookup(key, &e))
+        {
+            r.pseudocode.assign(e.pseudocode, e.pseudocode_len);
+            r.summary.assign(e.summary, e.summary_len);
+            r.ok = r.cached = true;
+            ++st.hits;
+            continue;
+        }
+
+        ++st.misses;
+        hexrays_failure_t hf;
+        cfuncptr_t cf = decompile_func(f, &hf, DECOMP_NO_WAIT);
+        if (cf == nullptr)
+        {
+            ++st.failures;
+            continue;
+        }
+
+        for (const simpleline_t& sl : cf->get_pseudocode())
+        {
+            tag_remove(&line, sl.line);
+            r.pseudocode.append(line.c_str(), line.length());
+            r.pseudocode.push_back('\n');
+        }
+        qsnprintf(summary, sizeof(summary), "blocks=%d maturity=%d lvars=%u",
+            cf->mba->qty,
+            (int)cf->maturity,
+            (uint)cf->get_lvars()->size());
+        r.summary = summary;
+        r.ok = true;
+
+        if (decomp_cache_ != nullptr)
+        {
+            decomp_cache_->insert(
+                key,
+                r.pseudocode.data(), (uint32_t)r.pseudocode.size(),
+                r.summary.data(), (uint32_t)r.summary.size());
+        }
+    }
+
+    if (stats != nullptr)
+        *stats = st;
+    return true;
+}
+
+//-------------------------------------------------------------------------
+// Server mode
+
+// The hosted kernel keeps one database open at a time. The first open starts
+// the session; after a close the session stays up and the next open loads
+// its database into the running kernel.
+struct idahost_server_provider_t : idahost_server_t::provider_t
+{
+    idahost_t* host;
+    idahost_t::options_t opt;
+    bool started = false;
+    uint32_t db_id = 0;         // 0 while no database is open
+    uint32_t next_id = 1;
+    std::wstring db_path;
+
+    idahost_server_provider_t(idahost_t* h, const idahost_t::options_t& o) : host(h), opt(o) { }
+
+    bool start()
+    {
+        started = host->init(opt);
+        if (started)
+        {
+            db_id = next_id++;
+            db_path = opt.input_file;
+        }
+        return started;
+    }
+
+    uint16_t open_database(const std::string& path, uint32_t* db) override
+    {
+        qwstring wpath;
+        utf8_utf16(&wpath, path.c_str());
+        if (db_id != 0)
+        {
+            // One at a time: another file needs a close first
+            if (!path.empty() && _wcsicmp(db_path.c_str(), wpath.c_str()) != 0)
+                return idahost_proto::st_busy;
+            *db = db_id;
+            return idahost_proto::st_ok;
+        }
+        if (path.empty())
+            return idahost_proto::st_no_database;
+
+        if (!started)
+        {
+            opt.input_file = wpath.c_str();
+            if (!start())
+                return idahost_proto::st_no_database;
+        }
+        else
+        {
+            if (!host->open_database(wpath.c_str()))
+                return idahost_proto::st_no_database;
+            db_id = next_id++;
+            db_path = wpath.c_str();
+        }
+        *db = db_id;
+        return idahost_proto::st_ok;
+    }
+
+    uint16_t run_query(
+        uint32_t db,
+        const std::string& name,
+        const std::string& args,
+        std::string* out) override
+    {
+        if (db_id == 0 || db != db_id)
+            return idahost_proto::st_no_database;
+
+        auto p = host->queries_.find(name);
+        if (p == host->queries_.end())
+            return idahost_proto::st_unknown_query;
+
+        return p->second.cb(p->second.ud, args, out)
+            ? idahost_proto::st_ok
+            : idahost_proto::st_query_failed;
+    }
+
+    uint16_t close_database(uint32_t db) override
+    {
+        if (db_id == 0 || db != db_id)
+            return idahost_proto::st_no_database;
+        // The session stays up so the next open does not pay for startup again
+        host->close_database();
+        db_id = 0;
+        db_path.clear();
+        return idahost_proto::st_ok;
+    }
+};
+
+// Built-in query: <u64 start><u64 end><str name> per function
+static bool s_query_functions(void*, const std::string&, std::string* out)
+{
+    idahost_proto::writer_t w(*out);
+    qstring name;
+    for (size_t i = 0, c = get_func_qty(); i < c; ++i)
+    {
+        func_t* f = getn_func(i);
+        if (f == nullptr)
+            continue;
+        if (get_func_name(&name, f->start_ea) <= 0)
+            name.qclear();
+        w.u64(f->start_ea);
+        w.u64(f->end_ea);
+        w.str(name.c_str(), name.length());
+    }
+    return true;
+}
+
+bool idahost_t::open_database(const std::wstring& path)
+{
+    qstring upath;
+    utf16_utf8(&upath, path.c_str());
+    const char* argv[] = { "idat64", upath.c_str() };
+    int newfile = 0;
+
+    save_screen();
+    bool ok = init_database(qnumber(argv), argv, &newfile) == 0;
+    if (ok)
+    {
+        auto_wait();
+        db_closed_ = false;
+    }
+    restore_screen();
+    return ok;
+}
+
+void idahost_t::close_database()
+{
+    save_screen();
+    term_database();
+    restore_screen();
+    db_closed_ = true;
+}
+
+void idahost_t::add_query(const char* name, query_handler_t cb, void* ud)
+{
+    queries_[name] = { cb, ud };
+}
+
+bool idahost_t::serve(const server_options_t& opt)
+{
+    if (queries_.find("functions") == queries_.end())
+        add_query("functions", s_query_functions);
+
+    idahost_server_provider_t provider(this, opt.provider);
+    if (!opt.provider.input_file.empty() && !provider.start())
+        return false;
+
+    ipc_listener_t listener;
+    if (!listener.listen(opt.endpoint.c_str()))
+    {
+        err_ = "Failed to listen on " + opt.endpoint;
+        return false;
+    }
+
+    idahost_server_t server(&provider);
+    ipc_stream_t client;
+    while (!server.shutdown_requested() && listener.accept(&client))
+    {
+        server.serve(client);
+        client.close();
+    }
+
+    if (provider.started)
+        term();
+    return server.shutdown_requested();
 }
@@ -0,0 +1,389 @@
+#pragma once
+
+#include <Windows.h>
+#include <intrin.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Opt-in profiler for the provider's imports.
+//
+// Each wrapped import gets a small generated stub in place of its IAT entry.
+// The stub jumps to a shared enter thunk that counts the call, remembers the
+// caller and swaps the return address on the stack for an exit thunk, then
+// tail-jumps to the real target. When the target returns into the exit thunk
+// the elapsed TSC ticks are charged to the import and control resumes at the
+// original return address. Counters live in per-thread storage, so the hot
+// path never takes a lock.
+//
+// Because return addresses are replaced and the thunks have no unwind data,
+// the stack cannot be unwound through a wrapped call: an exception crossing
+// one terminates the process. Only imports the host names explicitly are
+// wrapped, never whole libraries, and the ones that throw, unwind, switch
+// fibers or never return are refused even then. Imports that take callbacks
+// (EnumXxx, qsort, ...) must only be listed if the callbacks cannot throw.
+class import_profiler_t
+{
+public:
+    static constexpr uint32_t MAX_ENTRIES = 8192;
+
+private:
+    static constexpr uint32_t MAX_DEPTH = 128;
+    static constexpr uint32_t CALLER_SLOTS = 4096;
+    static constexpr uint32_t CALLER_PROBES = 8;
+    static constexpr size_t STUB_SIZE = 24;
+    static constexpr size_t CODE_SIZE = 256 + MAX_ENTRIES * STUB_SIZE;
+
+    struct entry_t
+    {
+        std::string lib;
+        std::string sym;
+        uint64_t target;
+    };
+
+    struct frame_t
+    {
+        uint32_t id;
+        uint64_t ret;
+        uint64_t t0;
+    };
+
+    struct caller_slot_t
+    {
+        uint64_t caller;
+        uint64_t id;
+        uint64_t count;
+    };
+
+    struct thread_stats_t
+    {
+        uint64_t calls[MAX_ENTRIES];
+        uint64_t ticks[MAX_ENTRIES];
+        caller_slot_t callers[CALLER_SLOTS];
+        uint64_t callers_dropped;
+        frame_t stack[MAX_DEPTH];
+        uint32_t depth;
+    };
+
+    static inline import_profiler_t* s_instance = nullptr;
+    static inline thread_local thread_stats_t* t_stats = nullptr;
+
+    BYTE* code_ = nullptr;
+    BYTE* enter_thunk_ = nullptr;
+    BYTE* exit_thunk_ = nullptr;
+    size_t code_used_ = 0;
+
+    entry_t* entries_[MAX_ENTRIES] = {};
+    uint32_t entry_count_ = 0;
+    std::vector<std::string> only_;
+
+    std::mutex threads_mtx_;
+    std::vector<thread_stats_t*> threads_;
+
+    uint64_t tsc0_ = 0;
+    LARGE_INTEGER qpc0_ = {};
+
+    static thread_stats_t* thread_stats()
+    {
+        thread_stats_t* ts = t_stats;
+        if (ts == nullptr)
+        {
+            ts = new thread_stats_t();
+            t_stats = ts;
+            std::lock_guard<std::mutex> lock(s_instance->threads_mtx_);
+            s_instance->threads_.push_back(ts);
+        }
+        return ts;
+    }
+
+    static void count_caller(thread_stats_t* ts, uint32_t id, uint64_t caller)
+    {
+        uint64_t h = (caller ^ ((uint64_t)id * 0x9E3779B97F4A7C15ull)) * 0xff51afd7ed558ccdull;
+        for (uint32_t i = 0; i < CALLER_PROBES; ++i)
+        {
+            caller_slot_t& s = ts->callers[(h + i) & (CALLER_SLOTS - 1)];
+            if (s.count == 0)
+            {
+                s.caller = caller;
+                s.id = id;
+            }
+            else if (s.caller != caller || s.id != id)
+            {
+                continue;
+            }
+            ++s.count;
+            return;
+        }
+        ++ts->callers_dropped;
+    }
+
+    // Called by the enter thunk with the stub's id and the address of the
+    // return address slot. Returns the real target.
+    static uint64_t on_enter(uint64_t id, uint64_t* ret_slot)
+    {
+        thread_stats_t* ts = thread_stats();
+        ++ts->calls[id];
+        count_caller(ts, (uint32_t)id, *ret_slot);
+        if (ts->depth < MAX_DEPTH)
+        {
+            frame_t& f = ts->stack[ts->depth++];
+            f.id = (uint32_t)id;
+            f.ret = *ret_slot;
+            f.t0 = __rdtsc();
+            *ret_slot = (uint64_t)s_instance->exit_thunk_;
+        }
+        return s_instance->entries_[id]->target;
+    }
+
+    // Called by the exit thunk. Returns the original return address.
+    static uint64_t on_exit()
+    {
+        thread_stats_t* ts = t_stats;
+        frame_t& f = ts->stack[--ts->depth];
+        ts->ticks[f.id] += __rdtsc() - f.t0;
+        return f.ret;
+    }
+
+    BYTE* emit(const BYTE* bytes, size_t size)
+    {
+        BYTE* p = code_ + code_used_;
+        memcpy(p, bytes, size);
+        code_used_ += size;
+        return p;
+    }
+
+    static void put64(BYTE* p, uint64_t v) {
+        memcpy(p, &v, sizeof(v));
+    }
+
+    void emit_thunks()
+    {
+        // Saves the argument registers, calls on_enter(r10 = id, &return address)
+        // and jumps to the target it returns
+        BYTE enter[] = {
+            0x51,                                       // push rcx
+            0x52,                                       // push rdx
+            0x41, 0x50,                                 // push r8
+            0x41, 0x51,                                 // push r9
+            0x48, 0x83, 0xEC, 0x68,                     // sub rsp, 68h
+            0xF3, 0x0F, 0x7F, 0x44, 0x24, 0x20,         // movdqu [rsp+20h], xmm0
+            0xF3, 0x0F, 0x7F, 0x4C, 0x24, 0x30,         // movdqu [rsp+30h], xmm1
+            0xF3, 0x0F, 0x7F, 0x54, 0x24, 0x40,         // movdqu [rsp+40h], xmm2
+            0xF3, 0x0F, 0x7F, 0x5C, 0x24, 0x50,         // movdqu [rsp+50h], xmm3
+            0x4C, 0x89, 0xD1,                           // mov rcx, r10
+            0x48, 0x8D, 0x94, 0x24, 0x88, 0, 0, 0,      // lea rdx, [rsp+88h]
+            0x48, 0xB8, 0, 0, 0, 0, 0, 0, 0, 0,         // mov rax, on_enter
+            0xFF, 0xD0,                                 // call rax
+            0xF3, 0x0F, 0x6F, 0x44, 0x24, 0x20,         // movdqu xmm0, [rsp+20h]
+            0xF3, 0x0F, 0x6F, 0x4C, 0x24, 0x30,         // movdqu xmm1, [rsp+30h]
+            0xF3, 0x0F, 0x6F, 0x54, 0x24, 0x40,         // movdqu xmm2, [rsp+40h]
+            0xF3, 0x0F, 0x6F, 0x5C, 0x24, 0x50,         // movdqu xmm3, [rsp+50h]
+            0x48, 0x83, 0xC4, 0x68,                     // add rsp, 68h
+            0x41, 0x59,                                 // pop r9
+            0x41, 0x58,                                 // pop r8
+            0x5A,                                       // pop rdx
+            0x59,                                       // pop rcx
+            0xFF, 0xE0,                                 // jmp rax
+        };
+        put64(enter + 47, (uint64_t)&on_enter);
+        enter_thunk_ = emit(enter, sizeof(enter));
+
+        // Entered by the target's ret; preserves the return value registers,
+        // calls on_exit() and resumes at the original return address
+        BYTE exit[] = {
+            0x50,                                       // push rax
+            0x48, 0x83, 0xEC, 0x38,                     // sub rsp, 38h
+            0xF3, 0x0F, 0x7F, 0x44, 0x24, 0x20,         // movdqu [rsp+20h], xmm0
+            0x48, 0xB8, 0, 0, 0, 0, 0, 0, 0, 0,         // mov rax, on_exit
+            0xFF, 0xD0,                                 // call rax
+            0xF3, 0x0F, 0x6F, 0x44, 0x24, 0x20,         // movdqu xmm0, [rsp+20h]
+            0x49, 0x89, 0xC3,                           // mov r11, rax
+            0x48, 0x83, 0xC4, 0x38,                     // add rsp, 38h
+            0x58,                                       // pop rax
+            0x41, 0xFF, 0xE3,                           // jmp r11
+        };
+        put64(exit + 13, (uint64_t)&on_exit);
+        exit_thunk_ = emit(exit, sizeof(exit));
+
+        code_used_ = (code_used_ + 15) & ~(size_t)15;
+    }
+
+    static bool never_wrap(const char* sym)
+    {
+        static const char* const deny[] = {
+            "SwitchToFiber", "ConvertThreadToFiber", "ConvertThreadToFiberEx",
+            "ConvertFiberToThread", "CreateFiber", "CreateFiberEx", "DeleteFiber",
+            "RaiseException", "RtlUnwind", "RtlUnwindEx", "RtlRaiseException",
+            "RtlCaptureContext", "RtlLookupFunctionEntry", "RtlVirtualUnwind",
+            "RtlRestoreContext", "RtlCaptureStackBackTrace", "CaptureStackBackTrace",
+            "_CxxThrowException", "__C_specific_handler", "__GSHandlerCheck",
+            "__GSHandlerCheck_SEH", "__GSHandlerCheck_EH", "__GSHandlerCheck_EH4",
+            "_setjmp", "_setjmpex", "setjmp", "longjmp", "__std_terminate",
+            "terminate", "abort", "exit", "_exit", "_Exit", "quick_exit",
+            "ExitProcess", "ExitThread", "TerminateProcess", "FreeLibraryAndExitThread",
+            "_invalid_parameter_noinfo_noreturn", "_invoke_watson", "__report_gsfailure",
+            "__chkstk", "_alloca_probe", "__security_check_cookie", "_purecall",
+        };
+        for (const char* d : deny)
+        {
+            if (strcmp(sym, d) == 0)
+                return true;
+        }
+        // C++ exception personality routines and the STL's throwing helpers
+        return strncmp(sym, "__CxxFrameHandler", 17) == 0
+            || strncmp(sym, "?_X", 3) == 0
+            || strncmp(sym, "?_Throw", 7) == 0;
+    }
+
+    bool selected(const char* sym) const
+    {
+        for (const std::string& s : only_)
+        {
+            if (s == sym)
+                return true;
+        }
+        return false;
+    }
+
+    static std::string describe_address(uint64_t addr)
+    {
+        HMODULE mod = nullptr;
+        char path[MAX_PATH];
+        char buf[MAX_PATH + 32];
+        if (GetModuleHandleExA(
+                GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                (LPCSTR)addr,
+                &mod)
+            && GetModuleFileNameA(mod, path, MAX_PATH) != 0)
+        {
+            const char* name = strrchr(path, '\\');
+            snprintf(buf, sizeof(buf), "%s+0x%llx", name != nullptr ? name + 1 : path, addr - (uint64_t)mod);
+        }
+        else
+        {
+            // The mapped provider image is not a registered module
+            snprintf(buf, sizeof(buf), "0x%llx", addr);
+        }
+        return buf;
+    }
+
+public:
+    explicit import_profiler_t(const std::vector<std::string>& only) : only_(only)
+    {
+        code_ = (BYTE*)VirtualAlloc(nullptr, CODE_SIZE, MEM_RESERVE | MEM_COMMIT, PAGE_EXECUTE_READWRITE);
+        if (code_ == nullptr)
+            return;
+        s_instance = this;
+        emit_thunks();
+        tsc0_ = __rdtsc();
+        QueryPerformanceCounter(&qpc0_);
+    }
+
+    // Stubs and per-thread counters stay alive for the rest of the process:
+    // the provider may call through them until it exits.
+    ~import_profiler_t() = default;
+
+    // Replaces *addr with a profiling stub for the import if it is selected.
+    // Returns false if the import is left as is.
+    bool wrap(const char* lib, const char* sym, uint64_t* addr)
+    {
+        if (code_ == nullptr || *addr == 0 || entry_count_ == MAX_ENTRIES)
+            return false;
+        if (never_wrap(sym) || !selected(sym))
+            return false;
+
+        uint32_t id = entry_count_++;
+        entries_[id] = new entry_t{ lib, sym, *addr };
+
+        BYTE stub[STUB_SIZE] = {
+            0x49, 0xBA, 0, 0, 0, 0, 0, 0, 0, 0,         // mov r10, id
+            0x49, 0xBB, 0, 0, 0, 0, 0, 0, 0, 0,         // mov r11, enter_thunk
+            0x41, 0xFF, 0xE3,                           // jmp r11
+            0xCC,                                       // int3
+        };
+        put64(stub + 2, id);
+        put64(stub + 12, (uint64_t)enter_thunk_);
+        *addr = (uint64_t)emit(stub, sizeof(stub));
+        return true;
+    }
+
+    uint32_t wrapped_count() const {
+        return entry_count_;
+    }
+
+    // Writes a report sorted by cumulative time
+    void report(FILE* fp)
+    {
+        struct row_t
+        {
+            uint32_t id;
+            uint64_t calls;
+            uint64_t ticks;
+        };
+        std::vector<row_t> rows(entry_count_);
+        std::map<std::pair<uint32_t, uint64_t>, uint64_t> callers;
+        uint64_t dropped = 0;
+        for (uint32_t i = 0; i < entry_count_; ++i)
+            rows[i] = { i, 0, 0 };
+        {
+            std::lock_guard<std::mutex> lock(threads_mtx_);
+            for (thread_stats_t* ts : threads_)
+            {
+                for (uint32_t i = 0; i < entry_count_; ++i)
+                {
+                    rows[i].calls += ts->calls[i];
+                    rows[i].ticks += ts->ticks[i];
+                }
+                for (const caller_slot_t& s : ts->callers)
+                {
+                    if (s.count != 0)
+                        callers[{ (uint32_t)s.id, s.caller }] += s.count;
+                }
+                dropped += ts->callers_dropped;
+            }
+        }
+
+        // Convert TSC ticks to time using the span since construction
+        LARGE_INTEGER qpc1, freq;
+        QueryPerformanceCounter(&qpc1);
+        QueryPerformanceFrequency(&freq);
+        double secs = (double)(qpc1.QuadPart - qpc0_.QuadPart) / (double)freq.QuadPart;
+        uint64_t dt = __rdtsc() - tsc0_;
+        double ns_per_tick = dt != 0 ? secs * 1e9 / (double)dt : 0.0;
+
+        std::sort(rows.begin(), rows.end(), [](const row_t& a, const row_t& b) {
+            return a.ticks > b.ticks;
+        });
+
+        fprintf(fp, "idahost import profile: %u imports wrapped, %zu threads\n", entry_count_, threads_.size());
+        if (only_.empty())
+            fprintf(fp, "(no imports listed in features_t::import_profiler.only)\n");
+        fprintf(fp, "%12s %14s %12s  %s\n", "calls", "total ms", "avg ns", "import");
+        for (const row_t& r : rows)
+        {
+            if (r.calls == 0)
+                continue;
+            const entry_t* e = entries_[r.id];
+            double total_ns = (double)r.ticks * ns_per_tick;
+            fprintf(fp, "%12llu %14.3f %12.1f  %s!%s\n",
+                r.calls,
+                total_ns / 1e6,
+                total_ns / (double)r.calls,
+                e->lib.c_str(),
+                e->sym.c_str());
+
+            std::vector<std::pair<uint64_t, uint64_t>> top;
+            for (auto p = callers.lower_bound({ r.id, 0 }); p != callers.end() && p->first.first == r.id; ++p)
+                top.push_back({ p->second, p->first.second });
+            std::sort(top.rbegin(), top.rend());
+            for (size_t i = 0; i < top.size() && i < 3; ++i)
+                fprintf(fp, "%12llu %14s %12s    <- %s\n", top[i].first, "", "", describe_address(top[i].second).c_str());
+        }
+        if (dropped != 0)
+            fprintf(fp, "(%llu caller samples did not fit the per-thread tables)\n", dropped);
+    }
+};
@@ -2,19 +2,190 @@
 
 #include <vector>
 #include <string>
+#include <map>
+#include <atomic>
+#include <thread>
 #include <stdio.h>
 #include "idahost_interface.h"
+#include "idahost_bulk.h"
+#include "idahost_metrics.h"
+#include "idahost_vfs.h"
+#include "idahost_readahead.h"
+#include "idahost_dispatch.h"
+#include "idahost_scan.h"
+#include "idahost_changes.h"
+#include "idahost_pe_image.h"
+#include "idahost_pipeline.h"
+#include "idahost_launch.h"
 #include <pro.h>
 #include <kernwin.hpp>
 
 struct idahost_cmdline_helper_t;
-class PEMapper;
+template <typename Traits> class PEMapperT;
+using PEMapper = PEMapperT<pe_image::native_traits>;
 struct ConsoleState;
+class decomp_cache_t;
+class import_profiler_t;
+class arena_heap_t;
+class alloc_trace_writer_t;
+struct idahost_server_provider_t;
 
 struct idahost_t : public IDAHostInterface
 {
 public:
     typedef int (*host_msg_handler_t)(void* ud, const char* format, va_list args);
+    typedef bool (*query_handler_t)(void* ud, const std::string& args, std::string* out);
+
+    // Latency of the host <-> provider round trips
+    struct fiber_metrics_t
+    {
+        counter_t switches;
+        latency_histogram_t roundtrip;        // a whole interact() call
+        latency_histogram_t provider;         // time the provider ran before returning
+        latency_histogram_t fiber_switch;     // provider -> host SwitchToFiber
+        latency_histogram_t save_screen;
+        latency_histogram_t restore_screen;
+        latency_histogram_t refresh_idaview;
+        gauge_t startup_seconds;
+        gauge_t input_resident_ratio;          // input read ahead when the provider opened it
+        gauge_t image_large_page_bytes;
+        latency_histogram_t dispatch_wait;    // submit() until the request ran
+        latency_histogram_t dispatch_run;
+        gauge_t term_seconds;
+        counter_t startup_hidden;             // modules a startup profile kept out of listings
+        counter_t startup_blocked;            // module loads a startup profile refused
+        latency_histogram_t startup_load;     // loads of allowed modules
+    };
+    struct import_profiler_options_t {
+        bool enabled = false;
+        // Imports to wrap, by symbol name; nothing is wrapped without a list.
+        // Exceptions must not cross them (see import_profiler.hpp)
+        std::vector<std::string> only;
+        // Report written by term(); stderr if empty
+        std::wstring report_file;
+    };
+    struct heap_options_t {
+        bool enabled = false;
+        // Address space reserved for the provider's heap
+        uint64_t reserve_bytes = 32ull << 30;
+        // term() stops freeing provider memory once the database is closed
+        bool release_at_term = true;
+        // Records the provider's heap calls for a session (idahost_alloc_trace.h)
+        std::wstring trace_file;
+    };
+    struct shared_image_options_t {
+        bool enabled = false;
+        // Every worker maps the relocated provider image at this address;
+        // if it is taken the worker falls back to a private copy
+        uint64_t base = 0x5F0000000000ull;
+        // Prefix of the shared region's name
+        std::string name = "idahost_image";
+    };
+    // Plugins, loaders and processor modules the provider may see at
+    // startup, by file (or plugin folder) name without extension, e.g.
+    // L"pc", L"pe", L"hexx64". The helper plugin is always allowed.
+    struct startup_profile_t {
+        bool enabled = false;
+        std::vector<std::wstring> plugins;
+        std::vector<std::wstring> loaders;
+        std::vector<std::wstring> procs;
+    };
+    struct startup_report_t {
+        double startup_seconds = 0;
+        uint64_t hidden = 0;
+        uint64_t blocked = 0;
+        uint64_t loads = 0;
+        double load_seconds = 0;
+        // Hidden and blocked modules at the mean cost of an allowed load
+        double estimated_saved_seconds = 0;
+    };
+    // How term() closes the database
+    enum term_mode_e {
+        term_default,           // pack and compress as IDA is configured
+        term_discard,           // delete the database without saving
+        term_save_unpacked,     // save, but leave the files unpacked
+        term_deferred,          // return at once; wait_term() closes
+    };
+    struct term_report_t {
+        term_mode_e mode = term_default;
+        double close_seconds = 0;       // term_database()
+        double blocking_seconds = 0;    // until term() returned
+        double total_seconds = 0;
+    };
+    struct change_feed_options_t {
+        bool enabled = false;
+        // Sealed batches kept for drain_changes(); the oldest go first
+        size_t capacity_bytes = 16u << 20;
+    };
+    // Resident bytes of one part of the provider image
+    struct image_sharing_t {
+        std::string section;
+        uint64_t shared_bytes = 0;
+        uint64_t private_bytes = 0;
+        uint64_t nonresident_bytes = 0;
+    };
+    // Allocation counters of the provider heap (heap_options_t)
+    struct heap_stats_t {
+        uint64_t allocs = 0;
+        uint64_t frees = 0;
+        uint64_t large_allocs = 0;
+        uint64_t bytes_in_use = 0;
+        uint64_t committed_bytes = 0;
+        uint64_t teardown_frees = 0;
+    };
+    // Address space of one part of the session; the private and shared
+    // bytes only count resident pages
+    struct memory_region_t {
+        std::string name;
+        uint64_t reserved_bytes = 0;
+        uint64_t committed_bytes = 0;
+        uint64_t private_bytes = 0;
+        uint64_t shared_bytes = 0;
+    };
+    // What the hosted session costs, see memory_report()
+    struct memory_report_t {
+        std::vector<memory_region_t> image;     // provider headers and sections
+        memory_region_t provider_stack;
+        memory_region_t host_stack;
+        uint64_t image_file_bytes = 0;          // file buffer kept by PEMapper::CreateFromFile
+        uint64_t console_buffer_bytes = 0;      // ConsoleState snapshot
+        uint64_t cmdline_bytes = 0;             // provider launch arguments and environment
+        uint64_t heap_committed_bytes = 0;      // provider heap, else the process heap
+        uint64_t heap_in_use_bytes = 0;
+        uint64_t vfs_bytes = 0;
+        uint64_t process_private_bytes = 0;     // commit charge of the whole process
+        uint64_t process_working_set_bytes = 0;
+    };
+    // Highest values seen since track_memory_peaks(true)
+    struct memory_peaks_t {
+        uint64_t samples = 0;
+        uint64_t heap_committed_bytes = 0;
+        uint64_t process_private_bytes = 0;
+        uint64_t process_working_set_bytes = 0;
+    };
+    // Optional provider features, all implemented through import hooks
+    struct features_t {
+        // Already loaded modules whose imports go through the same hooks as
+        // the mapped provider image; the IDA kernel itself lives in ida64.dll
+        std::vector<std::wstring> hook_modules = { L"ida64.dll" };
+        import_profiler_options_t import_profiler;
+        heap_options_t heap;
+        shared_image_options_t shared_image;
+        // Map the provider's code on large pages when the account holds
+        // SeLockMemoryPrivilege; ignored for shared images. Large pages
+        // cannot change protection, so that code stays writable: opt-in
+        bool large_pages = false;
+        // init(options_t) reads the input and its database files into the
+        // page cache while the provider image is being mapped. Opt-in: it
+        // only pays off when the files are not cached yet and the disk is
+        // idle otherwise
+        bool input_readahead = false;
+        // Files under these path prefixes live in vfs() instead of on disk
+        std::vector<std::wstring> vfs_prefixes;
+        // Stream the helper plugin's IDB events to the host
+        change_feed_options_t change_feed;
+        startup_profile_t startup_profile;
+    };
 
 private:
     void* host_fiber_ = nullptr;
@@ -27,13 +198,73 @@ private:
     host_msg_handler_t msg_handler_ = nullptr;
     void* msg_ud_ = nullptr;
 
+    struct query_t
+    {
+        query_handler_t cb;
+        void* ud;
+    };
+    std::map<std::string, query_t> queries_;
+    friend struct idahost_server_provider_t;
+
+    decomp_cache_t* decomp_cache_ = nullptr;
+    std::string decomp_tag_;
+
+    features_t features_;
+    import_profiler_t* profiler_ = nullptr;
+    vfs_store_t vfs_;
+    arena_heap_t* heap_ = nullptr;
+    alloc_trace_writer_t* heap_trace_ = nullptr;
+    readahead_t readahead_;
+    dispatcher_t dispatcher_;
+    change_feed_t changes_;
+    bool db_closed_ = false;    // by close_database(), in server mode
+
+    // Variables the provider's environment overrode, with the values they
+    // had before, put back by finish_term()
+    struct saved_env_t
+    {
+        std::string name;
+        std::string value;
+        bool was_set;
+    };
+    std::vector<saved_env_t> saved_env_;
+    bool term_pending_ = false; // term(term_deferred) until wait_term()
+    bool term_done_ = false;
+    uint64_t term_t0_ = 0;
+    term_report_t term_report_;
+
+    fiber_metrics_t metrics_;
+    metrics_registry_t registry_;
+    metrics_dumper_t dumper_;
+    uint64_t provider_enter_ns_ = 0;
+    uint64_t host_switch_ns_ = 0;
+
+    // Allocation bases of the fiber stacks, taken on each fiber
+    void* host_stack_ = nullptr;
+    void* provider_stack_ = nullptr;
+    bool track_peaks_ = false;
+    memory_peaks_t peaks_;
+
+    void sample_memory_peaks();
+    void set_provider_env(const char* name, const char* value);
+    void restore_env();
+    void close_for_term();
+    void finish_term();
+
     bool init_internal();
-    bool CanResolveImport(const char* sym_name, uint64_t* addr);
+    // Server mode: swap the database of a running session
+    bool open_database(const std::wstring& path);
+    void close_database();
+    void hook_provider_modules();
+    bool CanResolveImport(const char* lib_name, const char* sym_name, uint64_t* addr, bool provider_image);
 public:
     struct rawoptions_t {
         std::wstring idadir;
         std::wstring idabin = L"idat64.exe";
         std::vector<std::wstring> args;
+        // Environment variables set for the provider, e.g. { L"TVHEADLESS", L"1" }
+        std::vector<launch_desc_t::env_t> env;
+        features_t features;
     };
     struct options_t {
         std::wstring idadir;
@@ -41,6 +272,30 @@ public:
         std::wstring input_file;
         std::wstring log_file;
         int dbg = 0;
+        std::vector<launch_desc_t::env_t> env;
+        features_t features;
+    };
+    struct decomp_result_t {
+        ea_t ea = BADADDR;
+        bool ok = false;
+        bool cached = false;
+        std::string pseudocode;
+        std::string summary;    // microcode summary
+    };
+    struct decomp_stats_t {
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t failures = 0;
+        double hit_rate() const {
+            return hits + misses == 0 ? 0.0 : (double)hits / (hits + misses);
+        }
+    };
+    struct server_options_t {
+        // Pipe name on Windows, Unix socket name or path elsewhere
+        std::string endpoint = "idahost";
+        // If `input_file` is set the provider is started before the first
+        // client connects; otherwise the first open request starts it.
+        options_t provider;
     };
     idahost_t();
     ~idahost_t() override;
@@ -48,6 +303,62 @@ public:
 
     void set_msg_handler(void* ud, host_msg_handler_t cb);
 
+    const fiber_metrics_t& metrics() const {
+        return metrics_;
+    }
+    // Hosts may register their own metrics next to idahost's
+    metrics_registry_t& metrics_registry() {
+        return registry_;
+    }
+    // Periodically writes all metrics to a Prometheus textfile
+    void start_metrics_dump(
+        const std::filesystem::path& path,
+        std::chrono::milliseconds interval = std::chrono::seconds(15));
+    void stop_metrics_dump();
+
+    // In-memory file store behind features_t::vfs_prefixes. Preload inputs
+    // before init() and extract outputs after the provider wrote them.
+    vfs_store_t& vfs() {
+        return vfs_;
+    }
+
+    // Queue for calling the kernel from other threads. Requests run when the
+    // owner thread calls dispatcher().pump() and whenever the provider
+    // returns to the host.
+    dispatcher_t& dispatcher() {
+        return dispatcher_;
+    }
+
+    // Batches of database change records (change_reader_t) since the last
+    // drain; a gap in the sequence numbers means batches were dropped
+    size_t drain_changes(std::vector<change_feed_t::batch_t>* out) {
+        return changes_.drain(out);
+    }
+    change_feed_t::stats_t change_stats() const {
+        return changes_.stats();
+    }
+
+    // Shared versus private pages of the mapped provider image; `*shared` is
+    // false if the image is a private copy
+    bool image_sharing(std::vector<image_sharing_t>* out, bool* shared = nullptr);
+
+    // False if the provider heap is not enabled
+    bool heap_stats(heap_stats_t* out) const;
+
+    // What the startup profile hid and what startup took
+    startup_report_t startup_report() const;
+
+    // Walks the session's memory; costs a few system calls per image section
+    // and stack, so it can be sampled periodically
+    bool memory_report(memory_report_t* out);
+
+    // Peak mode samples the heap and process counters on every return to the
+    // host and on each memory_report(); enabling it resets the peaks
+    void track_memory_peaks(bool on);
+    memory_peaks_t memory_peaks() const {
+        return peaks_;
+    }
+
     const char* err_str() const {
         return err_.c_str();
     }
@@ -55,11 +366,58 @@ public:
     void return_to_host() override;
     void save_screen() override;
     void restore_screen() override;
+    bool change_feed_enabled() override {
+        return features_.change_feed.enabled;
+    }
+    void post_change(const void* record, size_t size) override {
+        changes_.append(record, size);
+    }
     void interact();
 
     void term();
+    void term(term_mode_e mode);
+    // The kernel only runs on the owner thread, so a deferred close does not
+    // overlap with the host: it lets the host finish its own work (e.g.
+    // answer its client) before paying for the close. A term() while one is
+    // pending is ignored.
+    //
+    // Owner thread; after term(term_deferred), closes the database and
+    // releases the fibers. False if term() was not called.
+    bool wait_term();
+    // Complete once term() returned, or wait_term() for a deferred close
+    const term_report_t& term_report() const {
+        return term_report_;
+    }
     bool init(const options_t &opt);
     bool init(const rawoptions_t& opt);
+
+    // Fills `out` with the columns selected by `what` (bulk_what_e) in one
+    // pass over the database. BULK_BYTES copies the segments `bytes_opt`
+    // selects, within its size limit, for host-side scanning
+    // (multi_scanner_t) while the provider keeps going.
+    bool extract(
+        bulk_snapshot_t* out,
+        uint32 what = BULK_FUNCS,
+        const bulk_bytes_options_t& bytes_opt = bulk_bytes_options_t());
+
+    // Decompilation results are cached in a store shared by all workers and
+    // keyed by decomp_key_t. `config_tag` stands for decompiler settings the
+    // key cannot see (hexrays.cfg, plugins); change it when they change.
+    bool open_decomp_cache(
+        const wchar_t* path,
+        uint32_t slots = 1u << 20,
+        uint64_t data_bytes = 1ull << 30,
+        const char* config_tag = "");
+    bool decompile_batch(
+        const ea_t* funcs,
+        size_t count,
+        std::vector<decomp_result_t>* out,
+        decomp_stats_t* stats = nullptr);
+
+    // Server mode: keep the provider mapped and serve requests over local IPC
+    // until a client asks for a shutdown. Terminates the session on return.
+    void add_query(const char* name, query_handler_t cb, void* ud = nullptr);
+    bool serve(const server_options_t& opt);
 };
 
 extern idahost_t idahost;
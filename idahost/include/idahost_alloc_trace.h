@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <mutex>
+#include <vector>
+
+// Recording of the provider's heap calls (heap_options_t::trace_file), for
+// replaying them against other allocators (tests/bench_arena.cpp).
+//
+// The file is a flat array of alloc_trace_rec_t in call order. Pointers are
+// only identities: a replay maps each live block to one of its own.
+struct alloc_trace_rec_t
+{
+    enum op_e : uint32_t
+    {
+        op_alloc = 1,       // ptr = result
+        op_free,            // ptr = block
+        op_realloc,         // old_ptr -> ptr
+    };
+
+    uint32_t op;
+    uint32_t thread;
+    uint64_t ptr;
+    uint64_t old_ptr;
+    uint64_t size;
+};
+static_assert(sizeof(alloc_trace_rec_t) == 32, "trace records are written as-is");
+
+class alloc_trace_writer_t
+{
+    static constexpr size_t BUFFER_RECS = 4096;
+
+    std::mutex mtx_;
+    FILE* f_ = nullptr;
+    std::vector<alloc_trace_rec_t> buf_;
+
+    void flush_locked()
+    {
+        if (!buf_.empty())
+            fwrite(buf_.data(), sizeof(alloc_trace_rec_t), buf_.size(), f_);
+        buf_.clear();
+    }
+
+public:
+    ~alloc_trace_writer_t()
+    {
+        close();
+    }
+
+    template <typename CharT>
+    bool open(const CharT* path)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (f_ != nullptr)
+            return false;
+#ifdef _WIN32
+        static_assert(sizeof(CharT) == sizeof(wchar_t), "paths are UTF-16 on Windows");
+        f_ = _wfopen((const wchar_t*)path, L"wb");
+#else
+        static_assert(sizeof(CharT) == 1, "paths are UTF-8 on POSIX");
+        f_ = fopen((const char*)path, "wb");
+#endif
+        buf_.reserve(BUFFER_RECS);
+        return f_ != nullptr;
+    }
+
+    // Calls after close() are dropped, so a late call from a provider thread
+    // is harmless
+    void record(uint32_t op, uint32_t thread, const void* ptr, const void* old_ptr, uint64_t size)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (f_ == nullptr)
+            return;
+        buf_.push_back({ op, thread, (uint64_t)(uintptr_t)ptr, (uint64_t)(uintptr_t)old_ptr, size });
+        if (buf_.size() == BUFFER_RECS)
+            flush_locked();
+    }
+
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (f_ == nullptr)
+            return;
+        flush_locked();
+        fclose(f_);
+        f_ = nullptr;
+    }
+};
+
+inline bool alloc_trace_load(const char* path, std::vector<alloc_trace_rec_t>* out)
+{
+    FILE* f = fopen(path, "rb");
+    if (f == nullptr)
+        return false;
+    alloc_trace_rec_t rec;
+    out->clear();
+    while (fread(&rec, sizeof(rec), 1, f) == 1)
+        out->push_back(rec);
+    fclose(f);
+    return true;
+}
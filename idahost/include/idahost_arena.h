@@ -0,0 +1,570 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <set>
+#include <vector>
+
+#ifdef _WIN32
+    #include <Windows.h>
+#else
+    #include <sys/mman.h>
+#endif
+
+// Thread-caching size-class allocator carved out of one reserved address
+// range, so ownership of any pointer is a range check.
+//
+// Small blocks (up to MAX_SMALL) come from 64 KiB spans dedicated to one of
+// CLASS_COUNT size classes. Each thread keeps a free list per class and
+// trades batches with a locked central list, so the common alloc/free is a
+// thread-local list push or pop. Larger blocks are runs of whole spans taken
+// from a coalescing free map. Spans never go back to the OS; the whole range
+// is returned by release().
+//
+// For a fast shutdown, begin_teardown() turns every free into a no-op until
+// end_teardown().
+class arena_heap_t
+{
+public:
+    static constexpr size_t SPAN_SIZE = 64 * 1024;
+    static constexpr size_t MAX_SMALL = 32 * 1024;
+    static constexpr int CLASS_COUNT = 44;
+
+    struct config_t
+    {
+        uint64_t reserve_bytes = 32ull << 30;
+    };
+
+    struct stats_t
+    {
+        uint64_t allocs = 0;
+        uint64_t frees = 0;
+        uint64_t bytes_allocated = 0;   // cumulative, rounded to class sizes
+        uint64_t bytes_freed = 0;
+        uint64_t large_allocs = 0;
+        uint64_t teardown_frees = 0;    // frees skipped after begin_teardown()
+        uint64_t spans_used = 0;        // high-water mark of the span bump pointer
+        uint64_t reserved_bytes = 0;
+
+        uint64_t bytes_in_use() const {
+            return bytes_allocated - bytes_freed;
+        }
+    };
+
+private:
+    struct node_t
+    {
+        node_t* next;
+    };
+
+    struct list_t
+    {
+        node_t* head = nullptr;
+        uint32_t count = 0;
+    };
+
+    struct alignas(64) central_t
+    {
+        std::mutex mtx;
+        list_t list;
+    };
+
+    struct counters_t
+    {
+        std::atomic<uint64_t> allocs{ 0 };
+        std::atomic<uint64_t> frees{ 0 };
+        std::atomic<uint64_t> bytes_allocated{ 0 };
+        std::atomic<uint64_t> bytes_freed{ 0 };
+    };
+
+    struct thread_cache_t
+    {
+        arena_heap_t* owner = nullptr;
+        list_t lists[CLASS_COUNT];
+        counters_t counters;
+
+        ~thread_cache_t()
+        {
+            if (owner != nullptr)
+                owner->detach(this);
+        }
+    };
+
+    static constexpr uint8_t SPAN_UNUSED = 0;
+    static constexpr uint8_t SPAN_LARGE = 0xFF;
+
+    uint8_t* base_ = nullptr;
+    uint64_t reserved_ = 0;
+    std::atomic<bool> teardown_{ false };
+    std::atomic<bool> released_{ false };
+
+    // Per span: size class + 1, SPAN_LARGE for the head of a large run
+    std::vector<uint8_t> span_class_;
+    std::vector<uint32_t> span_count_;
+
+    mutable std::mutex span_mtx_;
+    uint32_t span_top_ = 0;
+    uint32_t span_high_ = 0;
+    uint64_t committed_ = 0;
+    std::map<uint32_t, uint32_t> runs_by_start_;                // first -> count
+    std::set<std::pair<uint32_t, uint32_t>> runs_by_size_;      // (count, first)
+
+    central_t central_[CLASS_COUNT];
+
+    mutable std::mutex caches_mtx_;
+    std::vector<thread_cache_t*> caches_;
+    counters_t retired_;
+    std::atomic<uint64_t> large_allocs_{ 0 };
+    std::atomic<uint64_t> teardown_frees_{ 0 };
+
+    // Only for a thread's own counters, which have a single writer
+    static void bump(std::atomic<uint64_t>& c, uint64_t n) {
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    // retired_ is updated by every thread without a cache and by detach()
+    static void add_shared(std::atomic<uint64_t>& c, uint64_t n) {
+        c.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    static uint32_t batch_of(int c)
+    {
+        size_t n = 256 * 1024 / class_size(c);
+        return (uint32_t)(n < 2 ? 2 : n > 64 ? 64 : n);
+    }
+
+    static thread_cache_t& local_cache()
+    {
+        static thread_local thread_cache_t tc;
+        return tc;
+    }
+
+    // The calling thread's cache, or nullptr if it already serves another arena
+    thread_cache_t* cache()
+    {
+        thread_cache_t& tc = local_cache();
+        if (tc.owner == this)
+            return &tc;
+        if (tc.owner != nullptr)
+            return nullptr;
+        std::lock_guard<std::mutex> lock(caches_mtx_);
+        tc.owner = this;
+        caches_.push_back(&tc);
+        return &tc;
+    }
+
+    void detach(thread_cache_t* tc)
+    {
+        if (!released_.load(std::memory_order_relaxed))
+        {
+            for (int c = 0; c < CLASS_COUNT; ++c)
+                flush(c, tc->lists[c], tc->lists[c].count);
+        }
+        std::lock_guard<std::mutex> lock(caches_mtx_);
+        add_shared(retired_.allocs, tc->counters.allocs.load(std::memory_order_relaxed));
+        add_shared(retired_.frees, tc->counters.frees.load(std::memory_order_relaxed));
+        add_shared(retired_.bytes_allocated, tc->counters.bytes_allocated.load(std::memory_order_relaxed));
+        add_shared(retired_.bytes_freed, tc->counters.bytes_freed.load(std::memory_order_relaxed));
+        for (size_t i = 0; i < caches_.size(); ++i)
+        {
+            if (caches_[i] == tc)
+            {
+                caches_[i] = caches_.back();
+                caches_.pop_back();
+                break;
+            }
+        }
+        tc->owner = nullptr;
+    }
+
+    // Takes `count` contiguous spans; called with span_mtx_ held
+    bool take_spans(uint32_t count, uint32_t* first)
+    {
+        auto r = runs_by_size_.lower_bound({ count, 0 });
+        if (r != runs_by_size_.end())
+        {
+            uint32_t have = r->first;
+            *first = r->second;
+            runs_by_size_.erase(r);
+            runs_by_start_.erase(*first);
+            if (have > count)
+            {
+                runs_by_start_[*first + count] = have - count;
+                runs_by_size_.insert({ have - count, *first + count });
+            }
+            return true;
+        }
+
+        if ((uint64_t)span_top_ + count > span_class_.size())
+            return false;
+        uint64_t end = ((uint64_t)span_top_ + count) * SPAN_SIZE;
+        if (end > committed_)
+        {
+            // Commit in 1 MiB steps to keep system calls off the hot path
+            uint64_t to = (end + (1u << 20) - 1) & ~(uint64_t)((1u << 20) - 1);
+            if (to > reserved_)
+                to = reserved_;
+#ifdef _WIN32
+            if (VirtualAlloc(base_ + committed_, (SIZE_T)(to - committed_), MEM_COMMIT, PAGE_READWRITE) == nullptr)
+                return false;
+#endif
+            committed_ = to;
+        }
+        *first = span_top_;
+        span_top_ += count;
+        if (span_top_ > span_high_)
+            span_high_ = span_top_;
+        return true;
+    }
+
+    // Returns a run to the free map, merging it with its neighbours
+    void give_spans(uint32_t first, uint32_t count)
+    {
+        std::lock_guard<std::mutex> lock(span_mtx_);
+        auto next = runs_by_start_.find(first + count);
+        if (next != runs_by_start_.end())
+        {
+            count += next->second;
+            runs_by_size_.erase({ next->second, next->first });
+            runs_by_start_.erase(next);
+        }
+        auto prev = runs_by_start_.lower_bound(first);
+        if (prev != runs_by_start_.begin())
+        {
+            --prev;
+            if (prev->first + prev->second == first)
+            {
+                first = prev->first;
+                count += prev->second;
+                runs_by_size_.erase({ prev->second, prev->first });
+                runs_by_start_.erase(prev);
+            }
+        }
+        if (first + count == span_top_)
+        {
+            span_top_ = first;
+            return;
+        }
+        runs_by_start_[first] = count;
+        runs_by_size_.insert({ count, first });
+    }
+
+    // Moves up to `want` blocks of class `c` from the central list to `l`
+    bool refill(int c, list_t& l, uint32_t want)
+    {
+        central_t& ce = central_[c];
+        std::lock_guard<std::mutex> lock(ce.mtx);
+        if (ce.list.head == nullptr)
+        {
+            uint32_t idx;
+            {
+                std::lock_guard<std::mutex> slock(span_mtx_);
+                if (!take_spans(1, &idx))
+                    return false;
+            }
+            span_class_[idx] = (uint8_t)(c + 1);
+            size_t sz = class_size(c);
+            uint8_t* span = base_ + (size_t)idx * SPAN_SIZE;
+            size_t n = SPAN_SIZE / sz;
+            for (size_t i = n; i-- > 0; )
+            {
+                node_t* b = (node_t*)(span + i * sz);
+                b->next = ce.list.head;
+                ce.list.head = b;
+            }
+            ce.list.count += (uint32_t)n;
+        }
+        while (want-- > 0 && ce.list.head != nullptr)
+        {
+            node_t* b = ce.list.head;
+            ce.list.head = b->next;
+            --ce.list.count;
+            b->next = l.head;
+            l.head = b;
+            ++l.count;
+        }
+        return true;
+    }
+
+    // Moves `n` blocks of class `c` from `l` to the central list
+    void flush(int c, list_t& l, uint32_t n)
+    {
+        if (n == 0)
+            return;
+        central_t& ce = central_[c];
+        std::lock_guard<std::mutex> lock(ce.mtx);
+        while (n-- > 0 && l.head != nullptr)
+        {
+            node_t* b = l.head;
+            l.head = b->next;
+            --l.count;
+            b->next = ce.list.head;
+            ce.list.head = b;
+            ++ce.list.count;
+        }
+    }
+
+    void* alloc_large(size_t n)
+    {
+        // Rounding a size near SIZE_MAX up to whole spans would wrap
+        if (n > reserved_)
+            return nullptr;
+        uint32_t count = (uint32_t)((n + SPAN_SIZE - 1) / SPAN_SIZE);
+        uint32_t idx;
+        {
+            std::lock_guard<std::mutex> lock(span_mtx_);
+            if (!take_spans(count, &idx))
+                return nullptr;
+        }
+        span_class_[idx] = SPAN_LARGE;
+        span_count_[idx] = count;
+        large_allocs_.fetch_add(1, std::memory_order_relaxed);
+        count_alloc(cache(), (uint64_t)count * SPAN_SIZE);
+        return base_ + (size_t)idx * SPAN_SIZE;
+    }
+
+    void count_alloc(thread_cache_t* tc, uint64_t bytes)
+    {
+        if (tc != nullptr)
+        {
+            bump(tc->counters.allocs, 1);
+            bump(tc->counters.bytes_allocated, bytes);
+        }
+        else
+        {
+            add_shared(retired_.allocs, 1);
+            add_shared(retired_.bytes_allocated, bytes);
+        }
+    }
+
+    void count_free(thread_cache_t* tc, uint64_t bytes)
+    {
+        if (tc != nullptr)
+        {
+            bump(tc->counters.frees, 1);
+            bump(tc->counters.bytes_freed, bytes);
+        }
+        else
+        {
+            add_shared(retired_.frees, 1);
+            add_shared(retired_.bytes_freed, bytes);
+        }
+    }
+
+public:
+    arena_heap_t() = default;
+    arena_heap_t(const arena_heap_t&) = delete;
+    arena_heap_t& operator=(const arena_heap_t&) = delete;
+
+    ~arena_heap_t()
+    {
+        std::lock_guard<std::mutex> lock(caches_mtx_);
+        for (thread_cache_t* tc : caches_)
+            tc->owner = nullptr;
+        caches_.clear();
+    }
+
+    static size_t class_size(int c)
+    {
+        if (c < 16)
+            return (size_t)(c + 1) * 16;
+        int k = c - 16;
+        return (size_t)(5 + k % 4) << (6 + k / 4);
+    }
+
+    static int class_of(size_t n)
+    {
+        if (n <= 256)
+            return n == 0 ? 0 : (int)((n + 15) / 16) - 1;
+        size_t v = n - 1;
+        int msb = 63;
+        while ((v >> msb) == 0)
+            --msb;
+        return 16 + (msb - 8) * 4 + (int)((v >> (msb - 2)) & 3);
+    }
+
+    bool init() {
+        return init(config_t());
+    }
+
+    bool init(const config_t& cfg)
+    {
+        if (base_ != nullptr)
+            return true;
+        uint64_t size = cfg.reserve_bytes & ~(uint64_t)(SPAN_SIZE - 1);
+#ifdef _WIN32
+        base_ = (uint8_t*)VirtualAlloc(nullptr, (SIZE_T)size, MEM_RESERVE, PAGE_READWRITE);
+#else
+        // Anonymous pages are committed lazily by the kernel
+        void* p = mmap(nullptr, (size_t)size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        base_ = p == MAP_FAILED ? nullptr : (uint8_t*)p;
+#endif
+        if (base_ == nullptr)
+            return false;
+        reserved_ = size;
+        span_class_.assign((size_t)(size / SPAN_SIZE), SPAN_UNUSED);
+        span_count_.assign((size_t)(size / SPAN_SIZE), 0);
+        return true;
+    }
+
+    bool owns(const void* p) const {
+        return (const uint8_t*)p >= base_ && (const uint8_t*)p < base_ + reserved_;
+    }
+
+    // nullptr when the arena is exhausted or released; callers fall back to
+    // the system allocator
+    void* alloc(size_t n)
+    {
+        if (base_ == nullptr || released_.load(std::memory_order_relaxed))
+            return nullptr;
+        if (n > MAX_SMALL)
+            return alloc_large(n);
+
+        int c = class_of(n);
+        thread_cache_t* tc = cache();
+        if (tc == nullptr)
+        {
+            list_t one;
+            if (!refill(c, one, 1))
+                return nullptr;
+            count_alloc(nullptr, class_size(c));
+            return one.head;
+        }
+
+        list_t& l = tc->lists[c];
+        if (l.head == nullptr && (!refill(c, l, batch_of(c)) || l.head == nullptr))
+            return nullptr;
+        node_t* b = l.head;
+        l.head = b->next;
+        --l.count;
+        count_alloc(tc, class_size(c));
+        return b;
+    }
+
+    // `p` must be owned by this arena
+    void free(void* p)
+    {
+        if (teardown_.load(std::memory_order_relaxed))
+        {
+            teardown_frees_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        size_t idx = (size_t)((uint8_t*)p - base_) / SPAN_SIZE;
+        uint8_t k = span_class_[idx];
+        if (k == SPAN_LARGE)
+        {
+            uint32_t count = span_count_[idx];
+            span_class_[idx] = SPAN_UNUSED;
+            count_free(cache(), (uint64_t)count * SPAN_SIZE);
+            give_spans((uint32_t)idx, count);
+            return;
+        }
+
+        int c = k - 1;
+        node_t* b = (node_t*)p;
+        thread_cache_t* tc = cache();
+        if (tc == nullptr)
+        {
+            list_t one;
+            b->next = nullptr;
+            one.head = b;
+            one.count = 1;
+            flush(c, one, 1);
+            count_free(nullptr, class_size(c));
+            return;
+        }
+
+        list_t& l = tc->lists[c];
+        b->next = l.head;
+        l.head = b;
+        ++l.count;
+        count_free(tc, class_size(c));
+        uint32_t batch = batch_of(c);
+        if (l.count > 2 * batch)
+            flush(c, l, batch);
+    }
+
+    // `p` must be owned by this arena
+    size_t usable_size(const void* p) const
+    {
+        size_t idx = (size_t)((const uint8_t*)p - base_) / SPAN_SIZE;
+        uint8_t k = span_class_[idx];
+        return k == SPAN_LARGE ? (size_t)span_count_[idx] * SPAN_SIZE : class_size(k - 1);
+    }
+
+    // `p` must be null or owned by this arena
+    void* realloc(void* p, size_t n)
+    {
+        if (p == nullptr)
+            return alloc(n);
+        size_t have = usable_size(p);
+        // Keep the block unless it would waste more than half of it
+        if (n <= have && (n > have / 2 || have <= 16))
+            return p;
+        void* q = alloc(n);
+        if (q == nullptr)
+            return nullptr;
+        memcpy(q, p, n < have ? n : have);
+        free(p);
+        return q;
+    }
+
+    void begin_teardown() {
+        teardown_.store(true, std::memory_order_relaxed);
+    }
+
+    // Frees take effect again, unless the range was released. Blocks whose
+    // frees were skipped stay allocated.
+    void end_teardown()
+    {
+        if (!released_.load(std::memory_order_relaxed))
+            teardown_.store(false, std::memory_order_relaxed);
+    }
+
+    bool in_teardown() const {
+        return teardown_.load(std::memory_order_relaxed);
+    }
+
+    // Returns the whole range to the OS. owns() keeps answering for the old
+    // range so late frees can still be recognized and ignored.
+    void release()
+    {
+        if (base_ == nullptr || released_.exchange(true))
+            return;
+        begin_teardown();
+#ifdef _WIN32
+        VirtualFree(base_, 0, MEM_RELEASE);
+#else
+        munmap(base_, (size_t)reserved_);
+#endif
+    }
+
+    stats_t stats() const
+    {
+        stats_t st;
+        {
+            std::lock_guard<std::mutex> lock(caches_mtx_);
+            auto add = [&st](const counters_t& c)
+            {
+                st.allocs += c.allocs.load(std::memory_order_relaxed);
+                st.frees += c.frees.load(std::memory_order_relaxed);
+                st.bytes_allocated += c.bytes_allocated.load(std::memory_order_relaxed);
+                st.bytes_freed += c.bytes_freed.load(std::memory_order_relaxed);
+            };
+            add(retired_);
+            for (const thread_cache_t* tc : caches_)
+                add(tc->counters);
+        }
+        st.large_allocs = large_allocs_.load(std::memory_order_relaxed);
+        st.teardown_frees = teardown_frees_.load(std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(span_mtx_);
+            st.spans_used = span_high_;
+        }
+        st.reserved_bytes = reserved_;
+        return st;
+    }
+};
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <vector>
+#include <pro.h>
+
+// Columnar (struct-of-arrays) snapshots filled by idahost_t::extract() in a
+// single pass over the database. Only the selected columns are rewritten.
+// Columns are plain vectors that host code can consume as raw arrays;
+// extraction keeps their capacity, so reusing the same object across calls
+// does not reallocate.
+//
+// Names live in one contiguous arena of NUL-terminated strings; `name_offs[i]`
+// is the offset of the i-th name in `names`.
+
+enum bulk_what_e : uint32
+{
+    BULK_FUNCS    = 0x1,
+    BULK_XREFS    = 0x2,   // references from the code items of every function
+    BULK_SEGMENTS = 0x4,
+    BULK_BYTES    = 0x8,   // contents of segments, see bulk_bytes_t
+};
+
+enum bulk_byte_kind_e : uint8
+{
+    BULK_BYTE_UNKNOWN,
+    BULK_BYTE_CODE,
+    BULK_BYTE_DATA,
+};
+
+struct bulk_names_t
+{
+    std::vector<uint32> name_offs;
+    std::vector<char> names;
+
+    const char* name(size_t i) const {
+        return names.data() + name_offs[i];
+    }
+
+    void add_name(const char* s, size_t len)
+    {
+        name_offs.push_back((uint32)names.size());
+        names.insert(names.end(), s, s + len + 1);
+    }
+
+    void clear_names()
+    {
+        name_offs.clear();
+        names.clear();
+    }
+};
+
+struct bulk_functions_t : bulk_names_t
+{
+    std::vector<ea_t> start;
+    std::vector<ea_t> end;
+    std::vector<uint64> flags;
+
+    size_t size() const {
+        return start.size();
+    }
+
+    void clear()
+    {
+        start.clear();
+        end.clear();
+        flags.clear();
+        clear_names();
+    }
+};
+
+struct bulk_xrefs_t
+{
+    std::vector<ea_t> from;
+    std::vector<ea_t> to;
+    std::vector<uint8> type;       // cref_t / dref_t
+    std::vector<uint8> iscode;
+    std::vector<uint32> func;      // row of the referencing function in bulk_functions_t
+
+    size_t size() const {
+        return from.size();
+    }
+
+    void clear()
+    {
+        from.clear();
+        to.clear();
+        type.clear();
+        iscode.clear();
+        func.clear();
+    }
+};
+
+struct bulk_segments_t : bulk_names_t
+{
+    std::vector<ea_t> start;
+    std::vector<ea_t> end;
+    std::vector<uint8> perm;
+    std::vector<uint8> bitness;
+    std::vector<uint8> type;
+
+    size_t size() const {
+        return start.size();
+    }
+
+    void clear()
+    {
+        start.clear();
+        end.clear();
+        perm.clear();
+        bitness.clear();
+        type.clear();
+        clear_names();
+    }
+};
+
+// The bytes of the selected segments (bulk_bytes_options_t) back to back, for
+// scanning on host threads.
+// Segment i starts at `seg_off[i]` (a multiple of 8, so that every segment
+// owns whole bytes of `loaded`); the padding in between reads as unloaded
+// zeros. Uninitialized bytes have their `loaded` bit clear and no meaningful
+// value. Scan matches map back to addresses through ea_of().
+struct bulk_bytes_t
+{
+    std::vector<ea_t> seg_start;
+    std::vector<uint64> seg_off;
+    std::vector<uint64> seg_size;
+    std::vector<uint8> bytes;
+    std::vector<uint8> loaded;     // bit i set if bytes[i] has a value
+    std::vector<uint8> kind;       // bulk_byte_kind_e of each byte
+    // Start of every selected segment left out for the size limit
+    std::vector<ea_t> skipped;
+
+    size_t size() const {
+        return bytes.size();
+    }
+
+    bool is_loaded(uint64 off) const {
+        return (loaded[off >> 3] >> (off & 7) & 1) != 0;
+    }
+
+    // BADADDR for padding
+    ea_t ea_of(uint64 off) const
+    {
+        size_t lo = 0, hi = seg_off.size();
+        while (lo < hi)
+        {
+            size_t mid = (lo + hi) / 2;
+            if (seg_off[mid] <= off)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo == 0 || off - seg_off[lo - 1] >= seg_size[lo - 1])
+            return BADADDR;
+        return seg_start[lo - 1] + (ea_t)(off - seg_off[lo - 1]);
+    }
+
+    void clear()
+    {
+        seg_start.clear();
+        seg_off.clear();
+        seg_size.clear();
+        bytes.clear();
+        loaded.clear();
+        kind.clear();
+        skipped.clear();
+    }
+};
+
+// What BULK_BYTES copies. A snapshot takes about 2.1 bytes of host memory per
+// segment byte, so sparse or huge segments are better left to get_bytes().
+struct bulk_bytes_options_t
+{
+    // Start addresses of the segments to copy; empty for all of them
+    std::vector<ea_t> segments;
+    // Segments that would take the snapshot past this many bytes are
+    // skipped; later, smaller ones may still fit
+    uint64 max_bytes = 1ull << 30;
+};
+
+struct bulk_snapshot_t
+{
+    bulk_functions_t funcs;
+    bulk_xrefs_t xrefs;
+    bulk_segments_t segs;
+    bulk_bytes_t bytes;
+};
@@ -0,0 +1,281 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+// Database change feed. The helper plugin encodes IDB events as records and
+// posts them to the host, which appends them to an open batch. Batches are
+// sealed with consecutive sequence numbers (on every return to the host and
+// before each drain) and kept in a ring bounded by bytes; when it overflows
+// the oldest batches go, and a reader notices the gap in the sequence.
+//
+// A record is a change_hdr_t followed by `len` payload bytes (a name,
+// comment or serialized type, not NUL-terminated).
+
+enum change_kind_e : uint8_t
+{
+    CHG_RENAMED,            // ea; payload new name; flags CHGF_LOCAL
+    CHG_FUNC_ADDED,         // ea..ea2
+    CHG_FUNC_DELETED,       // ea..ea2
+    CHG_FUNC_UPDATED,       // ea..ea2
+    CHG_FUNC_START,         // ea old start, ea2 new start
+    CHG_FUNC_END,           // ea function start, ea2 new end
+    CHG_CMT,                // ea; payload comment; flags CHGF_REPEATABLE
+    CHG_RANGE_CMT,          // ea..ea2; payload comment; flags CHGF_REPEATABLE, CHGF_FUNC_RANGE
+    CHG_EXTRA_CMT,          // ea, ea2 line index; payload comment
+    CHG_TYPE,               // ea; payload type and field names, empty if deleted (change_encode_type)
+    CHG_SEG_ADDED,          // ea..ea2; payload name
+    CHG_SEG_DELETED,        // ea..ea2
+    CHG_SEG_START,          // ea new start, ea2 old start
+    CHG_SEG_END,            // ea segment start, ea2 new end
+    CHG_SEG_RENAMED,        // ea segment start; payload name
+    CHG_SEG_MOVED,          // ea from, ea2 to; payload uint64 size
+    CHG_BYTE_PATCHED,       // ea; payload uint32 old value
+};
+
+enum change_flags_e : uint8_t
+{
+    CHGF_LOCAL          = 0x01,
+    CHGF_REPEATABLE     = 0x02,
+    CHGF_FUNC_RANGE     = 0x04,     // range comment of a function, else of a segment
+    CHGF_TRUNCATED      = 0x08,     // CHG_TYPE: the type or its fields did not fit
+};
+
+#pragma pack(push, 1)
+struct change_hdr_t
+{
+    uint8_t kind;
+    uint8_t flags;
+    uint16_t len;
+    uint64_t ea;
+    uint64_t ea2;
+};
+#pragma pack(pop)
+
+// Serializes one record into `buf` (room for sizeof(change_hdr_t) + 64K);
+// longer payloads are cut. Returns the record size.
+inline size_t change_encode(
+    uint8_t* buf,
+    change_kind_e kind,
+    uint8_t flags,
+    uint64_t ea,
+    uint64_t ea2 = 0,
+    const void* payload = nullptr,
+    size_t len = 0)
+{
+    change_hdr_t hdr;
+    hdr.kind = kind;
+    hdr.flags = flags;
+    hdr.len = (uint16_t)(len < 0xFFFF ? len : 0xFFFF);
+    hdr.ea = ea;
+    hdr.ea2 = ea2;
+    memcpy(buf, &hdr, sizeof(hdr));
+    if (hdr.len != 0)
+        memcpy(buf + sizeof(hdr), payload, hdr.len);
+    return sizeof(hdr) + hdr.len;
+}
+
+// CHG_TYPE payload: uint16 length of the serialized type_t string, the type,
+// then the p_list of argument and member names up to the end. Fields are cut
+// before the type when both do not fit; either sets CHGF_TRUNCATED.
+inline size_t change_encode_type(
+    uint8_t* buf,
+    uint64_t ea,
+    const void* type,
+    size_t type_len,
+    const void* fields,
+    size_t fields_len)
+{
+    if (type == nullptr)
+        return change_encode(buf, CHG_TYPE, 0, ea);
+    const size_t room = 0xFFFF - sizeof(uint16_t);
+    uint8_t flags = type_len + fields_len > room ? CHGF_TRUNCATED : 0;
+    type_len = type_len < room ? type_len : room;
+    fields_len = fields_len < room - type_len ? fields_len : room - type_len;
+
+    change_hdr_t hdr;
+    hdr.kind = CHG_TYPE;
+    hdr.flags = flags;
+    hdr.len = (uint16_t)(sizeof(uint16_t) + type_len + fields_len);
+    hdr.ea = ea;
+    hdr.ea2 = 0;
+    uint16_t tl = (uint16_t)type_len;
+    uint8_t* out = buf;
+    memcpy(out, &hdr, sizeof(hdr));
+    out += sizeof(hdr);
+    memcpy(out, &tl, sizeof(tl));
+    out += sizeof(tl);
+    if (type_len != 0)
+        memcpy(out, type, type_len);
+    if (fields_len != 0)
+        memcpy(out + type_len, fields, fields_len);
+    return sizeof(hdr) + hdr.len;
+}
+
+struct change_t
+{
+    change_kind_e kind;
+    uint8_t flags;
+    uint64_t ea;
+    uint64_t ea2;
+    const uint8_t* payload;
+    size_t len;
+};
+
+// Splits a CHG_TYPE payload; false if it is empty (type deleted) or malformed
+inline bool change_decode_type(
+    const change_t& c,
+    const uint8_t** type,
+    size_t* type_len,
+    const uint8_t** fields,
+    size_t* fields_len)
+{
+    uint16_t tl;
+    if (c.kind != CHG_TYPE || c.len < sizeof(tl))
+        return false;
+    memcpy(&tl, c.payload, sizeof(tl));
+    if (c.len - sizeof(tl) < tl)
+        return false;
+    *type = c.payload + sizeof(tl);
+    *type_len = tl;
+    *fields = *type + tl;
+    *fields_len = c.len - sizeof(tl) - tl;
+    return true;
+}
+
+// Walks the records of one batch
+class change_reader_t
+{
+    const uint8_t* p_;
+    const uint8_t* end_;
+
+public:
+    change_reader_t(const void* data, size_t size)
+        : p_((const uint8_t*)data), end_((const uint8_t*)data + size) { }
+
+    bool next(change_t* c)
+    {
+        change_hdr_t hdr;
+        if ((size_t)(end_ - p_) < sizeof(hdr))
+            return false;
+        memcpy(&hdr, p_, sizeof(hdr));
+        if ((size_t)(end_ - p_) < sizeof(hdr) + hdr.len)
+            return false;
+        c->kind = (change_kind_e)hdr.kind;
+        c->flags = hdr.flags;
+        c->ea = hdr.ea;
+        c->ea2 = hdr.ea2;
+        c->payload = p_ + sizeof(hdr);
+        c->len = hdr.len;
+        p_ += sizeof(hdr) + hdr.len;
+        return true;
+    }
+};
+
+class change_feed_t
+{
+public:
+    struct batch_t
+    {
+        uint64_t seq;
+        uint32_t records;
+        std::vector<uint8_t> data;
+    };
+
+    struct stats_t
+    {
+        uint64_t records = 0;
+        uint64_t batches = 0;
+        uint64_t dropped_batches = 0;
+        uint64_t queued_bytes = 0;
+        uint64_t held_bytes = 0;        // allocated for the queued and open batches
+    };
+
+private:
+    mutable std::mutex mtx_;
+    std::vector<uint8_t> open_;
+    uint32_t open_records_ = 0;
+    std::deque<batch_t> ring_;
+    size_t ring_bytes_ = 0;
+    size_t capacity_ = 16u << 20;
+    uint64_t next_seq_ = 1;
+    uint64_t records_ = 0;
+    uint64_t dropped_ = 0;
+
+    void seal_locked()
+    {
+        if (open_records_ == 0)
+            return;
+        batch_t b;
+        b.seq = next_seq_++;
+        b.records = open_records_;
+        // A sealed batch holds exactly its records; the open buffer keeps
+        // its capacity for the next one
+        b.data.assign(open_.begin(), open_.end());
+        open_.clear();
+        open_records_ = 0;
+        ring_bytes_ += b.data.size();
+        ring_.push_back(std::move(b));
+        // Keep the newest batch even if it alone exceeds the capacity
+        while (ring_bytes_ > capacity_ && ring_.size() > 1)
+        {
+            ring_bytes_ -= ring_.front().data.size();
+            ring_.pop_front();
+            ++dropped_;
+        }
+    }
+
+public:
+    void set_capacity(size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        capacity_ = bytes;
+    }
+
+    void append(const void* record, size_t size)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        open_.insert(open_.end(), (const uint8_t*)record, (const uint8_t*)record + size);
+        ++open_records_;
+        ++records_;
+    }
+
+    void seal()
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        seal_locked();
+    }
+
+    // Seals the open batch and moves every queued batch to `out`. Batches
+    // were lost if the first sequence number is not the last one seen + 1.
+    size_t drain(std::vector<batch_t>* out)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        seal_locked();
+        out->clear();
+        out->reserve(ring_.size());
+        for (batch_t& b : ring_)
+            out->push_back(std::move(b));
+        ring_.clear();
+        ring_bytes_ = 0;
+        return out->size();
+    }
+
+    stats_t stats() const
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        stats_t st;
+        st.records = records_;
+        st.batches = next_seq_ - 1;
+        st.dropped_batches = dropped_;
+        st.queued_bytes = ring_bytes_ + open_.size();
+        st.held_bytes = open_.capacity();
+        for (const batch_t& b : ring_)
+            st.held_bytes += b.data.capacity();
+        return st;
+    }
+};
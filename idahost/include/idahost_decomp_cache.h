@@ -0,0 +1,395 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "idahost_hash.h"
+
+#ifdef _WIN32
+    #include <Windows.h>
+#else
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+// Key of a decompilation result. Everything that can show up in the
+// pseudocode goes in: the decompiler and its configuration, the prototype,
+// the names of the function and of everything it refers to (or the address
+// where there is no name) and the code with address operands masked out.
+// Parts are tagged and length-prefixed so adjacent parts cannot run into each
+// other.
+class decomp_key_t
+{
+    std::vector<uint8_t> buf_;
+
+public:
+    enum part_e : uint8_t
+    {
+        part_context = 1,   // decompiler version, options, processor
+        part_prototype,
+        part_name,          // of the function itself
+        part_ref,           // name or address of a referenced item
+        part_code,
+    };
+
+    void clear() {
+        buf_.clear();
+    }
+
+    void add(part_e kind, const void* data, size_t size)
+    {
+        uint32_t n = (uint32_t)size;
+        buf_.push_back(kind);
+        buf_.insert(buf_.end(), (const uint8_t*)&n, (const uint8_t*)&n + sizeof(n));
+        buf_.insert(buf_.end(), (const uint8_t*)data, (const uint8_t*)data + size);
+    }
+
+    void add_str(part_e kind, const char* s) {
+        add(kind, s, strlen(s));
+    }
+
+    void add_u64(part_e kind, uint64_t v) {
+        add(kind, &v, sizeof(v));
+    }
+
+    hash128_t hash() const {
+        return hash128(buf_.data(), buf_.size());
+    }
+};
+
+// Content-addressed store of decompilation results in a memory-mapped file
+// that any number of worker processes can share.
+//
+// The file holds a fixed-size open-addressing index followed by an
+// append-only data arena. Writers allocate data with an atomic bump pointer,
+// claim an index slot with a compare-and-swap and publish it last, so readers
+// never take a lock and only ever see complete entries. The store does not
+// evict; once the arena or the index is full further inserts are refused.
+class decomp_cache_t
+{
+public:
+    struct config_t
+    {
+        uint32_t slots = 1u << 20;                   // rounded up to a power of two
+        uint64_t data_bytes = 1024ull * 1024 * 1024;
+    };
+
+    // Points into the mapping; valid while the store is open
+    struct entry_t
+    {
+        const char* pseudocode;
+        uint32_t pseudocode_len;
+        const char* summary;
+        uint32_t summary_len;
+    };
+
+private:
+    static constexpr uint32_t MAGIC = 0x43444849; // "IHDC"
+    static constexpr uint32_t MAX_PROBE = 64;
+
+    enum slot_state_e : uint32_t
+    {
+        slot_empty,
+        slot_writing,
+        slot_ready,
+    };
+
+    struct header_t
+    {
+        std::atomic<uint32_t> magic;
+        uint32_t version;
+        uint32_t slot_count;
+        uint32_t reserved;
+        uint64_t data_capacity;
+        alignas(64) std::atomic<uint64_t> data_used;
+        alignas(64) std::atomic<uint64_t> entries;
+    };
+
+    struct slot_t
+    {
+        std::atomic<uint32_t> state;
+        uint32_t pseudocode_len;
+        uint64_t key_lo;
+        uint64_t key_hi;
+        uint64_t data_off;
+        uint32_t summary_len;
+        uint32_t reserved;
+    };
+
+    header_t* hdr_ = nullptr;
+    slot_t* slots_ = nullptr;
+    char* data_ = nullptr;
+    uint64_t map_size_ = 0;
+#ifdef _WIN32
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+    HANDLE mapping_ = nullptr;
+#else
+    int fd_ = -1;
+#endif
+
+    static constexpr uint64_t slots_offset() {
+        return (sizeof(header_t) + 63) & ~(uint64_t)63;
+    }
+
+    static uint64_t layout_size(uint32_t slot_count, uint64_t data_bytes) {
+        return slots_offset() + (uint64_t)slot_count * sizeof(slot_t) + data_bytes;
+    }
+
+    bool map_file(uint64_t size)
+    {
+#ifdef _WIN32
+        mapping_ = CreateFileMappingW(
+            file_,
+            nullptr,
+            PAGE_READWRITE,
+            (DWORD)(size >> 32),
+            (DWORD)size,
+            nullptr);
+        if (mapping_ == nullptr)
+            return false;
+        hdr_ = (header_t*)MapViewOfFile(mapping_, FILE_MAP_ALL_ACCESS, 0, 0, (SIZE_T)size);
+#else
+        void* p = mmap(nullptr, (size_t)size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        hdr_ = p == MAP_FAILED ? nullptr : (header_t*)p;
+#endif
+        map_size_ = size;
+        return hdr_ != nullptr;
+    }
+
+    uint64_t file_size() const
+    {
+#ifdef _WIN32
+        LARGE_INTEGER sz;
+        return GetFileSizeEx(file_, &sz) ? (uint64_t)sz.QuadPart : 0;
+#else
+        struct stat st;
+        return fstat(fd_, &st) == 0 ? (uint64_t)st.st_size : 0;
+#endif
+    }
+
+    void bind_layout()
+    {
+        slots_ = (slot_t*)((char*)hdr_ + slots_offset());
+        data_ = (char*)(slots_ + hdr_->slot_count);
+    }
+
+public:
+    decomp_cache_t() = default;
+    decomp_cache_t(const decomp_cache_t&) = delete;
+    decomp_cache_t& operator=(const decomp_cache_t&) = delete;
+
+    ~decomp_cache_t()
+    {
+        close();
+    }
+
+    bool is_open() const {
+        return hdr_ != nullptr;
+    }
+
+    // Opens the store at `path`, creating it with `cfg` if it does not exist.
+    // Processes racing to create the same file all end up sharing one store.
+    template <typename CharT>
+    bool open(const CharT* path, const config_t& cfg = config_t())
+    {
+        close();
+        uint32_t slots = 1024;
+        while (slots < cfg.slots)
+            slots <<= 1;
+        bool creator = true;
+#ifdef _WIN32
+        static_assert(sizeof(CharT) == sizeof(wchar_t), "paths are UTF-16 on Windows");
+        file_ = CreateFileW(
+            (LPCWSTR)path,
+            GENERIC_READ | GENERIC_WRITE,
+            FILE_SHARE_READ | FILE_SHARE_WRITE,
+            nullptr,
+            CREATE_NEW,
+            FILE_ATTRIBUTE_NORMAL,
+            nullptr);
+        if (file_ == INVALID_HANDLE_VALUE)
+        {
+            creator = false;
+            file_ = CreateFileW(
+                (LPCWSTR)path,
+                GENERIC_READ | GENERIC_WRITE,
+                FILE_SHARE_READ | FILE_SHARE_WRITE,
+                nullptr,
+                OPEN_EXISTING,
+                FILE_ATTRIBUTE_NORMAL,
+                nullptr);
+        }
+        if (file_ == INVALID_HANDLE_VALUE)
+            return false;
+#else
+        static_assert(sizeof(CharT) == 1, "paths are UTF-8 on POSIX");
+        fd_ = ::open((const char*)path, O_RDWR | O_CREAT | O_EXCL, 0644);
+        if (fd_ == -1)
+        {
+            creator = false;
+            fd_ = ::open((const char*)path, O_RDWR);
+        }
+        if (fd_ == -1)
+            return false;
+#endif
+
+        if (creator)
+        {
+            // Mapping a file extends it to the requested size
+            uint64_t size = layout_size(slots, cfg.data_bytes);
+#ifndef _WIN32
+            if (ftruncate(fd_, (off_t)size) != 0)
+            {
+                close();
+                return false;
+            }
+#endif
+            if (!map_file(size))
+            {
+                close();
+                return false;
+            }
+            hdr_->version = 1;
+            hdr_->slot_count = slots;
+            hdr_->data_capacity = cfg.data_bytes;
+            hdr_->data_used.store(0, std::memory_order_relaxed);
+            hdr_->entries.store(0, std::memory_order_relaxed);
+            hdr_->magic.store(MAGIC, std::memory_order_release);
+            bind_layout();
+            return true;
+        }
+
+        // Wait for the creator to size and initialize the file
+        for (int tries = 0; ; ++tries)
+        {
+            uint64_t size = file_size();
+            if (size >= slots_offset())
+            {
+                if (!map_file(size))
+                    break;
+                if (hdr_->magic.load(std::memory_order_acquire) == MAGIC
+                    && layout_size(hdr_->slot_count, hdr_->data_capacity) <= size)
+                {
+                    bind_layout();
+                    return true;
+                }
+                unmap();
+            }
+            if (tries == 500)
+                break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        close();
+        return false;
+    }
+
+    bool lookup(const hash128_t& key, entry_t* e) const
+    {
+        if (hdr_ == nullptr)
+            return false;
+        uint32_t mask = hdr_->slot_count - 1;
+        for (uint32_t i = 0; i < MAX_PROBE; ++i)
+        {
+            const slot_t& s = slots_[(key.lo + i) & mask];
+            uint32_t st = s.state.load(std::memory_order_acquire);
+            if (st == slot_empty)
+                return false;
+            if (st != slot_ready || s.key_lo != key.lo || s.key_hi != key.hi)
+                continue;
+            e->pseudocode = data_ + s.data_off;
+            e->pseudocode_len = s.pseudocode_len;
+            e->summary = e->pseudocode + s.pseudocode_len;
+            e->summary_len = s.summary_len;
+            return true;
+        }
+        return false;
+    }
+
+    bool insert(
+        const hash128_t& key,
+        const char* pseudocode,
+        uint32_t pseudocode_len,
+        const char* summary,
+        uint32_t summary_len)
+    {
+        if (hdr_ == nullptr)
+            return false;
+        entry_t existing;
+        if (lookup(key, &existing))
+            return true;
+
+        uint64_t len = (uint64_t)pseudocode_len + summary_len;
+        uint64_t off = hdr_->data_used.fetch_add((len + 7) & ~(uint64_t)7, std::memory_order_relaxed);
+        if (off + len > hdr_->data_capacity)
+            return false;
+        memcpy(data_ + off, pseudocode, pseudocode_len);
+        memcpy(data_ + off + pseudocode_len, summary, summary_len);
+
+        uint32_t mask = hdr_->slot_count - 1;
+        for (uint32_t i = 0; i < MAX_PROBE; ++i)
+        {
+            slot_t& s = slots_[(key.lo + i) & mask];
+            uint32_t expected = slot_empty;
+            if (!s.state.compare_exchange_strong(expected, slot_writing, std::memory_order_acquire))
+                continue;
+            s.key_lo = key.lo;
+            s.key_hi = key.hi;
+            s.data_off = off;
+            s.pseudocode_len = pseudocode_len;
+            s.summary_len = summary_len;
+            s.state.store(slot_ready, std::memory_order_release);
+            hdr_->entries.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
+
+    uint64_t entries() const {
+        return hdr_ == nullptr ? 0 : hdr_->entries.load(std::memory_order_relaxed);
+    }
+
+    uint64_t data_used() const {
+        return hdr_ == nullptr ? 0 : hdr_->data_used.load(std::memory_order_relaxed);
+    }
+
+    void unmap()
+    {
+        if (hdr_ != nullptr)
+        {
+#ifdef _WIN32
+            UnmapViewOfFile(hdr_);
+#else
+            munmap(hdr_, (size_t)map_size_);
+#endif
+        }
+#ifdef _WIN32
+        if (mapping_ != nullptr)
+            CloseHandle(mapping_);
+        mapping_ = nullptr;
+#endif
+        hdr_ = nullptr;
+        slots_ = nullptr;
+        data_ = nullptr;
+        map_size_ = 0;
+    }
+
+    void close()
+    {
+        unmap();
+#ifdef _WIN32
+        if (file_ != INVALID_HANDLE_VALUE)
+            CloseHandle(file_);
+        file_ = INVALID_HANDLE_VALUE;
+#else
+        if (fd_ != -1)
+            ::close(fd_);
+        fd_ = -1;
+#endif
+    }
+};
@@ -0,0 +1,325 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "idahost_metrics.h"
+
+// Runs closures submitted from any thread on the one thread that owns the
+// provider. Producers push onto lock-free intrusive MPSC queues (one per
+// priority) and get a std::future back; the owner executes them in pump(),
+// highest priority first and in submission order within a priority.
+//
+// Requests with the same non-zero coalescing key that are pending together
+// run once: the newest closure runs in the oldest request's place, at the
+// highest priority among them, and every submitter gets its result.
+//
+// The owner must not block on a future of its own submission without
+// pumping; nothing else would ever run it.
+class dispatcher_t
+{
+public:
+    enum priority_e
+    {
+        prio_high,
+        prio_normal,
+        prio_low,
+        prio_count,
+    };
+
+    struct stats_t
+    {
+        uint64_t submitted = 0;
+        uint64_t executed = 0;
+        uint64_t coalesced = 0;     // requests answered by another's run
+    };
+
+private:
+    struct node_t
+    {
+        std::atomic<node_t*> next{ nullptr };
+        uint64_t key = 0;
+        uint64_t seq = 0;
+        uint64_t submit_ns = 0;
+        int prio = prio_normal;
+        // Identifies the result type; only equal types coalesce
+        const void* type = nullptr;
+
+        virtual ~node_t() = default;
+        virtual void run() = 0;
+        // Takes over `newer`'s closure and promises; `newer` is then deleted
+        virtual void absorb(node_t* newer) = 0;
+    };
+
+    template <typename R>
+    struct task_t : node_t
+    {
+        static inline const char type_tag = 0;
+        std::function<R()> fn;
+        std::vector<std::promise<R>> promises;
+
+        void run() override
+        {
+            // Promises before `done` hold a value; a copy that throws fails
+            // only the ones after it
+            size_t done = 0;
+            try
+            {
+                if constexpr (std::is_void_v<R>)
+                {
+                    fn();
+                    for (; done < promises.size(); ++done)
+                        promises[done].set_value();
+                }
+                else if constexpr (std::is_copy_constructible_v<R>)
+                {
+                    R r = fn();
+                    for (; done + 1 < promises.size(); ++done)
+                        promises[done].set_value(r);
+                    promises.back().set_value(std::move(r));
+                }
+                else
+                {
+                    promises.back().set_value(fn());
+                }
+            }
+            catch (...)
+            {
+                for (size_t i = done; i < promises.size(); ++i)
+                    promises[i].set_exception(std::current_exception());
+            }
+        }
+
+        void absorb(node_t* newer) override
+        {
+            task_t* t = static_cast<task_t*>(newer);
+            fn = std::move(t->fn);
+            for (auto& p : t->promises)
+                promises.push_back(std::move(p));
+            prio = (std::min)(prio, t->prio);
+        }
+    };
+
+    // Vyukov's intrusive MPSC queue: push is one exchange, pop is owner only
+    struct queue_t
+    {
+        std::atomic<node_t*> head;
+        node_t* tail;
+        struct stub_t : node_t
+        {
+            void run() override { }
+            void absorb(node_t*) override { }
+        } stub;
+
+        queue_t() : head(&stub), tail(&stub) { }
+
+        void push(node_t* n)
+        {
+            n->next.store(nullptr, std::memory_order_relaxed);
+            node_t* prev = head.exchange(n, std::memory_order_acq_rel);
+            prev->next.store(n, std::memory_order_release);
+        }
+
+        // nullptr when empty, or while a producer is between its two steps
+        node_t* pop()
+        {
+            node_t* t = tail;
+            node_t* next = t->next.load(std::memory_order_acquire);
+            if (t == &stub)
+            {
+                if (next == nullptr)
+                    return nullptr;
+                tail = next;
+                t = next;
+                next = next->next.load(std::memory_order_acquire);
+            }
+            if (next != nullptr)
+            {
+                tail = next;
+                return t;
+            }
+            if (t != head.load(std::memory_order_acquire))
+                return nullptr;
+            push(&stub);
+            next = t->next.load(std::memory_order_acquire);
+            if (next == nullptr)
+                return nullptr;
+            tail = next;
+            return t;
+        }
+    };
+
+    queue_t queues_[prio_count];
+    std::atomic<uint64_t> seq_{ 0 };
+    std::atomic<uint64_t> pending_{ 0 };
+    std::atomic<uint64_t> executed_{ 0 };
+    std::atomic<uint64_t> coalesced_{ 0 };
+
+    // Owner side: popped requests not yet run, and the keyed ones among them
+    std::vector<node_t*> ready_;
+    std::unordered_map<uint64_t, node_t*> keyed_;
+
+    std::atomic<bool> sleeping_{ false };
+    std::mutex wake_mtx_;
+    std::condition_variable wake_cv_;
+
+    latency_histogram_t* wait_hist_ = nullptr;
+    latency_histogram_t* run_hist_ = nullptr;
+
+    void enqueue(node_t* n)
+    {
+        n->seq = seq_.fetch_add(1, std::memory_order_relaxed);
+        n->submit_ns = metrics_now_ns();
+        // Counted first so that collect() never sees a request it must
+        // uncount before it was counted
+        pending_.fetch_add(1, std::memory_order_seq_cst);
+        queues_[n->prio].push(n);
+        if (sleeping_.load(std::memory_order_seq_cst))
+        {
+            std::lock_guard<std::mutex> lock(wake_mtx_);
+            wake_cv_.notify_one();
+        }
+    }
+
+    // Moves everything published so far into ready_, coalescing as it goes
+    bool collect()
+    {
+        bool added = false;
+        for (queue_t& q : queues_)
+        {
+            while (node_t* n = q.pop())
+            {
+                pending_.fetch_sub(1, std::memory_order_relaxed);
+                added = true;
+                if (n->key != 0)
+                {
+                    auto it = keyed_.find(n->key);
+                    if (it != keyed_.end() && it->second->type == n->type)
+                    {
+                        it->second->absorb(n);
+                        delete n;
+                        coalesced_.fetch_add(1, std::memory_order_relaxed);
+                        continue;
+                    }
+                    keyed_[n->key] = n;
+                }
+                ready_.push_back(n);
+            }
+        }
+        return added;
+    }
+
+public:
+    dispatcher_t() = default;
+    dispatcher_t(const dispatcher_t&) = delete;
+    dispatcher_t& operator=(const dispatcher_t&) = delete;
+
+    // Requests still queued are dropped; their futures report broken_promise
+    ~dispatcher_t()
+    {
+        collect();
+        for (node_t* n : ready_)
+            delete n;
+    }
+
+    // Optional histograms of queueing delay and run time, recorded by pump()
+    void set_metrics(latency_histogram_t* wait, latency_histogram_t* run)
+    {
+        wait_hist_ = wait;
+        run_hist_ = run;
+    }
+
+    // Any thread. `key` 0 never coalesces.
+    template <typename F, typename R = std::invoke_result_t<F&>>
+    std::future<R> submit(F&& fn, priority_e prio = prio_normal, uint64_t key = 0)
+    {
+        task_t<R>* t = new task_t<R>();
+        t->fn = std::forward<F>(fn);
+        t->promises.emplace_back();
+        t->prio = prio;
+        // Results that cannot be copied cannot be shared by coalesced requests
+        t->key = std::is_void_v<R> || std::is_copy_constructible_v<R> ? key : 0;
+        t->type = &task_t<R>::type_tag;
+        std::future<R> f = t->promises.back().get_future();
+        enqueue(t);
+        return f;
+    }
+
+    // Any thread; a snapshot that may already be stale
+    uint64_t pending() const {
+        return pending_.load(std::memory_order_relaxed);
+    }
+
+    // Owner thread. Runs up to `max` requests and returns how many ran;
+    // requests submitted by the ones running wait for the next pump().
+    size_t pump(size_t max = SIZE_MAX)
+    {
+        if (collect())
+        {
+            std::stable_sort(ready_.begin(), ready_.end(), [](const node_t* a, const node_t* b)
+            {
+                return a->prio != b->prio ? a->prio < b->prio : a->seq < b->seq;
+            });
+        }
+        size_t n = (std::min)(max, ready_.size());
+        if (n == 0)
+            return 0;
+
+        // Detach the batch first: a closure may pump() again
+        std::vector<node_t*> batch(ready_.begin(), ready_.begin() + n);
+        ready_.erase(ready_.begin(), ready_.begin() + n);
+        for (node_t* t : batch)
+        {
+            if (t->key != 0)
+                keyed_.erase(t->key);
+        }
+        for (node_t* t : batch)
+        {
+            uint64_t t0 = metrics_now_ns();
+            if (wait_hist_ != nullptr)
+                wait_hist_->record(t0 - t->submit_ns);
+            t->run();
+            if (run_hist_ != nullptr)
+                run_hist_->record(metrics_now_ns() - t0);
+            delete t;
+        }
+        executed_.fetch_add(n, std::memory_order_relaxed);
+        return n;
+    }
+
+    // Owner thread. Sleeps until a request is submitted or `timeout` passes;
+    // true if there is something to pump.
+    bool wait(std::chrono::milliseconds timeout)
+    {
+        if (!ready_.empty())
+            return true;
+        std::unique_lock<std::mutex> lock(wake_mtx_);
+        sleeping_.store(true, std::memory_order_seq_cst);
+        bool ok = wake_cv_.wait_for(lock, timeout, [this]
+        {
+            return pending_.load(std::memory_order_seq_cst) != 0;
+        });
+        sleeping_.store(false, std::memory_order_relaxed);
+        return ok;
+    }
+
+    stats_t stats() const
+    {
+        stats_t st;
+        st.executed = executed_.load(std::memory_order_relaxed);
+        st.coalesced = coalesced_.load(std::memory_order_relaxed);
+        st.submitted = seq_.load(std::memory_order_relaxed);
+        return st;
+    }
+};
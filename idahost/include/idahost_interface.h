@@ -1,6 +1,16 @@
 #pragma once
 
 #include <stdarg.h>
+#include <stddef.h>
+
+// Bumped whenever slots are added to the end of IDAHostInterface. The host
+// exports get_idahost_interface_version(); a host without that export
+// predates it and has version 1. The plugin must not call a slot newer than
+// the host's version: the host's vtable does not have it.
+//
+//   1  return_to_host .. ~IDAHostInterface
+//   2  change_feed_enabled, post_change
+#define IDAHOST_INTERFACE_VERSION 2
 
 struct IDAHostInterface
 {
@@ -10,7 +20,13 @@ struct IDAHostInterface
     virtual void interact() = 0;
     virtual void ui_msg_(const char* format, va_list args) = 0;
     virtual ~IDAHostInterface() = 0 { };
+    // Version 2. Database change feed (idahost_changes.h): the plugin only
+    // hooks IDB events if the host wants them, then posts one encoded record
+    // per event
+    virtual bool change_feed_enabled() = 0;
+    virtual void post_change(const void* record, size_t size) = 0;
     //;!TODO: transaction_begin, transaction_end, transaction_abort
 };
 
 typedef IDAHostInterface* (*get_host_interface_proc_t)();
+typedef int (*get_host_interface_version_proc_t)();
@@ -0,0 +1,324 @@
+#pragma once
+
+#include <string>
+#include "idahost_server.h"
+
+#ifdef _WIN32
+    #include <Windows.h>
+#else
+    #include <sys/socket.h>
+    #include <sys/stat.h>
+    #include <sys/un.h>
+    #include <unistd.h>
+    #include <errno.h>
+    #include <stdlib.h>
+#endif
+
+// Local IPC endpoints for idahost_server_t: a named pipe (\\.\pipe\<name>) on
+// Windows and a Unix domain socket elsewhere. A name containing a path
+// separator is used verbatim; other sockets go in $XDG_RUNTIME_DIR, or in
+// /tmp/idahost-<uid>, which must be a directory only its owner can enter.
+class ipc_stream_t : public idahost_server_t::stream_t
+{
+#ifdef _WIN32
+    HANDLE h_ = INVALID_HANDLE_VALUE;
+    bool server_side_ = false;
+#else
+    int fd_ = -1;
+#endif
+
+    friend class ipc_listener_t;
+
+#ifndef _WIN32
+    // Where send() has no MSG_NOSIGNAL, the socket itself is told
+    static void no_sigpipe(int fd)
+    {
+#if !defined(MSG_NOSIGNAL) && defined(SO_NOSIGPIPE)
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#else
+        (void)fd;
+#endif
+    }
+#endif
+
+public:
+    static std::string endpoint_path(const char* name)
+    {
+#ifdef _WIN32
+        if (strchr(name, '\\') != nullptr)
+            return name;
+        return std::string("\\\\.\\pipe\\") + name;
+#else
+        if (strchr(name, '/') != nullptr)
+            return name;
+        return runtime_dir() + "/" + name + ".sock";
+#endif
+    }
+
+#ifndef _WIN32
+    static std::string runtime_dir()
+    {
+        const char* rt = getenv("XDG_RUNTIME_DIR");
+        if (rt != nullptr && rt[0] == '/')
+            return rt;
+        return "/tmp/idahost-" + std::to_string((unsigned)geteuid());
+    }
+
+    // False unless the socket's directory is ours and closed to others;
+    // `create` makes the fallback directory
+    static bool check_dir(const std::string& path, bool create)
+    {
+        std::string dir = path.substr(0, path.find_last_of('/'));
+        if (create && dir == runtime_dir() && ::mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST)
+            return false;
+        struct stat st;
+        if (::lstat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode))
+            return false;
+        return st.st_uid == geteuid() && (st.st_mode & 077) == 0;
+    }
+#endif
+
+    ipc_stream_t() = default;
+    ipc_stream_t(const ipc_stream_t&) = delete;
+    ipc_stream_t& operator=(const ipc_stream_t&) = delete;
+
+    ~ipc_stream_t() override
+    {
+        close();
+    }
+
+    bool is_open() const
+    {
+#ifdef _WIN32
+        return h_ != INVALID_HANDLE_VALUE;
+#else
+        return fd_ != -1;
+#endif
+    }
+
+    bool connect(const char* name)
+    {
+        close();
+        std::string path = endpoint_path(name);
+#ifdef _WIN32
+        for (;;)
+        {
+            h_ = CreateFileA(
+                path.c_str(),
+                GENERIC_READ | GENERIC_WRITE,
+                0,
+                nullptr,
+                OPEN_EXISTING,
+                0,
+                nullptr);
+            if (h_ != INVALID_HANDLE_VALUE)
+                return true;
+            if (GetLastError() != ERROR_PIPE_BUSY || !WaitNamedPipeA(path.c_str(), 5000))
+                return false;
+        }
+#else
+        sockaddr_un addr = {};
+        if (path.size() >= sizeof(addr.sun_path))
+            return false;
+        if (strchr(name, '/') == nullptr && !check_dir(path, false))
+            return false;
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+        fd_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd_ == -1)
+            return false;
+        no_sigpipe(fd_);
+        if (::connect(fd_, (sockaddr*)&addr, sizeof(addr)) != 0)
+        {
+            close();
+            return false;
+        }
+        return true;
+#endif
+    }
+
+    ptrdiff_t read(void* buf, size_t size) override
+    {
+#ifdef _WIN32
+        DWORD nread = 0;
+        if (!ReadFile(h_, buf, (DWORD)size, &nread, nullptr))
+            return GetLastError() == ERROR_BROKEN_PIPE ? 0 : -1;
+        return nread;
+#else
+        for (;;)
+        {
+            ssize_t n = ::read(fd_, buf, size);
+            if (n < 0 && errno == EINTR)
+                continue;
+            return n;
+        }
+#endif
+    }
+
+    bool write(const void* buf, size_t size) override
+    {
+        const char* p = (const char*)buf;
+        while (size != 0)
+        {
+#ifdef _WIN32
+            DWORD nwritten = 0;
+            if (!WriteFile(h_, p, (DWORD)size, &nwritten, nullptr))
+                return false;
+#else
+            // A peer that hung up must not raise SIGPIPE in the server
+#ifdef MSG_NOSIGNAL
+            ssize_t nwritten = ::send(fd_, p, size, MSG_NOSIGNAL);
+#else
+            ssize_t nwritten = ::send(fd_, p, size, 0);
+#endif
+            if (nwritten < 0 && errno == EINTR)
+                continue;
+            if (nwritten <= 0)
+                return false;
+#endif
+            p += nwritten;
+            size -= nwritten;
+        }
+        return true;
+    }
+
+    void close()
+    {
+#ifdef _WIN32
+        if (h_ != INVALID_HANDLE_VALUE)
+        {
+            if (server_side_)
+            {
+                FlushFileBuffers(h_);
+                DisconnectNamedPipe(h_);
+            }
+            CloseHandle(h_);
+            h_ = INVALID_HANDLE_VALUE;
+        }
+        server_side_ = false;
+#else
+        if (fd_ != -1)
+        {
+            ::close(fd_);
+            fd_ = -1;
+        }
+#endif
+    }
+};
+
+class ipc_listener_t
+{
+    std::string path_;
+#ifndef _WIN32
+    int fd_ = -1;
+    bool bound_ = false;    // the socket file is ours to remove
+#endif
+
+public:
+    ipc_listener_t() = default;
+    ipc_listener_t(const ipc_listener_t&) = delete;
+    ipc_listener_t& operator=(const ipc_listener_t&) = delete;
+
+    ~ipc_listener_t()
+    {
+        close();
+    }
+
+    bool listen(const char* name)
+    {
+        close();
+        path_ = ipc_stream_t::endpoint_path(name);
+#ifdef _WIN32
+        // Pipe instances are created on demand by accept()
+        return true;
+#else
+        sockaddr_un addr = {};
+        if (path_.size() >= sizeof(addr.sun_path))
+            return false;
+        if (strchr(name, '/') == nullptr && !ipc_stream_t::check_dir(path_, true))
+            return false;
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, path_.c_str(), path_.size() + 1);
+
+        // Only a stale socket of ours is replaced
+        struct stat st;
+        if (::lstat(path_.c_str(), &st) == 0)
+        {
+            if (!S_ISSOCK(st.st_mode) || st.st_uid != geteuid())
+                return false;
+            ::unlink(path_.c_str());
+        }
+        fd_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd_ == -1)
+            return false;
+        if (::bind(fd_, (sockaddr*)&addr, sizeof(addr)) != 0)
+        {
+            close();
+            return false;
+        }
+        bound_ = true;
+        if (::listen(fd_, 8) != 0)
+        {
+            close();
+            return false;
+        }
+        return true;
+#endif
+    }
+
+    // Blocks until a client connects
+    bool accept(ipc_stream_t* s)
+    {
+        s->close();
+#ifdef _WIN32
+        HANDLE h = CreateNamedPipeA(
+            path_.c_str(),
+            PIPE_ACCESS_DUPLEX,
+            PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+            PIPE_UNLIMITED_INSTANCES,
+            64 * 1024,
+            64 * 1024,
+            0,
+            nullptr);
+        if (h == INVALID_HANDLE_VALUE)
+            return false;
+
+        if (!ConnectNamedPipe(h, nullptr) && GetLastError() != ERROR_PIPE_CONNECTED)
+        {
+            CloseHandle(h);
+            return false;
+        }
+        s->h_ = h;
+        s->server_side_ = true;
+        return true;
+#else
+        for (;;)
+        {
+            int fd = ::accept(fd_, nullptr, nullptr);
+            if (fd == -1 && errno == EINTR)
+                continue;
+            if (fd == -1)
+                return false;
+            ipc_stream_t::no_sigpipe(fd);
+            s->fd_ = fd;
+            return true;
+        }
+#endif
+    }
+
+    void close()
+    {
+#ifndef _WIN32
+        if (fd_ != -1)
+        {
+            ::close(fd_);
+            fd_ = -1;
+        }
+        if (bound_)
+            ::unlink(path_.c_str());
+        bound_ = false;
+#endif
+    }
+};
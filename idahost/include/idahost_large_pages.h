@@ -0,0 +1,195 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+    #include <Windows.h>
+#else
+    #include <sys/mman.h>
+    #include <stdio.h>
+#endif
+
+// Large-page backed memory for mapped images: a planner that picks the
+// large-page aligned stretches of an image, and allocators for them
+// (MEM_LARGE_PAGES on Windows; MAP_HUGETLB, else transparent huge pages, on
+// Linux). Every step can fail; callers keep ordinary pages as the fallback.
+namespace large_pages
+{
+    enum kind_e
+    {
+        kind_none,
+        kind_large,         // MEM_LARGE_PAGES or MAP_HUGETLB
+        kind_transparent,   // THP hint only
+    };
+
+    struct range_t
+    {
+        uint64_t offset;
+        uint64_t size;
+        bool large;
+    };
+
+    // Splits [0, image_size) into ordered ranges. Whole large pages that lie
+    // inside the `eligible` [start, end) intervals are marked large.
+    inline std::vector<range_t> plan(
+        std::vector<std::pair<uint64_t, uint64_t>> eligible,
+        uint64_t image_size,
+        uint64_t large_size)
+    {
+        std::sort(eligible.begin(), eligible.end());
+        std::vector<std::pair<uint64_t, uint64_t>> merged;
+        for (const auto& e : eligible)
+        {
+            if (!merged.empty() && e.first <= merged.back().second)
+                merged.back().second = (std::max)(merged.back().second, e.second);
+            else
+                merged.push_back(e);
+        }
+
+        std::vector<range_t> out;
+        uint64_t pos = 0;
+        for (const auto& m : merged)
+        {
+            uint64_t s = (m.first + large_size - 1) / large_size * large_size;
+            uint64_t e = (std::min)(m.second, image_size) / large_size * large_size;
+            if (e <= s)
+                continue;
+            if (s > pos)
+                out.push_back({ pos, s - pos, false });
+            out.push_back({ s, e - s, true });
+            pos = e;
+        }
+        if (pos < image_size)
+            out.push_back({ pos, image_size - pos, false });
+        return out;
+    }
+
+    // Large page size, or 0 if the system has none
+    inline size_t minimum()
+    {
+#ifdef _WIN32
+        return GetLargePageMinimum();
+#else
+        size_t kb = 0;
+        FILE* fp = fopen("/proc/meminfo", "r");
+        if (fp == nullptr)
+            return 0;
+        char line[256];
+        while (fgets(line, sizeof(line), fp) != nullptr)
+        {
+            if (sscanf(line, "Hugepagesize: %zu kB", &kb) == 1)
+                break;
+        }
+        fclose(fp);
+        return kb * 1024;
+#endif
+    }
+
+    // Windows needs SeLockMemoryPrivilege enabled in the process token
+    inline bool enable_privilege()
+    {
+#ifdef _WIN32
+        HANDLE token;
+        if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+            return false;
+        TOKEN_PRIVILEGES tp = {};
+        tp.PrivilegeCount = 1;
+        tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+        bool ok = LookupPrivilegeValueW(nullptr, SE_LOCK_MEMORY_NAME, &tp.Privileges[0].Luid)
+            && AdjustTokenPrivileges(token, FALSE, &tp, 0, nullptr, nullptr)
+            && GetLastError() == ERROR_SUCCESS;
+        CloseHandle(token);
+        return ok;
+#else
+        return true;
+#endif
+    }
+
+    // A currently free address range of `size` bytes aligned to `align`.
+    // Nothing holds it, so allocating there can still lose a race.
+    inline void* find_free_range(size_t size, size_t align)
+    {
+#ifdef _WIN32
+        BYTE* p = (BYTE*)VirtualAlloc(nullptr, size + align, MEM_RESERVE, PAGE_NOACCESS);
+        if (p == nullptr)
+            return nullptr;
+        VirtualFree(p, 0, MEM_RELEASE);
+#else
+        void* m = mmap(nullptr, size + align, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (m == MAP_FAILED)
+            return nullptr;
+        munmap(m, size + align);
+        uint8_t* p = (uint8_t*)m;
+#endif
+        return (void*)(((uintptr_t)p + align - 1) & ~(uintptr_t)(align - 1));
+    }
+
+    // Read/write/execute memory at exactly `addr`; `*kind` tells how it is
+    // backed. `addr` and `size` must be multiples of minimum() for large pages.
+    inline void* alloc_at(void* addr, size_t size, bool large, kind_e* kind)
+    {
+        *kind = kind_none;
+#ifdef _WIN32
+        if (large)
+        {
+            void* p = VirtualAlloc(addr, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_EXECUTE_READWRITE);
+            if (p != nullptr)
+            {
+                *kind = kind_large;
+                return p;
+            }
+        }
+        return VirtualAlloc(addr, size, MEM_RESERVE | MEM_COMMIT, PAGE_EXECUTE_READWRITE);
+#else
+        const int prot = PROT_READ | PROT_WRITE | PROT_EXEC;
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    #ifdef MAP_FIXED_NOREPLACE
+        flags |= MAP_FIXED_NOREPLACE;
+    #endif
+        void* p = MAP_FAILED;
+    #ifdef MAP_HUGETLB
+        if (large)
+        {
+            p = mmap(addr, size, prot, flags | MAP_HUGETLB, -1, 0);
+            if (p != MAP_FAILED && p != addr)
+            {
+                munmap(p, size);
+                p = MAP_FAILED;
+            }
+            if (p != MAP_FAILED)
+                *kind = kind_large;
+        }
+    #endif
+        if (p == MAP_FAILED)
+        {
+            p = mmap(addr, size, prot, flags, -1, 0);
+            if (p != MAP_FAILED && p != addr)
+            {
+                munmap(p, size);
+                return nullptr;
+            }
+            if (p == MAP_FAILED)
+                return nullptr;
+    #ifdef MADV_HUGEPAGE
+            if (large && madvise(p, size, MADV_HUGEPAGE) == 0)
+                *kind = kind_transparent;
+    #endif
+        }
+        return p;
+#endif
+    }
+
+    inline void free(void* p, size_t size)
+    {
+#ifdef _WIN32
+        (void)size;
+        VirtualFree(p, 0, MEM_RELEASE);
+#else
+        munmap(p, size);
+#endif
+    }
+}
@@ -0,0 +1,273 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <wchar.h>
+#include <wctype.h>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// The provider's launch environment: argv, the command line, the module path
+// and environment overrides, all in one block. build() sizes everything
+// first and only reallocates when the block must grow, so relaunching with
+// similar arguments allocates nothing; the accessors hand out pointers into
+// the block as the intercepted __p___wargv, GetCommandLineW and
+// GetModuleFileNameW return them.
+//
+// Block layout: argv pointers (argc + 1, null-terminated), env pointers
+// (count + 1, "NAME=VALUE"), then the strings: argv[0..argc), the command
+// line, the module path and the env entries.
+class launch_desc_t
+{
+public:
+    using env_t = std::pair<std::wstring, std::wstring>;
+
+private:
+    std::unique_ptr<char[]> block_;
+    size_t capacity_ = 0;
+    size_t used_ = 0;
+
+    int argc_ = 0;
+    wchar_t** argv_ = nullptr;
+    wchar_t** env_ = nullptr;
+    size_t env_count_ = 0;
+    const wchar_t* cmd_line_ = L"";
+    const wchar_t* module_path_ = L"";
+    size_t module_path_len_ = 0;
+
+    static bool is_sep(wchar_t c) {
+        return c == L'\\' || c == L'/';
+    }
+
+    static wchar_t* put(wchar_t* out, const wchar_t* s, size_t n)
+    {
+        memcpy(out, s, n * sizeof(wchar_t));
+        return out + n;
+    }
+
+    static wchar_t* put_module(wchar_t* out, const std::wstring& dir, const std::wstring& file)
+    {
+        out = put(out, dir.c_str(), dir.size());
+        if (!dir.empty() && !is_sep(dir.back()))
+            *out++ = L'\\';
+        return put(out, file.c_str(), file.size());
+    }
+
+public:
+    launch_desc_t() = default;
+    launch_desc_t(const launch_desc_t&) = delete;
+    launch_desc_t& operator=(const launch_desc_t&) = delete;
+
+    // Length of `arg` as quoted for CommandLineToArgvW and the C runtime
+    static size_t quoted_length(const wchar_t* arg, size_t len)
+    {
+        if (len != 0 && wcscspn(arg, L" \t\n\v\"") >= len)
+            return len;
+        size_t n = 2;
+        size_t slashes = 0;
+        for (size_t i = 0; i < len; ++i)
+        {
+            if (arg[i] == L'\\')
+            {
+                ++slashes;
+            }
+            else
+            {
+                // Backslashes before a quote are doubled and the quote escaped
+                if (arg[i] == L'"')
+                    n += slashes + 1;
+                slashes = 0;
+            }
+            ++n;
+        }
+        // ... and so are the ones before the closing quote
+        return n + slashes;
+    }
+
+    // Writes quoted_length(arg, len) characters at `out`
+    static wchar_t* append_quoted(wchar_t* out, const wchar_t* arg, size_t len)
+    {
+        if (len != 0 && wcscspn(arg, L" \t\n\v\"") >= len)
+            return put(out, arg, len);
+        *out++ = L'"';
+        size_t slashes = 0;
+        for (size_t i = 0; i < len; ++i)
+        {
+            if (arg[i] == L'\\')
+            {
+                ++slashes;
+            }
+            else
+            {
+                if (arg[i] == L'"')
+                {
+                    for (size_t k = 0; k <= slashes; ++k)
+                        *out++ = L'\\';
+                }
+                slashes = 0;
+            }
+            *out++ = arg[i];
+        }
+        for (size_t k = 0; k < slashes; ++k)
+            *out++ = L'\\';
+        *out++ = L'"';
+        return out;
+    }
+
+    // The module is `dir`\`file`; argv[0] is the module path, and the
+    // command line quotes it as the shell does (no escapes, paths cannot
+    // hold quotes). False only if the block cannot be allocated.
+    bool build(
+        const std::wstring& dir,
+        const std::wstring& file,
+        const std::vector<std::wstring>& args,
+        const std::vector<env_t>& env = {})
+    {
+        size_t module_len = dir.size() + file.size() + (!dir.empty() && !is_sep(dir.back()) ? 1 : 0);
+        size_t argc = args.size() + 1;
+
+        size_t chars = (module_len + 1) * 2;            // argv[0] and the module path
+        chars += module_len + 2 + 1;                    // quoted in the command line
+        for (const std::wstring& a : args)
+            chars += a.size() + 1 + 1 + quoted_length(a.c_str(), a.size());
+        for (const env_t& e : env)
+            chars += e.first.size() + 1 + e.second.size() + 1;
+        size_t ptr_bytes = (argc + 1 + env.size() + 1) * sizeof(wchar_t*);
+        size_t total = ptr_bytes + chars * sizeof(wchar_t);
+
+        if (total > capacity_)
+        {
+            // Leave room for a few longer arguments next time
+            size_t cap = total + total / 4;
+            std::unique_ptr<char[]> block(new (std::nothrow) char[cap]);
+            if (block == nullptr)
+                return false;
+            block_ = std::move(block);
+            capacity_ = cap;
+        }
+        used_ = total;
+
+        argv_ = (wchar_t**)block_.get();
+        env_ = argv_ + argc + 1;
+        wchar_t* out = (wchar_t*)(block_.get() + ptr_bytes);
+
+        argv_[0] = out;
+        out = put_module(out, dir, file);
+        *out++ = L'\0';
+        for (size_t i = 0; i < args.size(); ++i)
+        {
+            argv_[i + 1] = out;
+            out = put(out, args[i].c_str(), args[i].size());
+            *out++ = L'\0';
+        }
+        argv_[argc] = nullptr;
+        argc_ = (int)argc;
+
+        cmd_line_ = out;
+        *out++ = L'"';
+        out = put_module(out, dir, file);
+        *out++ = L'"';
+        for (const std::wstring& a : args)
+        {
+            *out++ = L' ';
+            out = append_quoted(out, a.c_str(), a.size());
+        }
+        *out++ = L'\0';
+
+        module_path_ = out;
+        module_path_len_ = module_len;
+        out = put_module(out, dir, file);
+        *out++ = L'\0';
+
+        for (size_t i = 0; i < env.size(); ++i)
+        {
+            env_[i] = out;
+            out = put(out, env[i].first.c_str(), env[i].first.size());
+            *out++ = L'=';
+            out = put(out, env[i].second.c_str(), env[i].second.size());
+            *out++ = L'\0';
+        }
+        env_[env.size()] = nullptr;
+        env_count_ = env.size();
+        return true;
+    }
+
+    int* p_argc() {
+        return &argc_;
+    }
+
+    wchar_t*** p_argv() {
+        return &argv_;
+    }
+
+    int argc() const {
+        return argc_;
+    }
+
+    const wchar_t* arg(int i) const {
+        return argv_[i];
+    }
+
+    wchar_t* command_line() {
+        return (wchar_t*)cmd_line_;
+    }
+
+    const wchar_t* module_path() const {
+        return module_path_;
+    }
+
+    size_t module_path_length() const {
+        return module_path_len_;
+    }
+
+    // GetModuleFileNameW semantics: returns the characters copied without
+    // the terminator, or `size` with `*truncated` set when the path and its
+    // terminator do not fit; a truncated copy is still terminated.
+    uint32_t copy_module_path(wchar_t* buf, uint32_t size, bool* truncated) const
+    {
+        *truncated = size <= module_path_len_;
+        if (size == 0)
+            return 0;
+        size_t n = *truncated ? size - 1 : module_path_len_;
+        memcpy(buf, module_path_, n * sizeof(wchar_t));
+        buf[n] = L'\0';
+        return *truncated ? size : (uint32_t)n;
+    }
+
+    size_t env_count() const {
+        return env_count_;
+    }
+
+    // "NAME=VALUE"
+    const wchar_t* env(size_t i) const {
+        return env_[i];
+    }
+
+    // Value of the override for `name` (case-insensitive, as Windows
+    // compares variable names), or nullptr
+    const wchar_t* find_env(const wchar_t* name) const
+    {
+        for (size_t i = 0; i < env_count_; ++i)
+        {
+            const wchar_t* e = env_[i];
+            size_t k = 0;
+            while (name[k] != L'\0' && towlower(e[k]) == towlower(name[k]))
+                ++k;
+            if (name[k] == L'\0' && e[k] == L'=')
+                return e + k + 1;
+        }
+        return nullptr;
+    }
+
+    // Bytes held by the block, and the part the current launch uses
+    size_t capacity_bytes() const {
+        return capacity_;
+    }
+
+    size_t used_bytes() const {
+        return used_;
+    }
+};
@@ -0,0 +1,335 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Lock-free counters, gauges and latency histograms with a Prometheus text
+// exporter. Recording never takes a lock, so metrics can sit on the fiber
+// switch path and be read concurrently by the dump thread.
+
+inline uint64_t metrics_now_ns()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct counter_t
+{
+    std::atomic<uint64_t> v{ 0 };
+
+    void add(uint64_t n = 1) {
+        v.fetch_add(n, std::memory_order_relaxed);
+    }
+    uint64_t get() const {
+        return v.load(std::memory_order_relaxed);
+    }
+};
+
+struct gauge_t
+{
+    std::atomic<double> v{ 0 };
+
+    void set(double x) {
+        v.store(x, std::memory_order_relaxed);
+    }
+    double get() const {
+        return v.load(std::memory_order_relaxed);
+    }
+};
+
+// HDR-style histogram of nanosecond values: every power of two is split into
+// 2^SUB_BITS linear sub-buckets, giving a relative error below 1/2^SUB_BITS
+// over the whole 64-bit range.
+class latency_histogram_t
+{
+public:
+    static constexpr int SUB_BITS = 4;
+    static constexpr int SUB_COUNT = 1 << SUB_BITS;
+    static constexpr int BUCKETS = (64 - SUB_BITS + 1) * SUB_COUNT;
+
+    struct snapshot_t
+    {
+        uint64_t counts[BUCKETS];
+        uint64_t count;
+        uint64_t sum;
+        uint64_t max;
+
+        // Upper bound (ns) of the bucket holding the q-th quantile
+        uint64_t quantile(double q) const
+        {
+            if (count == 0)
+                return 0;
+            uint64_t rank = (uint64_t)(q * (double)(count - 1)) + 1;
+            uint64_t seen = 0;
+            for (int b = 0; b < BUCKETS; ++b)
+            {
+                seen += counts[b];
+                if (seen >= rank)
+                    return bucket_upper(b) < max ? bucket_upper(b) : max;
+            }
+            return max;
+        }
+
+        // Number of values <= limit_ns, at bucket resolution
+        uint64_t count_le(uint64_t limit_ns) const
+        {
+            uint64_t n = 0;
+            for (int b = 0; b < BUCKETS && bucket_upper(b) <= limit_ns; ++b)
+                n += counts[b];
+            return n;
+        }
+    };
+
+private:
+    std::atomic<uint64_t> counts_[BUCKETS] = {};
+    std::atomic<uint64_t> count_{ 0 };
+    std::atomic<uint64_t> sum_{ 0 };
+    std::atomic<uint64_t> max_{ 0 };
+
+public:
+    static int bucket_of(uint64_t v)
+    {
+        if (v < SUB_COUNT)
+            return (int)v;
+        int msb = 63 - std::countl_zero(v);
+        int shift = msb - SUB_BITS;
+        return ((shift + 1) << SUB_BITS) + (int)((v >> shift) & (SUB_COUNT - 1));
+    }
+
+    static uint64_t bucket_upper(int b)
+    {
+        if (b < SUB_COUNT)
+            return (uint64_t)b;
+        int shift = (b >> SUB_BITS) - 1;
+        uint64_t lower = (uint64_t)(SUB_COUNT + (b & (SUB_COUNT - 1))) << shift;
+        return lower + (((uint64_t)1 << shift) - 1);
+    }
+
+    void record(uint64_t ns)
+    {
+        counts_[bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(ns, std::memory_order_relaxed);
+        uint64_t m = max_.load(std::memory_order_relaxed);
+        while (ns > m && !max_.compare_exchange_weak(m, ns, std::memory_order_relaxed))
+            ;
+    }
+
+    uint64_t count() const {
+        return count_.load(std::memory_order_relaxed);
+    }
+
+    void snapshot(snapshot_t* s) const
+    {
+        for (int b = 0; b < BUCKETS; ++b)
+            s->counts[b] = counts_[b].load(std::memory_order_relaxed);
+        s->count = 0;
+        for (int b = 0; b < BUCKETS; ++b)
+            s->count += s->counts[b];
+        s->sum = sum_.load(std::memory_order_relaxed);
+        s->max = max_.load(std::memory_order_relaxed);
+    }
+
+    void reset()
+    {
+        for (auto& c : counts_)
+            c.store(0, std::memory_order_relaxed);
+        count_.store(0, std::memory_order_relaxed);
+        sum_.store(0, std::memory_order_relaxed);
+        max_.store(0, std::memory_order_relaxed);
+    }
+};
+
+// Records the time from construction to destruction into a histogram
+class scoped_latency_t
+{
+    latency_histogram_t& h_;
+    uint64_t t0_;
+
+public:
+    explicit scoped_latency_t(latency_histogram_t& h) : h_(h), t0_(metrics_now_ns()) { }
+    ~scoped_latency_t() {
+        h_.record(metrics_now_ns() - t0_);
+    }
+};
+
+// Named set of metrics. Registration is expected to happen up front; exports
+// may run concurrently with recording.
+class metrics_registry_t
+{
+    enum kind_e
+    {
+        kind_counter,
+        kind_gauge,
+        kind_histogram,
+    };
+
+    struct entry_t
+    {
+        std::string name;
+        std::string help;
+        kind_e kind;
+        const void* p;
+    };
+
+    std::vector<entry_t> entries_;
+    mutable std::mutex mtx_;
+
+    static void appendf(std::string& out, const char* fmt, ...)
+    {
+        char buf[512];
+        va_list va;
+        va_start(va, fmt);
+        int n = vsnprintf(buf, sizeof(buf), fmt, va);
+        va_end(va);
+        if (n > 0)
+            out.append(buf, (size_t)n < sizeof(buf) ? (size_t)n : sizeof(buf) - 1);
+    }
+
+public:
+    void add(const char* name, const char* help, const counter_t* c)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        entries_.push_back({ name, help, kind_counter, c });
+    }
+
+    void add(const char* name, const char* help, const gauge_t* g)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        entries_.push_back({ name, help, kind_gauge, g });
+    }
+
+    void add(const char* name, const char* help, const latency_histogram_t* h)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        entries_.push_back({ name, help, kind_histogram, h });
+    }
+
+    // Prometheus text exposition format. Histograms are exported in seconds
+    // with a fixed set of buckets plus p50/p90/p99/p999/max gauges.
+    std::string prometheus_text() const
+    {
+        static const double les[] = {
+            1e-6, 5e-6, 1e-5, 5e-5, 1e-4, 5e-4, 1e-3, 2e-3, 5e-3, 1e-2, 5e-2, 1e-1, 5e-1, 1.0, 5.0,
+        };
+        static const double qs[] = { 0.5, 0.9, 0.99, 0.999 };
+
+        std::lock_guard<std::mutex> lock(mtx_);
+        std::string out;
+        auto snap = std::make_unique<latency_histogram_t::snapshot_t>();
+        for (const entry_t& e : entries_)
+        {
+            const char* n = e.name.c_str();
+            switch (e.kind)
+            {
+                case kind_counter:
+                    appendf(out, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n",
+                        n, e.help.c_str(), n, n, (unsigned long long)((const counter_t*)e.p)->get());
+                    break;
+                case kind_gauge:
+                    appendf(out, "# HELP %s %s\n# TYPE %s gauge\n%s %.9g\n",
+                        n, e.help.c_str(), n, n, ((const gauge_t*)e.p)->get());
+                    break;
+                case kind_histogram:
+                {
+                    ((const latency_histogram_t*)e.p)->snapshot(snap.get());
+                    appendf(out, "# HELP %s %s\n# TYPE %s histogram\n", n, e.help.c_str(), n);
+                    for (double le : les)
+                        appendf(out, "%s_bucket{le=\"%g\"} %llu\n", n, le, (unsigned long long)snap->count_le((uint64_t)(le * 1e9)));
+                    appendf(out, "%s_bucket{le=\"+Inf\"} %llu\n", n, (unsigned long long)snap->count);
+                    appendf(out, "%s_sum %.9f\n%s_count %llu\n", n, snap->sum / 1e9, n, (unsigned long long)snap->count);
+                    appendf(out, "# TYPE %s_quantile gauge\n", n);
+                    for (double q : qs)
+                        appendf(out, "%s_quantile{quantile=\"%g\"} %.9f\n", n, q, snap->quantile(q) / 1e9);
+                    appendf(out, "%s_quantile{quantile=\"1\"} %.9f\n", n, snap->max / 1e9);
+                    break;
+                }
+            }
+        }
+        return out;
+    }
+
+    // Writes the exposition to a temporary file and renames it into place, so
+    // a textfile collector never sees a partial dump
+    bool write_prometheus(const std::filesystem::path& path) const
+    {
+        std::string text = prometheus_text();
+        std::filesystem::path tmp = path;
+        tmp += ".tmp";
+        FILE* fp = nullptr;
+#ifdef _WIN32
+        if (_wfopen_s(&fp, tmp.c_str(), L"wb") != 0)
+            fp = nullptr;
+#else
+        fp = fopen(tmp.c_str(), "wb");
+#endif
+        if (fp == nullptr)
+            return false;
+        bool ok = fwrite(text.data(), 1, text.size(), fp) == text.size();
+        ok = fclose(fp) == 0 && ok;
+        std::error_code ec;
+        if (ok)
+            std::filesystem::rename(tmp, path, ec);
+        return ok && !ec;
+    }
+};
+
+// Periodically dumps a registry to a Prometheus text file
+class metrics_dumper_t
+{
+    std::thread thread_;
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+
+public:
+    ~metrics_dumper_t()
+    {
+        stop();
+    }
+
+    bool running() const {
+        return thread_.joinable();
+    }
+
+    void start(const metrics_registry_t* reg, const std::filesystem::path& path, std::chrono::milliseconds interval)
+    {
+        stop();
+        stop_ = false;
+        thread_ = std::thread([this, reg, path, interval]()
+        {
+            std::unique_lock<std::mutex> lock(mtx_);
+            do
+            {
+                lock.unlock();
+                reg->write_prometheus(path);
+                lock.lock();
+            } while (!cv_.wait_for(lock, interval, [this] { return stop_; }));
+            lock.unlock();
+            reg->write_prometheus(path);
+        });
+    }
+
+    void stop()
+    {
+        if (!thread_.joinable())
+            return;
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        thread_.join();
+    }
+};
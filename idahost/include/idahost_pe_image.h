@@ -0,0 +1,343 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <vector>
+
+// OS independent PE parsing and mapping kernels. The image flavour (PE32+
+// for x64 or ARM64, PE32) is a traits type, so header layout, thunk width,
+// the ordinal flag and the relocation type are compile-time constants. The
+// headers are parsed once into a layout_t; the kernels then work from it.
+// PEMapperT adds memory, libraries and protections on Windows.
+namespace pe_image
+{
+    constexpr uint16_t DOS_MAGIC = 0x5A4D;          // "MZ"
+    constexpr uint32_t NT_SIGNATURE = 0x00004550;   // "PE\0\0"
+
+    constexpr uint32_t SCN_MEM_EXECUTE = 0x20000000;
+    constexpr uint32_t SCN_MEM_READ = 0x40000000;
+    constexpr uint32_t SCN_MEM_WRITE = 0x80000000;
+
+    constexpr int DIR_IMPORT = 1;
+    constexpr int DIR_BASERELOC = 5;
+    constexpr int DIR_COUNT = 16;
+
+    constexpr uint16_t REL_ABSOLUTE = 0;
+    constexpr uint16_t REL_HIGHLOW = 3;
+    constexpr uint16_t REL_DIR64 = 10;
+
+    struct file_header_t
+    {
+        uint16_t machine;
+        uint16_t number_of_sections;
+        uint32_t time_date_stamp;
+        uint32_t pointer_to_symbol_table;
+        uint32_t number_of_symbols;
+        uint16_t size_of_optional_header;
+        uint16_t characteristics;
+    };
+
+    struct data_directory_t
+    {
+        uint32_t rva;
+        uint32_t size;
+    };
+
+    struct optional_header32_t
+    {
+        uint16_t magic;
+        uint8_t major_linker_version;
+        uint8_t minor_linker_version;
+        uint32_t size_of_code;
+        uint32_t size_of_initialized_data;
+        uint32_t size_of_uninitialized_data;
+        uint32_t address_of_entry_point;
+        uint32_t base_of_code;
+        uint32_t base_of_data;
+        uint32_t image_base;
+        uint32_t section_alignment;
+        uint32_t file_alignment;
+        uint16_t versions[6];
+        uint32_t win32_version_value;
+        uint32_t size_of_image;
+        uint32_t size_of_headers;
+        uint32_t checksum;
+        uint16_t subsystem;
+        uint16_t dll_characteristics;
+        uint32_t stack_and_heap[4];
+        uint32_t loader_flags;
+        uint32_t number_of_rva_and_sizes;
+        data_directory_t data_directory[DIR_COUNT];
+    };
+
+    struct optional_header64_t
+    {
+        uint16_t magic;
+        uint8_t major_linker_version;
+        uint8_t minor_linker_version;
+        uint32_t size_of_code;
+        uint32_t size_of_initialized_data;
+        uint32_t size_of_uninitialized_data;
+        uint32_t address_of_entry_point;
+        uint32_t base_of_code;
+        uint64_t image_base;
+        uint32_t section_alignment;
+        uint32_t file_alignment;
+        uint16_t versions[6];
+        uint32_t win32_version_value;
+        uint32_t size_of_image;
+        uint32_t size_of_headers;
+        uint32_t checksum;
+        uint16_t subsystem;
+        uint16_t dll_characteristics;
+        uint64_t stack_and_heap[4];
+        uint32_t loader_flags;
+        uint32_t number_of_rva_and_sizes;
+        data_directory_t data_directory[DIR_COUNT];
+    };
+
+    struct section_header_t
+    {
+        char name[8];
+        uint32_t virtual_size;
+        uint32_t virtual_address;
+        uint32_t size_of_raw_data;
+        uint32_t pointer_to_raw_data;
+        uint32_t pointer_to_relocations;
+        uint32_t pointer_to_linenumbers;
+        uint16_t number_of_relocations;
+        uint16_t number_of_linenumbers;
+        uint32_t characteristics;
+    };
+
+    struct import_descriptor_t
+    {
+        uint32_t original_first_thunk;
+        uint32_t time_date_stamp;
+        uint32_t forwarder_chain;
+        uint32_t name;
+        uint32_t first_thunk;
+    };
+
+    struct base_relocation_t
+    {
+        uint32_t virtual_address;
+        uint32_t size_of_block;
+    };
+
+    static_assert(sizeof(file_header_t) == 20);
+    static_assert(sizeof(optional_header32_t) == 224);
+    static_assert(sizeof(optional_header64_t) == 240);
+    static_assert(sizeof(section_header_t) == 40);
+    static_assert(sizeof(import_descriptor_t) == 20);
+
+    struct pe32plus_x64_traits
+    {
+        using optional_header_t = optional_header64_t;
+        using thunk_t = uint64_t;
+        static constexpr uint16_t machine = 0x8664;
+        static constexpr uint16_t magic = 0x20B;
+        static constexpr thunk_t ordinal_flag = (thunk_t)1 << 63;
+        static constexpr uint16_t reloc_type = REL_DIR64;
+    };
+
+    struct pe32plus_arm64_traits : pe32plus_x64_traits
+    {
+        static constexpr uint16_t machine = 0xAA64;
+    };
+
+    struct pe32_traits
+    {
+        using optional_header_t = optional_header32_t;
+        using thunk_t = uint32_t;
+        static constexpr uint16_t machine = 0x14C;
+        static constexpr uint16_t magic = 0x10B;
+        static constexpr thunk_t ordinal_flag = (thunk_t)1 << 31;
+        static constexpr uint16_t reloc_type = REL_HIGHLOW;
+    };
+
+    // The flavour the host process itself runs
+#if defined(_M_ARM64) || defined(__aarch64__)
+    using native_traits = pe32plus_arm64_traits;
+#elif defined(_M_IX86) || defined(__i386__)
+    using native_traits = pe32_traits;
+#else
+    using native_traits = pe32plus_x64_traits;
+#endif
+
+    struct section_t
+    {
+        char name[8];
+        uint32_t rva;
+        uint32_t virtual_size;
+        uint32_t raw_offset;
+        uint32_t raw_size;
+        uint32_t characteristics;
+    };
+
+    // Everything the mapping stages need, taken from the headers once
+    template <typename Traits>
+    struct layout_t
+    {
+        uint64_t image_base = 0;
+        uint32_t image_size = 0;
+        uint32_t header_size = 0;
+        uint32_t entry_rva = 0;
+        uint32_t section_alignment = 0;
+        data_directory_t imports = {};
+        data_directory_t relocs = {};
+        std::vector<section_t> sections;
+    };
+
+    // Reads the headers at `data`. `size` bounds the reads: the file size,
+    // or SIZE_MAX for an image the OS loader already mapped.
+    template <typename Traits>
+    bool parse(const void* data, size_t size, layout_t<Traits>* out)
+    {
+        const uint8_t* p = (const uint8_t*)data;
+        uint16_t mz;
+        uint32_t lfanew;
+        if (size < 0x40)
+            return false;
+        memcpy(&mz, p, sizeof(mz));
+        memcpy(&lfanew, p + 0x3C, sizeof(lfanew));
+        if (mz != DOS_MAGIC)
+            return false;
+
+        using opt_t = typename Traits::optional_header_t;
+        uint64_t opt_off = (uint64_t)lfanew + 4 + sizeof(file_header_t);
+        if (opt_off + sizeof(opt_t) > size)
+            return false;
+        uint32_t sig;
+        file_header_t fh;
+        opt_t opt;
+        memcpy(&sig, p + lfanew, sizeof(sig));
+        memcpy(&fh, p + lfanew + 4, sizeof(fh));
+        memcpy(&opt, p + opt_off, sizeof(opt));
+        if (sig != NT_SIGNATURE || fh.machine != Traits::machine || opt.magic != Traits::magic)
+            return false;
+
+        uint64_t sec_off = opt_off + fh.size_of_optional_header;
+        if (sec_off + (uint64_t)fh.number_of_sections * sizeof(section_header_t) > size)
+            return false;
+
+        out->image_base = opt.image_base;
+        out->image_size = opt.size_of_image;
+        out->header_size = opt.size_of_headers;
+        out->entry_rva = opt.address_of_entry_point;
+        out->section_alignment = opt.section_alignment;
+        out->imports = opt.number_of_rva_and_sizes > DIR_IMPORT ? opt.data_directory[DIR_IMPORT] : data_directory_t{};
+        out->relocs = opt.number_of_rva_and_sizes > DIR_BASERELOC ? opt.data_directory[DIR_BASERELOC] : data_directory_t{};
+        out->sections.resize(fh.number_of_sections);
+        for (uint16_t i = 0; i < fh.number_of_sections; ++i)
+        {
+            section_header_t sh;
+            memcpy(&sh, p + sec_off + i * sizeof(sh), sizeof(sh));
+            section_t& s = out->sections[i];
+            memcpy(s.name, sh.name, sizeof(s.name));
+            s.rva = sh.virtual_address;
+            s.virtual_size = sh.virtual_size;
+            s.raw_offset = sh.pointer_to_raw_data;
+            s.raw_size = sh.size_of_raw_data;
+            s.characteristics = sh.characteristics;
+            if ((uint64_t)s.rva + s.raw_size > out->image_size)
+                return false;
+        }
+        return out->header_size <= out->image_size;
+    }
+
+    // Copies the headers and the raw data of every section into `image`
+    template <typename Traits>
+    bool map_sections(const layout_t<Traits>& l, const uint8_t* file, size_t file_size, uint8_t* image)
+    {
+        if (l.header_size > file_size)
+            return false;
+        memcpy(image, file, l.header_size);
+        for (const section_t& s : l.sections)
+        {
+            if ((uint64_t)s.raw_offset + s.raw_size > file_size)
+                return false;
+            memcpy(image + s.rva, file + s.raw_offset, s.raw_size);
+        }
+        return true;
+    }
+
+    // Rebases a mapped image from its preferred base to `load_base`
+    template <typename Traits>
+    void relocate(const layout_t<Traits>& l, uint8_t* image, uint64_t load_base)
+    {
+        using thunk_t = typename Traits::thunk_t;
+        thunk_t delta = (thunk_t)(load_base - l.image_base);
+        if (delta == 0 || l.relocs.rva == 0)
+            return;
+
+        const uint8_t* block = image + l.relocs.rva;
+        const uint8_t* end = block + l.relocs.size;
+        while (block + sizeof(base_relocation_t) <= end)
+        {
+            const base_relocation_t* br = (const base_relocation_t*)block;
+            if (br->size_of_block < sizeof(base_relocation_t))
+                break;
+            uint8_t* page = image + br->virtual_address;
+            const uint16_t* entry = (const uint16_t*)(br + 1);
+            size_t n = (br->size_of_block - sizeof(base_relocation_t)) / sizeof(uint16_t);
+            for (size_t i = 0; i < n; ++i)
+            {
+                // Anything but the flavour's pointer type is block padding
+                if (entry[i] >> 12 != Traits::reloc_type)
+                    continue;
+                // Targets need not be aligned
+                uint8_t* at = page + (entry[i] & 0xFFF);
+                thunk_t v;
+                memcpy(&v, at, sizeof(v));
+                v += delta;
+                memcpy(at, &v, sizeof(v));
+            }
+            block += br->size_of_block;
+        }
+    }
+
+    // Walks the imports of a mapped image. `on_library(name)` returns a
+    // context, or nullptr to fail; `on_symbol(ctx, name, ordinal, iat)` gets
+    // a null name for imports by ordinal and returns false to fail. Names come
+    // from the lookup table if there is one, else from the IAT itself, which
+    // must then be unbound; with `require_lookup_table` descriptors without
+    // one are skipped.
+    template <typename Traits, typename LibFn, typename SymFn>
+    bool walk_imports(
+        const layout_t<Traits>& l,
+        uint8_t* image,
+        bool require_lookup_table,
+        LibFn&& on_library,
+        SymFn&& on_symbol)
+    {
+        using thunk_t = typename Traits::thunk_t;
+        if (l.imports.rva == 0)
+            return true;
+        for (const import_descriptor_t* d = (const import_descriptor_t*)(image + l.imports.rva); d->name != 0; ++d)
+        {
+            uint32_t names_rva = d->original_first_thunk != 0 ? d->original_first_thunk : d->first_thunk;
+            if (require_lookup_table && d->original_first_thunk == 0)
+                continue;
+
+            const char* lib = (const char*)(image + d->name);
+            void* ctx = on_library(lib);
+            if (ctx == nullptr)
+                return false;
+
+            const thunk_t* names = (const thunk_t*)(image + names_rva);
+            thunk_t* iat = (thunk_t*)(image + d->first_thunk);
+            for (; *names != 0; ++names, ++iat)
+            {
+                thunk_t v = *names;
+                bool ok = (v & Traits::ordinal_flag) != 0
+                    ? on_symbol(ctx, (const char*)nullptr, (uint16_t)(v & 0xFFFF), iat)
+                    : on_symbol(ctx, (const char*)(image + (uint32_t)v + sizeof(uint16_t)), (uint16_t)0, iat);
+                if (!ok)
+                    return false;
+            }
+        }
+        return true;
+    }
+}
@@ -0,0 +1,279 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "idahost_metrics.h"
+
+// Keeps the provider busy across a list of jobs. Three stages overlap:
+//
+//  prepare  worker threads locate, hash and stage the next inputs and check
+//           result caches; returning false (a cache hit) skips the run stage
+//  run      the thread that owns the provider analyzes one job at a time
+//  finish   worker threads post-process and serialize the results
+//
+// Stages hand job indexes to each other through bounded queues, so prepare
+// runs at most `queue_depth` jobs ahead of the provider and a slow finish
+// stage holds the provider back instead of piling up results. Jobs run in
+// the order they were prepared. The callbacks must not throw.
+template <typename Job>
+class job_pipeline_t
+{
+public:
+    enum stage_e
+    {
+        stage_prepare,
+        stage_run,
+        stage_finish,
+        stage_count,
+    };
+
+    struct options_t
+    {
+        unsigned prepare_threads = 2;
+        unsigned finish_threads = 1;
+        // Jobs waiting between two stages
+        size_t queue_depth = 4;
+    };
+
+    using prepare_fn = std::function<bool(Job&)>;
+    using run_fn = std::function<void(Job&)>;
+    using finish_fn = std::function<void(Job&)>;
+
+    struct stage_stats_t
+    {
+        unsigned threads = 0;
+        uint64_t jobs = 0;
+        double busy_seconds = 0;
+        double starved_seconds = 0;     // waiting for the previous stage
+        double blocked_seconds = 0;     // waiting for room in the next queue
+        double utilization = 0;         // busy / (wall * threads)
+        size_t max_queued = 0;          // deepest the input queue got
+    };
+
+    struct stats_t
+    {
+        double wall_seconds = 0;
+        uint64_t skipped = 0;           // jobs prepare sent straight to finish
+        stage_stats_t stages[stage_count];
+    };
+
+private:
+    // Bounded FIFO of job indexes; pop() fails once closed and empty
+    class queue_t
+    {
+        std::mutex mtx_;
+        std::condition_variable not_empty_;
+        std::condition_variable not_full_;
+        std::deque<size_t> items_;
+        size_t capacity_ = 1;
+        size_t max_size_ = 0;
+        bool closed_ = false;
+
+    public:
+        void reset(size_t capacity)
+        {
+            capacity_ = (std::max)((size_t)1, capacity);
+            items_.clear();
+            max_size_ = 0;
+            closed_ = false;
+        }
+
+        void push(size_t item)
+        {
+            std::unique_lock<std::mutex> lock(mtx_);
+            not_full_.wait(lock, [this] { return items_.size() < capacity_; });
+            items_.push_back(item);
+            max_size_ = (std::max)(max_size_, items_.size());
+            not_empty_.notify_one();
+        }
+
+        bool pop(size_t* item)
+        {
+            std::unique_lock<std::mutex> lock(mtx_);
+            not_empty_.wait(lock, [this] { return !items_.empty() || closed_; });
+            if (items_.empty())
+                return false;
+            *item = items_.front();
+            items_.pop_front();
+            not_full_.notify_one();
+            return true;
+        }
+
+        void close()
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            closed_ = true;
+            not_empty_.notify_all();
+        }
+
+        size_t max_size()
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            return max_size_;
+        }
+    };
+
+    struct counters_t
+    {
+        std::atomic<uint64_t> jobs{ 0 };
+        std::atomic<uint64_t> busy_ns{ 0 };
+        std::atomic<uint64_t> starved_ns{ 0 };
+        std::atomic<uint64_t> blocked_ns{ 0 };
+    };
+
+    prepare_fn prepare_;
+    run_fn run_;
+    finish_fn finish_;
+    options_t opt_;
+
+    queue_t prepared_;
+    queue_t done_;
+    std::atomic<size_t> next_input_{ 0 };
+    std::atomic<unsigned> preparing_{ 0 };
+    std::atomic<uint64_t> skipped_{ 0 };
+    counters_t counters_[stage_count];
+    uint64_t wall_ns_ = 0;
+
+    static void add(std::atomic<uint64_t>& c, uint64_t t0, uint64_t t1) {
+        c.fetch_add(t1 - t0, std::memory_order_relaxed);
+    }
+
+    void prepare_worker(std::vector<Job>& jobs)
+    {
+        counters_t& c = counters_[stage_prepare];
+        for (;;)
+        {
+            size_t i = next_input_.fetch_add(1, std::memory_order_relaxed);
+            if (i >= jobs.size())
+                break;
+            uint64_t t0 = metrics_now_ns();
+            bool needs_run = prepare_(jobs[i]);
+            uint64_t t1 = metrics_now_ns();
+            if (needs_run)
+            {
+                prepared_.push(i);
+            }
+            else
+            {
+                skipped_.fetch_add(1, std::memory_order_relaxed);
+                done_.push(i);
+            }
+            add(c.busy_ns, t0, t1);
+            add(c.blocked_ns, t1, metrics_now_ns());
+            c.jobs.fetch_add(1, std::memory_order_relaxed);
+        }
+        // The last one out ends the run stage's input
+        if (preparing_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            prepared_.close();
+    }
+
+    void finish_worker(std::vector<Job>& jobs)
+    {
+        counters_t& c = counters_[stage_finish];
+        for (;;)
+        {
+            size_t i;
+            uint64_t t0 = metrics_now_ns();
+            if (!done_.pop(&i))
+                break;
+            uint64_t t1 = metrics_now_ns();
+            finish_(jobs[i]);
+            add(c.starved_ns, t0, t1);
+            add(c.busy_ns, t1, metrics_now_ns());
+            c.jobs.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+public:
+    job_pipeline_t(prepare_fn prepare, run_fn run, finish_fn finish, const options_t& opt = options_t())
+        : prepare_(std::move(prepare)), run_(std::move(run)), finish_(std::move(finish)), opt_(opt)
+    {
+        opt_.prepare_threads = (std::max)(1u, opt_.prepare_threads);
+        opt_.finish_threads = (std::max)(1u, opt_.finish_threads);
+    }
+
+    job_pipeline_t(const job_pipeline_t&) = delete;
+    job_pipeline_t& operator=(const job_pipeline_t&) = delete;
+
+    // Owner thread. Takes every job through the stages and returns once the
+    // last one is finished; the run stage executes on the calling thread.
+    void run(std::vector<Job>& jobs)
+    {
+        prepared_.reset(opt_.queue_depth);
+        done_.reset(opt_.queue_depth);
+        next_input_.store(0, std::memory_order_relaxed);
+        preparing_.store(opt_.prepare_threads, std::memory_order_relaxed);
+        skipped_.store(0, std::memory_order_relaxed);
+        for (counters_t& c : counters_)
+        {
+            c.jobs = 0;
+            c.busy_ns = 0;
+            c.starved_ns = 0;
+            c.blocked_ns = 0;
+        }
+
+        uint64_t start = metrics_now_ns();
+        std::vector<std::thread> pool;
+        for (unsigned t = 0; t < opt_.prepare_threads; ++t)
+            pool.emplace_back([this, &jobs] { prepare_worker(jobs); });
+        size_t first_finisher = pool.size();
+        for (unsigned t = 0; t < opt_.finish_threads; ++t)
+            pool.emplace_back([this, &jobs] { finish_worker(jobs); });
+
+        counters_t& c = counters_[stage_run];
+        for (;;)
+        {
+            size_t i;
+            uint64_t t0 = metrics_now_ns();
+            if (!prepared_.pop(&i))
+                break;
+            uint64_t t1 = metrics_now_ns();
+            run_(jobs[i]);
+            uint64_t t2 = metrics_now_ns();
+            done_.push(i);
+            add(c.starved_ns, t0, t1);
+            add(c.busy_ns, t1, t2);
+            add(c.blocked_ns, t2, metrics_now_ns());
+            c.jobs.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // prepared_ closes only after every prepare worker is done pushing
+        for (size_t t = 0; t < first_finisher; ++t)
+            pool[t].join();
+        done_.close();
+        for (size_t t = first_finisher; t < pool.size(); ++t)
+            pool[t].join();
+        wall_ns_ = metrics_now_ns() - start;
+    }
+
+    // Of the last run()
+    stats_t stats()
+    {
+        stats_t st;
+        st.wall_seconds = wall_ns_ / 1e9;
+        st.skipped = skipped_.load(std::memory_order_relaxed);
+        const unsigned threads[stage_count] = { opt_.prepare_threads, 1, opt_.finish_threads };
+        const size_t queued[stage_count] = { 0, prepared_.max_size(), done_.max_size() };
+        for (int s = 0; s < stage_count; ++s)
+        {
+            stage_stats_t& ss = st.stages[s];
+            const counters_t& c = counters_[s];
+            ss.threads = threads[s];
+            ss.jobs = c.jobs.load(std::memory_order_relaxed);
+            ss.busy_seconds = c.busy_ns.load(std::memory_order_relaxed) / 1e9;
+            ss.starved_seconds = c.starved_ns.load(std::memory_order_relaxed) / 1e9;
+            ss.blocked_seconds = c.blocked_ns.load(std::memory_order_relaxed) / 1e9;
+            ss.utilization = wall_ns_ != 0 ? ss.busy_seconds / (st.wall_seconds * ss.threads) : 0;
+            ss.max_queued = queued[s];
+        }
+        return st;
+    }
+};
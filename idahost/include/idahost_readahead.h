@@ -0,0 +1,245 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+    #include <Windows.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+// Reads a list of files front to back on a background thread so that they
+// are in the OS page cache by the time somebody else opens them. Progress is
+// tracked per file, which doubles as a residency estimate: the part already
+// read ahead is what a later reader finds cached. A file is left alone once
+// note_open() sees it opened, so the read-ahead never competes with the reader
+// for the disk, and it is opened with full sharing so it never locks the
+// reader out.
+class readahead_t
+{
+public:
+    struct file_stats_t
+    {
+        std::filesystem::path path;
+        uint64_t size;
+        uint64_t read;
+        double resident_at_open;    // -1 until note_open() saw the file
+    };
+
+private:
+    struct file_t
+    {
+        std::filesystem::path path;
+        uint64_t size = 0;
+        std::atomic<uint64_t> read{ 0 };
+        std::atomic<double> resident_at_open{ -1.0 };
+    };
+
+    // Fixed once the thread starts
+    std::vector<std::unique_ptr<file_t>> files_;
+    std::thread thread_;
+    std::atomic<bool> stop_{ false };
+    std::atomic<uint64_t> bytes_{ 0 };
+
+#ifdef _WIN32
+    typedef HANDLE handle_t;
+    static inline const handle_t bad_handle = INVALID_HANDLE_VALUE;
+#else
+    typedef int handle_t;
+    static constexpr handle_t bad_handle = -1;
+#endif
+
+    static handle_t open_file(const std::filesystem::path& p)
+    {
+#ifdef _WIN32
+        return CreateFileW(
+            p.c_str(),
+            GENERIC_READ,
+            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            nullptr,
+            OPEN_EXISTING,
+            FILE_FLAG_SEQUENTIAL_SCAN,
+            nullptr);
+#else
+        int fd = ::open(p.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd != -1)
+            posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        return fd;
+#endif
+    }
+
+    static size_t read_file(handle_t h, char* buf, size_t n)
+    {
+#ifdef _WIN32
+        DWORD got = 0;
+        return ReadFile(h, buf, (DWORD)n, &got, nullptr) ? got : 0;
+#else
+        ssize_t got = ::read(h, buf, n);
+        return got > 0 ? (size_t)got : 0;
+#endif
+    }
+
+    static void close_file(handle_t h)
+    {
+#ifdef _WIN32
+        CloseHandle(h);
+#else
+        ::close(h);
+#endif
+    }
+
+    static bool same_path(const std::filesystem::path& a, const std::filesystem::path& b)
+    {
+#ifdef _WIN32
+        return _wcsicmp(a.c_str(), b.c_str()) == 0;
+#else
+        return a == b;
+#endif
+    }
+
+    static bool opened(const file_t& f) {
+        return f.resident_at_open.load(std::memory_order_relaxed) >= 0;
+    }
+
+    void run(size_t chunk)
+    {
+        std::unique_ptr<char[]> buf(new char[chunk]);
+        for (auto& f : files_)
+        {
+            if (opened(*f))
+                continue;
+            handle_t h = open_file(f->path);
+            if (h == bad_handle)
+                continue;
+            size_t n;
+            while (!stop_.load(std::memory_order_relaxed)
+                && !opened(*f)
+                && (n = read_file(h, buf.get(), chunk)) != 0)
+            {
+                f->read.fetch_add(n, std::memory_order_relaxed);
+                bytes_.fetch_add(n, std::memory_order_relaxed);
+            }
+            close_file(h);
+            if (stop_.load(std::memory_order_relaxed))
+                break;
+        }
+    }
+
+public:
+    ~readahead_t()
+    {
+        stop();
+    }
+
+    // The input followed by the database files IDA keeps next to it, both
+    // for "name.ext.*" and "name.*" naming; missing files are skipped
+    static std::vector<std::filesystem::path> database_files(const std::filesystem::path& input)
+    {
+        static const char* const exts[] = { ".id0", ".id1", ".nam", ".id2", ".til", ".i64", ".idb" };
+        std::vector<std::filesystem::path> out;
+        auto add = [&out](const std::filesystem::path& p)
+        {
+            std::error_code ec;
+            if (!std::filesystem::is_regular_file(p, ec))
+                return;
+            for (const auto& o : out)
+            {
+                if (same_path(o, p))
+                    return;
+            }
+            out.push_back(p);
+        };
+
+        std::error_code ec;
+        std::filesystem::path abs = std::filesystem::absolute(input, ec);
+        if (ec)
+            abs = input;
+        add(abs);
+        std::filesystem::path stem = abs;
+        stem.replace_extension();
+        for (const std::filesystem::path& base : { abs, stem })
+        {
+            for (const char* ext : exts)
+            {
+                std::filesystem::path p = base;
+                p += ext;
+                add(p);
+            }
+        }
+        return out;
+    }
+
+    void start(const std::vector<std::filesystem::path>& files, size_t chunk = 1024 * 1024)
+    {
+        stop();
+        files_.clear();
+        bytes_.store(0, std::memory_order_relaxed);
+        for (const auto& p : files)
+        {
+            auto f = std::make_unique<file_t>();
+            std::error_code ec;
+            f->path = std::filesystem::absolute(p, ec);
+            if (ec)
+                f->path = p;
+            f->size = std::filesystem::file_size(f->path, ec);
+            if (ec)
+                f->size = 0;
+            files_.push_back(std::move(f));
+        }
+        stop_.store(false, std::memory_order_relaxed);
+        thread_ = std::thread(&readahead_t::run, this, chunk);
+    }
+
+    void stop()
+    {
+        stop_.store(true, std::memory_order_relaxed);
+        if (thread_.joinable())
+            thread_.join();
+    }
+
+    // Records how much of `path` was read ahead the first time it is opened,
+    // and stops reading it ahead. Returns the index of the file in the
+    // start() list, or -1 if it is not tracked or was seen before.
+    int note_open(const std::filesystem::path& path, double* resident)
+    {
+        for (size_t i = 0; i < files_.size(); ++i)
+        {
+            file_t& f = *files_[i];
+            if (!same_path(f.path, path))
+                continue;
+            uint64_t rd = f.read.load(std::memory_order_relaxed);
+            double r = f.size == 0 ? 1.0 : (double)(rd < f.size ? rd : f.size) / (double)f.size;
+            double expected = -1.0;
+            if (!f.resident_at_open.compare_exchange_strong(expected, r))
+                return -1;
+            *resident = r;
+            return (int)i;
+        }
+        return -1;
+    }
+
+    uint64_t bytes_read() const {
+        return bytes_.load(std::memory_order_relaxed);
+    }
+
+    std::vector<file_stats_t> stats() const
+    {
+        std::vector<file_stats_t> out;
+        for (const auto& f : files_)
+        {
+            out.push_back({
+                f->path,
+                f->size,
+                f->read.load(std::memory_order_relaxed),
+                f->resident_at_open.load(std::memory_order_relaxed) });
+        }
+        return out;
+    }
+};
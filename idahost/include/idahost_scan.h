@@ -0,0 +1,325 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+    #include <emmintrin.h>
+    #define IDAHOST_SCAN_SSE2 1
+#endif
+#ifdef _MSC_VER
+    #include <intrin.h>
+#endif
+
+// Multi-pattern byte scanner for host-side work over database snapshots
+// (bulk_bytes_t). Every pattern is anchored on two consecutive fixed bytes;
+// a 64K table of anchor pairs rejects most positions, and with few
+// distinct anchor first bytes an SSE2 compare over 16 bytes at a time skips
+// ahead to the candidates. Survivors are verified against the patterns of
+// their anchor pair. scan() splits the buffer between threads.
+class multi_scanner_t
+{
+public:
+    struct match_t
+    {
+        uint64_t offset;    // of the first pattern byte
+        uint32_t pattern;   // index returned by add()
+    };
+
+private:
+    // Up to this many distinct anchor first bytes use the SSE2 prefilter
+    static constexpr size_t SIMD_FIRST_BYTES = 6;
+
+    struct pattern_t
+    {
+        std::vector<uint8_t> bytes;
+        std::vector<uint8_t> mask;  // 0xFF where the byte must match
+        uint32_t anchor;            // offset of the anchor pair
+        bool single;                // anchored on one byte (no fixed pair)
+    };
+
+    struct entry_t
+    {
+        uint32_t pattern;
+        uint32_t anchor;
+    };
+
+    std::vector<pattern_t> patterns_;
+    std::vector<uint8_t> pairs_;            // 65536 flags, index b0 | b1 << 8
+    // Patterns per anchor pair: bucket_start_[pair] .. bucket_start_[pair + 1]
+    std::vector<uint32_t> bucket_start_;
+    std::vector<entry_t> entries_;
+    std::vector<uint8_t> first_bytes_;
+    bool compiled_ = false;
+
+    bool pair_set(uint32_t pair) const {
+        return pairs_[pair] != 0;
+    }
+
+    bool verify(const pattern_t& p, const uint8_t* at) const
+    {
+        for (size_t i = 0; i < p.bytes.size(); ++i)
+        {
+            if (((at[i] ^ p.bytes[i]) & p.mask[i]) != 0)
+                return false;
+        }
+        return true;
+    }
+
+    static uint32_t pair_at(const uint8_t* data, size_t n, size_t pos) {
+        return data[pos] | (pos + 1 < n ? (uint32_t)data[pos + 1] << 8 : 0);
+    }
+
+    // `pair` is known to be in pairs_
+    void check(const uint8_t* data, size_t n, size_t pos, uint32_t pair, std::vector<match_t>* out) const
+    {
+        for (uint32_t i = bucket_start_[pair]; i < bucket_start_[pair + 1]; ++i)
+        {
+            const entry_t& e = entries_[i];
+            const pattern_t& p = patterns_[e.pattern];
+            if (pos < e.anchor || pos - e.anchor + p.bytes.size() > n)
+                continue;
+            if (verify(p, data + pos - e.anchor))
+                out->push_back({ (uint64_t)(pos - e.anchor), e.pattern });
+        }
+    }
+
+    // Anchor positions in [begin, end) of data[0, n)
+    void scan_range(const uint8_t* data, size_t n, size_t begin, size_t end, std::vector<match_t>* out) const
+    {
+        size_t pos = begin;
+#ifdef IDAHOST_SCAN_SSE2
+        if (first_bytes_.size() <= SIMD_FIRST_BYTES)
+        {
+            __m128i firsts[SIMD_FIRST_BYTES];
+            for (size_t i = 0; i < first_bytes_.size(); ++i)
+                firsts[i] = _mm_set1_epi8((char)first_bytes_[i]);
+            for (; pos + 16 <= end; pos += 16)
+            {
+                __m128i v = _mm_loadu_si128((const __m128i*)(data + pos));
+                __m128i hit = _mm_setzero_si128();
+                for (size_t i = 0; i < first_bytes_.size(); ++i)
+                    hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, firsts[i]));
+                uint32_t bits = (uint32_t)_mm_movemask_epi8(hit);
+                while (bits != 0)
+                {
+                    unsigned long bit;
+    #ifdef _MSC_VER
+                    _BitScanForward(&bit, bits);
+    #else
+                    bit = (unsigned long)__builtin_ctz(bits);
+    #endif
+                    uint32_t pair = pair_at(data, n, pos + bit);
+                    if (pair_set(pair))
+                        check(data, n, pos + bit, pair, out);
+                    bits &= bits - 1;
+                }
+            }
+        }
+#endif
+        // The last position has no second byte; pair_at() pads it with 0
+        size_t fast_end = (std::min)(end, n - 1);
+        const uint8_t* pairs = pairs_.data();
+        for (; pos < fast_end; ++pos)
+        {
+            uint32_t pair = data[pos] | (uint32_t)data[pos + 1] << 8;
+            if (pairs[pair] != 0)
+                check(data, n, pos, pair, out);
+        }
+        for (; pos < end; ++pos)
+        {
+            uint32_t pair = pair_at(data, n, pos);
+            if (pair_set(pair))
+                check(data, n, pos, pair, out);
+        }
+    }
+
+public:
+    // `mask` may be null; a 0 mask byte is a wildcard. Returns the pattern
+    // index, or -1 if the pattern is empty or all wildcards.
+    int add(const void* bytes, size_t len, const uint8_t* mask = nullptr)
+    {
+        pattern_t p;
+        p.bytes.assign((const uint8_t*)bytes, (const uint8_t*)bytes + len);
+        if (mask != nullptr)
+            p.mask.assign(mask, mask + len);
+        else
+            p.mask.assign(len, 0xFF);
+        for (size_t i = 0; i < len; ++i)
+            p.bytes[i] &= p.mask[i];
+
+        // Prefer a fixed pair; else the first fixed byte
+        p.anchor = UINT32_MAX;
+        p.single = false;
+        for (size_t i = 0; i + 1 < len && p.anchor == UINT32_MAX; ++i)
+        {
+            if (p.mask[i] == 0xFF && p.mask[i + 1] == 0xFF)
+                p.anchor = (uint32_t)i;
+        }
+        for (size_t i = 0; i < len && p.anchor == UINT32_MAX; ++i)
+        {
+            if (p.mask[i] == 0xFF)
+            {
+                p.anchor = (uint32_t)i;
+                p.single = true;
+            }
+        }
+        if (p.anchor == UINT32_MAX)
+            return -1;
+
+        patterns_.push_back(std::move(p));
+        compiled_ = false;
+        return (int)patterns_.size() - 1;
+    }
+
+    // Parses "48 8B ?? 24" style hex; "?" or "??" is a wildcard byte
+    int add_hex(const char* hex)
+    {
+        std::vector<uint8_t> bytes, mask;
+        for (const char* s = hex; *s != '\0'; )
+        {
+            if (*s == ' ')
+            {
+                ++s;
+                continue;
+            }
+            if (*s == '?')
+            {
+                s += s[1] == '?' ? 2 : 1;
+                bytes.push_back(0);
+                mask.push_back(0);
+                continue;
+            }
+            auto nibble = [](char c) -> int
+            {
+                if (c >= '0' && c <= '9') return c - '0';
+                if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+                if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+                return -1;
+            };
+            int hi = nibble(s[0]);
+            int lo = hi < 0 ? -1 : nibble(s[1]);
+            if (lo < 0)
+                return -1;
+            bytes.push_back((uint8_t)(hi << 4 | lo));
+            mask.push_back(0xFF);
+            s += 2;
+        }
+        return add(bytes.data(), bytes.size(), mask.data());
+    }
+
+    size_t size() const {
+        return patterns_.size();
+    }
+
+    void clear()
+    {
+        patterns_.clear();
+        compiled_ = false;
+    }
+
+    // Builds the lookup tables; scan() calls it when patterns were added
+    void compile()
+    {
+        pairs_.assign(65536, 0);
+        std::vector<uint32_t> counts(65536 + 1, 0);
+        bool firsts[256] = {};
+        auto each_pair = [this](const pattern_t& p, auto&& fn)
+        {
+            uint32_t b0 = p.bytes[p.anchor];
+            if (!p.single)
+            {
+                fn(b0 | (uint32_t)p.bytes[p.anchor + 1] << 8);
+                return;
+            }
+            for (uint32_t b1 = 0; b1 < 256; ++b1)
+                fn(b0 | b1 << 8);
+        };
+
+        for (const pattern_t& p : patterns_)
+        {
+            firsts[p.bytes[p.anchor]] = true;
+            each_pair(p, [&](uint32_t pair)
+            {
+                pairs_[pair] = 1;
+                ++counts[pair + 1];
+            });
+        }
+        bucket_start_.assign(65536 + 1, 0);
+        for (size_t i = 1; i <= 65536; ++i)
+            bucket_start_[i] = bucket_start_[i - 1] + counts[i];
+        entries_.resize(bucket_start_[65536]);
+        std::vector<uint32_t> fill(bucket_start_.begin(), bucket_start_.end() - 1);
+        for (uint32_t i = 0; i < patterns_.size(); ++i)
+        {
+            const pattern_t& p = patterns_[i];
+            each_pair(p, [&](uint32_t pair)
+            {
+                entries_[fill[pair]++] = { i, p.anchor };
+            });
+        }
+        first_bytes_.clear();
+        for (int b = 0; b < 256; ++b)
+        {
+            if (firsts[b])
+                first_bytes_.push_back((uint8_t)b);
+        }
+        compiled_ = true;
+    }
+
+    // Matches sorted by offset, then pattern. `threads` 0 uses every core.
+    std::vector<match_t> scan(const void* data, size_t n, unsigned threads = 0)
+    {
+        std::vector<match_t> out;
+        if (patterns_.empty() || n == 0)
+            return out;
+        if (!compiled_)
+            compile();
+
+        const uint8_t* d = (const uint8_t*)data;
+        if (threads == 0)
+            threads = (std::max)(1u, std::thread::hardware_concurrency());
+        // Below a few pages per thread the threads cost more than they save
+        threads = (unsigned)(std::min)((size_t)threads, (std::max)((size_t)1, n / (64 * 1024)));
+
+        if (threads == 1)
+        {
+            scan_range(d, n, 0, n, &out);
+        }
+        else
+        {
+            std::vector<std::vector<match_t>> parts(threads);
+            std::vector<std::thread> pool;
+            size_t step = (n + threads - 1) / threads;
+            for (unsigned t = 0; t < threads; ++t)
+            {
+                size_t b = (std::min)(n, t * step);
+                size_t e = (std::min)(n, b + step);
+                pool.emplace_back([this, d, n, b, e, &parts, t]
+                {
+                    scan_range(d, n, b, e, &parts[t]);
+                });
+            }
+            for (std::thread& th : pool)
+                th.join();
+            size_t total = 0;
+            for (const auto& p : parts)
+                total += p.size();
+            out.reserve(total);
+            for (const auto& p : parts)
+                out.insert(out.end(), p.begin(), p.end());
+        }
+
+        // Anchors at different offsets find patterns out of offset order
+        auto less = [](const match_t& a, const match_t& b)
+        {
+            return a.offset != b.offset ? a.offset < b.offset : a.pattern < b.pattern;
+        };
+        if (!std::is_sorted(out.begin(), out.end(), less))
+            std::sort(out.begin(), out.end(), less);
+        return out;
+    }
+};
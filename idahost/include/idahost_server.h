@@ -0,0 +1,471 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <map>
+
+// Compact binary protocol spoken between an analysis client and a long-lived
+// idahost server.
+//
+// Every message is a frame: a fixed 16-byte little-endian header followed by
+// `size` bytes of payload. Clients may pipeline any number of requests; the
+// server executes them serially in arrival order and answers each one with a
+// frame carrying the same `id`.
+//
+//  op_open     <str path>                        -> <u32 db>
+//  op_query    <u32 db><str name><str args>      -> <u32 result><u64 total><bytes first chunk>
+//  op_fetch    <u32 result><u64 offset><u32 max> -> <bytes chunk>
+//  op_release  <u32 result>                      -> (empty)
+//  op_close    <u32 db>                          -> (empty)
+//  op_ping     <bytes>                           -> <same bytes>
+//  op_shutdown (empty)                           -> (empty)
+//
+// `str` is a u32 length followed by that many bytes (UTF-8 for paths).
+// A query result that fits in the first chunk is returned with result id 0 and
+// is not retained by the server; larger results must be fetched and released.
+// One database is open at a time: opening another file answers st_busy until
+// the current one is closed. Requests behind a shutdown get st_shutting_down.
+namespace idahost_proto
+{
+    static constexpr uint32_t MAGIC = 0x31484449; // "IDH1"
+    static constexpr uint32_t MAX_PAYLOAD = 64 * 1024 * 1024;
+    static constexpr uint32_t INLINE_RESULT = 64 * 1024;
+
+    enum op_e : uint16_t
+    {
+        op_ping,
+        op_open,
+        op_query,
+        op_fetch,
+        op_release,
+        op_close,
+        op_shutdown,
+    };
+
+    enum status_e : uint16_t
+    {
+        st_ok,
+        st_bad_request,
+        st_unknown_op,
+        st_no_database,
+        st_busy,
+        st_unknown_query,
+        st_query_failed,
+        st_no_result,
+        st_shutting_down,   // sent after a shutdown request in the same batch
+    };
+
+    struct frame_header_t
+    {
+        uint32_t magic;
+        uint32_t size;
+        uint32_t id;
+        uint16_t op;
+        uint16_t status;
+    };
+    static_assert(sizeof(frame_header_t) == 16, "frame header must be packed");
+
+    struct writer_t
+    {
+        std::string& out;
+
+        explicit writer_t(std::string& o) : out(o) { }
+
+        void bytes(const void* p, size_t n) {
+            out.append((const char*)p, n);
+        }
+        void u32(uint32_t v) {
+            bytes(&v, sizeof(v));
+        }
+        void u64(uint64_t v) {
+            bytes(&v, sizeof(v));
+        }
+        void str(const char* s, size_t n)
+        {
+            u32((uint32_t)n);
+            bytes(s, n);
+        }
+        void str(const std::string& s) {
+            str(s.data(), s.size());
+        }
+    };
+
+    struct reader_t
+    {
+        const uint8_t* p;
+        size_t n;
+        bool ok = true;
+
+        reader_t(const void* data, size_t size) : p((const uint8_t*)data), n(size) { }
+
+        bool take(void* dst, size_t sz)
+        {
+            if (!ok || n < sz)
+                return ok = false;
+            memcpy(dst, p, sz);
+            p += sz;
+            n -= sz;
+            return true;
+        }
+        uint32_t u32()
+        {
+            uint32_t v = 0;
+            take(&v, sizeof(v));
+            return v;
+        }
+        uint64_t u64()
+        {
+            uint64_t v = 0;
+            take(&v, sizeof(v));
+            return v;
+        }
+        std::string str()
+        {
+            uint32_t len = u32();
+            if (!ok || n < len)
+            {
+                ok = false;
+                return {};
+            }
+            std::string s((const char*)p, len);
+            p += len;
+            n -= len;
+            return s;
+        }
+    };
+
+    // Appends a complete frame to `out`
+    inline void put_frame(
+        std::string& out,
+        uint32_t id,
+        uint16_t op,
+        uint16_t status,
+        const void* payload,
+        size_t size)
+    {
+        frame_header_t hdr = { MAGIC, (uint32_t)size, id, op, status };
+        out.append((const char*)&hdr, sizeof(hdr));
+        if (size != 0)
+            out.append((const char*)payload, size);
+    }
+}
+
+class idahost_server_t
+{
+public:
+    // What the server executes requests against. The idahost binding talks to
+    // the hosted kernel; tests can plug in a mock.
+    struct provider_t
+    {
+        virtual ~provider_t() = default;
+        virtual uint16_t open_database(const std::string& path, uint32_t* db) = 0;
+        virtual uint16_t run_query(
+            uint32_t db,
+            const std::string& name,
+            const std::string& args,
+            std::string* out) = 0;
+        virtual uint16_t close_database(uint32_t db) = 0;
+    };
+
+    // A connected byte stream (see idahost_ipc.h)
+    struct stream_t
+    {
+        virtual ~stream_t() = default;
+        // Returns the number of bytes read, 0 on end of stream and <0 on error
+        virtual ptrdiff_t read(void* buf, size_t size) = 0;
+        virtual bool write(const void* buf, size_t size) = 0;
+    };
+
+    struct stats_t
+    {
+        uint64_t requests = 0;
+        uint64_t batches = 0;
+        uint64_t bytes_in = 0;
+        uint64_t bytes_out = 0;
+    };
+
+private:
+    struct result_t
+    {
+        uint32_t db;
+        std::string data;
+    };
+
+    provider_t* provider_;
+    std::map<uint32_t, result_t> results_;
+    uint32_t next_result_ = 1;
+    bool shutdown_ = false;
+    stats_t stats_;
+
+    void handle_query(idahost_proto::reader_t& rd, std::string& reply, uint16_t& status)
+    {
+        using namespace idahost_proto;
+        uint32_t db = rd.u32();
+        std::string name = rd.str();
+        std::string args = rd.str();
+        if (!rd.ok)
+        {
+            status = st_bad_request;
+            return;
+        }
+
+        std::string data;
+        status = provider_->run_query(db, name, args, &data);
+        if (status != st_ok)
+            return;
+
+        writer_t w(reply);
+        if (data.size() <= INLINE_RESULT)
+        {
+            w.u32(0);
+            w.u64(data.size());
+            w.bytes(data.data(), data.size());
+            return;
+        }
+
+        uint32_t rid = next_result_++;
+        if (next_result_ == 0)
+            next_result_ = 1;
+        w.u32(rid);
+        w.u64(data.size());
+        w.bytes(data.data(), INLINE_RESULT);
+        results_[rid] = { db, std::move(data) };
+    }
+
+    void handle_fetch(idahost_proto::reader_t& rd, std::string& reply, uint16_t& status)
+    {
+        using namespace idahost_proto;
+        uint32_t rid = rd.u32();
+        uint64_t offs = rd.u64();
+        uint32_t max = rd.u32();
+        if (!rd.ok)
+        {
+            status = st_bad_request;
+            return;
+        }
+        auto p = results_.find(rid);
+        if (p == results_.end())
+        {
+            status = st_no_result;
+            return;
+        }
+        const std::string& data = p->second.data;
+        if (offs < data.size())
+        {
+            size_t n = data.size() - (size_t)offs;
+            if (n > max)
+                n = max;
+            if (n > MAX_PAYLOAD)
+                n = MAX_PAYLOAD;
+            reply.assign(data, (size_t)offs, n);
+        }
+    }
+
+    void drop_results(uint32_t db)
+    {
+        for (auto p = results_.begin(); p != results_.end(); )
+        {
+            if (p->second.db == db)
+                p = results_.erase(p);
+            else
+                ++p;
+        }
+    }
+
+public:
+    explicit idahost_server_t(provider_t* provider) : provider_(provider) { }
+
+    const stats_t& stats() const {
+        return stats_;
+    }
+
+    bool shutdown_requested() const {
+        return shutdown_;
+    }
+
+    // Executes one request and appends its response frame to `out`
+    void dispatch(
+        const idahost_proto::frame_header_t& hdr,
+        const uint8_t* payload,
+        std::string& out)
+    {
+        using namespace idahost_proto;
+        reader_t rd(payload, hdr.size);
+        std::string reply;
+        uint16_t status = st_ok;
+
+        ++stats_.requests;
+        if (shutdown_)
+        {
+            put_frame(out, hdr.id, hdr.op, st_shutting_down, nullptr, 0);
+            return;
+        }
+        switch (hdr.op)
+        {
+            case op_ping:
+                reply.assign((const char*)payload, hdr.size);
+                break;
+            case op_open:
+            {
+                std::string path = rd.str();
+                uint32_t db = 0;
+                status = rd.ok ? provider_->open_database(path, &db) : (uint16_t)st_bad_request;
+                if (status == st_ok)
+                    writer_t(reply).u32(db);
+                break;
+            }
+            case op_query:
+                handle_query(rd, reply, status);
+                break;
+            case op_fetch:
+                handle_fetch(rd, reply, status);
+                break;
+            case op_release:
+            {
+                uint32_t rid = rd.u32();
+                if (!rd.ok)
+                    status = st_bad_request;
+                else if (results_.erase(rid) == 0)
+                    status = st_no_result;
+                break;
+            }
+            case op_close:
+            {
+                uint32_t db = rd.u32();
+                if (!rd.ok)
+                {
+                    status = st_bad_request;
+                    break;
+                }
+                drop_results(db);
+                status = provider_->close_database(db);
+                break;
+            }
+            case op_shutdown:
+                shutdown_ = true;
+                break;
+            default:
+                status = st_unknown_op;
+                break;
+        }
+        put_frame(out, hdr.id, hdr.op, status, reply.data(), reply.size());
+    }
+
+    // Serves one client until it disconnects or asks for a shutdown.
+    // All complete frames that arrived together are executed back to back and
+    // their responses are flushed with a single write. Frames pipelined
+    // behind a shutdown in the same batch are answered st_shutting_down.
+    bool serve(stream_t& s)
+    {
+        using namespace idahost_proto;
+        std::vector<uint8_t> in;
+        std::string out;
+        size_t start = 0;
+        uint8_t chunk[64 * 1024];
+
+        while (!shutdown_)
+        {
+            ptrdiff_t n = s.read(chunk, sizeof(chunk));
+            if (n <= 0)
+                return n == 0;
+
+            stats_.bytes_in += n;
+            in.insert(in.end(), chunk, chunk + n);
+
+            while (in.size() - start >= sizeof(frame_header_t))
+            {
+                frame_header_t hdr;
+                memcpy(&hdr, in.data() + start, sizeof(hdr));
+                if (hdr.magic != MAGIC || hdr.size > MAX_PAYLOAD)
+                    return false;
+                if (in.size() - start - sizeof(hdr) < hdr.size)
+                    break;
+                dispatch(hdr, in.data() + start + sizeof(hdr), out);
+                start += sizeof(hdr) + hdr.size;
+            }
+
+            // Compact consumed input
+            in.erase(in.begin(), in.begin() + start);
+            start = 0;
+
+            if (!out.empty())
+            {
+                ++stats_.batches;
+                stats_.bytes_out += out.size();
+                if (!s.write(out.data(), out.size()))
+                    return false;
+                out.clear();
+            }
+        }
+        return true;
+    }
+};
+
+// Client side of the protocol. Requests can be sent back to back and their
+// responses collected later in the same order.
+class idahost_client_t
+{
+    idahost_server_t::stream_t* s_;
+    uint32_t next_id_ = 1;
+    std::string out_;
+    std::vector<uint8_t> in_;
+
+public:
+    explicit idahost_client_t(idahost_server_t::stream_t* s) : s_(s) { }
+
+    // Queues a request and returns its id. Nothing is written until flush()
+    uint32_t post(uint16_t op, const std::string& payload = {})
+    {
+        uint32_t id = next_id_++;
+        idahost_proto::put_frame(out_, id, op, idahost_proto::st_ok, payload.data(), payload.size());
+        return id;
+    }
+
+    bool flush()
+    {
+        if (out_.empty())
+            return true;
+        bool ok = s_->write(out_.data(), out_.size());
+        out_.clear();
+        return ok;
+    }
+
+    // Receives the next response frame
+    bool recv(idahost_proto::frame_header_t* hdr, std::string* payload)
+    {
+        using namespace idahost_proto;
+        uint8_t chunk[64 * 1024];
+        for (;;)
+        {
+            if (in_.size() >= sizeof(frame_header_t))
+            {
+                memcpy(hdr, in_.data(), sizeof(*hdr));
+                if (hdr->magic != MAGIC)
+                    return false;
+                if (in_.size() - sizeof(*hdr) >= hdr->size)
+                {
+                    payload->assign((const char*)in_.data() + sizeof(*hdr), hdr->size);
+                    in_.erase(in_.begin(), in_.begin() + sizeof(*hdr) + hdr->size);
+                    return true;
+                }
+            }
+            ptrdiff_t n = s_->read(chunk, sizeof(chunk));
+            if (n <= 0)
+                return false;
+            in_.insert(in_.end(), chunk, chunk + n);
+        }
+    }
+
+    // Convenience wrapper: send one request and wait for its response
+    uint16_t call(uint16_t op, const std::string& payload, std::string* reply)
+    {
+        uint32_t id = post(op, payload);
+        idahost_proto::frame_header_t hdr;
+        if (!flush() || !recv(&hdr, reply) || hdr.id != id)
+            return idahost_proto::st_bad_request;
+        return hdr.status;
+    }
+};
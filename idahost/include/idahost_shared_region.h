@@ -0,0 +1,355 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#ifdef _WIN32
+    #include <Windows.h>
+    #include <Psapi.h>
+#else
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <stdio.h>
+#endif
+
+// Named region that the first process fills once and every process, the
+// first included, maps copy-on-write at one agreed address. Pages nobody
+// writes stay shared between all processes; written pages become private.
+//
+// The backing object is laid out as a 64 KiB header followed by the content
+// (the header size keeps the content at a valid view offset on Windows). The
+// name outlives the creator: Windows drops it with the last handle, POSIX
+// keeps it until remove() so that later processes can join.
+class shared_region_t
+{
+public:
+    // Fills the content through a writable view; runs in the creator only
+    using populate_fn = bool (*)(void* ud, void* dst, size_t size);
+
+    struct sharing_t
+    {
+        uint64_t shared_bytes = 0;
+        uint64_t private_bytes = 0;
+        uint64_t nonresident_bytes = 0;
+    };
+
+private:
+    static constexpr size_t HEADER_SIZE = 64 * 1024;
+    static constexpr uint32_t MAGIC = 0x52534849; // "IHSR"
+
+    enum state_e : uint32_t
+    {
+        state_empty,
+        state_ready,
+        state_failed,
+    };
+
+    struct header_t
+    {
+        std::atomic<uint32_t> state;
+        uint32_t magic;
+        uint64_t size;
+    };
+
+    void* base_ = nullptr;
+    size_t size_ = 0;
+    bool created_ = false;
+#ifdef _WIN32
+    HANDLE h_ = nullptr;
+#else
+    int fd_ = -1;
+#endif
+
+    static std::string os_name(const char* name)
+    {
+#ifdef _WIN32
+        return name;
+#else
+        return name[0] == '/' ? std::string(name) : std::string("/") + name;
+#endif
+    }
+
+    static size_t page_size()
+    {
+#ifdef _WIN32
+        SYSTEM_INFO si;
+        GetSystemInfo(&si);
+        return si.dwPageSize;
+#else
+        return (size_t)sysconf(_SC_PAGESIZE);
+#endif
+    }
+
+    void* map_rw(uint64_t offset, size_t size)
+    {
+#ifdef _WIN32
+        return MapViewOfFile(h_, FILE_MAP_WRITE, (DWORD)(offset >> 32), (DWORD)offset, size);
+#else
+        void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, (off_t)offset);
+        return p == MAP_FAILED ? nullptr : p;
+#endif
+    }
+
+    static void unmap(void* p, size_t size)
+    {
+#ifdef _WIN32
+        (void)size;
+        UnmapViewOfFile(p);
+#else
+        munmap(p, size);
+#endif
+    }
+
+public:
+    shared_region_t() = default;
+    shared_region_t(const shared_region_t&) = delete;
+    shared_region_t& operator=(const shared_region_t&) = delete;
+
+    ~shared_region_t()
+    {
+        close();
+    }
+
+    void* base() const {
+        return base_;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    // True if this process filled the region
+    bool created() const {
+        return created_;
+    }
+
+    // Opens or creates `name` and maps its `size` bytes copy-on-write at
+    // `fixed_base`. Fails if the address is taken, the existing region has a
+    // different size, or its creator does not finish within `timeout_ms`.
+    bool open(
+        const char* name,
+        size_t size,
+        void* fixed_base,
+        populate_fn populate,
+        void* ud,
+        int timeout_ms = 10000)
+    {
+        close();
+        std::string n = os_name(name);
+        uint64_t total = HEADER_SIZE + (uint64_t)size;
+        int waited = 0;
+#ifdef _WIN32
+        h_ = CreateFileMappingA(
+            INVALID_HANDLE_VALUE,
+            nullptr,
+            PAGE_EXECUTE_READWRITE,
+            (DWORD)(total >> 32),
+            (DWORD)total,
+            n.c_str());
+        if (h_ == nullptr)
+            return false;
+        created_ = GetLastError() != ERROR_ALREADY_EXISTS;
+#else
+        created_ = true;
+        fd_ = shm_open(n.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd_ == -1)
+        {
+            created_ = false;
+            fd_ = shm_open(n.c_str(), O_RDWR, 0600);
+        }
+        if (fd_ == -1)
+            return false;
+        if (created_ && ftruncate(fd_, (off_t)total) != 0)
+        {
+            shm_unlink(n.c_str());
+            close();
+            return false;
+        }
+        if (!created_)
+        {
+            // Touching a mapping past the end of the object raises SIGBUS, so
+            // wait for the creator's ftruncate; one that died before it
+            // leaves the object empty and the wait times out
+            struct stat st;
+            for (;; ++waited)
+            {
+                if (fstat(fd_, &st) != 0)
+                {
+                    close();
+                    return false;
+                }
+                if ((uint64_t)st.st_size >= HEADER_SIZE)
+                    break;
+                if (waited >= timeout_ms)
+                {
+                    close();
+                    return false;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            if ((uint64_t)st.st_size != total)
+            {
+                close();
+                return false;
+            }
+        }
+#endif
+
+        header_t* hdr = (header_t*)map_rw(0, HEADER_SIZE);
+        if (hdr == nullptr)
+        {
+            close();
+            return false;
+        }
+
+        bool ok = true;
+        if (created_)
+        {
+            void* view = map_rw(HEADER_SIZE, size);
+            ok = view != nullptr && populate(ud, view, size);
+            if (view != nullptr)
+                unmap(view, size);
+            hdr->magic = MAGIC;
+            hdr->size = size;
+            hdr->state.store(ok ? state_ready : state_failed, std::memory_order_release);
+        }
+        else
+        {
+            // Wait for the creator to fill the content; the object is sized
+            for (;; ++waited)
+            {
+                uint32_t st = hdr->state.load(std::memory_order_acquire);
+                if (st != state_empty)
+                {
+                    ok = st == state_ready && hdr->magic == MAGIC && hdr->size == size;
+                    break;
+                }
+                if (waited >= timeout_ms)
+                {
+                    ok = false;
+                    break;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+        unmap(hdr, HEADER_SIZE);
+        if (!ok)
+        {
+            close();
+            return false;
+        }
+
+#ifdef _WIN32
+        base_ = MapViewOfFileEx(
+            h_,
+            FILE_MAP_COPY | FILE_MAP_EXECUTE,
+            0,
+            (DWORD)HEADER_SIZE,
+            size,
+            fixed_base);
+#else
+        int flags = MAP_PRIVATE;
+    #ifdef MAP_FIXED_NOREPLACE
+        flags |= MAP_FIXED_NOREPLACE;
+    #endif
+        void* p = mmap(fixed_base, size, PROT_READ | PROT_WRITE, flags, fd_, (off_t)HEADER_SIZE);
+        if (p != MAP_FAILED && p != fixed_base)
+            munmap(p, size);
+        base_ = p == fixed_base ? p : nullptr;
+#endif
+        if (base_ == nullptr)
+        {
+            close();
+            return false;
+        }
+        size_ = size;
+        return true;
+    }
+
+    void close()
+    {
+        if (base_ != nullptr)
+            unmap(base_, size_);
+#ifdef _WIN32
+        if (h_ != nullptr)
+            CloseHandle(h_);
+        h_ = nullptr;
+#else
+        if (fd_ != -1)
+            ::close(fd_);
+        fd_ = -1;
+#endif
+        base_ = nullptr;
+        size_ = 0;
+        created_ = false;
+    }
+
+    // Drops the name so the next open() creates a fresh region
+    static void remove(const char* name)
+    {
+#ifndef _WIN32
+        shm_unlink(os_name(name).c_str());
+#else
+        (void)name;
+#endif
+    }
+
+    // Classifies the resident pages of [p, p + n) of this process as shared
+    // with other mappings or private to it
+    static bool query_sharing(const void* p, size_t n, sharing_t* out)
+    {
+        size_t page = page_size();
+        uintptr_t first = (uintptr_t)p & ~(uintptr_t)(page - 1);
+        size_t count = (size_t)(((uintptr_t)p + n - first + page - 1) / page);
+        *out = sharing_t();
+#ifdef _WIN32
+        PSAPI_WORKING_SET_EX_INFORMATION info[1024];
+        for (size_t done = 0; done < count; )
+        {
+            size_t batch = count - done < 1024 ? count - done : 1024;
+            for (size_t i = 0; i < batch; ++i)
+                info[i].VirtualAddress = (void*)(first + (done + i) * page);
+            if (!QueryWorkingSetEx(GetCurrentProcess(), info, (DWORD)(batch * sizeof(info[0]))))
+                return false;
+            for (size_t i = 0; i < batch; ++i)
+            {
+                if (!info[i].VirtualAttributes.Valid)
+                    out->nonresident_bytes += page;
+                else if (info[i].VirtualAttributes.Shared)
+                    out->shared_bytes += page;
+                else
+                    out->private_bytes += page;
+            }
+            done += batch;
+        }
+        return true;
+#else
+        // pagemap: bit 63 present, bit 61 file-backed or shared anonymous page
+        FILE* fp = fopen("/proc/self/pagemap", "rb");
+        if (fp == nullptr)
+            return false;
+        bool ok = fseek(fp, (long)(first / page * 8), SEEK_SET) == 0;
+        for (size_t i = 0; ok && i < count; ++i)
+        {
+            uint64_t e;
+            ok = fread(&e, sizeof(e), 1, fp) == 1;
+            if (!ok)
+                break;
+            if ((e >> 63 & 1) == 0)
+                out->nonresident_bytes += page;
+            else if ((e >> 61 & 1) != 0)
+                out->shared_bytes += page;
+            else
+                out->private_bytes += page;
+        }
+        fclose(fp);
+        return ok;
+#endif
+    }
+};
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <stddef.h>
+#include <string>
+
+#ifdef _WIN32
+    #include <Windows.h>
+#else
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+// Named shared-memory segment: a pagefile-backed file mapping on Windows and a
+// POSIX shm object elsewhere. The creating side removes the name on close.
+class shm_segment_t
+{
+    void* base_ = nullptr;
+    size_t size_ = 0;
+#ifdef _WIN32
+    HANDLE h_ = nullptr;
+#else
+    int fd_ = -1;
+    bool owner_ = false;
+    std::string name_;
+#endif
+
+    static std::string os_name(const char* name)
+    {
+#ifdef _WIN32
+        return name;
+#else
+        return name[0] == '/' ? std::string(name) : std::string("/") + name;
+#endif
+    }
+
+public:
+    shm_segment_t() = default;
+    shm_segment_t(const shm_segment_t&) = delete;
+    shm_segment_t& operator=(const shm_segment_t&) = delete;
+
+    ~shm_segment_t()
+    {
+        close();
+    }
+
+    void* data() const {
+        return base_;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    // Creates the segment, or opens it if it already exists. `*created` tells
+    // which one happened. An existing segment is mapped with its own size,
+    // which size() returns and the caller must check; one its creator has
+    // not sized yet fails.
+    bool create(const char* name, size_t size, bool* created = nullptr)
+    {
+        close();
+        std::string n = os_name(name);
+#ifdef _WIN32
+        h_ = CreateFileMappingA(
+            INVALID_HANDLE_VALUE,
+            nullptr,
+            PAGE_READWRITE,
+            (DWORD)((unsigned long long)size >> 32),
+            (DWORD)size,
+            n.c_str());
+        if (h_ == nullptr)
+            return false;
+        bool fresh = GetLastError() != ERROR_ALREADY_EXISTS;
+        if (created != nullptr)
+            *created = fresh;
+
+        base_ = MapViewOfFile(h_, FILE_MAP_ALL_ACCESS, 0, 0, fresh ? size : 0);
+        if (!fresh && base_ != nullptr)
+        {
+            MEMORY_BASIC_INFORMATION mbi;
+            if (VirtualQuery(base_, &mbi, sizeof(mbi)) == 0)
+            {
+                close();
+                return false;
+            }
+            size = mbi.RegionSize;
+        }
+#else
+        bool fresh = true;
+        fd_ = shm_open(n.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd_ == -1)
+        {
+            fresh = false;
+            fd_ = shm_open(n.c_str(), O_RDWR, 0600);
+        }
+        if (fd_ == -1)
+            return false;
+        if (fresh && ftruncate(fd_, (off_t)size) != 0)
+        {
+            close();
+            return false;
+        }
+        if (!fresh)
+        {
+            // Mapping past the end of the object faults on first touch
+            struct stat st;
+            if (fstat(fd_, &st) != 0 || st.st_size <= 0)
+            {
+                close();
+                return false;
+            }
+            size = (size_t)st.st_size;
+        }
+        if (created != nullptr)
+            *created = fresh;
+        owner_ = fresh;
+        name_ = n;
+
+        base_ = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (base_ == MAP_FAILED)
+            base_ = nullptr;
+#endif
+        if (base_ == nullptr)
+        {
+            close();
+            return false;
+        }
+        size_ = size;
+        return true;
+    }
+
+    // Opens an existing segment with its full size
+    bool open(const char* name)
+    {
+        close();
+        std::string n = os_name(name);
+#ifdef _WIN32
+        h_ = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, n.c_str());
+        if (h_ == nullptr)
+            return false;
+        base_ = MapViewOfFile(h_, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+        MEMORY_BASIC_INFORMATION mbi;
+        if (base_ != nullptr && VirtualQuery(base_, &mbi, sizeof(mbi)) != 0)
+            size_ = mbi.RegionSize;
+#else
+        fd_ = shm_open(n.c_str(), O_RDWR, 0600);
+        if (fd_ == -1)
+            return false;
+        struct stat st;
+        if (fstat(fd_, &st) == 0 && st.st_size > 0)
+        {
+            size_ = (size_t)st.st_size;
+            base_ = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+            if (base_ == MAP_FAILED)
+                base_ = nullptr;
+        }
+#endif
+        if (base_ == nullptr)
+        {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close()
+    {
+#ifdef _WIN32
+        if (base_ != nullptr)
+            UnmapViewOfFile(base_);
+        if (h_ != nullptr)
+            CloseHandle(h_);
+        h_ = nullptr;
+#else
+        if (base_ != nullptr)
+            munmap(base_, size_);
+        if (fd_ != -1)
+            ::close(fd_);
+        if (owner_)
+            shm_unlink(name_.c_str());
+        fd_ = -1;
+        owner_ = false;
+#endif
+        base_ = nullptr;
+        size_ = 0;
+    }
+};
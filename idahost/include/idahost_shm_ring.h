@@ -0,0 +1,346 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "idahost_shm.h"
+
+// Single-producer/single-consumer ring of length-prefixed records living in a
+// shared-memory segment. Results are written in place by the producer
+// (reserve/commit) and read in place by the consumer (peek/release), so a
+// payload crosses the process boundary without being copied.
+//
+// Every record starts on an 8-byte boundary with a shm_record_t header. A
+// record never wraps: when it does not fit before the end of the ring, the
+// tail end is filled with a padding record and the record starts at offset 0.
+struct shm_record_t
+{
+    uint32_t size;
+    uint32_t type;
+};
+
+class shm_ring_t
+{
+public:
+    enum rec_type_e : uint32_t
+    {
+        rec_msg = 1,            // formatted output from msg()
+        rec_user = 0x100,       // first type available to hosts
+        rec_pad = 0xFFFFFFFF,
+    };
+
+    struct view_t
+    {
+        uint32_t type;
+        uint32_t size;
+        const uint8_t* data;
+    };
+
+    struct stats_t
+    {
+        uint64_t records = 0;
+        uint64_t bytes = 0;
+        uint64_t waits = 0;
+        uint64_t timeouts = 0;      // reserves given up on a stalled consumer
+    };
+
+private:
+    static constexpr uint32_t MAGIC = 0x474E5249; // "IRNG"
+    static constexpr uint32_t VERSION = 1;
+
+    struct header_t
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t capacity;
+        alignas(64) std::atomic<uint64_t> head;     // written by the producer
+        alignas(64) std::atomic<uint64_t> tail;     // written by the consumer
+        alignas(64) std::atomic<uint32_t> closed;
+    };
+
+    shm_segment_t seg_;
+    header_t* hdr_ = nullptr;
+    uint8_t* data_ = nullptr;
+    uint64_t cap_ = 0;
+
+    // Producer side
+    uint64_t pending_ = 0;
+    uint64_t tail_cache_ = 0;
+    std::chrono::milliseconds stall_timeout_{ 10000 };
+    // Consumer side
+    uint64_t cur_size_ = 0;
+    bool corrupt_ = false;
+    stats_t stats_;
+
+    static uint64_t align8(uint64_t v) {
+        return (v + 7) & ~(uint64_t)7;
+    }
+
+    static constexpr size_t data_offset() {
+        return (sizeof(header_t) + 63) & ~(size_t)63;
+    }
+
+    // Spin briefly, then yield, then sleep
+    static void backoff(unsigned& n)
+    {
+        if (++n < 64)
+            return;
+        if (n < 128)
+            std::this_thread::yield();
+        else
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+
+    bool attach(bool init, uint64_t capacity)
+    {
+        hdr_ = (header_t*)seg_.data();
+        data_ = (uint8_t*)seg_.data() + data_offset();
+        if (init)
+        {
+            hdr_->capacity = capacity;
+            hdr_->version = VERSION;
+            hdr_->head.store(0, std::memory_order_relaxed);
+            hdr_->tail.store(0, std::memory_order_relaxed);
+            hdr_->closed.store(0, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            hdr_->magic = MAGIC;
+        }
+        // Indexing masks with capacity - 1, so it must be a power of two
+        else if (seg_.size() < data_offset()
+            || hdr_->magic != MAGIC
+            || hdr_->version != VERSION
+            || hdr_->capacity < 64
+            || (hdr_->capacity & (hdr_->capacity - 1)) != 0
+            || hdr_->capacity > seg_.size() - data_offset())
+        {
+            seg_.close();
+            hdr_ = nullptr;
+            return false;
+        }
+        cap_ = hdr_->capacity;
+        tail_cache_ = hdr_->tail.load(std::memory_order_acquire);
+        return true;
+    }
+
+public:
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "ring requires lock-free 64-bit atomics");
+
+    ~shm_ring_t()
+    {
+        close();
+    }
+
+    const stats_t& stats() const {
+        return stats_;
+    }
+
+    uint64_t capacity() const {
+        return cap_;
+    }
+
+    // How long reserve() waits for a consumer that frees no space, e.g.
+    // because it died, before failing
+    void set_stall_timeout(std::chrono::milliseconds t) {
+        stall_timeout_ = t;
+    }
+
+    // Creates the named ring. `capacity` is rounded up to a power of two.
+    bool create(const char* name, uint64_t capacity)
+    {
+        uint64_t cap = 4096;
+        while (cap < capacity)
+            cap <<= 1;
+        bool created = false;
+        if (!seg_.create(name, data_offset() + cap, &created))
+            return false;
+        return attach(created, cap);
+    }
+
+    bool open(const char* name)
+    {
+        return seg_.open(name) && attach(false, 0);
+    }
+
+    //
+    // Producer
+    //
+
+    // Returns a pointer to `size` writable bytes inside the ring, blocking
+    // while the consumer catches up. Returns nullptr if the record can never
+    // fit, the ring was closed or the consumer stalled (set_stall_timeout).
+    void* reserve(uint32_t size, uint32_t type = rec_user)
+    {
+        uint64_t need = align8(sizeof(shm_record_t) + size);
+        if (hdr_ == nullptr || need > cap_ / 2)
+            return nullptr;
+
+        uint64_t head = hdr_->head.load(std::memory_order_relaxed);
+        uint64_t to_end = cap_ - (head & (cap_ - 1));
+        uint64_t total = to_end < need ? to_end + need : need;
+
+        std::chrono::steady_clock::time_point progress;
+        for (unsigned n = 0; head + total - tail_cache_ > cap_; )
+        {
+            if (hdr_->closed.load(std::memory_order_relaxed))
+                return nullptr;
+            uint64_t tail = hdr_->tail.load(std::memory_order_acquire);
+            if (n == 0 || tail != tail_cache_)
+                progress = std::chrono::steady_clock::now();
+            tail_cache_ = tail;
+            if (head + total - tail_cache_ <= cap_)
+                break;
+            if (n == 0)
+                ++stats_.waits;
+            else if (n >= 128 && std::chrono::steady_clock::now() - progress > stall_timeout_)
+            {
+                ++stats_.timeouts;
+                return nullptr;
+            }
+            backoff(n);
+        }
+
+        if (to_end < need)
+        {
+            shm_record_t* pad = (shm_record_t*)(data_ + (head & (cap_ - 1)));
+            pad->size = (uint32_t)(to_end - sizeof(shm_record_t));
+            pad->type = rec_pad;
+            head += to_end;
+        }
+
+        shm_record_t* rec = (shm_record_t*)(data_ + (head & (cap_ - 1)));
+        rec->size = size;
+        rec->type = type;
+        pending_ = head;
+        return rec + 1;
+    }
+
+    // Publishes the reserved record, optionally shrinking it to `size` bytes
+    void commit(uint32_t size)
+    {
+        shm_record_t* rec = (shm_record_t*)(data_ + (pending_ & (cap_ - 1)));
+        if (size < rec->size)
+            rec->size = size;
+        ++stats_.records;
+        stats_.bytes += rec->size;
+        hdr_->head.store(pending_ + align8(sizeof(shm_record_t) + rec->size), std::memory_order_release);
+    }
+
+    bool write(const void* data, uint32_t size, uint32_t type = rec_user)
+    {
+        void* p = reserve(size, type);
+        if (p == nullptr)
+            return false;
+        memcpy(p, data, size);
+        commit(size);
+        return true;
+    }
+
+    // Tells the consumer that no more records will be produced
+    void close_producer()
+    {
+        if (hdr_ != nullptr)
+            hdr_->closed.store(1, std::memory_order_release);
+    }
+
+    // Compatible with idahost_t::set_msg_handler(): formats directly into the ring
+    static int msg_handler(void* ud, const char* format, va_list args)
+    {
+        shm_ring_t* ring = (shm_ring_t*)ud;
+        va_list va;
+        va_copy(va, args);
+        int len = vsnprintf(nullptr, 0, format, va);
+        va_end(va);
+        if (len < 0)
+            return len;
+
+        char* p = (char*)ring->reserve((uint32_t)len + 1, rec_msg);
+        if (p == nullptr)
+            return -1;
+        vsnprintf(p, (size_t)len + 1, format, args);
+        ring->commit((uint32_t)len);
+        return len;
+    }
+
+    //
+    // Consumer
+    //
+
+    // True once a record ran past the published data or the end of the
+    // ring; the consumer stops reading there
+    bool corrupt() const {
+        return corrupt_;
+    }
+
+    // Returns the next record without copying it. The view stays valid until release().
+    bool try_peek(view_t* v)
+    {
+        if (corrupt_)
+            return false;
+        uint64_t tail = hdr_->tail.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            uint64_t head = hdr_->head.load(std::memory_order_acquire);
+            if (tail == head)
+                return false;
+
+            // The other process may write anything: check the record lies
+            // within what was published and does not wrap
+            uint64_t pos = tail & (cap_ - 1);
+            uint64_t avail = head - tail;
+            const shm_record_t* rec = (const shm_record_t*)(data_ + pos);
+            uint32_t type = rec->type;
+            uint32_t size = rec->size;
+            uint64_t len = type == rec_pad ? sizeof(shm_record_t) + (uint64_t)size : align8(sizeof(shm_record_t) + (uint64_t)size);
+            if (avail > cap_ || avail < sizeof(shm_record_t) || len > avail || len > cap_ - pos)
+            {
+                corrupt_ = true;
+                return false;
+            }
+            if (type == rec_pad)
+            {
+                tail += len;
+                hdr_->tail.store(tail, std::memory_order_release);
+                continue;
+            }
+            v->type = type;
+            v->size = size;
+            v->data = (const uint8_t*)(rec + 1);
+            cur_size_ = len;
+            return true;
+        }
+    }
+
+    // Blocks until a record is available. Returns false once the producer has
+    // closed the ring and everything was consumed, or the ring is corrupt().
+    bool peek(view_t* v)
+    {
+        for (unsigned n = 0; ; backoff(n))
+        {
+            bool closed = hdr_->closed.load(std::memory_order_acquire) != 0;
+            if (try_peek(v))
+                return true;
+            if (closed || corrupt_)
+                return false;
+        }
+    }
+
+    void release()
+    {
+        uint64_t tail = hdr_->tail.load(std::memory_order_relaxed);
+        hdr_->tail.store(tail + cur_size_, std::memory_order_release);
+        cur_size_ = 0;
+    }
+
+    void close()
+    {
+        seg_.close();
+        hdr_ = nullptr;
+        data_ = nullptr;
+        cap_ = 0;
+        corrupt_ = false;
+    }
+};
@@ -0,0 +1,463 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <wctype.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// RAM-backed file store used to keep the provider's database files off the
+// disk. Files are lists of large fixed-size blocks, so growing a file never
+// moves data that was already written.
+//
+// Paths are compared case-insensitively with '/' and '\\' treated alike.
+// Everything is serialized by one lock: the hosted kernel does its file I/O
+// from a single thread.
+class vfs_store_t
+{
+public:
+    static constexpr size_t BLOCK_SIZE = 1024 * 1024;
+
+    enum open_mode_e
+    {
+        open_existing,
+        open_always,
+        create_new,
+        create_always,
+        truncate_existing,
+    };
+
+    enum status_e
+    {
+        st_ok,
+        st_not_found,
+        st_exists,
+        st_bad_handle,
+        st_access_denied,
+    };
+
+    struct stats_t
+    {
+        uint64_t files = 0;
+        uint64_t bytes = 0;          // logical file sizes
+        uint64_t blocks_bytes = 0;   // memory held by blocks
+        uint64_t reads = 0;
+        uint64_t writes = 0;
+    };
+
+private:
+    struct file_t
+    {
+        std::vector<std::unique_ptr<uint8_t[]>> blocks;
+        uint64_t size = 0;
+    };
+
+    struct handle_t
+    {
+        std::shared_ptr<file_t> file;
+        std::wstring path;
+        uint64_t pos = 0;
+        bool can_read = false;
+        bool can_write = false;
+        bool append = false;
+        bool delete_on_close = false;
+    };
+
+    mutable std::mutex mtx_;
+    std::map<std::wstring, std::shared_ptr<file_t>> files_;
+    // Duplicated handles share one handle_t, and so the file position
+    std::map<uint32_t, std::shared_ptr<handle_t>> handles_;
+    std::vector<std::wstring> prefixes_;
+    uint32_t next_handle_ = 1;
+    uint64_t reads_ = 0;
+    uint64_t writes_ = 0;
+
+    static void resize(file_t& f, uint64_t size)
+    {
+        size_t nblocks = (size_t)((size + BLOCK_SIZE - 1) / BLOCK_SIZE);
+        if (size < f.size)
+        {
+            // Zero the discarded tail of the last kept block so a later
+            // extension reads zeros
+            size_t in_block = (size_t)(size % BLOCK_SIZE);
+            if (in_block != 0)
+                memset(f.blocks[nblocks - 1].get() + in_block, 0, BLOCK_SIZE - in_block);
+            f.blocks.resize(nblocks);
+        }
+        while (f.blocks.size() < nblocks)
+            f.blocks.emplace_back(new uint8_t[BLOCK_SIZE]());
+        f.size = size;
+    }
+
+    static size_t read_at(const file_t& f, uint64_t off, void* buf, size_t n)
+    {
+        if (off >= f.size)
+            return 0;
+        if (n > f.size - off)
+            n = (size_t)(f.size - off);
+        uint8_t* out = (uint8_t*)buf;
+        for (size_t done = 0; done < n; )
+        {
+            size_t in_block = (size_t)((off + done) % BLOCK_SIZE);
+            size_t chunk = BLOCK_SIZE - in_block;
+            if (chunk > n - done)
+                chunk = n - done;
+            memcpy(out + done, f.blocks[(size_t)((off + done) / BLOCK_SIZE)].get() + in_block, chunk);
+            done += chunk;
+        }
+        return n;
+    }
+
+    static void write_at(file_t& f, uint64_t off, const void* buf, size_t n)
+    {
+        if (off + n > f.size)
+            resize(f, off + n);
+        const uint8_t* in = (const uint8_t*)buf;
+        for (size_t done = 0; done < n; )
+        {
+            size_t in_block = (size_t)((off + done) % BLOCK_SIZE);
+            size_t chunk = BLOCK_SIZE - in_block;
+            if (chunk > n - done)
+                chunk = n - done;
+            memcpy(f.blocks[(size_t)((off + done) / BLOCK_SIZE)].get() + in_block, in + done, chunk);
+            done += chunk;
+        }
+    }
+
+    handle_t* find_handle(uint32_t h)
+    {
+        auto p = handles_.find(h);
+        return p == handles_.end() ? nullptr : p->second.get();
+    }
+
+public:
+    static std::wstring normalize(const wchar_t* path)
+    {
+        std::wstring s;
+        s.reserve(wcslen(path));
+        for (const wchar_t* p = path; *p != 0; ++p)
+        {
+            wchar_t c = *p == L'/' ? L'\\' : (wchar_t)towlower(*p);
+            // Collapse repeated separators
+            if (c == L'\\' && !s.empty() && s.back() == L'\\' && s.size() > 1)
+                continue;
+            s.push_back(c);
+        }
+        return s;
+    }
+
+    // Paths in any of these directories belong to the store
+    void add_prefix(const wchar_t* prefix)
+    {
+        std::wstring p = normalize(prefix);
+        while (p.size() > 1 && p.back() == L'\\')
+            p.pop_back();
+        std::lock_guard<std::mutex> lock(mtx_);
+        prefixes_.push_back(std::move(p));
+    }
+
+    // A prefix only matches whole path components: c:/db holds c:/db/x.i64
+    // but not c:/db2/x.i64
+    bool matches(const wchar_t* path) const
+    {
+        std::wstring n = normalize(path);
+        std::lock_guard<std::mutex> lock(mtx_);
+        for (const std::wstring& p : prefixes_)
+        {
+            if (n.compare(0, p.size(), p) != 0)
+                continue;
+            if (n.size() == p.size() || n[p.size()] == L'\\' || p.back() == L'\\')
+                return true;
+        }
+        return false;
+    }
+
+    bool exists(const wchar_t* path) const
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return files_.find(normalize(path)) != files_.end();
+    }
+
+    bool file_size(const wchar_t* path, uint64_t* size) const
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto p = files_.find(normalize(path));
+        if (p == files_.end())
+            return false;
+        *size = p->second->size;
+        return true;
+    }
+
+    //
+    // Host side: stage inputs and collect outputs without touching the disk
+    //
+
+    void preload(const wchar_t* path, const void* data, size_t size)
+    {
+        auto f = std::make_shared<file_t>();
+        write_at(*f, 0, data, size);
+        std::lock_guard<std::mutex> lock(mtx_);
+        files_[normalize(path)] = std::move(f);
+    }
+
+    bool extract(const wchar_t* path, std::vector<uint8_t>* out) const
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto p = files_.find(normalize(path));
+        if (p == files_.end())
+            return false;
+        out->resize((size_t)p->second->size);
+        read_at(*p->second, 0, out->data(), out->size());
+        return true;
+    }
+
+    std::vector<std::wstring> list() const
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        std::vector<std::wstring> names;
+        for (const auto& f : files_)
+            names.push_back(f.first);
+        return names;
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        files_.clear();
+    }
+
+    stats_t stats() const
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        stats_t st;
+        st.files = files_.size();
+        for (const auto& f : files_)
+        {
+            st.bytes += f.second->size;
+            st.blocks_bytes += f.second->blocks.size() * BLOCK_SIZE;
+        }
+        st.reads = reads_;
+        st.writes = writes_;
+        return st;
+    }
+
+    //
+    // Provider side: handle based file API
+    //
+
+    // Returns st_ok or st_exists (the file was already there) on success
+    status_e open(
+        const wchar_t* path,
+        open_mode_e mode,
+        bool can_read,
+        bool can_write,
+        bool append,
+        bool delete_on_close,
+        uint32_t* h)
+    {
+        std::wstring key = normalize(path);
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto p = files_.find(key);
+        bool existed = p != files_.end();
+        std::shared_ptr<file_t> f;
+        switch (mode)
+        {
+            case open_existing:
+            case truncate_existing:
+                if (!existed)
+                    return st_not_found;
+                f = p->second;
+                if (mode == truncate_existing)
+                    resize(*f, 0);
+                break;
+            case create_new:
+                if (existed)
+                    return st_exists;
+                [[fallthrough]];
+            case open_always:
+            case create_always:
+                if (existed)
+                {
+                    f = p->second;
+                    if (mode == create_always)
+                        resize(*f, 0);
+                }
+                else
+                {
+                    f = std::make_shared<file_t>();
+                    files_[key] = f;
+                }
+                break;
+        }
+
+        uint32_t id = next_handle_++;
+        auto hp = std::make_shared<handle_t>();
+        handles_[id] = hp;
+        handle_t& hd = *hp;
+        hd.file = std::move(f);
+        hd.path = std::move(key);
+        hd.can_read = can_read;
+        hd.can_write = can_write;
+        hd.append = append;
+        hd.delete_on_close = delete_on_close;
+        *h = id;
+        return existed && mode != open_existing && mode != truncate_existing ? st_exists : st_ok;
+    }
+
+    bool is_handle(uint32_t h) const
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return handles_.find(h) != handles_.end();
+    }
+
+    status_e read(uint32_t h, void* buf, size_t n, size_t* nread, const uint64_t* at = nullptr)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        handle_t* hd = find_handle(h);
+        if (hd == nullptr)
+            return st_bad_handle;
+        if (!hd->can_read)
+            return st_access_denied;
+        uint64_t pos = at != nullptr ? *at : hd->pos;
+        *nread = read_at(*hd->file, pos, buf, n);
+        hd->pos = pos + *nread;
+        ++reads_;
+        return st_ok;
+    }
+
+    status_e write(uint32_t h, const void* buf, size_t n, const uint64_t* at = nullptr)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        handle_t* hd = find_handle(h);
+        if (hd == nullptr)
+            return st_bad_handle;
+        if (!hd->can_write)
+            return st_access_denied;
+        uint64_t pos = at != nullptr ? *at : (hd->append ? hd->file->size : hd->pos);
+        write_at(*hd->file, pos, buf, n);
+        hd->pos = pos + n;
+        ++writes_;
+        return st_ok;
+    }
+
+    // `whence`: 0 = begin, 1 = current, 2 = end
+    status_e seek(uint32_t h, int64_t dist, int whence, uint64_t* newpos)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        handle_t* hd = find_handle(h);
+        if (hd == nullptr)
+            return st_bad_handle;
+        int64_t base = whence == 0 ? 0 : whence == 1 ? (int64_t)hd->pos : (int64_t)hd->file->size;
+        if (base + dist < 0)
+            return st_access_denied;
+        hd->pos = (uint64_t)(base + dist);
+        if (newpos != nullptr)
+            *newpos = hd->pos;
+        return st_ok;
+    }
+
+    status_e size(uint32_t h, uint64_t* size)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        handle_t* hd = find_handle(h);
+        if (hd == nullptr)
+            return st_bad_handle;
+        *size = hd->file->size;
+        return st_ok;
+    }
+
+    // Truncates or extends the file to the current position
+    status_e set_end(uint32_t h)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        handle_t* hd = find_handle(h);
+        if (hd == nullptr)
+            return st_bad_handle;
+        if (!hd->can_write)
+            return st_access_denied;
+        resize(*hd->file, hd->pos);
+        return st_ok;
+    }
+
+    // A second handle to the same open file, sharing its position
+    status_e duplicate(uint32_t h, uint32_t* out)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto p = handles_.find(h);
+        if (p == handles_.end())
+            return st_bad_handle;
+        uint32_t id = next_handle_++;
+        handles_[id] = p->second;
+        *out = id;
+        return st_ok;
+    }
+
+    // The open file behind a handle, for the provider-side shims
+    status_e info(uint32_t h, std::wstring* path, bool* can_write)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        handle_t* hd = find_handle(h);
+        if (hd == nullptr)
+            return st_bad_handle;
+        if (path != nullptr)
+            *path = hd->path;
+        if (can_write != nullptr)
+            *can_write = hd->can_write;
+        return st_ok;
+    }
+
+    // Copies up to `n` bytes from `off` without moving the handle's position
+    status_e read_snapshot(uint32_t h, uint64_t off, void* buf, size_t n, size_t* nread)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        handle_t* hd = find_handle(h);
+        if (hd == nullptr)
+            return st_bad_handle;
+        *nread = read_at(*hd->file, off, buf, n);
+        return st_ok;
+    }
+
+    status_e close(uint32_t h)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto p = handles_.find(h);
+        if (p == handles_.end())
+            return st_bad_handle;
+        std::shared_ptr<handle_t> hd = std::move(p->second);
+        handles_.erase(p);
+        // The last duplicate deletes
+        if (hd->delete_on_close && hd.use_count() == 1)
+        {
+            auto f = files_.find(hd->path);
+            if (f != files_.end() && f->second == hd->file)
+                files_.erase(f);
+        }
+        return st_ok;
+    }
+
+    // Open handles keep a removed file's data alive until they are closed
+    bool remove(const wchar_t* path)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return files_.erase(normalize(path)) != 0;
+    }
+
+    status_e rename(const wchar_t* from, const wchar_t* to, bool replace)
+    {
+        std::wstring src = normalize(from);
+        std::wstring dst = normalize(to);
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto p = files_.find(src);
+        if (p == files_.end())
+            return st_not_found;
+        if (!replace && files_.find(dst) != files_.end())
+            return st_exists;
+        std::shared_ptr<file_t> f = p->second;
+        files_.erase(p);
+        files_[dst] = std::move(f);
+        return st_ok;
+    }
+};
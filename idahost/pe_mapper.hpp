@@ -1,202 +1,294 @@
 #pragma once
 
 #include <Windows.h>
-
-class PEMapper 
+#include <stdio.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "idahost_hash.h"
+#include "idahost_shared_region.h"
+#include "idahost_large_pages.h"
+#include "idahost_pe_image.h"
+
+// Maps and runs a PE image of the flavour `Traits` (see idahost_pe_image.h).
+// The headers are parsed once on construction; the mapping stages work from
+// that layout.
+template <typename Traits>
+class PEMapperT
 {
 public:
+    // On entry *addr holds the default resolution of the import. Returns true
+    // if the callback replaced it.
     using ResolveImportProto = bool(*)(void *ud, LPCSTR lib_name, HMODULE lib_handle, LPCSTR sym_name, DWORD64 *addr);
 
 private:
+    using thunk_t = typename Traits::thunk_t;
+    using layout_t = pe_image::layout_t<Traits>;
+
     BYTE* pe_content_;
     size_t pe_size_;
+    layout_t layout_;
+    bool parsed_ = false;
     void* base_ = nullptr;
     DWORD64 entry_point_ = 0;
     bool owns_memory_ = false;
-    const char* current_imported_library_ = nullptr;
 
     ResolveImportProto ResolveImport_ = nullptr;
     void* ResolveImport_ud_ = nullptr;
 
-    IMAGE_NT_HEADERS* GetNtHeaders()
+    // Shared mode: the relocated image comes from a region shared by all
+    // processes mapping the same file at the same base
+    std::string shared_name_;
+    DWORD64 shared_base_ = 0;
+    shared_region_t shared_;
+
+    // Large-page mode: the image is assembled from separate allocations
+    struct Piece
     {
-        IMAGE_DOS_HEADER* dos_header = (IMAGE_DOS_HEADER*)pe_content_;
-        return (IMAGE_NT_HEADERS*)(pe_content_ + dos_header->e_lfanew);
-    }
+        BYTE* address;
+        size_t size;
+        bool large;
+    };
+    bool large_pages_ = false;
+    std::vector<Piece> pieces_;
+    size_t large_page_bytes_ = 0;
 
     bool MapPE()
     {
-        base_ = AllocateAndMapHeaders();
-        if (base_ == nullptr)
+        if (!parsed_)
             return false;
+        if (!shared_name_.empty() && MapShared())
+        {
+            // Relocated by the region's creator; the IAT writes below only
+            // make the pages holding it private
+            if (!LoadImports())
+                return false;
+        }
+        else
+        {
+            base_ = AllocateImage();
+            if (base_ == nullptr)
+                return false;
 
-        if (!MapSections())
-            return false;
+            if (!MapSections((BYTE*)base_))
+                return false;
 
-        if (!LoadImports())
-            return false;
+            if (!LoadImports())
+                return false;
 
-        ApplyBaseRelocations();
+            ApplyBaseRelocations((BYTE*)base_, (DWORD64)base_);
+        }
         SetSectionProtections();
 
-        entry_point_ = GetNtHeaders()->OptionalHeader.AddressOfEntryPoint + (DWORD64)base_;
+        entry_point_ = layout_.entry_rva + (DWORD64)base_;
         return true;
     }
 
-    void* AllocateAndMapHeaders()
+    void* AllocateImage()
     {
-        IMAGE_NT_HEADERS* nt_headers = GetNtHeaders();
-        DWORD image_size = nt_headers->OptionalHeader.SizeOfImage;
-        void* base = ::VirtualAlloc(NULL, image_size, MEM_RESERVE | MEM_COMMIT, PAGE_EXECUTE_READWRITE);
-        if (!base) 
-            return nullptr;
-
-        DWORD header_size = nt_headers->OptionalHeader.SizeOfHeaders;
-        memcpy(base, pe_content_, header_size);
+        DWORD image_size = layout_.image_size;
+        void* base = large_pages_ ? AllocateLargePageImage(image_size) : nullptr;
+        if (base == nullptr)
+            base = ::VirtualAlloc(NULL, image_size, MEM_RESERVE | MEM_COMMIT, PAGE_EXECUTE_READWRITE);
         return base;
     }
 
-    bool MapSections() 
+    // Puts whole large pages over the code, with ordinary pages for the rest
+    // of the image right next to them. Large pages keep the read/write/execute
+    // protection they were allocated with, so only code, which is what the
+    // iTLB sees, goes there; headers and read-only data keep their own
+    // protection on ordinary pages
+    void* AllocateLargePageImage(DWORD image_size)
     {
-        IMAGE_NT_HEADERS* nt_headers = GetNtHeaders();
-        IMAGE_SECTION_HEADER* section_table = IMAGE_FIRST_SECTION(nt_headers);
-        DWORD section_count = nt_headers->FileHeader.NumberOfSections;
+        size_t large = large_pages::minimum();
+        if (large == 0 || !large_pages::enable_privilege())
+            return nullptr;
 
-        for (DWORD i = 0; i < section_count; ++i) 
+        DWORD align = layout_.section_alignment;
+
+        std::vector<std::pair<uint64_t, uint64_t>> eligible;
+        for (const pe_image::section_t& sec : layout_.sections)
         {
-            memcpy(
-                (BYTE*)base_ + section_table[i].VirtualAddress,
-                pe_content_ + section_table[i].PointerToRawData,
-                section_table[i].SizeOfRawData);
+            if ((sec.characteristics & pe_image::SCN_MEM_EXECUTE) == 0)
+                continue;
+            uint64_t start = sec.rva;
+            uint64_t size = ((uint64_t)sec.virtual_size + align - 1) / align * align;
+            eligible.push_back({ start, start + size });
         }
-        return true;
-    }
 
-    bool LoadImports() 
-    {
-        IMAGE_NT_HEADERS* nt_headers = GetNtHeaders();
-        IMAGE_DATA_DIRECTORY* import_data_dir = &nt_headers->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_IMPORT];
-        IMAGE_IMPORT_DESCRIPTOR* import_descriptor = (IMAGE_IMPORT_DESCRIPTOR*)((BYTE*)base_ + import_data_dir->VirtualAddress);
+        std::vector<large_pages::range_t> plan = large_pages::plan(eligible, image_size, large);
+        if (std::none_of(plan.begin(), plan.end(), [](const large_pages::range_t& r) { return r.large; }))
+            return nullptr;
 
-        while (import_descriptor->Name) 
+        // The free range found can be taken before it is filled; try again
+        for (int attempt = 0; attempt < 3; ++attempt)
         {
-            LPCSTR library_name = (LPCSTR)((BYTE*)base_ + import_descriptor->Name);
-            current_imported_library_ = library_name;
-            HMODULE library_handle = GetModuleHandleA(library_name);
-            if (!library_handle)
-                library_handle = ::LoadLibraryA(library_name);
-
-            if (!library_handle) 
+            BYTE* base = (BYTE*)large_pages::find_free_range(image_size, large);
+            if (base == nullptr)
+                return nullptr;
+            bool ok = true;
+            for (const large_pages::range_t& r : plan)
             {
-                err = err_load_library;
-                return false;
+                large_pages::kind_e kind;
+                BYTE* p = (BYTE*)large_pages::alloc_at(base + r.offset, (size_t)r.size, r.large, &kind);
+                if (p == nullptr)
+                {
+                    ok = false;
+                    break;
+                }
+                pieces_.push_back({ p, (size_t)r.size, kind == large_pages::kind_large });
+                if (r.large && kind != large_pages::kind_large)
+                {
+                    ok = false;
+                    break;
+                }
             }
-            
-            if (!ResolveImports(library_handle, import_descriptor))
-                return false;
-
-            ++import_descriptor;
+            if (ok)
+            {
+                for (const Piece& piece : pieces_)
+                    large_page_bytes_ += piece.large ? piece.size : 0;
+                return base;
+            }
+            FreePieces();
         }
-        return true;
+        return nullptr;
     }
 
-    bool ResolveImports(
-        HMODULE library_handle, 
-        IMAGE_IMPORT_DESCRIPTOR* import_descriptor) 
+    void FreePieces()
     {
-        IMAGE_THUNK_DATA64* thunk = (IMAGE_THUNK_DATA64*)((BYTE*)base_ + import_descriptor->FirstThunk);
-        while (*(DWORD64*)thunk) 
-        {
-            if (*(DWORD64*)thunk & ((DWORD64)1 << 63)) 
-            {  
-                // Import by ordinal?
-                *(DWORD64*)thunk = (DWORD64)::GetProcAddress(library_handle, (LPCSTR)(*(DWORD64*)thunk & 0xFFFF));
-            }
-            else 
-            {  
-                // Import by name
-                DWORD64* func_address = (DWORD64*)((BYTE*)base_ + *(DWORD64*)thunk + sizeof(WORD));
-                const char* func_name = (LPCSTR)func_address;
-                DWORD64 addr = 0;
-                if (   ResolveImport_ == nullptr 
-                    || !ResolveImport_(ResolveImport_ud_, current_imported_library_, library_handle, func_name, &addr))
-                {
-                    addr = (DWORD64)::GetProcAddress(library_handle, func_name);
-                }
-                *(DWORD64*)thunk = addr;
-                    
-            }
-            ++thunk;
-        }
-        return true;
+        for (const Piece& piece : pieces_)
+            large_pages::free(piece.address, piece.size);
+        pieces_.clear();
+        large_page_bytes_ = 0;
     }
 
-    void ApplyBaseRelocations() 
+    // Large pages keep their allocation-time protection, and a protection
+    // change cannot span separate allocations
+    void ProtectRange(BYTE* address, SIZE_T size, DWORD prot)
     {
-        IMAGE_NT_HEADERS* nt_headers = GetNtHeaders();
-        DWORD64 base_difference = (DWORD64)base_ - nt_headers->OptionalHeader.ImageBase;
-        if (base_difference == 0)
+        DWORD old_protection;
+        if (pieces_.empty())
+        {
+            ::VirtualProtect(address, size, prot, &old_protection);
             return;
+        }
+        for (const Piece& piece : pieces_)
+        {
+            if (piece.large)
+                continue;
+            BYTE* s = (std::max)(address, piece.address);
+            BYTE* e = (std::min)(address + size, piece.address + piece.size);
+            if (s < e)
+                ::VirtualProtect(s, e - s, prot, &old_protection);
+        }
+    }
 
-        IMAGE_DATA_DIRECTORY* relocation_data_dir = &nt_headers->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_BASERELOC];
-        IMAGE_BASE_RELOCATION* relocation = (IMAGE_BASE_RELOCATION*)((BYTE*)base_ + relocation_data_dir->VirtualAddress);
+    // Copies the headers and sections of the file into `image`
+    bool MapSections(BYTE* image)
+    {
+        return pe_image::map_sections(layout_, pe_content_, pe_size_, image);
+    }
 
-        while (relocation->SizeOfBlock) 
+    bool LoadImports()
+    {
+        LPCSTR library_name = nullptr;
+        HMODULE library_handle = nullptr;
+        auto on_library = [&](const char* name) -> void*
         {
-            WORD* reloc = (WORD*)(relocation + 1);
-            for (DWORD i = 0, n = (relocation->SizeOfBlock - sizeof(IMAGE_BASE_RELOCATION)) / sizeof(WORD);
-                 i < n; 
-                 ++i) 
+            library_name = name;
+            library_handle = GetModuleHandleA(name);
+            if (!library_handle)
+                library_handle = ::LoadLibraryA(name);
+            if (!library_handle)
+                err = err_load_library;
+            return library_handle;
+        };
+        auto on_symbol = [&](void*, const char* func_name, uint16_t ordinal, thunk_t* thunk)
+        {
+            if (func_name == nullptr)
             {
-                if (reloc[i] >> 12 == IMAGE_REL_BASED_DIR64) 
-                {
-                    DWORD64* patch_addr = (DWORD64*)((BYTE*)base_ + relocation->VirtualAddress + (reloc[i] & 0xFFF));
-                    *patch_addr += base_difference;
-                }
+                *thunk = (thunk_t)::GetProcAddress(library_handle, (LPCSTR)(ULONG_PTR)ordinal);
+                return true;
             }
-            relocation = (IMAGE_BASE_RELOCATION*)((BYTE*)relocation + relocation->SizeOfBlock);
-        }
+            DWORD64 addr = (DWORD64)::GetProcAddress(library_handle, func_name);
+            if (ResolveImport_ != nullptr)
+                ResolveImport_(ResolveImport_ud_, library_name, library_handle, func_name, &addr);
+            *thunk = (thunk_t)addr;
+            return true;
+        };
+        return pe_image::walk_imports(layout_, (uint8_t*)base_, false, on_library, on_symbol);
     }
 
-    void SetSectionProtections()
+    // Relocates the image at `image` to run at `load_base`
+    void ApplyBaseRelocations(BYTE* image, DWORD64 load_base)
     {
-        IMAGE_NT_HEADERS* nt_headers = GetNtHeaders();
-        IMAGE_SECTION_HEADER* section_table = IMAGE_FIRST_SECTION(nt_headers);
-        DWORD section_count = nt_headers->FileHeader.NumberOfSections;
+        pe_image::relocate(layout_, image, load_base);
+    }
 
-        for (DWORD i = 0; i < section_count; ++i)
+    void SetSectionProtections()
+    {
+        for (const pe_image::section_t& sec : layout_.sections)
         {
             DWORD vm_prot = PAGE_NOACCESS;  // Start with no access as default
-            auto sec_prot = section_table[i].Characteristics;
+            auto sec_prot = sec.characteristics;
 
-            if ((sec_prot & IMAGE_SCN_MEM_EXECUTE) &&
-                (sec_prot & IMAGE_SCN_MEM_READ) &&
-                (sec_prot & IMAGE_SCN_MEM_WRITE)) {
+            if ((sec_prot & pe_image::SCN_MEM_EXECUTE) &&
+                (sec_prot & pe_image::SCN_MEM_READ) &&
+                (sec_prot & pe_image::SCN_MEM_WRITE)) {
                 vm_prot = PAGE_EXECUTE_READWRITE;
             }
-            else if ((sec_prot & IMAGE_SCN_MEM_EXECUTE) &&
-                (sec_prot & IMAGE_SCN_MEM_READ)) {
+            else if ((sec_prot & pe_image::SCN_MEM_EXECUTE) &&
+                (sec_prot & pe_image::SCN_MEM_READ)) {
                 vm_prot = PAGE_EXECUTE_READ;
             }
-            else if (sec_prot & IMAGE_SCN_MEM_EXECUTE) {
+            else if (sec_prot & pe_image::SCN_MEM_EXECUTE) {
                 vm_prot = PAGE_EXECUTE;
             }
-            else if ((sec_prot & IMAGE_SCN_MEM_READ) &&
-                (sec_prot & IMAGE_SCN_MEM_WRITE)) {
+            else if ((sec_prot & pe_image::SCN_MEM_READ) &&
+                (sec_prot & pe_image::SCN_MEM_WRITE)) {
                 vm_prot = PAGE_READWRITE;
             }
-            else if (sec_prot & IMAGE_SCN_MEM_READ) {
+            else if (sec_prot & pe_image::SCN_MEM_READ) {
                 vm_prot = PAGE_READONLY;
             }
 
-            DWORD old_protection;
-            ::VirtualProtect(
-                (BYTE*)base_ + section_table[i].VirtualAddress, 
-                section_table[i].SizeOfRawData, 
-                vm_prot, 
-                &old_protection);
+            // Views of the shared image can only be written copy-on-write
+            if (shared_.base() != nullptr)
+            {
+                if (vm_prot == PAGE_EXECUTE_READWRITE)
+                    vm_prot = PAGE_EXECUTE_WRITECOPY;
+                else if (vm_prot == PAGE_READWRITE)
+                    vm_prot = PAGE_WRITECOPY;
+            }
+
+            ProtectRange(
+                (BYTE*)base_ + sec.rva,
+                sec.raw_size,
+                vm_prot);
         }
     }
+    static bool PopulateShared(void* ud, void* dst, size_t)
+    {
+        PEMapperT* self = (PEMapperT*)ud;
+        BYTE* image = (BYTE*)dst;
+        if (!self->MapSections(image))
+            return false;
+        self->ApplyBaseRelocations(image, self->shared_base_);
+        return true;
+    }
+
+    bool MapShared()
+    {
+        // Same file contents and base -> same region
+        hash128_t h = hash128(pe_content_, pe_size_, shared_base_);
+        char name[128];
+        sprintf_s(name, "%s_%016llx%016llx", shared_name_.c_str(), h.hi, h.lo);
+        if (!shared_.open(name, layout_.image_size, (void*)shared_base_, PopulateShared, this))
+            return false;
+        base_ = shared_.base();
+        return true;
+    }
+
 public:
     enum err_e
     {
@@ -216,18 +308,121 @@ public:
         ResolveImport_ud_ = ud;
     }
 
-    explicit PEMapper(BYTE* content, size_t size) : 
-        pe_content_(content), pe_size_(size), owns_memory_(false) 
+    // Maps the image from a region named after `name` and the file contents,
+    // relocated for `base`, that all processes doing the same share. Falls
+    // back to a private copy if `base` is not free.
+    void SetSharedImage(const char* name, DWORD64 base)
+    {
+        shared_name_ = name;
+        shared_base_ = base;
+    }
+
+    // Backs the executable sections with large pages where whole large pages
+    // fit; headers and data stay on ordinary pages. Needs
+    // SeLockMemoryPrivilege; without it, or without free large pages, the
+    // image is mapped as usual. Not used for shared images.
+    void SetLargePages(bool enable) {
+        large_pages_ = enable;
+    }
+
+    size_t LargePageBytes() const {
+        return large_page_bytes_;
+    }
+
+    // The file read by CreateFromFile; kept for the mapper's lifetime
+    size_t FileBufferBytes() const {
+        return owns_memory_ ? pe_size_ : 0;
+    }
+
+    bool IsShared() const {
+        return shared_.base() != nullptr;
+    }
+
+    struct SectionSharing
+    {
+        std::string name;
+        DWORD64 address;
+        size_t size;
+        shared_region_t::sharing_t pages;
+    };
+
+    // Resident pages of the headers and each section, shared with other
+    // processes or private to this one
+    bool QuerySharing(std::vector<SectionSharing>* out)
+    {
+        if (base_ == nullptr)
+            return false;
+        out->clear();
+        SectionSharing hdr = { "(headers)", (DWORD64)base_, layout_.header_size };
+        if (!shared_region_t::query_sharing(base_, hdr.size, &hdr.pages))
+            return false;
+        out->push_back(hdr);
+        for (const pe_image::section_t& s : layout_.sections)
+        {
+            SectionSharing sec;
+            sec.name.assign(s.name, strnlen(s.name, sizeof(s.name)));
+            sec.address = (DWORD64)base_ + s.rva;
+            sec.size = s.virtual_size;
+            if (!shared_region_t::query_sharing((void*)sec.address, sec.size, &sec.pages))
+                return false;
+            out->push_back(sec);
+        }
+        return true;
+    }
+
+    // Routes the by-name imports of an already loaded module through
+    // `ResolveImport` and patches its IAT with the replacements
+    static bool HookModuleImports(HMODULE module, ResolveImportProto ResolveImport, void* ud)
+    {
+        // The loader already checked the headers of a module it mapped
+        layout_t layout;
+        if (!pe_image::parse((const void*)module, SIZE_MAX, &layout))
+            return false;
+
+        LPCSTR library_name = nullptr;
+        HMODULE library_handle = nullptr;
+        auto on_library = [&](const char* name) -> void*
+        {
+            library_name = name;
+            library_handle = GetModuleHandleA(name);
+            return (void*)name;
+        };
+        auto on_symbol = [&](void*, const char* func_name, uint16_t, thunk_t* thunk)
+        {
+            if (func_name == nullptr)
+                return true;
+
+            DWORD64 addr = *thunk;
+            if (!ResolveImport(ud, library_name, library_handle, func_name, &addr) || addr == *thunk)
+                return true;
+
+            DWORD old_protection;
+            if (!::VirtualProtect(thunk, sizeof(thunk_t), PAGE_READWRITE, &old_protection))
+                return false;
+            *thunk = (thunk_t)addr;
+            ::VirtualProtect(thunk, sizeof(thunk_t), old_protection, &old_protection);
+            return true;
+        };
+        // The bound IAT no longer has the names; they are in the INT
+        return pe_image::walk_imports(layout, (uint8_t*)module, true, on_library, on_symbol);
+    }
+
+    explicit PEMapperT(BYTE* content, size_t size) :
+        pe_content_(content), pe_size_(size), owns_memory_(false)
     {
+        parsed_ = pe_image::parse(content, size, &layout_);
     }
 
-    ~PEMapper() 
+    ~PEMapperT()
     {
-        if (base_ != nullptr && owns_memory_)
+        // A shared view is unmapped by shared_
+        if (!pieces_.empty())
+            FreePieces();
+        else if (base_ != nullptr && owns_memory_ && base_ != shared_.base())
             ::VirtualFree(base_, 0, MEM_RELEASE);
     }
 
-    static PEMapper* CreateFromFile(const wchar_t* file_path, err_e *perr = nullptr)
+    static PEMapperT* CreateFromFile(const wchar_t* file_path, err_e *perr = nullptr)
     {
         err_e _err = err_none;
         err_e& err = perr ? *perr : _err;
@@ -270,7 +465,7 @@ public:
             return nullptr;
         }
 
-        PEMapper* mapper = new PEMapper(buffer, file_size);
+        PEMapperT* mapper = new PEMapperT(buffer, file_size);
         mapper->owns_memory_ = true;
 
         return mapper;
@@ -294,3 +489,5 @@ public:
         return entry_point();
     }
 };
+
+using PEMapper = PEMapperT<pe_image::native_traits>;
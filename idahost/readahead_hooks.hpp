@@ -0,0 +1,109 @@
+#pragma once
+
+#include <windows.h>
+#include <stdio.h>
+#include <string.h>
+#include "idahost_readahead.h"
+#include "idahost_metrics.h"
+
+// Observes the provider opening files so the read-ahead can tell how much of
+// each file was already cached at that moment. The shims only take notes and
+// then call whatever the import resolved to before, including other shims.
+namespace readahead_hooks
+{
+    inline readahead_t* g_readahead = nullptr;
+    // Set to the residency of the first file handed to the read-ahead
+    inline gauge_t* g_input_resident = nullptr;
+
+    typedef HANDLE (WINAPI* CreateFileW_fn)(LPCWSTR, DWORD, DWORD, LPSECURITY_ATTRIBUTES, DWORD, DWORD, HANDLE);
+    typedef FILE* (__cdecl* wfopen_fn)(const wchar_t*, const wchar_t*);
+    typedef FILE* (__cdecl* wfsopen_fn)(const wchar_t*, const wchar_t*, int);
+    typedef int (__cdecl* wopen_fn)(const wchar_t*, int, int);
+    typedef errno_t (__cdecl* wsopen_s_fn)(int*, const wchar_t*, int, int, int);
+
+    inline CreateFileW_fn next_CreateFileW = ::CreateFileW;
+    inline wfopen_fn next_wfopen = ::_wfopen;
+    inline wfsopen_fn next_wfsopen = ::_wfsopen;
+    inline wopen_fn next_wopen = nullptr;
+    inline wsopen_s_fn next_wsopen_s = ::_wsopen_s;
+
+    inline void on_open(const wchar_t* name)
+    {
+        if (g_readahead == nullptr || name == nullptr)
+            return;
+        wchar_t buf[MAX_PATH * 4];
+        DWORD len = GetFullPathNameW(name, _countof(buf), buf, nullptr);
+        if (len == 0 || len >= _countof(buf))
+            return;
+        double resident;
+        if (g_readahead->note_open(buf, &resident) == 0 && g_input_resident != nullptr)
+            g_input_resident->set(resident);
+    }
+
+    inline HANDLE WINAPI my_CreateFileW(
+        LPCWSTR name,
+        DWORD access,
+        DWORD share,
+        LPSECURITY_ATTRIBUTES sa,
+        DWORD disposition,
+        DWORD flags,
+        HANDLE tmpl)
+    {
+        on_open(name);
+        return next_CreateFileW(name, access, share, sa, disposition, flags, tmpl);
+    }
+
+    inline FILE* __cdecl my_wfopen(const wchar_t* name, const wchar_t* mode)
+    {
+        on_open(name);
+        return next_wfopen(name, mode);
+    }
+
+    inline FILE* __cdecl my_wfsopen(const wchar_t* name, const wchar_t* mode, int shflag)
+    {
+        on_open(name);
+        return next_wfsopen(name, mode, shflag);
+    }
+
+    // _wopen is variadic; on x64 passing the optional mode through is harmless
+    inline int __cdecl my_wopen(const wchar_t* name, int oflag, int pmode)
+    {
+        on_open(name);
+        return next_wopen(name, oflag, pmode);
+    }
+
+    inline errno_t __cdecl my_wsopen_s(int* fh, const wchar_t* name, int oflag, int shflag, int pmode)
+    {
+        on_open(name);
+        return next_wsopen_s(fh, name, oflag, shflag, pmode);
+    }
+
+    // Chains in front of whatever `*addr` currently resolves to
+    inline bool resolve_import(const char* sym_name, uint64_t* addr)
+    {
+        static const struct
+        {
+            const char* name;
+            const void* shim;
+            void** next;
+        } shims[] = {
+            { "CreateFileW",    (const void*)my_CreateFileW,    (void**)&next_CreateFileW },
+            { "_wfopen",        (const void*)my_wfopen,         (void**)&next_wfopen },
+            { "_wfsopen",       (const void*)my_wfsopen,        (void**)&next_wfsopen },
+            { "_wopen",         (const void*)my_wopen,          (void**)&next_wopen },
+            { "_wsopen_s",      (const void*)my_wsopen_s,       (void**)&next_wsopen_s },
+        };
+        if (g_readahead == nullptr || *addr == 0)
+            return false;
+        for (const auto& s : shims)
+        {
+            if (strcmp(sym_name, s.name) != 0)
+                continue;
+            if (*addr != (uint64_t)s.shim)
+                *s.next = (void*)*addr;
+            *addr = (uint64_t)s.shim;
+            return true;
+        }
+        return false;
+    }
+}
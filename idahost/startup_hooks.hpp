@@ -0,0 +1,274 @@
+#pragma once
+
+#include <windows.h>
+#include <string.h>
+#include <wchar.h>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "idahost_metrics.h"
+
+// Per-launch allow-lists for the plugins, loaders and processor modules the
+// kernel finds at startup. Directory listings of the plugins, loaders and
+// procs folders skip entries that are not allowed, and loading one of them
+// by path fails as if the file did not exist. Like the read-ahead shims these
+// chain to whatever the import resolved to before.
+namespace startup_hooks
+{
+    enum category_e
+    {
+        cat_plugins,
+        cat_loaders,
+        cat_procs,
+        cat_count,
+        cat_none = cat_count,
+    };
+
+    struct profile_t
+    {
+        // Lowercase file (or plugin folder) names without extension
+        std::vector<std::wstring> allowed[cat_count];
+        counter_t* hidden;              // entries left out of directory listings
+        counter_t* blocked;             // loads refused
+        latency_histogram_t* loads;     // allowed loads from the folders
+    };
+
+    inline profile_t* g_profile = nullptr;
+
+    typedef HANDLE (WINAPI* FindFirstFileW_fn)(LPCWSTR, LPWIN32_FIND_DATAW);
+    typedef HANDLE (WINAPI* FindFirstFileExW_fn)(LPCWSTR, FINDEX_INFO_LEVELS, LPVOID, FINDEX_SEARCH_OPS, LPVOID, DWORD);
+    typedef BOOL (WINAPI* FindNextFileW_fn)(HANDLE, LPWIN32_FIND_DATAW);
+    typedef BOOL (WINAPI* FindClose_fn)(HANDLE);
+    typedef HMODULE (WINAPI* LoadLibraryW_fn)(LPCWSTR);
+    typedef HMODULE (WINAPI* LoadLibraryExW_fn)(LPCWSTR, HANDLE, DWORD);
+
+    inline FindFirstFileW_fn next_FindFirstFileW = ::FindFirstFileW;
+    inline FindFirstFileExW_fn next_FindFirstFileExW = ::FindFirstFileExW;
+    inline FindNextFileW_fn next_FindNextFileW = ::FindNextFileW;
+    inline FindClose_fn next_FindClose = ::FindClose;
+    inline LoadLibraryW_fn next_LoadLibraryW = ::LoadLibraryW;
+    inline LoadLibraryExW_fn next_LoadLibraryExW = ::LoadLibraryExW;
+
+    // Open listings of a category folder
+    inline std::mutex g_mtx;
+    inline std::unordered_map<HANDLE, category_e> g_finds;
+
+    inline category_e category_of(const std::wstring& dir_name)
+    {
+        static const wchar_t* const names[cat_count] = { L"plugins", L"loaders", L"procs" };
+        for (int i = 0; i < cat_count; ++i)
+        {
+            if (_wcsicmp(dir_name.c_str(), names[i]) == 0)
+                return (category_e)i;
+        }
+        return cat_none;
+    }
+
+    // Splits "...\<category>\<entry>[\...]" into the category and the entry
+    inline category_e classify(const wchar_t* path, std::wstring* entry)
+    {
+        std::vector<std::wstring> parts;
+        std::wstring cur;
+        for (const wchar_t* p = path; ; ++p)
+        {
+            if (*p == L'\\' || *p == L'/' || *p == L'\0')
+            {
+                if (!cur.empty())
+                    parts.push_back(cur);
+                cur.clear();
+                if (*p == L'\0')
+                    break;
+            }
+            else
+            {
+                cur.push_back(*p);
+            }
+        }
+        for (size_t i = parts.size(); i-- > 1; )
+        {
+            category_e cat = category_of(parts[i - 1]);
+            if (cat != cat_none)
+            {
+                *entry = parts[i];
+                return cat;
+            }
+        }
+        return cat_none;
+    }
+
+    inline bool allowed(category_e cat, const wchar_t* name)
+    {
+        std::wstring stem(name);
+        size_t dot = stem.find_last_of(L'.');
+        if (dot != std::wstring::npos && dot != 0)
+            stem.resize(dot);
+        for (wchar_t& c : stem)
+            c = towlower(c);
+        if (stem == L"." || stem == L".." || stem.empty())
+            return true;
+        // The helper plugin is how the provider returns to the host
+        if (cat == cat_plugins && stem.compare(0, 7, L"idahost") == 0)
+            return true;
+        for (const std::wstring& a : g_profile->allowed[cat])
+        {
+            if (a == stem)
+                return true;
+        }
+        return false;
+    }
+
+    // Advances `h` past entries that are not allowed; false at the end
+    inline bool skip_hidden(HANDLE h, category_e cat, LPWIN32_FIND_DATAW data)
+    {
+        while (!allowed(cat, data->cFileName))
+        {
+            g_profile->hidden->add();
+            if (!next_FindNextFileW(h, data))
+                return false;
+        }
+        return true;
+    }
+
+    inline HANDLE on_find_first(HANDLE h, LPCWSTR pattern, LPWIN32_FIND_DATAW data)
+    {
+        if (h == INVALID_HANDLE_VALUE || pattern == nullptr)
+            return h;
+        // The folder being listed is the pattern's parent
+        std::wstring dir(pattern);
+        size_t sep = dir.find_last_of(L"\\/");
+        if (sep == std::wstring::npos)
+            return h;
+        dir.resize(sep);
+        sep = dir.find_last_of(L"\\/");
+        category_e cat = category_of(sep == std::wstring::npos ? dir : dir.substr(sep + 1));
+        if (cat == cat_none)
+            return h;
+
+        if (!skip_hidden(h, cat, data))
+        {
+            next_FindClose(h);
+            SetLastError(ERROR_FILE_NOT_FOUND);
+            return INVALID_HANDLE_VALUE;
+        }
+        std::lock_guard<std::mutex> lock(g_mtx);
+        g_finds[h] = cat;
+        return h;
+    }
+
+    inline HANDLE WINAPI my_FindFirstFileW(LPCWSTR pattern, LPWIN32_FIND_DATAW data)
+    {
+        return on_find_first(next_FindFirstFileW(pattern, data), pattern, data);
+    }
+
+    inline HANDLE WINAPI my_FindFirstFileExW(
+        LPCWSTR pattern,
+        FINDEX_INFO_LEVELS level,
+        LPVOID data,
+        FINDEX_SEARCH_OPS op,
+        LPVOID filter,
+        DWORD flags)
+    {
+        HANDLE h = next_FindFirstFileExW(pattern, level, data, op, filter, flags);
+        // Both info levels fill a WIN32_FIND_DATAW
+        return on_find_first(h, pattern, (LPWIN32_FIND_DATAW)data);
+    }
+
+    inline BOOL WINAPI my_FindNextFileW(HANDLE h, LPWIN32_FIND_DATAW data)
+    {
+        if (!next_FindNextFileW(h, data))
+            return FALSE;
+        category_e cat;
+        {
+            std::lock_guard<std::mutex> lock(g_mtx);
+            auto it = g_finds.find(h);
+            if (it == g_finds.end())
+                return TRUE;
+            cat = it->second;
+        }
+        if (skip_hidden(h, cat, data))
+            return TRUE;
+        SetLastError(ERROR_NO_MORE_FILES);
+        return FALSE;
+    }
+
+    inline BOOL WINAPI my_FindClose(HANDLE h)
+    {
+        {
+            std::lock_guard<std::mutex> lock(g_mtx);
+            g_finds.erase(h);
+        }
+        return next_FindClose(h);
+    }
+
+    // False if the profile refuses `name`; `*cat` tells whether to time it
+    inline bool may_load(LPCWSTR name, category_e* cat)
+    {
+        std::wstring entry;
+        *cat = name != nullptr ? classify(name, &entry) : cat_none;
+        if (*cat == cat_none || allowed(*cat, entry.c_str()))
+            return true;
+        g_profile->blocked->add();
+        SetLastError(ERROR_MOD_NOT_FOUND);
+        return false;
+    }
+
+    inline void loaded(category_e cat, uint64_t t0)
+    {
+        if (cat == cat_none)
+            return;
+        g_profile->loads->record(metrics_now_ns() - t0);
+    }
+
+    inline HMODULE WINAPI my_LoadLibraryW(LPCWSTR name)
+    {
+        category_e cat;
+        if (!may_load(name, &cat))
+            return nullptr;
+        uint64_t t0 = metrics_now_ns();
+        HMODULE mod = next_LoadLibraryW(name);
+        loaded(cat, t0);
+        return mod;
+    }
+
+    inline HMODULE WINAPI my_LoadLibraryExW(LPCWSTR name, HANDLE file, DWORD flags)
+    {
+        category_e cat;
+        if (!may_load(name, &cat))
+            return nullptr;
+        uint64_t t0 = metrics_now_ns();
+        HMODULE mod = next_LoadLibraryExW(name, file, flags);
+        loaded(cat, t0);
+        return mod;
+    }
+
+    // Chains in front of whatever `*addr` currently resolves to
+    inline bool resolve_import(const char* sym_name, uint64_t* addr)
+    {
+        static const struct
+        {
+            const char* name;
+            const void* shim;
+            void** next;
+        } shims[] = {
+            { "FindFirstFileW",     (const void*)my_FindFirstFileW,     (void**)&next_FindFirstFileW },
+            { "FindFirstFileExW",   (const void*)my_FindFirstFileExW,   (void**)&next_FindFirstFileExW },
+            { "FindNextFileW",      (const void*)my_FindNextFileW,      (void**)&next_FindNextFileW },
+            { "FindClose",          (const void*)my_FindClose,          (void**)&next_FindClose },
+            { "LoadLibraryW",       (const void*)my_LoadLibraryW,       (void**)&next_LoadLibraryW },
+            { "LoadLibraryExW",     (const void*)my_LoadLibraryExW,     (void**)&next_LoadLibraryExW },
+        };
+        if (g_profile == nullptr || *addr == 0)
+            return false;
+        for (const auto& s : shims)
+        {
+            if (strcmp(sym_name, s.name) != 0)
+                continue;
+            if (*addr != (uint64_t)s.shim)
+                *s.next = (void*)*addr;
+            *addr = (uint64_t)s.shim;
+            return true;
+        }
+        return false;
+    }
+}
@@ -0,0 +1,955 @@
+#pragma once
+
+#include <windows.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <io.h>
+#include <share.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "idahost_vfs.h"
+
+// Win32 file API shims that redirect paths under the store's prefixes to a
+// vfs_store_t. Only modules whose imports go through CanResolveImport are
+// redirected.
+//
+// The CRT does its I/O on real handles, so wide CRT opens of store files
+// (_wfopen, _wopen, _wsopen_s, ...) work on a temporary copy that is loaded
+// back into the store when the stream or descriptor is closed. Mappings of
+// store files are read-only snapshots.
+//
+// Paths under a prefix that the store does not know about are served from
+// the disk until they are created or overwritten, so inputs that were not
+// preloaded keep working.
+namespace vfs_hooks
+{
+    inline vfs_store_t* g_store = nullptr;
+
+    // Store handles: a tag no kernel handle or pseudo-handle can carry
+    constexpr uintptr_t HANDLE_TAG = (uintptr_t)0x5646 << 48;
+
+    inline HANDLE to_handle(uint32_t id) {
+        return (HANDLE)(HANDLE_TAG | ((uintptr_t)id << 2));
+    }
+
+    inline bool from_handle(HANDLE h, uint32_t* id)
+    {
+        uintptr_t v = (uintptr_t)h;
+        if (g_store == nullptr || (v & ~(uintptr_t)0xFFFFFFFFFFFF) != HANDLE_TAG)
+            return false;
+        *id = (uint32_t)(v >> 2);
+        return true;
+    }
+
+    inline bool owns_path(LPCWSTR name, std::wstring* full)
+    {
+        if (g_store == nullptr || name == nullptr)
+            return false;
+        wchar_t buf[MAX_PATH * 4];
+        DWORD len = GetFullPathNameW(name, _countof(buf), buf, nullptr);
+        if (len == 0 || len >= _countof(buf))
+            return false;
+        if (!g_store->matches(buf))
+            return false;
+        full->assign(buf, len);
+        return true;
+    }
+
+    inline BOOL fail(vfs_store_t::status_e st)
+    {
+        switch (st)
+        {
+            case vfs_store_t::st_not_found:     SetLastError(ERROR_FILE_NOT_FOUND); break;
+            case vfs_store_t::st_exists:        SetLastError(ERROR_FILE_EXISTS); break;
+            case vfs_store_t::st_bad_handle:    SetLastError(ERROR_INVALID_HANDLE); break;
+            default:                            SetLastError(ERROR_ACCESS_DENIED); break;
+        }
+        return FALSE;
+    }
+
+    inline bool on_disk(LPCWSTR name) {
+        return ::GetFileAttributesW(name) != INVALID_FILE_ATTRIBUTES;
+    }
+
+    // Moves a disk file into the store
+    inline bool load_file(LPCWSTR disk_path, const std::wstring& vpath)
+    {
+        HANDLE h = ::CreateFileW(disk_path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, 0, nullptr);
+        if (h == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER sz;
+        std::vector<uint8_t> data;
+        bool ok = ::GetFileSizeEx(h, &sz) != FALSE;
+        if (ok)
+        {
+            data.resize((size_t)sz.QuadPart);
+            for (size_t done = 0; ok && done < data.size(); )
+            {
+                DWORD chunk = (DWORD)(std::min)(data.size() - done, (size_t)(64 << 20));
+                DWORD got = 0;
+                ok = ::ReadFile(h, data.data() + done, chunk, &got, nullptr) && got != 0;
+                done += got;
+            }
+        }
+        ::CloseHandle(h);
+        if (ok)
+            g_store->preload(vpath.c_str(), data.data(), data.size());
+        return ok;
+    }
+
+    // Writes a store file out to the disk
+    inline bool save_file(const std::wstring& vpath, LPCWSTR disk_path, bool replace)
+    {
+        std::vector<uint8_t> data;
+        if (!g_store->extract(vpath.c_str(), &data))
+        {
+            SetLastError(ERROR_FILE_NOT_FOUND);
+            return false;
+        }
+        HANDLE h = ::CreateFileW(disk_path, GENERIC_WRITE, 0, nullptr, replace ? CREATE_ALWAYS : CREATE_NEW, 0, nullptr);
+        if (h == INVALID_HANDLE_VALUE)
+            return false;
+        bool ok = true;
+        for (size_t done = 0; ok && done < data.size(); )
+        {
+            DWORD chunk = (DWORD)(std::min)(data.size() - done, (size_t)(64 << 20));
+            DWORD put = 0;
+            ok = ::WriteFile(h, data.data() + done, chunk, &put, nullptr) && put == chunk;
+            done += put;
+        }
+        ::CloseHandle(h);
+        return ok;
+    }
+
+    inline HANDLE WINAPI my_CreateFileW(
+        LPCWSTR name,
+        DWORD access,
+        DWORD share,
+        LPSECURITY_ATTRIBUTES sa,
+        DWORD disposition,
+        DWORD flags,
+        HANDLE tmpl)
+    {
+        std::wstring full;
+        if (!owns_path(name, &full))
+            return ::CreateFileW(name, access, share, sa, disposition, flags, tmpl);
+
+        vfs_store_t::open_mode_e mode;
+        switch (disposition)
+        {
+            case CREATE_NEW:        mode = vfs_store_t::create_new; break;
+            case CREATE_ALWAYS:     mode = vfs_store_t::create_always; break;
+            case OPEN_EXISTING:     mode = vfs_store_t::open_existing; break;
+            case OPEN_ALWAYS:       mode = vfs_store_t::open_always; break;
+            case TRUNCATE_EXISTING: mode = vfs_store_t::truncate_existing; break;
+            default:
+                SetLastError(ERROR_INVALID_PARAMETER);
+                return INVALID_HANDLE_VALUE;
+        }
+
+        // Fall back to the disk for files the store has never seen
+        if (mode != vfs_store_t::create_new
+            && mode != vfs_store_t::create_always
+            && !g_store->exists(full.c_str())
+            && on_disk(full.c_str()))
+        {
+            return ::CreateFileW(name, access, share, sa, disposition, flags, tmpl);
+        }
+
+        const DWORD write_bits = GENERIC_WRITE | GENERIC_ALL | FILE_WRITE_DATA;
+        bool can_read = (access & (GENERIC_READ | GENERIC_ALL | FILE_READ_DATA)) != 0;
+        bool can_write = (access & (write_bits | FILE_APPEND_DATA)) != 0;
+        bool append = (access & FILE_APPEND_DATA) != 0 && (access & write_bits) == 0;
+
+        uint32_t id;
+        vfs_store_t::status_e st = g_store->open(
+            full.c_str(),
+            mode,
+            can_read,
+            can_write,
+            append,
+            (flags & FILE_FLAG_DELETE_ON_CLOSE) != 0,
+            &id);
+        if (st == vfs_store_t::st_exists && mode != vfs_store_t::create_new)
+        {
+            SetLastError(ERROR_ALREADY_EXISTS);
+            return to_handle(id);
+        }
+        if (st != vfs_store_t::st_ok)
+        {
+            fail(st);
+            return INVALID_HANDLE_VALUE;
+        }
+        SetLastError(ERROR_SUCCESS);
+        return to_handle(id);
+    }
+
+    inline BOOL WINAPI my_ReadFile(HANDLE h, LPVOID buf, DWORD n, LPDWORD nread, LPOVERLAPPED ov)
+    {
+        uint32_t id;
+        if (!from_handle(h, &id))
+            return ::ReadFile(h, buf, n, nread, ov);
+
+        uint64_t at = 0;
+        if (ov != nullptr)
+            at = ((uint64_t)ov->OffsetHigh << 32) | ov->Offset;
+        size_t got = 0;
+        vfs_store_t::status_e st = g_store->read(id, buf, n, &got, ov != nullptr ? &at : nullptr);
+        if (st != vfs_store_t::st_ok)
+            return fail(st);
+        if (nread != nullptr)
+            *nread = (DWORD)got;
+        if (ov != nullptr)
+        {
+            ov->Internal = 0;
+            ov->InternalHigh = got;
+            if (ov->hEvent != nullptr)
+                SetEvent(ov->hEvent);
+            if (got == 0 && n != 0)
+            {
+                SetLastError(ERROR_HANDLE_EOF);
+                return FALSE;
+            }
+        }
+        return TRUE;
+    }
+
+    inline BOOL WINAPI my_WriteFile(HANDLE h, LPCVOID buf, DWORD n, LPDWORD nwritten, LPOVERLAPPED ov)
+    {
+        uint32_t id;
+        if (!from_handle(h, &id))
+            return ::WriteFile(h, buf, n, nwritten, ov);
+
+        uint64_t at = 0;
+        bool positioned = ov != nullptr && !(ov->Offset == 0xFFFFFFFF && ov->OffsetHigh == 0xFFFFFFFF);
+        if (positioned)
+            at = ((uint64_t)ov->OffsetHigh << 32) | ov->Offset;
+        vfs_store_t::status_e st = g_store->write(id, buf, n, positioned ? &at : nullptr);
+        if (st != vfs_store_t::st_ok)
+            return fail(st);
+        if (nwritten != nullptr)
+            *nwritten = n;
+        if (ov != nullptr)
+        {
+            ov->Internal = 0;
+            ov->InternalHigh = n;
+            if (ov->hEvent != nullptr)
+                SetEvent(ov->hEvent);
+        }
+        return TRUE;
+    }
+
+    inline BOOL WINAPI my_SetFilePointerEx(HANDLE h, LARGE_INTEGER dist, PLARGE_INTEGER newpos, DWORD method)
+    {
+        uint32_t id;
+        if (!from_handle(h, &id))
+            return ::SetFilePointerEx(h, dist, newpos, method);
+
+        uint64_t pos;
+        vfs_store_t::status_e st = g_store->seek(id, dist.QuadPart, (int)method, &pos);
+        if (st == vfs_store_t::st_access_denied)
+        {
+            SetLastError(ERROR_NEGATIVE_SEEK);
+            return FALSE;
+        }
+        if (st != vfs_store_t::st_ok)
+            return fail(st);
+        if (newpos != nullptr)
+            newpos->QuadPart = (LONGLONG)pos;
+        return TRUE;
+    }
+
+    inline DWORD WINAPI my_SetFilePointer(HANDLE h, LONG lo, PLONG hi, DWORD method)
+    {
+        uint32_t id;
+        if (!from_handle(h, &id))
+            return ::SetFilePointer(h, lo, hi, method);
+
+        LARGE_INTEGER dist, pos;
+        dist.QuadPart = hi != nullptr ? (LONGLONG)(((uint64_t)(uint32_t)*hi << 32) | (uint32_t)lo) : (LONGLONG)lo;
+        if (!my_SetFilePointerEx(h, dist, &pos, method))
+            return INVALID_SET_FILE_POINTER;
+        if (hi != nullptr)
+            *hi = pos.HighPart;
+        SetLastError(ERROR_SUCCESS);
+        return pos.LowPart;
+    }
+
+    inline BOOL WINAPI my_GetFileSizeEx(HANDLE h, PLARGE_INTEGER size)
+    {
+        uint32_t id;
+        if (!from_handle(h, &id))
+            return ::GetFileSizeEx(h, size);
+
+        uint64_t sz;
+        vfs_store_t::status_e st = g_store->size(id, &sz);
+        if (st != vfs_store_t::st_ok)
+            return fail(st);
+        size->QuadPart = (LONGLONG)sz;
+        return TRUE;
+    }
+
+    inline DWORD WINAPI my_GetFileSize(HANDLE h, LPDWORD hi)
+    {
+        uint32_t id;
+        if (!from_handle(h, &id))
+            return ::GetFileSize(h, hi);
+
+        LARGE_INTEGER sz;
+        if (!my_GetFileSizeEx(h, &sz))
+            return INVALID_FILE_SIZE;
+        if (hi != nullptr)
+            *hi = (DWORD)sz.HighPart;
+        SetLastError(ERROR_SUCCESS);
+        return sz.LowPart;
+    }
+
+    inline BOOL WINAPI my_SetEndOfFile(HANDLE h)
+    {
+        uint32_t id;
+        if (!from_handle(h, &id))
+            return ::SetEndOfFile(h);
+
+        vfs_store_t::status_e st = g_store->set_end(id);
+        return st == vfs_store_t::st_ok ? TRUE : fail(st);
+    }
+
+    inline BOOL WINAPI my_FlushFileBuffers(HANDLE h)
+    {
+        uint32_t id;
+        if (!from_handle(h, &id))
+            return ::FlushFileBuffers(h);
+        return g_store->is_handle(id) ? TRUE : fail(vfs_store_t::st_bad_handle);
+    }
+
+    inline DWORD WINAPI my_GetFileType(HANDLE h)
+    {
+        uint32_t id;
+        if (!from_handle(h, &id))
+            return ::GetFileType(h);
+        return FILE_TYPE_DISK;
+    }
+
+    inline BOOL WINAPI my_GetFileInformationByHandle(HANDLE h, LPBY_HANDLE_FILE_INFORMATION info)
+    {
+        uint32_t id;
+        if (!from_handle(h, &id))
+            return ::GetFileInformationByHandle(h, info);
+
+        LARGE_INTEGER sz;
+        if (!my_GetFileSizeEx(h, &sz))
+            return FALSE;
+        FILETIME now;
+        GetSystemTimeAsFileTime(&now);
+        memset(info, 0, sizeof(*info));
+        info->dwFileAttributes = FILE_ATTRIBUTE_NORMAL;
+        info->ftCreationTime = now;
+        info->ftLastAccessTime = now;
+        info->ftLastWriteTime = now;
+        info->nFileSizeHigh = (DWORD)sz.HighPart;
+        info->nFileSizeLow = sz.LowPart;
+        info->nNumberOfLinks = 1;
+        info->nFileIndexLow = id;
+        return TRUE;
+    }
+
+    inline BOOL WINAPI my_CloseHandle(HANDLE h)
+    {
+        uint32_t id;
+        if (!from_handle(h, &id))
+            return ::CloseHandle(h);
+
+        vfs_store_t::status_e st = g_store->close(id);
+        return st == vfs_store_t::st_ok ? TRUE : fail(st);
+    }
+
+    inline DWORD WINAPI my_GetFileAttributesW(LPCWSTR name)
+    {
+        std::wstring full;
+        if (!owns_path(name, &full) || !g_store->exists(full.c_str()))
+            return ::GetFileAttributesW(name);
+        return FILE_ATTRIBUTE_NORMAL;
+    }
+
+    inline BOOL WINAPI my_GetFileAttributesExW(LPCWSTR name, GET_FILEEX_INFO_LEVELS level, LPVOID out)
+    {
+        std::wstring full;
+        uint64_t sz;
+        if (level != GetFileExInfoStandard
+            || !owns_path(name, &full)
+            || !g_store->file_size(full.c_str(), &sz))
+        {
+            return ::GetFileAttributesExW(name, level, out);
+        }
+
+        WIN32_FILE_ATTRIBUTE_DATA* data = (WIN32_FILE_ATTRIBUTE_DATA*)out;
+        FILETIME now;
+        GetSystemTimeAsFileTime(&now);
+        data->dwFileAttributes = FILE_ATTRIBUTE_NORMAL;
+        data->ftCreationTime = now;
+        data->ftLastAccessTime = now;
+        data->ftLastWriteTime = now;
+        data->nFileSizeHigh = (DWORD)(sz >> 32);
+        data->nFileSizeLow = (DWORD)sz;
+        return TRUE;
+    }
+
+    inline BOOL WINAPI my_DeleteFileW(LPCWSTR name)
+    {
+        std::wstring full;
+        if (!owns_path(name, &full) || !g_store->remove(full.c_str()))
+            return ::DeleteFileW(name);
+        return TRUE;
+    }
+
+    inline BOOL WINAPI my_MoveFileExW(LPCWSTR from, LPCWSTR to, DWORD flags)
+    {
+        std::wstring src, dst;
+        bool src_vfs = owns_path(from, &src) && g_store->exists(src.c_str());
+        bool dst_vfs = to != nullptr && owns_path(to, &dst);
+        bool replace = (flags & MOVEFILE_REPLACE_EXISTING) != 0;
+
+        if (src_vfs && dst_vfs)
+        {
+            vfs_store_t::status_e st = g_store->rename(src.c_str(), dst.c_str(), replace);
+            return st == vfs_store_t::st_ok ? TRUE : fail(st);
+        }
+        if (src_vfs)
+        {
+            // Leaving the store, e.g. a packed database saved next to the input
+            if (to == nullptr)
+                return g_store->remove(src.c_str()) ? TRUE : fail(vfs_store_t::st_not_found);
+            if (!save_file(src, to, replace))
+                return FALSE;
+            g_store->remove(src.c_str());
+            return TRUE;
+        }
+        if (dst_vfs)
+        {
+            if (!replace && g_store->exists(dst.c_str()))
+                return fail(vfs_store_t::st_exists);
+            if (!load_file(from, dst))
+                return FALSE;
+            return ::DeleteFileW(from);
+        }
+        return ::MoveFileExW(from, to, flags);
+    }
+
+    inline BOOL WINAPI my_MoveFileW(LPCWSTR from, LPCWSTR to) {
+        return my_MoveFileExW(from, to, MOVEFILE_COPY_ALLOWED);
+    }
+
+    // Views are copied into pagefile-backed memory, which cannot write back
+    inline HANDLE WINAPI my_CreateFileMappingW(
+        HANDLE h,
+        LPSECURITY_ATTRIBUTES sa,
+        DWORD protect,
+        DWORD size_hi,
+        DWORD size_lo,
+        LPCWSTR name)
+    {
+        uint32_t id;
+        if (!from_handle(h, &id))
+            return ::CreateFileMappingW(h, sa, protect, size_hi, size_lo, name);
+
+        DWORD page = protect & 0xFF;
+        bool exec = page == PAGE_EXECUTE_READ || page == PAGE_EXECUTE_WRITECOPY;
+        if (!exec && page != PAGE_READONLY && page != PAGE_WRITECOPY)
+        {
+            SetLastError(ERROR_NOT_SUPPORTED);
+            return nullptr;
+        }
+        uint64_t file_size;
+        vfs_store_t::status_e st = g_store->size(id, &file_size);
+        if (st != vfs_store_t::st_ok)
+        {
+            fail(st);
+            return nullptr;
+        }
+        uint64_t size = ((uint64_t)size_hi << 32) | size_lo;
+        if (size == 0)
+            size = file_size;
+        if (size == 0 || size > file_size)
+        {
+            // As for a read-only mapping of a disk file
+            SetLastError(size == 0 ? ERROR_FILE_INVALID : ERROR_NOT_ENOUGH_MEMORY);
+            return nullptr;
+        }
+
+        HANDLE m = ::CreateFileMappingW(
+            INVALID_HANDLE_VALUE,
+            sa,
+            exec ? PAGE_EXECUTE_READWRITE : PAGE_READWRITE,
+            (DWORD)(size >> 32),
+            (DWORD)size,
+            name);
+        if (m == nullptr)
+            return nullptr;
+        uint8_t* view = (uint8_t*)MapViewOfFile(m, FILE_MAP_WRITE, 0, 0, (SIZE_T)size);
+        if (view == nullptr)
+        {
+            ::CloseHandle(m);
+            return nullptr;
+        }
+        size_t got = 0;
+        g_store->read_snapshot(id, 0, view, (size_t)size, &got);
+        UnmapViewOfFile(view);
+        SetLastError(ERROR_SUCCESS);
+        return m;
+    }
+
+    inline BOOL WINAPI my_GetFileInformationByHandleEx(
+        HANDLE h,
+        FILE_INFO_BY_HANDLE_CLASS cls,
+        LPVOID out,
+        DWORD size)
+    {
+        uint32_t id;
+        if (!from_handle(h, &id))
+            return ::GetFileInformationByHandleEx(h, cls, out, size);
+
+        uint64_t sz;
+        std::wstring path;
+        vfs_store_t::status_e st = g_store->size(id, &sz);
+        if (st == vfs_store_t::st_ok)
+            st = g_store->info(id, &path, nullptr);
+        if (st != vfs_store_t::st_ok)
+            return fail(st);
+
+        FILETIME now;
+        GetSystemTimeAsFileTime(&now);
+        LARGE_INTEGER t;
+        t.LowPart = now.dwLowDateTime;
+        t.HighPart = (LONG)now.dwHighDateTime;
+        switch (cls)
+        {
+            case FileBasicInfo:
+            {
+                if (size < sizeof(FILE_BASIC_INFO))
+                    break;
+                FILE_BASIC_INFO* bi = (FILE_BASIC_INFO*)out;
+                bi->CreationTime = bi->LastAccessTime = bi->LastWriteTime = bi->ChangeTime = t;
+                bi->FileAttributes = FILE_ATTRIBUTE_NORMAL;
+                return TRUE;
+            }
+            case FileStandardInfo:
+            {
+                if (size < sizeof(FILE_STANDARD_INFO))
+                    break;
+                FILE_STANDARD_INFO* si = (FILE_STANDARD_INFO*)out;
+                si->AllocationSize.QuadPart = (LONGLONG)((sz + vfs_store_t::BLOCK_SIZE - 1) & ~(uint64_t)(vfs_store_t::BLOCK_SIZE - 1));
+                si->EndOfFile.QuadPart = (LONGLONG)sz;
+                si->NumberOfLinks = 1;
+                si->DeletePending = FALSE;
+                si->Directory = FALSE;
+                return TRUE;
+            }
+            case FileAttributeTagInfo:
+            {
+                if (size < sizeof(FILE_ATTRIBUTE_TAG_INFO))
+                    break;
+                FILE_ATTRIBUTE_TAG_INFO* ai = (FILE_ATTRIBUTE_TAG_INFO*)out;
+                ai->FileAttributes = FILE_ATTRIBUTE_NORMAL;
+                ai->ReparseTag = 0;
+                return TRUE;
+            }
+            case FileNameInfo:
+            {
+                // Without the drive, as for disk files
+                if (size < sizeof(FILE_NAME_INFO))
+                    break;
+                const wchar_t* rel = path.size() > 2 && path[1] == L':' ? path.c_str() + 2 : path.c_str();
+                DWORD bytes = (DWORD)(wcslen(rel) * sizeof(wchar_t));
+                FILE_NAME_INFO* ni = (FILE_NAME_INFO*)out;
+                ni->FileNameLength = bytes;
+                DWORD room = size - offsetof(FILE_NAME_INFO, FileName);
+                memcpy(ni->FileName, rel, (std::min)(bytes, room));
+                if (room < bytes)
+                {
+                    SetLastError(ERROR_MORE_DATA);
+                    return FALSE;
+                }
+                return TRUE;
+            }
+            default:
+                SetLastError(ERROR_INVALID_PARAMETER);
+                return FALSE;
+        }
+        SetLastError(ERROR_BAD_LENGTH);
+        return FALSE;
+    }
+
+    // Only this process sees the store, so byte-range locks always succeed
+    inline BOOL WINAPI my_LockFileEx(HANDLE h, DWORD flags, DWORD reserved, DWORD lo, DWORD hi, LPOVERLAPPED ov)
+    {
+        uint32_t id;
+        if (!from_handle(h, &id))
+            return ::LockFileEx(h, flags, reserved, lo, hi, ov);
+        if (!g_store->is_handle(id))
+            return fail(vfs_store_t::st_bad_handle);
+        if (ov != nullptr)
+        {
+            ov->Internal = 0;
+            if (ov->hEvent != nullptr)
+                SetEvent(ov->hEvent);
+        }
+        return TRUE;
+    }
+
+    inline BOOL WINAPI my_UnlockFileEx(HANDLE h, DWORD reserved, DWORD lo, DWORD hi, LPOVERLAPPED ov)
+    {
+        uint32_t id;
+        if (!from_handle(h, &id))
+            return ::UnlockFileEx(h, reserved, lo, hi, ov);
+        return g_store->is_handle(id) ? TRUE : fail(vfs_store_t::st_bad_handle);
+    }
+
+    inline BOOL WINAPI my_LockFile(HANDLE h, DWORD off_lo, DWORD off_hi, DWORD lo, DWORD hi)
+    {
+        uint32_t id;
+        if (!from_handle(h, &id))
+            return ::LockFile(h, off_lo, off_hi, lo, hi);
+        return g_store->is_handle(id) ? TRUE : fail(vfs_store_t::st_bad_handle);
+    }
+
+    inline BOOL WINAPI my_UnlockFile(HANDLE h, DWORD off_lo, DWORD off_hi, DWORD lo, DWORD hi)
+    {
+        uint32_t id;
+        if (!from_handle(h, &id))
+            return ::UnlockFile(h, off_lo, off_hi, lo, hi);
+        return g_store->is_handle(id) ? TRUE : fail(vfs_store_t::st_bad_handle);
+    }
+
+    inline bool is_current_process(HANDLE p) {
+        return p == GetCurrentProcess() || GetProcessId(p) == GetCurrentProcessId();
+    }
+
+    // Store handles cannot leave the process
+    inline BOOL WINAPI my_DuplicateHandle(
+        HANDLE src_process,
+        HANDLE src,
+        HANDLE dst_process,
+        LPHANDLE dst,
+        DWORD access,
+        BOOL inherit,
+        DWORD options)
+    {
+        uint32_t id;
+        if (!from_handle(src, &id))
+            return ::DuplicateHandle(src_process, src, dst_process, dst, access, inherit, options);
+        if (!is_current_process(src_process) || (dst != nullptr && !is_current_process(dst_process)))
+        {
+            SetLastError(ERROR_NOT_SUPPORTED);
+            return FALSE;
+        }
+
+        vfs_store_t::status_e st = vfs_store_t::st_ok;
+        if (dst != nullptr)
+        {
+            uint32_t dup;
+            st = g_store->duplicate(id, &dup);
+            if (st == vfs_store_t::st_ok)
+                *dst = to_handle(dup);
+        }
+        if ((options & DUPLICATE_CLOSE_SOURCE) != 0)
+            g_store->close(id);
+        return st == vfs_store_t::st_ok ? TRUE : fail(st);
+    }
+
+    //
+    // CRT opens of store files
+    //
+
+    struct crt_file_t
+    {
+        std::wstring vpath;
+        std::wstring temp;
+        bool writable;
+    };
+
+    inline std::mutex g_crt_mtx;
+    inline std::map<int, crt_file_t> g_crt_files;      // by descriptor
+    inline std::atomic<size_t> g_crt_open{ 0 };
+
+    enum crt_stage_e
+    {
+        crt_pass,       // not a store file: open it as asked
+        crt_fail,
+        crt_temp,       // open the temporary copy instead
+    };
+
+    // Applies the CreateFileW rules to a CRT open of `name` and, for a store
+    // file, stages its contents in a temporary file
+    inline crt_stage_e crt_stage(
+        const wchar_t* name,
+        bool create,
+        bool excl,
+        bool truncate,
+        std::wstring* vpath,
+        std::wstring* temp,
+        int* err)
+    {
+        if (!owns_path(name, vpath))
+            return crt_pass;
+        bool in_store = g_store->exists(vpath->c_str());
+        if (!in_store && !(create && truncate) && on_disk(vpath->c_str()))
+            return crt_pass;
+        if (!in_store && !create)
+        {
+            *err = ENOENT;
+            return crt_fail;
+        }
+        if (in_store && create && excl)
+        {
+            *err = EEXIST;
+            return crt_fail;
+        }
+
+        wchar_t dir[MAX_PATH];
+        wchar_t path[MAX_PATH];
+        if (GetTempPathW(MAX_PATH, dir) == 0 || GetTempFileNameW(dir, L"ihv", 0, path) == 0)
+        {
+            *err = EACCES;
+            return crt_fail;
+        }
+        // Kept in the cache rather than written out where possible
+        ::SetFileAttributesW(path, FILE_ATTRIBUTE_TEMPORARY);
+        if (in_store && !truncate && !save_file(*vpath, path, true))
+        {
+            ::DeleteFileW(path);
+            *err = EIO;
+            return crt_fail;
+        }
+        temp->assign(path);
+        return crt_temp;
+    }
+
+    inline void crt_track(int fd, std::wstring&& vpath, std::wstring&& temp, bool writable)
+    {
+        std::lock_guard<std::mutex> lock(g_crt_mtx);
+        g_crt_files[fd] = { std::move(vpath), std::move(temp), writable };
+        g_crt_open.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    inline bool crt_untrack(int fd, crt_file_t* f)
+    {
+        if (fd < 0 || g_crt_open.load(std::memory_order_relaxed) == 0)
+            return false;
+        std::lock_guard<std::mutex> lock(g_crt_mtx);
+        auto p = g_crt_files.find(fd);
+        if (p == g_crt_files.end())
+            return false;
+        *f = std::move(p->second);
+        g_crt_files.erase(p);
+        g_crt_open.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // After the descriptor is closed: the copy goes back into the store
+    inline void crt_finish(const crt_file_t& f)
+    {
+        if (f.writable)
+            load_file(f.temp.c_str(), f.vpath);
+        ::DeleteFileW(f.temp.c_str());
+    }
+
+    inline errno_t __cdecl my__wsopen_s(int* fd, const wchar_t* name, int oflag, int shflag, int pmode)
+    {
+        std::wstring vpath, temp;
+        int err = 0;
+        switch (crt_stage(name, (oflag & _O_CREAT) != 0, (oflag & _O_EXCL) != 0, (oflag & _O_TRUNC) != 0, &vpath, &temp, &err))
+        {
+            case crt_pass:
+                return ::_wsopen_s(fd, name, oflag, shflag, pmode);
+            case crt_fail:
+                *fd = -1;
+                errno = err;
+                return err;
+            default:
+                break;
+        }
+        // The temporary file exists already
+        errno_t e = ::_wsopen_s(fd, temp.c_str(), oflag & ~_O_EXCL, shflag, pmode);
+        if (e != 0)
+        {
+            ::DeleteFileW(temp.c_str());
+            return e;
+        }
+        bool writable = (oflag & (_O_WRONLY | _O_RDWR | _O_APPEND | _O_TRUNC)) != 0;
+        crt_track(*fd, std::move(vpath), std::move(temp), writable);
+        return 0;
+    }
+
+    inline int __cdecl my__wsopen(const wchar_t* name, int oflag, int shflag, ...)
+    {
+        int pmode = 0;
+        if ((oflag & _O_CREAT) != 0)
+        {
+            va_list va;
+            va_start(va, shflag);
+            pmode = va_arg(va, int);
+            va_end(va);
+        }
+        int fd;
+        errno_t e = my__wsopen_s(&fd, name, oflag, shflag, pmode);
+        if (e != 0)
+        {
+            errno = e;
+            return -1;
+        }
+        return fd;
+    }
+
+    inline int __cdecl my__wopen(const wchar_t* name, int oflag, ...)
+    {
+        int pmode = 0;
+        if ((oflag & _O_CREAT) != 0)
+        {
+            va_list va;
+            va_start(va, oflag);
+            pmode = va_arg(va, int);
+            va_end(va);
+        }
+        return my__wsopen(name, oflag, _SH_DENYNO, pmode);
+    }
+
+    // `open(path, mode)` opens the stream: the real CRT call of the shim
+    template <typename Open>
+    inline FILE* crt_fopen(const wchar_t* name, const wchar_t* mode, Open&& open)
+    {
+        wchar_t kind = mode[0];
+        bool plus = wcschr(mode, L'+') != nullptr;
+        bool excl = wcschr(mode, L'x') != nullptr;
+        std::wstring vpath, temp;
+        int err = 0;
+        switch (crt_stage(name, kind == L'w' || kind == L'a', excl, kind == L'w', &vpath, &temp, &err))
+        {
+            case crt_pass:
+                return open(name, mode);
+            case crt_fail:
+                errno = err;
+                return nullptr;
+            default:
+                break;
+        }
+        std::wstring m;
+        for (const wchar_t* p = mode; *p != 0; ++p)
+        {
+            if (*p != L'x')
+                m.push_back(*p);
+        }
+        FILE* fp = open(temp.c_str(), m.c_str());
+        if (fp == nullptr)
+        {
+            ::DeleteFileW(temp.c_str());
+            return nullptr;
+        }
+        crt_track(_fileno(fp), std::move(vpath), std::move(temp), kind != L'r' || plus);
+        return fp;
+    }
+
+    inline FILE* __cdecl my__wfsopen(const wchar_t* name, const wchar_t* mode, int shflag)
+    {
+        return crt_fopen(name, mode, [shflag](const wchar_t* n, const wchar_t* m) {
+            return ::_wfsopen(n, m, shflag);
+        });
+    }
+
+    inline FILE* __cdecl my__wfopen(const wchar_t* name, const wchar_t* mode)
+    {
+        return crt_fopen(name, mode, [](const wchar_t* n, const wchar_t* m) {
+            return ::_wfopen(n, m);
+        });
+    }
+
+    inline errno_t __cdecl my__wfopen_s(FILE** fp, const wchar_t* name, const wchar_t* mode)
+    {
+        errno_t e = 0;
+        *fp = crt_fopen(name, mode, [&e](const wchar_t* n, const wchar_t* m) {
+            FILE* f = nullptr;
+            e = ::_wfopen_s(&f, n, m);
+            return f;
+        });
+        return *fp != nullptr ? 0 : (e != 0 ? e : errno);
+    }
+
+    inline int __cdecl my__close(int fd)
+    {
+        crt_file_t f;
+        bool staged = crt_untrack(fd, &f);
+        int r = ::_close(fd);
+        if (staged)
+            crt_finish(f);
+        return r;
+    }
+
+    inline int __cdecl my_fclose(FILE* fp)
+    {
+        crt_file_t f;
+        bool staged = fp != nullptr && crt_untrack(_fileno(fp), &f);
+        int r = ::fclose(fp);
+        if (staged)
+            crt_finish(f);
+        return r;
+    }
+
+    // Replaces `*addr` with the shim for `sym_name`, if there is one
+    inline bool resolve_import(const char* sym_name, uint64_t* addr)
+    {
+        static const struct
+        {
+            const char* name;
+            const void* shim;
+        } shims[] = {
+            { "CreateFileW",                    (const void*)my_CreateFileW },
+            { "ReadFile",                       (const void*)my_ReadFile },
+            { "WriteFile",                      (const void*)my_WriteFile },
+            { "SetFilePointer",                 (const void*)my_SetFilePointer },
+            { "SetFilePointerEx",               (const void*)my_SetFilePointerEx },
+            { "GetFileSize",                    (const void*)my_GetFileSize },
+            { "GetFileSizeEx",                  (const void*)my_GetFileSizeEx },
+            { "SetEndOfFile",                   (const void*)my_SetEndOfFile },
+            { "FlushFileBuffers",               (const void*)my_FlushFileBuffers },
+            { "GetFileType",                    (const void*)my_GetFileType },
+            { "GetFileInformationByHandle",     (const void*)my_GetFileInformationByHandle },
+            { "CloseHandle",                    (const void*)my_CloseHandle },
+            { "GetFileAttributesW",             (const void*)my_GetFileAttributesW },
+            { "GetFileAttributesExW",           (const void*)my_GetFileAttributesExW },
+            { "DeleteFileW",                    (const void*)my_DeleteFileW },
+            { "MoveFileExW",                    (const void*)my_MoveFileExW },
+            { "MoveFileW",                      (const void*)my_MoveFileW },
+            { "CreateFileMappingW",             (const void*)my_CreateFileMappingW },
+            { "GetFileInformationByHandleEx",   (const void*)my_GetFileInformationByHandleEx },
+            { "LockFileEx",                     (const void*)my_LockFileEx },
+            { "UnlockFileEx",                   (const void*)my_UnlockFileEx },
+            { "LockFile",                       (const void*)my_LockFile },
+            { "UnlockFile",                     (const void*)my_UnlockFile },
+            { "DuplicateHandle",                (const void*)my_DuplicateHandle },
+            { "_wsopen_s",                      (const void*)my__wsopen_s },
+            { "_wsopen",                        (const void*)my__wsopen },
+            { "_wopen",                         (const void*)my__wopen },
+            { "_wfsopen",                       (const void*)my__wfsopen },
+            { "_wfopen",                        (const void*)my__wfopen },
+            { "_wfopen_s",                      (const void*)my__wfopen_s },
+            { "_close",                         (const void*)my__close },
+            { "fclose",                         (const void*)my_fclose },
+        };
+        if (g_store == nullptr)
+            return false;
+        for (const auto& s : shims)
+        {
+            if (strcmp(sym_name, s.name) == 0)
+            {
+                *addr = (uint64_t)s.shim;
+                return true;
+            }
+        }
+        return false;
+    }
+}
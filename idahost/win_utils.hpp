@@ -34,6 +34,10 @@ public:
         }
     }
 
+    size_t buffer_bytes() const {
+        return buffer == nullptr ? 0 : (size_t)bufferSize.X * bufferSize.Y * sizeof(CHAR_INFO);
+    }
+
     bool save()
     {
         free_buffer();
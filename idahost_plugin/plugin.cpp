@@ -2,14 +2,161 @@
 #include <idp.hpp>
 #include <loader.hpp>
 #include <kernwin.hpp>
+#include <funcs.hpp>
+#include <segment.hpp>
+#include <bytes.hpp>
+#include <typeinf.hpp>
 #include <windows.h>
 #include "../idahost/include/idahost_interface.h"
+#include "../idahost/include/idahost_changes.h"
+
+// Encodes IDB events into change records for the host
+struct idb_change_listener_t : public event_listener_t
+{
+    IDAHostInterface* host_ = nullptr;
+    uint8_t buf_[sizeof(change_hdr_t) + 0x10000];
+    qstring tmp_;
+
+    void post(change_kind_e kind, uint8_t flags, ea_t ea, ea_t ea2 = 0, const void* payload = nullptr, size_t len = 0)
+    {
+        size_t n = change_encode(buf_, kind, flags, ea, ea2, payload, len);
+        host_->post_change(buf_, n);
+    }
+
+    void post_text(change_kind_e kind, uint8_t flags, ea_t ea, ea_t ea2, const char* text)
+    {
+        post(kind, flags, ea, ea2, text, text == nullptr ? 0 : strlen(text));
+    }
+
+    ssize_t idaapi on_event(ssize_t code, va_list va) override
+    {
+        switch (code)
+        {
+            case idb_event::renamed:
+            {
+                ea_t ea = va_arg(va, ea_t);
+                const char* new_name = va_arg(va, const char*);
+                bool local_name = va_argi(va, bool);
+                post_text(CHG_RENAMED, local_name ? CHGF_LOCAL : 0, ea, 0, new_name);
+                break;
+            }
+            case idb_event::func_added:
+            case idb_event::deleting_func:
+            case idb_event::func_updated:
+            {
+                func_t* pfn = va_arg(va, func_t*);
+                change_kind_e kind = code == idb_event::func_added ? CHG_FUNC_ADDED
+                                   : code == idb_event::deleting_func ? CHG_FUNC_DELETED
+                                   : CHG_FUNC_UPDATED;
+                post(kind, 0, pfn->start_ea, pfn->end_ea);
+                break;
+            }
+            case idb_event::set_func_start:
+            case idb_event::set_func_end:
+            {
+                func_t* pfn = va_arg(va, func_t*);
+                ea_t ea = va_arg(va, ea_t);
+                post(code == idb_event::set_func_start ? CHG_FUNC_START : CHG_FUNC_END, 0, pfn->start_ea, ea);
+                break;
+            }
+            case idb_event::cmt_changed:
+            {
+                ea_t ea = va_arg(va, ea_t);
+                bool rpt = va_argi(va, bool);
+                if (get_cmt(&tmp_, ea, rpt) < 0)
+                    tmp_.qclear();
+                post(CHG_CMT, rpt ? CHGF_REPEATABLE : 0, ea, 0, tmp_.c_str(), tmp_.length());
+                break;
+            }
+            case idb_event::range_cmt_changed:
+            {
+                range_kind_t kind = va_argi(va, range_kind_t);
+                const range_t* a = va_arg(va, const range_t*);
+                const char* cmt = va_arg(va, const char*);
+                bool rpt = va_argi(va, bool);
+                uint8_t flags = (rpt ? CHGF_REPEATABLE : 0) | (kind == RANGE_KIND_FUNC ? CHGF_FUNC_RANGE : 0);
+                post_text(CHG_RANGE_CMT, flags, a->start_ea, a->end_ea, cmt);
+                break;
+            }
+            case idb_event::extra_cmt_changed:
+            {
+                ea_t ea = va_arg(va, ea_t);
+                int line_idx = va_arg(va, int);
+                const char* cmt = va_arg(va, const char*);
+                post_text(CHG_EXTRA_CMT, 0, ea, (ea_t)line_idx, cmt);
+                break;
+            }
+            case idb_event::ti_changed:
+            {
+                ea_t ea = va_arg(va, ea_t);
+                const type_t* type = va_arg(va, const type_t*);
+                const p_list* fnames = va_arg(va, const p_list*);
+                size_t type_len = type == nullptr ? 0 : strlen((const char*)type);
+                size_t fields_len = fnames == nullptr ? 0 : strlen((const char*)fnames);
+                host_->post_change(buf_, change_encode_type(buf_, ea, type, type_len, fnames, fields_len));
+                break;
+            }
+            case idb_event::segm_added:
+            {
+                segment_t* s = va_arg(va, segment_t*);
+                if (get_segm_name(&tmp_, s) < 0)
+                    tmp_.qclear();
+                post(CHG_SEG_ADDED, 0, s->start_ea, s->end_ea, tmp_.c_str(), tmp_.length());
+                break;
+            }
+            case idb_event::segm_deleted:
+            {
+                ea_t start_ea = va_arg(va, ea_t);
+                ea_t end_ea = va_arg(va, ea_t);
+                post(CHG_SEG_DELETED, 0, start_ea, end_ea);
+                break;
+            }
+            case idb_event::segm_start_changed:
+            {
+                segment_t* s = va_arg(va, segment_t*);
+                ea_t oldstart = va_arg(va, ea_t);
+                post(CHG_SEG_START, 0, s->start_ea, oldstart);
+                break;
+            }
+            case idb_event::segm_end_changed:
+            {
+                segment_t* s = va_arg(va, segment_t*);
+                post(CHG_SEG_END, 0, s->start_ea, s->end_ea);
+                break;
+            }
+            case idb_event::segm_name_changed:
+            {
+                segment_t* s = va_arg(va, segment_t*);
+                const char* name = va_arg(va, const char*);
+                post_text(CHG_SEG_RENAMED, 0, s->start_ea, 0, name);
+                break;
+            }
+            case idb_event::segm_moved:
+            {
+                ea_t from = va_arg(va, ea_t);
+                ea_t to = va_arg(va, ea_t);
+                uint64_t size = va_arg(va, asize_t);
+                post(CHG_SEG_MOVED, 0, from, to, &size, sizeof(size));
+                break;
+            }
+            case idb_event::byte_patched:
+            {
+                ea_t ea = va_arg(va, ea_t);
+                uint32_t old_value = va_arg(va, uint32);
+                post(CHG_BYTE_PATCHED, 0, ea, 0, &old_value, sizeof(old_value));
+                break;
+            }
+        }
+        return 0;
+    }
+};
 
 class idahost_plgmod_t : 
     public plugmod_t, public event_listener_t
 {
     bool initial_return_to_host_ = false;
     IDAHostInterface* host_;
+    idb_change_listener_t changes_;
 
 public:
     ssize_t idaapi on_event(ssize_t code, va_list va) override
@@ -49,9 +196,19 @@ public:
         return 0;
     }
 
-    idahost_plgmod_t(IDAHostInterface* host) : host_(host)
+    idahost_plgmod_t(IDAHostInterface* host, int host_version) : host_(host)
     {
         hook_event_listener(HT_UI, this);
+        if (host_version >= 2 && host_->change_feed_enabled())
+        {
+            changes_.host_ = host_;
+            hook_event_listener(HT_IDB, &changes_);
+        }
+    }
+
+    ~idahost_plgmod_t()
+    {
+        unhook_event_listener(HT_IDB, &changes_);
     }
 
     bool run(size_t) override
@@ -73,7 +230,13 @@ public:
             return nullptr;
         }
 
-        return new idahost_plgmod_t(get_host_interface());
+        // Hosts built before the version export only have version 1 slots
+        auto get_host_version = (get_host_interface_version_proc_t)GetProcAddress(
+            GetModuleHandle(nullptr),
+            "get_idahost_interface_version");
+        int version = get_host_version != nullptr ? get_host_version() : 1;
+
+        return new idahost_plgmod_t(get_host_interface(), version);
     }
 };
 
@@ -0,0 +1,312 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <functional>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "idahost_arena.h"
+#include "idahost_alloc_trace.h"
+#include "test_util.h"
+
+// Replays a provider allocation trace against arena_heap_t and the system
+// allocator, on one thread and on several threads each replaying its own copy.
+//
+//   bench_arena [--quick] [--trace file]
+//
+// `file` is recorded with heap_options_t::trace_file. Without one a synthetic
+// trace shaped like an analysis run is used: mostly small short-lived blocks,
+// a tail of long-lived ones, growing buffers and a few large blocks.
+struct op_t
+{
+    uint32_t kind;          // alloc_trace_rec_t::op_e
+    uint32_t slot;
+    uint32_t old_slot;
+    uint32_t size;
+};
+
+struct trace_t
+{
+    std::vector<op_t> ops;
+    uint32_t slots = 0;
+};
+
+// Maps recorded pointers to dense slots. Frees of blocks allocated before
+// recording started are dropped; reallocs of them become allocs.
+static trace_t compile(const std::vector<alloc_trace_rec_t>& recs)
+{
+    trace_t t;
+    std::unordered_map<uint64_t, uint32_t> live;
+    std::vector<uint32_t> unused;
+    auto take = [&](uint64_t ptr)
+    {
+        uint32_t s;
+        if (unused.empty())
+            s = t.slots++;
+        else
+        {
+            s = unused.back();
+            unused.pop_back();
+        }
+        live[ptr] = s;
+        return s;
+    };
+    auto drop = [&](uint64_t ptr, uint32_t* s)
+    {
+        auto it = live.find(ptr);
+        if (it == live.end())
+            return false;
+        *s = it->second;
+        live.erase(it);
+        unused.push_back(*s);
+        return true;
+    };
+
+    for (const alloc_trace_rec_t& r : recs)
+    {
+        uint32_t size = (uint32_t)(std::min)(r.size, (uint64_t)UINT32_MAX);
+        uint32_t old;
+        switch (r.op)
+        {
+        case alloc_trace_rec_t::op_alloc:
+            t.ops.push_back({ alloc_trace_rec_t::op_alloc, take(r.ptr), 0, size });
+            break;
+        case alloc_trace_rec_t::op_free:
+            if (drop(r.ptr, &old))
+                t.ops.push_back({ alloc_trace_rec_t::op_free, old, 0, 0 });
+            break;
+        case alloc_trace_rec_t::op_realloc:
+            if (!drop(r.old_ptr, &old))
+            {
+                if (r.ptr != 0)
+                    t.ops.push_back({ alloc_trace_rec_t::op_alloc, take(r.ptr), 0, size });
+            }
+            else if (r.ptr == 0)
+                t.ops.push_back({ alloc_trace_rec_t::op_free, old, 0, 0 });
+            else
+            {
+                // The slot may be reused right away: take() pops the one drop() pushed
+                uint32_t s = take(r.ptr);
+                t.ops.push_back({ alloc_trace_rec_t::op_realloc, s, old, size });
+            }
+            break;
+        }
+    }
+    return t;
+}
+
+static uint32_t s_rand(uint64_t& state)
+{
+    state = state * 6364136223846793005ull + 1442695040888963407ull;
+    return (uint32_t)(state >> 33);
+}
+
+static std::vector<alloc_trace_rec_t> synthesize(size_t count)
+{
+    std::vector<alloc_trace_rec_t> recs;
+    recs.reserve(count);
+    uint64_t rng = 42;
+    uint64_t next_ptr = 0x10000;
+    struct pending_t
+    {
+        size_t due;         // op index it is freed at
+        uint64_t ptr;
+        uint64_t size;
+
+        bool operator>(const pending_t& o) const {
+            return due > o.due;
+        }
+    };
+    std::priority_queue<pending_t, std::vector<pending_t>, std::greater<pending_t>> short_lived;
+    std::vector<pending_t> growing;
+
+    while (recs.size() < count)
+    {
+        size_t now = recs.size();
+        while (!short_lived.empty() && short_lived.top().due <= now)
+        {
+            recs.push_back({ alloc_trace_rec_t::op_free, 1, short_lived.top().ptr, 0, 0 });
+            short_lived.pop();
+        }
+
+        uint32_t r = s_rand(rng) % 1000;
+        uint64_t size;
+        if (r < 700)
+            size = 16 + s_rand(rng) % 112;
+        else if (r < 950)
+            size = 128 + s_rand(rng) % 3968;
+        else if (r < 995)
+            size = 4096 + s_rand(rng) % 28672;
+        else
+            size = 65536 + s_rand(rng) % (1 << 20);
+
+        uint32_t kind = s_rand(rng) % 100;
+        if (kind < 5 && !growing.empty())
+        {
+            // A buffer doubles, then is done with
+            pending_t& g = growing[s_rand(rng) % growing.size()];
+            uint64_t ptr = next_ptr++;
+            recs.push_back({ alloc_trace_rec_t::op_realloc, 1, ptr, g.ptr, g.size * 2 });
+            g.ptr = ptr;
+            g.size *= 2;
+            if (g.size > (1 << 20))
+            {
+                recs.push_back({ alloc_trace_rec_t::op_free, 1, g.ptr, 0, 0 });
+                g = growing.back();
+                growing.pop_back();
+            }
+            continue;
+        }
+
+        uint64_t ptr = next_ptr++;
+        recs.push_back({ alloc_trace_rec_t::op_alloc, 1, ptr, 0, size });
+        if (kind < 10)
+            growing.push_back({ 0, ptr, size });
+        else if (kind < 90)
+            short_lived.push({ now + 1 + s_rand(rng) % 200, ptr, size });
+        // else: lives until the end
+    }
+    return recs;
+}
+
+struct arena_alloc_t
+{
+    arena_heap_t heap;
+
+    arena_alloc_t()
+    {
+        arena_heap_t::config_t cfg;
+        cfg.reserve_bytes = 16ull << 30;
+        heap.init(cfg);
+    }
+
+    void* alloc(size_t n) {
+        return heap.alloc(n);
+    }
+
+    void free(void* p) {
+        heap.free(p);
+    }
+
+    void* realloc(void* p, size_t n) {
+        return heap.realloc(p, n);
+    }
+};
+
+struct system_alloc_t
+{
+    void* alloc(size_t n) {
+        return ::malloc(n);
+    }
+
+    void free(void* p) {
+        ::free(p);
+    }
+
+    void* realloc(void* p, size_t n) {
+        return ::realloc(p, n);
+    }
+};
+
+// Returns false if an allocation failed
+template <typename A>
+static bool replay(A& a, const trace_t& t)
+{
+    std::vector<void*> slots(t.slots, nullptr);
+    bool ok = true;
+    for (const op_t& op : t.ops)
+    {
+        switch (op.kind)
+        {
+        case alloc_trace_rec_t::op_alloc:
+            slots[op.slot] = a.alloc(op.size);
+            break;
+        case alloc_trace_rec_t::op_free:
+            a.free(slots[op.slot]);
+            slots[op.slot] = nullptr;
+            continue;
+        case alloc_trace_rec_t::op_realloc:
+        {
+            void* p = slots[op.old_slot];
+            slots[op.old_slot] = nullptr;
+            slots[op.slot] = a.realloc(p, op.size);
+            break;
+        }
+        }
+        uint8_t* p = (uint8_t*)slots[op.slot];
+        if (p == nullptr)
+            ok = false;
+        else
+            *(volatile uint8_t*)p = 1;
+    }
+    for (void* p : slots)
+    {
+        if (p != nullptr)
+            a.free(p);
+    }
+    return ok;
+}
+
+// Seconds for `threads` concurrent replays
+template <typename A>
+static double run(A& a, const trace_t& t, int threads, bool* ok)
+{
+    std::vector<std::thread> pool;
+    std::vector<char> results((size_t)threads, 1);
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < threads; ++i)
+        pool.emplace_back([&, i] { results[(size_t)i] = replay(a, t); });
+    for (std::thread& th : pool)
+        th.join();
+    double secs = bench_seconds_since(t0);
+    for (char r : results)
+        *ok = *ok && r != 0;
+    return secs;
+}
+
+int main(int argc, char** argv)
+{
+    bool quick = bench_quick(argc, argv);
+    const char* trace_file = nullptr;
+    for (int i = 1; i + 1 < argc; ++i)
+    {
+        if (strcmp(argv[i], "--trace") == 0)
+            trace_file = argv[i + 1];
+    }
+
+    std::vector<alloc_trace_rec_t> recs;
+    if (trace_file != nullptr)
+    {
+        if (!alloc_trace_load(trace_file, &recs))
+        {
+            fprintf(stderr, "cannot read %s\n", trace_file);
+            return 1;
+        }
+    }
+    else
+        recs = synthesize(quick ? 200000 : 5000000);
+
+    trace_t t = compile(recs);
+    printf("trace: %zu records, %zu ops, %u slots%s\n",
+        recs.size(), t.ops.size(), t.slots, trace_file != nullptr ? "" : " (synthetic)");
+
+    unsigned hw = (std::max)(2u, std::thread::hardware_concurrency());
+    const int thread_counts[] = { 1, (int)(std::min)(hw, 8u) };
+    printf("%-8s %14s %14s %8s\n", "threads", "malloc Mops/s", "arena Mops/s", "speedup");
+    for (int threads : thread_counts)
+    {
+        bool ok = true;
+        system_alloc_t sys;
+        double ts = run(sys, t, threads, &ok);
+        double ta;
+        {
+            arena_alloc_t arena;
+            ta = run(arena, t, threads, &ok);
+        }
+        CHECK(ok);
+        double mops = (double)t.ops.size() * threads / 1e6;
+        printf("%-8d %14.1f %14.1f %7.2fx\n", threads, mops / ts, mops / ta, ts / ta);
+    }
+    return test_result("bench_arena");
+}
@@ -0,0 +1,137 @@
+#include <deque>
+#include <thread>
+#include "idahost_dispatch.h"
+#include "test_util.h"
+
+// Requests marshalled to one owner thread: dispatcher_t against a locked
+// deque of packaged tasks. Throughput with several producers flooding the
+// owner, and round-trip latency of one producer waiting on every request.
+//
+//   bench_dispatch [--quick]
+struct locked_queue_t
+{
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<std::packaged_task<int()>> q;
+
+    std::future<int> submit(std::function<int()> fn)
+    {
+        std::packaged_task<int()> t(std::move(fn));
+        std::future<int> f = t.get_future();
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            q.push_back(std::move(t));
+        }
+        cv.notify_one();
+        return f;
+    }
+
+    size_t pump()
+    {
+        std::deque<std::packaged_task<int()>> batch;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            cv.wait_for(lock, std::chrono::milliseconds(1), [this] { return !q.empty(); });
+            batch.swap(q);
+        }
+        for (auto& t : batch)
+            t();
+        return batch.size();
+    }
+};
+
+struct dispatch_queue_t
+{
+    dispatcher_t d;
+
+    std::future<int> submit(std::function<int()> fn) {
+        return d.submit(std::move(fn));
+    }
+
+    size_t pump()
+    {
+        d.wait(std::chrono::milliseconds(1));
+        return d.pump();
+    }
+};
+
+// Requests per second with `producers` threads each submitting `per`
+template <typename Q>
+static double throughput(int producers, uint64_t per)
+{
+    Q q;
+    std::atomic<uint64_t> sum{ 0 };
+    std::vector<std::thread> threads;
+    auto t0 = std::chrono::steady_clock::now();
+    for (int p = 0; p < producers; ++p)
+    {
+        threads.emplace_back([&q, &sum, per]
+        {
+            std::future<int> last;
+            for (uint64_t i = 0; i < per; ++i)
+                last = q.submit([] { return 1; });
+            sum.fetch_add((uint64_t)last.get());
+        });
+    }
+    uint64_t total = (uint64_t)producers * per;
+    for (uint64_t ran = 0; ran < total; )
+        ran += q.pump();
+    for (std::thread& t : threads)
+        t.join();
+    CHECK_EQ(sum.load(), (uint64_t)producers);
+    return (double)total / bench_seconds_since(t0);
+}
+
+// Round trips with the owner sleeping between requests
+template <typename Q>
+static void latency(uint64_t count, latency_histogram_t* h)
+{
+    Q q;
+    std::atomic<bool> stop{ false };
+    std::thread owner([&]
+    {
+        while (!stop.load(std::memory_order_relaxed))
+            q.pump();
+    });
+    for (uint64_t i = 0; i < count; ++i)
+    {
+        uint64_t t0 = metrics_now_ns();
+        q.submit([] { return 1; }).get();
+        h->record(metrics_now_ns() - t0);
+    }
+    stop.store(true);
+    q.submit([] { return 0; });
+    owner.join();
+}
+
+int main(int argc, char** argv)
+{
+    bool quick = bench_quick(argc, argv);
+    uint64_t per = quick ? 20000 : 1000000;
+    uint64_t round_trips = quick ? 2000 : 100000;
+
+    unsigned hw = std::thread::hardware_concurrency();
+    const int producer_counts[] = { 1, (int)(std::min)((std::max)(hw, 3u) - 1, 8u) };
+    printf("%-10s %16s %16s %8s\n", "producers", "mutex req/s", "dispatch req/s", "speedup");
+    for (int producers : producer_counts)
+    {
+        double tm = throughput<locked_queue_t>(producers, per);
+        double td = throughput<dispatch_queue_t>(producers, per);
+        printf("%-10d %16.0f %16.0f %7.2fx\n", producers, tm, td, td / tm);
+    }
+
+    latency_histogram_t hm;
+    latency_histogram_t hd;
+    latency<locked_queue_t>(round_trips, &hm);
+    latency<dispatch_queue_t>(round_trips, &hd);
+    latency_histogram_t::snapshot_t sm;
+    latency_histogram_t::snapshot_t sd;
+    hm.snapshot(&sm);
+    hd.snapshot(&sd);
+    printf("\n%-10s %12s %12s %12s\n", "round trip", "p50 us", "p99 us", "max us");
+    printf("%-10s %12.1f %12.1f %12.1f\n", "mutex",
+        sm.quantile(0.5) / 1e3, sm.quantile(0.99) / 1e3, sm.max / 1e3);
+    printf("%-10s %12.1f %12.1f %12.1f\n", "dispatch",
+        sd.quantile(0.5) / 1e3, sd.quantile(0.99) / 1e3, sd.max / 1e3);
+    return test_result("bench_dispatch");
+}
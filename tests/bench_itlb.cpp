@@ -0,0 +1,222 @@
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include "idahost_large_pages.h"
+#include "test_util.h"
+#ifdef __linux__
+    #include <linux/perf_event.h>
+    #include <sys/ioctl.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
+
+// iTLB cost of code spread over a large image: thousands of tiny functions,
+// one per page, called in random order from ordinary pages and from large
+// pages (MAP_HUGETLB, else transparent huge pages), as PEMapper lays out the
+// provider's code with features_t::large_pages. Reports time per call and,
+// where perf_event_open is permitted, iTLB read misses per call ("n/a"
+// otherwise).
+//
+//   bench_itlb [--quick]
+#if defined(__x86_64__) || defined(_M_X64)
+
+// Keeps calls from sharing cache sets as a plain 4 KiB stride would
+static const size_t STRIDE = 4096 + 64;
+
+typedef uint32_t (*fn_t)(uint32_t);
+
+struct image_t
+{
+    uint8_t* base = nullptr;
+    size_t size = 0;
+    large_pages::kind_e kind = large_pages::kind_none;
+};
+
+static bool map_image(size_t size, bool large, size_t large_size, image_t* out)
+{
+    size = (size + large_size - 1) / large_size * large_size;
+    void* at = large_pages::find_free_range(size, large_size);
+    if (at == nullptr)
+        return false;
+    out->base = (uint8_t*)large_pages::alloc_at(at, size, large, &out->kind);
+    out->size = size;
+    return out->base != nullptr;
+}
+
+// f_i(x) = x + i: mov eax, edi / add eax, imm32 / ret
+static std::vector<fn_t> emit(const image_t& img)
+{
+    std::vector<fn_t> fns;
+    for (size_t off = 0; off + 8 <= img.size; off += STRIDE)
+    {
+        uint8_t* p = img.base + off;
+        uint32_t imm = (uint32_t)fns.size();
+        p[0] = 0x89;
+        p[1] = 0xF8;
+        p[2] = 0x05;
+        memcpy(p + 3, &imm, sizeof(imm));
+        p[7] = 0xC3;
+        fns.push_back((fn_t)(void*)p);
+    }
+    return fns;
+}
+
+// User-mode iTLB read misses of the calling thread; -1 when the counter
+// cannot be opened (no PMU, or perf_event_paranoid forbids it)
+class itlb_counter_t
+{
+    int fd_ = -1;
+
+public:
+    itlb_counter_t()
+    {
+#ifdef __linux__
+        perf_event_attr attr = {};
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CACHE_ITLB
+            | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+            | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd_ = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+    }
+
+    ~itlb_counter_t()
+    {
+#ifdef __linux__
+        if (fd_ != -1)
+            close(fd_);
+#endif
+    }
+
+    void start()
+    {
+#ifdef __linux__
+        if (fd_ != -1)
+        {
+            ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    int64_t stop()
+    {
+#ifdef __linux__
+        uint64_t n = 0;
+        if (fd_ != -1)
+        {
+            ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fd_, &n, sizeof(n)) == (ssize_t)sizeof(n))
+                return (int64_t)n;
+        }
+#endif
+        return -1;
+    }
+};
+
+struct result_t
+{
+    double ns_per_call;
+    double misses_per_call;     // < 0 if not measured
+};
+
+// Calls `calls` functions chasing `order`
+static result_t run(const std::vector<fn_t>& fns, const std::vector<uint32_t>& order, uint64_t calls, uint32_t* result)
+{
+    uint32_t acc = 0;
+    for (uint32_t i : order)
+        acc = fns[i](acc);
+    itlb_counter_t itlb;
+    itlb.start();
+    auto t0 = std::chrono::steady_clock::now();
+    size_t k = 0;
+    for (uint64_t c = 0; c < calls; ++c)
+    {
+        acc = fns[order[k]](acc);
+        if (++k == order.size())
+            k = 0;
+    }
+    double secs = bench_seconds_since(t0);
+    int64_t misses = itlb.stop();
+    *result = acc;
+    return { secs * 1e9 / (double)calls, misses < 0 ? -1.0 : (double)misses / (double)calls };
+}
+
+static const char* format_misses(double v, char* buf, size_t size)
+{
+    if (v < 0)
+        return "n/a";
+    snprintf(buf, size, "%.3f", v);
+    return buf;
+}
+
+int main(int argc, char** argv)
+{
+    bool quick = bench_quick(argc, argv);
+    size_t large_size = large_pages::minimum();
+    if (large_size == 0)
+        large_size = 2u << 20;
+
+    const size_t sizes[] = { 16u << 20, 128u << 20 };
+    const uint64_t calls = quick ? 200000 : 20000000;
+
+    printf("%-10s %8s %11s %11s %8s %12s %12s  %s\n",
+        "image", "funcs", "4K ns", "large ns", "speedup", "4K iTLB", "large iTLB", "backing");
+    for (size_t size : sizes)
+    {
+        if (quick && size > (16u << 20))
+            break;
+        image_t small_img;
+        image_t large_img;
+        if (!map_image(size, false, large_size, &small_img) || !map_image(size, true, large_size, &large_img))
+        {
+            printf("%-10zu cannot map\n", size >> 20);
+            continue;
+        }
+        std::vector<fn_t> fs = emit(small_img);
+        std::vector<fn_t> fl = emit(large_img);
+        CHECK_EQ(fs.size(), fl.size());
+
+        std::vector<uint32_t> order(fs.size());
+        uint64_t rng = 42;
+        for (uint32_t i = 0; i < order.size(); ++i)
+            order[i] = i;
+        for (size_t i = order.size() - 1; i > 0; --i)
+        {
+            rng = rng * 6364136223846793005ull + 1442695040888963407ull;
+            std::swap(order[i], order[(size_t)(rng >> 33) % (i + 1)]);
+        }
+
+        uint32_t rs = 0;
+        uint32_t rl = 0;
+        result_t s = run(fs, order, calls, &rs);
+        result_t l = run(fl, order, calls, &rl);
+        CHECK_EQ(rs, rl);
+        const char* backing = large_img.kind == large_pages::kind_large ? "hugetlb"
+            : large_img.kind == large_pages::kind_transparent ? "THP hint" : "4K only";
+        char ms[32];
+        char ml[32];
+        printf("%-7zuMiB %8zu %11.2f %11.2f %7.2fx %12s %12s  %s\n",
+            size >> 20, fs.size(), s.ns_per_call, l.ns_per_call, s.ns_per_call / l.ns_per_call,
+            format_misses(s.misses_per_call, ms, sizeof(ms)),
+            format_misses(l.misses_per_call, ml, sizeof(ml)), backing);
+
+        large_pages::free(small_img.base, small_img.size);
+        large_pages::free(large_img.base, large_img.size);
+    }
+    return test_result("bench_itlb");
+}
+
+#else
+
+int main()
+{
+    printf("bench_itlb: x86-64 only, skipped\n");
+    return 0;
+}
+
+#endif
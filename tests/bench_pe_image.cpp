@@ -0,0 +1,50 @@
+#include "pe_test_image.h"
+#include "test_util.h"
+
+using namespace pe_image;
+
+// The mapping kernels PEMapper runs on every start: parsing the headers,
+// copying the sections and applying base relocations, over an image dense
+// with relocations (one per pointer slot).
+//
+//   bench_pe_image [--quick]
+int main(int argc, char** argv)
+{
+    bool quick = bench_quick(argc, argv);
+    const uint32_t pages = quick ? 1024 : 16384;
+    const int iters = quick ? 3 : 20;
+    const int parses = quick ? 1000 : 100000;
+
+    std::vector<uint8_t> f = pe_test::build<pe32plus_x64_traits>(pages, 1);
+    layout_t<pe32plus_x64_traits> l;
+    CHECK(parse(f.data(), f.size(), &l));
+    std::vector<uint8_t> img(l.image_size);
+
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < iters; ++i)
+        map_sections(l, f.data(), f.size(), img.data());
+    double t_map = bench_seconds_since(t0) / iters;
+
+    t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < iters; ++i)
+        relocate(l, img.data(), l.image_base + 0x10000ull * (i + 1));
+    double t_reloc = bench_seconds_since(t0) / iters;
+
+    t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < parses; ++i)
+        parse(f.data(), f.size(), &l);
+    double t_parse = bench_seconds_since(t0) / parses;
+
+    // The last pass moved every relocated slot by iters * (iters + 1) / 2
+    uint64_t slot;
+    memcpy(&slot, &img[pe_test::HEADER_SIZE], sizeof(slot));
+    CHECK_EQ(slot, l.image_base + 0x10000ull * iters * (iters + 1) / 2);
+
+    double mib = (double)f.size() / (1 << 20);
+    double relocs = (double)pages * (pe_test::PAGE / 8);
+    printf("image %.0f MiB, %.0f relocations\n", mib, relocs);
+    printf("%-12s %12.3f ms %12.0f MiB/s\n", "map", t_map * 1e3, mib / t_map);
+    printf("%-12s %12.3f ms %12.0f M/s\n", "relocate", t_reloc * 1e3, relocs / t_reloc / 1e6);
+    printf("%-12s %12.0f ns\n", "parse", t_parse * 1e9);
+    return test_result("bench_pe_image");
+}
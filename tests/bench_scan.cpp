@@ -0,0 +1,139 @@
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include "idahost_scan.h"
+#include "test_util.h"
+
+// Signature scanning over a snapshot the size of a BULK_BYTES extract:
+// multi_scanner_t on one thread and on every core, against checking each
+// pattern at every position on its own.
+//
+//   bench_scan [--quick]
+static const char* const SIGNATURES[] = {
+    "48 89 5C 24 ?? 57 48 83 EC 20",
+    "48 8B C4 48 89 58 08",
+    "40 53 48 83 EC 20 48 8B D9",
+    "E8 ?? ?? ?? ?? 48 8B D8 48 85 C0",
+    "FF 15 ?? ?? ?? ?? 85 C0 74",
+    "48 8D 0D ?? ?? ?? ?? E8",
+    "0F B6 ?? 83 ?? 7F",
+    "33 C0 48 83 C4 28 C3",
+    "48 83 EC 28 E8 ?? ?? ?? ?? 48 83 C4 28",
+    "CC CC CC CC 48 89 4C 24 08",
+    "4C 8B DC 49 89 5B 08",
+    "66 0F 6F 05 ?? ?? ?? ??",
+    "B8 ?? ?? ?? ?? 0F 05 C3",
+    "89 54 24 10 4C 89 44 24 18",
+    "41 57 41 56 41 55 41 54",
+    "F3 0F 10 05 ?? ?? ?? ??",
+};
+
+// Bytes that lean toward common opcode and prefix values, as code does
+static std::vector<uint8_t> make_buffer(size_t n)
+{
+    static const uint8_t common[] = { 0x48, 0x8B, 0x89, 0x00, 0xFF, 0xE8, 0x83, 0xC4, 0x24, 0x4C, 0x0F, 0x85 };
+    std::vector<uint8_t> buf(n);
+    uint64_t rng = 7;
+    for (size_t i = 0; i < n; ++i)
+    {
+        rng = rng * 6364136223846793005ull + 1442695040888963407ull;
+        uint32_t r = (uint32_t)(rng >> 33);
+        buf[i] = (r & 3) == 0 ? common[(r >> 2) % sizeof(common)] : (uint8_t)(r >> 8);
+    }
+    return buf;
+}
+
+// One pattern at a time, every position
+static size_t naive(const std::vector<std::vector<uint8_t>>& bytes,
+    const std::vector<std::vector<uint8_t>>& masks,
+    const uint8_t* d,
+    size_t n)
+{
+    size_t found = 0;
+    for (size_t p = 0; p < bytes.size(); ++p)
+    {
+        const std::vector<uint8_t>& b = bytes[p];
+        const std::vector<uint8_t>& m = masks[p];
+        for (size_t i = 0; i + b.size() <= n; ++i)
+        {
+            size_t k = 0;
+            while (k < b.size() && ((d[i + k] ^ b[k]) & m[k]) == 0)
+                ++k;
+            found += k == b.size();
+        }
+    }
+    return found;
+}
+
+static bool parse(const char* hex, std::vector<uint8_t>* b, std::vector<uint8_t>* m)
+{
+    for (const char* s = hex; *s != '\0'; )
+    {
+        if (*s == ' ')
+            ++s;
+        else if (*s == '?')
+        {
+            s += 2;
+            b->push_back(0);
+            m->push_back(0);
+        }
+        else
+        {
+            unsigned v;
+            if (sscanf(s, "%2x", &v) != 1)
+                return false;
+            b->push_back((uint8_t)v);
+            m->push_back(0xFF);
+            s += 2;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    bool quick = bench_quick(argc, argv);
+    size_t n = quick ? (8u << 20) : (256u << 20);
+    std::vector<uint8_t> buf = make_buffer(n);
+
+    multi_scanner_t scanner;
+    std::vector<std::vector<uint8_t>> bytes;
+    std::vector<std::vector<uint8_t>> masks;
+    size_t plant = 0;
+    for (const char* sig : SIGNATURES)
+    {
+        CHECK(scanner.add_hex(sig) >= 0);
+        bytes.emplace_back();
+        masks.emplace_back();
+        CHECK(parse(sig, &bytes.back(), &masks.back()));
+        // A few real occurrences of every signature
+        for (int k = 0; k < 8; ++k)
+        {
+            plant = (plant + 104729 * 37) % (n - 64);
+            memcpy(&buf[plant], bytes.back().data(), bytes.back().size());
+        }
+    }
+
+    double mb = (double)n / (1 << 20);
+    auto t0 = std::chrono::steady_clock::now();
+    size_t expected = naive(bytes, masks, buf.data(), n);
+    double tn = bench_seconds_since(t0);
+
+    t0 = std::chrono::steady_clock::now();
+    size_t one = scanner.scan(buf.data(), n, 1).size();
+    double t1 = bench_seconds_since(t0);
+
+    t0 = std::chrono::steady_clock::now();
+    size_t all = scanner.scan(buf.data(), n).size();
+    double ta = bench_seconds_since(t0);
+
+    CHECK_EQ(one, expected);
+    CHECK_EQ(all, expected);
+    CHECK(expected >= 8);
+    printf("%.0f MiB, %zu patterns, %zu matches\n", mb, bytes.size(), expected);
+    printf("%-22s %10s %8s\n", "", "MiB/s", "speedup");
+    printf("%-22s %10.0f %8s\n", "per pattern", mb / tn, "1.00x");
+    printf("%-22s %10.0f %7.2fx\n", "multi_scanner 1 thread", mb / t1, tn / t1);
+    printf("%-22s %10.0f %7.2fx\n", "multi_scanner all", mb / ta, tn / ta);
+    return test_result("bench_scan");
+}
@@ -0,0 +1,121 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <vector>
+#include "idahost_shm_ring.h"
+#include "test_util.h"
+
+// Throughput of results streamed from a producer to a consumer thread: the
+// shared-memory ring (written and read in place) against a pipe carrying the
+// same length-prefixed records
+static bool read_all(int fd, void* buf, size_t n)
+{
+    uint8_t* p = (uint8_t*)buf;
+    while (n != 0)
+    {
+        ssize_t r = read(fd, p, n);
+        if (r <= 0)
+            return false;
+        p += r;
+        n -= (size_t)r;
+    }
+    return true;
+}
+
+static bool write_all(int fd, const void* buf, size_t n)
+{
+    const uint8_t* p = (const uint8_t*)buf;
+    while (n != 0)
+    {
+        ssize_t w = write(fd, p, n);
+        if (w <= 0)
+            return false;
+        p += w;
+        n -= (size_t)w;
+    }
+    return true;
+}
+
+static double run_pipe(uint32_t size, uint64_t count, uint64_t* checksum)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+        return 0;
+    std::vector<uint8_t> payload(size, 0x5A);
+    auto t0 = std::chrono::steady_clock::now();
+    std::thread producer([&]
+    {
+        for (uint64_t i = 0; i < count; ++i)
+        {
+            payload[0] = (uint8_t)i;
+            if (!write_all(fds[1], &size, sizeof(size)) || !write_all(fds[1], payload.data(), size))
+                break;
+        }
+        close(fds[1]);
+    });
+    std::vector<uint8_t> buf(size);
+    uint32_t len;
+    uint64_t sum = 0;
+    while (read_all(fds[0], &len, sizeof(len)) && read_all(fds[0], buf.data(), len))
+        sum += buf[0];
+    producer.join();
+    close(fds[0]);
+    *checksum = sum;
+    return bench_seconds_since(t0);
+}
+
+static double run_ring(uint32_t size, uint64_t count, uint64_t* checksum)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "/idahost_bench_%d", (int)getpid());
+    shm_ring_t prod;
+    shm_ring_t cons;
+    if (!prod.create(name, 4 << 20) || !cons.open(name))
+        return 0;
+    auto t0 = std::chrono::steady_clock::now();
+    std::thread producer([&]
+    {
+        for (uint64_t i = 0; i < count; ++i)
+        {
+            uint8_t* p = (uint8_t*)prod.reserve(size);
+            if (p == nullptr)
+                break;
+            memset(p, 0x5A, size);
+            p[0] = (uint8_t)i;
+            prod.commit(size);
+        }
+        prod.close_producer();
+    });
+    shm_ring_t::view_t v;
+    uint64_t sum = 0;
+    while (cons.peek(&v))
+    {
+        sum += v.data[0];
+        cons.release();
+    }
+    producer.join();
+    *checksum = sum;
+    return bench_seconds_since(t0);
+}
+
+int main(int argc, char** argv)
+{
+    bool quick = bench_quick(argc, argv);
+    const uint32_t sizes[] = { 64, 4096, 256 * 1024 };
+    const uint64_t total_bytes = quick ? (8ull << 20) : (2ull << 30);
+
+    printf("%-10s %12s %12s %12s %8s\n", "record", "records", "pipe MB/s", "ring MB/s", "speedup");
+    for (uint32_t size : sizes)
+    {
+        uint64_t count = (std::max)((uint64_t)1000, total_bytes / size);
+        uint64_t sum_pipe = 0;
+        uint64_t sum_ring = 0;
+        double tp = run_pipe(size, count, &sum_pipe);
+        double tr = run_ring(size, count, &sum_ring);
+        CHECK(tp > 0 && tr > 0);
+        CHECK_EQ(sum_pipe, sum_ring);
+        double mb = (double)size * count / (1 << 20);
+        printf("%-10u %12llu %12.0f %12.0f %7.2fx\n",
+            size, (unsigned long long)count, mb / tp, mb / tr, tp / tr);
+    }
+    return test_result("bench_shm_ring");
+}
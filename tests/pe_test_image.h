@@ -0,0 +1,118 @@
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "idahost_pe_image.h"
+
+// Synthetic PE file for test_pe_image and bench_pe_image. The file layout
+// equals the image layout. Three sections:
+//   .data    `pages` pages of pointers, entry i = image base + i, every one
+//            relocated except those at index k % 97 == 5 (REL_ABSOLUTE)
+//   .reloc   one block per page
+//   .idata   one descriptor for kernel32.dll with `imports` imports, every
+//            tenth by ordinal (i + 1), the others named "Func<i>"
+namespace pe_test
+{
+    constexpr uint32_t HEADER_SIZE = 0x1000;
+    constexpr uint32_t PAGE = 0x1000;
+    constexpr uint32_t SKIPPED_EVERY = 97;
+    constexpr uint32_t SKIPPED_AT = 5;
+
+    inline uint32_t align_page(uint32_t v)
+    {
+        return (v + PAGE - 1) & ~(PAGE - 1);
+    }
+
+    template <typename Traits>
+    std::vector<uint8_t> build(uint32_t pages, uint32_t imports)
+    {
+        using namespace pe_image;
+        using thunk_t = typename Traits::thunk_t;
+        using optional_t = typename Traits::optional_header_t;
+        const uint32_t per_page = PAGE / sizeof(thunk_t);
+
+        const uint32_t data_size = pages * PAGE;
+        const uint32_t reloc_rva = HEADER_SIZE + data_size;
+        const uint32_t reloc_size = pages * (8 + 2 * per_page);
+        const uint32_t import_rva = reloc_rva + align_page(reloc_size);
+        const uint32_t import_size = 0x1000 + imports * 64;
+        const uint32_t image_size = import_rva + align_page(import_size);
+        std::vector<uint8_t> f(image_size);
+
+        const uint32_t lfanew = 0x80;
+        const uint16_t mz = DOS_MAGIC;
+        memcpy(&f[0], &mz, sizeof(mz));
+        memcpy(&f[0x3C], &lfanew, sizeof(lfanew));
+        const uint32_t sig = NT_SIGNATURE;
+        memcpy(&f[lfanew], &sig, sizeof(sig));
+
+        file_header_t fh = {};
+        fh.machine = Traits::machine;
+        fh.number_of_sections = 3;
+        fh.size_of_optional_header = sizeof(optional_t);
+        memcpy(&f[lfanew + 4], &fh, sizeof(fh));
+
+        optional_t o = {};
+        o.magic = Traits::magic;
+        o.image_base = sizeof(thunk_t) == 4 ? 0x400000 : (decltype(o.image_base))0x140000000ull;
+        o.size_of_image = image_size;
+        o.size_of_headers = HEADER_SIZE;
+        o.address_of_entry_point = HEADER_SIZE;
+        o.section_alignment = PAGE;
+        o.number_of_rva_and_sizes = DIR_COUNT;
+        o.data_directory[DIR_BASERELOC] = { reloc_rva, reloc_size };
+        o.data_directory[DIR_IMPORT] = { import_rva, 2 * sizeof(import_descriptor_t) };
+        memcpy(&f[lfanew + 24], &o, sizeof(o));
+
+        section_header_t sh[3] = {};
+        const uint32_t rvas[3] = { HEADER_SIZE, reloc_rva, import_rva };
+        const uint32_t sizes[3] = { data_size, import_rva - reloc_rva, image_size - import_rva };
+        for (int i = 0; i < 3; ++i)
+        {
+            sh[i].virtual_address = sh[i].pointer_to_raw_data = rvas[i];
+            sh[i].virtual_size = sh[i].size_of_raw_data = sizes[i];
+            sh[i].characteristics = SCN_MEM_READ;
+        }
+        memcpy(&f[lfanew + 24 + sizeof(optional_t)], sh, sizeof(sh));
+
+        const thunk_t base = (thunk_t)o.image_base;
+        for (uint32_t i = 0; i < data_size / sizeof(thunk_t); ++i)
+        {
+            thunk_t v = base + i;
+            memcpy(&f[HEADER_SIZE + i * sizeof(thunk_t)], &v, sizeof(v));
+        }
+
+        uint8_t* r = &f[reloc_rva];
+        for (uint32_t pg = 0; pg < pages; ++pg)
+        {
+            base_relocation_t b = { HEADER_SIZE + pg * PAGE, 8 + 2 * per_page };
+            memcpy(r, &b, 8);
+            r += 8;
+            for (uint32_t k = 0; k < per_page; ++k)
+            {
+                uint16_t e = (uint16_t)(Traits::reloc_type << 12 | (k * sizeof(thunk_t)));
+                if (k % SKIPPED_EVERY == SKIPPED_AT)
+                    e = REL_ABSOLUTE;
+                memcpy(r, &e, sizeof(e));
+                r += 2;
+            }
+        }
+
+        // Descriptor at +0, library name at +0x40, lookup table at +0x100,
+        // IAT at +0x800, hint/name entries from +0x1000
+        import_descriptor_t d = { import_rva + 0x100, 0, 0, import_rva + 0x40, import_rva + 0x800 };
+        memcpy(&f[import_rva], &d, sizeof(d));
+        strcpy((char*)&f[import_rva + 0x40], "kernel32.dll");
+        for (uint32_t i = 0; i < imports; ++i)
+        {
+            thunk_t v = i % 10 == 9
+                ? (Traits::ordinal_flag | (thunk_t)(i + 1))
+                : (thunk_t)(import_rva + 0x1000 + i * 64);
+            memcpy(&f[import_rva + 0x100 + i * sizeof(thunk_t)], &v, sizeof(v));
+            memcpy(&f[import_rva + 0x800 + i * sizeof(thunk_t)], &v, sizeof(v));
+            snprintf((char*)&f[import_rva + 0x1000 + i * 64 + 2], 60, "Func%u", i);
+        }
+        return f;
+    }
+}
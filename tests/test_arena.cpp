@@ -0,0 +1,122 @@
+#include <stdint.h>
+#include <unistd.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "idahost_arena.h"
+#include "idahost_alloc_trace.h"
+#include "test_util.h"
+
+static void init_small(arena_heap_t& heap)
+{
+    arena_heap_t::config_t cfg;
+    cfg.reserve_bytes = 64ull << 20;
+    CHECK(heap.init(cfg));
+}
+
+// Sizes near SIZE_MAX must not wrap to a few spans
+static void test_huge_sizes()
+{
+    arena_heap_t heap;
+    init_small(heap);
+    CHECK(heap.alloc(SIZE_MAX) == nullptr);
+    CHECK(heap.alloc(SIZE_MAX - arena_heap_t::SPAN_SIZE + 2) == nullptr);
+    CHECK(heap.alloc((64u << 20) + 1) == nullptr);
+    CHECK(heap.realloc(heap.alloc(16), SIZE_MAX - 1) == nullptr);
+    CHECK_EQ(heap.stats().large_allocs, 0u);
+
+    // Sizes that fit are still served
+    void* p = heap.alloc(32u << 20);
+    CHECK(p != nullptr);
+    if (p != nullptr)
+        CHECK_EQ(heap.usable_size(p), (size_t)32 << 20);
+}
+
+// A new session frees again after the previous one's teardown
+static void test_teardown_reset()
+{
+    arena_heap_t heap;
+    init_small(heap);
+    void* a = heap.alloc(100);
+    void* b = heap.alloc(100);
+    heap.begin_teardown();
+    heap.free(a);
+    CHECK_EQ(heap.stats().teardown_frees, 1u);
+    CHECK_EQ(heap.stats().frees, 0u);
+
+    heap.end_teardown();
+    CHECK(!heap.in_teardown());
+    heap.free(b);
+    CHECK_EQ(heap.stats().frees, 1u);
+    CHECK_EQ(heap.stats().teardown_frees, 1u);
+
+    // A released range stays off limits
+    heap.release();
+    heap.end_teardown();
+    CHECK(heap.in_teardown());
+    CHECK(heap.alloc(100) == nullptr);
+}
+
+// Threads whose cache already serves another arena count into the shared
+// counters; concurrent updates must not be lost
+static void test_shared_counters()
+{
+    arena_heap_t first;
+    arena_heap_t second;
+    init_small(first);
+    init_small(second);
+    const int threads = 4;
+    const int per = 50000;
+    std::vector<std::thread> ts;
+    for (int t = 0; t < threads; ++t)
+    {
+        ts.emplace_back([&]
+        {
+            first.free(first.alloc(16));
+            for (int i = 0; i < per; ++i)
+                second.free(second.alloc(16 + i % 4 * 16));
+        });
+    }
+    for (std::thread& t : ts)
+        t.join();
+    arena_heap_t::stats_t st = second.stats();
+    CHECK_EQ(st.allocs, (uint64_t)threads * per);
+    CHECK_EQ(st.frees, (uint64_t)threads * per);
+    CHECK_EQ(st.bytes_in_use(), 0u);
+}
+
+static void test_trace_round_trip()
+{
+    std::string path = "/tmp/idahost_test_trace_" + std::to_string((int)getpid());
+    {
+        alloc_trace_writer_t w;
+        CHECK(w.open(path.c_str()));
+        for (uint64_t i = 0; i < 10000; ++i)
+            w.record(alloc_trace_rec_t::op_alloc, 7, (void*)(uintptr_t)(i + 1), nullptr, i);
+        w.record(alloc_trace_rec_t::op_realloc, 7, (void*)0x100, (void*)0x1, 99);
+        w.close();
+        // Dropped once closed
+        w.record(alloc_trace_rec_t::op_free, 7, (void*)0x100, nullptr, 0);
+    }
+    std::vector<alloc_trace_rec_t> recs;
+    CHECK(alloc_trace_load(path.c_str(), &recs));
+    CHECK_EQ(recs.size(), 10001u);
+    if (recs.size() == 10001)
+    {
+        CHECK_EQ(recs[4096].ptr, 4097u);
+        CHECK_EQ(recs[4096].size, 4096u);
+        CHECK_EQ(recs[10000].op, (uint32_t)alloc_trace_rec_t::op_realloc);
+        CHECK_EQ(recs[10000].old_ptr, 1u);
+        CHECK_EQ(recs[10000].thread, 7u);
+    }
+    unlink(path.c_str());
+}
+
+int main()
+{
+    test_huge_sizes();
+    test_teardown_reset();
+    test_shared_counters();
+    test_trace_round_trip();
+    return test_result("test_arena");
+}
@@ -0,0 +1,176 @@
+#include <string>
+#include "idahost_changes.h"
+#include "test_util.h"
+
+static uint8_t g_buf[sizeof(change_hdr_t) + 0x10000];
+
+static void test_round_trip()
+{
+    std::vector<uint8_t> batch;
+    auto add = [&batch](size_t n) { batch.insert(batch.end(), g_buf, g_buf + n); };
+    add(change_encode(g_buf, CHG_RENAMED, CHGF_LOCAL, 0x1000, 0, "main", 4));
+    add(change_encode(g_buf, CHG_FUNC_ADDED, 0, 0x2000, 0x2040));
+    std::string big(70000, 'x');
+    add(change_encode(g_buf, CHG_CMT, CHGF_REPEATABLE, 0x3000, 0, big.data(), big.size()));
+
+    change_reader_t r(batch.data(), batch.size());
+    change_t c;
+    CHECK(r.next(&c));
+    CHECK_EQ(c.kind, CHG_RENAMED);
+    CHECK_EQ(c.flags, CHGF_LOCAL);
+    CHECK_EQ(c.ea, 0x1000u);
+    CHECK(std::string((const char*)c.payload, c.len) == "main");
+    CHECK(r.next(&c));
+    CHECK_EQ(c.kind, CHG_FUNC_ADDED);
+    CHECK_EQ(c.ea2, 0x2040u);
+    CHECK_EQ(c.len, 0u);
+    // Payloads over 64K are cut
+    CHECK(r.next(&c));
+    CHECK_EQ(c.kind, CHG_CMT);
+    CHECK_EQ(c.len, 0xFFFFu);
+    CHECK(!r.next(&c));
+
+    // A cut header or payload ends the walk
+    change_reader_t cut_hdr(batch.data(), sizeof(change_hdr_t) - 1);
+    CHECK(!cut_hdr.next(&c));
+    change_reader_t cut_payload(batch.data(), sizeof(change_hdr_t) + 3);
+    CHECK(!cut_payload.next(&c));
+    change_reader_t one(batch.data(), sizeof(change_hdr_t) + 4 + sizeof(change_hdr_t));
+    CHECK(one.next(&c));
+    CHECK(one.next(&c));
+    CHECK(!one.next(&c));
+}
+
+static void test_type()
+{
+    const char type[] = "\x0c\x01\x07";
+    const char fields[] = "\x02" "a" "\x02" "b";
+    size_t n = change_encode_type(g_buf, 0x4000, type, 3, fields, 4);
+    change_reader_t r(g_buf, n);
+    change_t c;
+    CHECK(r.next(&c));
+    const uint8_t* t;
+    const uint8_t* f;
+    size_t tl;
+    size_t fl;
+    CHECK(change_decode_type(c, &t, &tl, &f, &fl));
+    CHECK_EQ(c.flags, 0);
+    CHECK(tl == 3 && memcmp(t, type, 3) == 0);
+    CHECK(fl == 4 && memcmp(f, fields, 4) == 0);
+
+    // Deleted
+    n = change_encode_type(g_buf, 0x4000, nullptr, 0, nullptr, 0);
+    change_reader_t del(g_buf, n);
+    CHECK(del.next(&c));
+    CHECK_EQ(c.len, 0u);
+    CHECK(!change_decode_type(c, &t, &tl, &f, &fl));
+
+    // Fields are cut before the type
+    std::string big_type(40000, 't');
+    std::string big_fields(40000, 'f');
+    n = change_encode_type(g_buf, 0x4000, big_type.data(), big_type.size(), big_fields.data(), big_fields.size());
+    change_reader_t cut(g_buf, n);
+    CHECK(cut.next(&c));
+    CHECK(change_decode_type(c, &t, &tl, &f, &fl));
+    CHECK_EQ(c.flags, CHGF_TRUNCATED);
+    CHECK_EQ(tl, big_type.size());
+    CHECK_EQ(fl, 0xFFFFu - 2 - big_type.size());
+}
+
+static void append(change_feed_t* feed, size_t records, size_t payload)
+{
+    static const std::string text(1000, 'c');
+    for (size_t i = 0; i < records; ++i)
+    {
+        size_t n = change_encode(g_buf, CHG_CMT, 0, i, 0, text.data(), payload);
+        feed->append(g_buf, n);
+    }
+}
+
+static void test_sequence()
+{
+    change_feed_t feed;
+    feed.seal();
+    append(&feed, 3, 10);
+    feed.seal();
+    feed.seal();
+    append(&feed, 1, 10);
+    std::vector<change_feed_t::batch_t> out;
+    CHECK_EQ(feed.drain(&out), 2u);
+    CHECK_EQ(out[0].seq, 1u);
+    CHECK_EQ(out[0].records, 3u);
+    CHECK_EQ(out[1].seq, 2u);
+    append(&feed, 1, 10);
+    CHECK_EQ(feed.drain(&out), 1u);
+    CHECK_EQ(out[0].seq, 3u);
+    CHECK_EQ(feed.drain(&out), 0u);
+    change_feed_t::stats_t st = feed.stats();
+    CHECK_EQ(st.records, 5u);
+    CHECK_EQ(st.batches, 3u);
+    CHECK_EQ(st.queued_bytes, 0u);
+}
+
+static void test_overflow()
+{
+    const size_t rec = sizeof(change_hdr_t) + 100;
+    change_feed_t feed;
+    feed.set_capacity(10 * rec);
+    for (int i = 0; i < 8; ++i)
+    {
+        append(&feed, 3, 100);
+        feed.seal();
+    }
+    // Eight batches of three: only three fit
+    std::vector<change_feed_t::batch_t> out;
+    CHECK_EQ(feed.drain(&out), 3u);
+    CHECK_EQ(out[0].seq, 6u);
+    CHECK_EQ(out[2].seq, 8u);
+    CHECK_EQ(feed.stats().dropped_batches, 5u);
+
+    // The newest is kept even if it alone is over the capacity
+    append(&feed, 3, 100);
+    feed.seal();
+    append(&feed, 20, 100);
+    CHECK_EQ(feed.drain(&out), 1u);
+    CHECK_EQ(out[0].seq, 10u);
+    CHECK_EQ(out[0].records, 20u);
+}
+
+// A large batch does not make later small batches hold as much
+static void test_memory()
+{
+    const size_t rec = sizeof(change_hdr_t) + 1000;
+    change_feed_t feed;
+    append(&feed, 2000, 1000);
+    feed.seal();
+    for (int i = 0; i < 200; ++i)
+    {
+        append(&feed, 1, 1000);
+        feed.seal();
+    }
+    change_feed_t::stats_t st = feed.stats();
+    CHECK_EQ(st.queued_bytes, 2200 * rec);
+    CHECK(st.held_bytes <= 2200 * rec + 2 * 2000 * rec);
+
+    std::vector<change_feed_t::batch_t> out;
+    CHECK_EQ(feed.drain(&out), 201u);
+    size_t held = 0;
+    for (const change_feed_t::batch_t& b : out)
+        held += b.data.capacity();
+    CHECK_EQ(held, 2200 * rec);
+    out.clear();
+    // Only the open buffer stays allocated
+    st = feed.stats();
+    CHECK_EQ(st.queued_bytes, 0u);
+    CHECK(st.held_bytes <= 2 * 2000 * rec);
+}
+
+int main()
+{
+    test_round_trip();
+    test_type();
+    test_sequence();
+    test_overflow();
+    test_memory();
+    return test_result("test_changes");
+}
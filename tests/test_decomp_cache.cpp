@@ -0,0 +1,147 @@
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "idahost_decomp_cache.h"
+#include "test_util.h"
+
+static hash128_t key_of(const char* context, const char* name, const char* ref, const char* code)
+{
+    decomp_key_t k;
+    k.add_str(decomp_key_t::part_context, context);
+    k.add_str(decomp_key_t::part_name, name);
+    k.add_str(decomp_key_t::part_ref, ref);
+    k.add_str(decomp_key_t::part_code, code);
+    return k.hash();
+}
+
+// Every part the pseudocode depends on changes the key
+static void test_key_parts()
+{
+    hash128_t base = key_of("8.4", "main", "printf", "\x55\x48");
+    CHECK(base == key_of("8.4", "main", "printf", "\x55\x48"));
+    CHECK(base != key_of("9.0", "main", "printf", "\x55\x48"));
+    CHECK(base != key_of("8.4", "start", "printf", "\x55\x48"));
+    CHECK(base != key_of("8.4", "main", "puts", "\x55\x48"));
+    CHECK(base != key_of("8.4", "main", "printf", "\x55\x49"));
+
+    // Parts cannot run into each other
+    CHECK(key_of("8.4", "ab", "c", "") != key_of("8.4", "a", "bc", ""));
+
+    // Unnamed targets are keyed by address
+    decomp_key_t a;
+    decomp_key_t b;
+    a.add_u64(decomp_key_t::part_ref, 0x401000);
+    b.add_u64(decomp_key_t::part_ref, 0x402000);
+    CHECK(a.hash() != b.hash());
+    b.clear();
+    b.add_u64(decomp_key_t::part_ref, 0x401000);
+    CHECK(a.hash() == b.hash());
+}
+
+static std::string temp_path()
+{
+    char tmpl[] = "/tmp/idahost_dc_XXXXXX";
+    int fd = mkstemp(tmpl);
+    close(fd);
+    unlink(tmpl);
+    return tmpl;
+}
+
+static void test_store()
+{
+    std::string path = temp_path();
+    decomp_cache_t::config_t cfg;
+    cfg.slots = 1024;
+    cfg.data_bytes = 4096;
+
+    decomp_cache_t c;
+    CHECK(c.open(path.c_str(), cfg));
+    hash128_t k1 = key_of("v", "f1", "", "");
+    hash128_t k2 = key_of("v", "f2", "", "");
+    CHECK(c.insert(k1, "int f1();", 9, "blocks=1", 8));
+
+    decomp_cache_t::entry_t e = {};
+    bool found = c.lookup(k1, &e);
+    CHECK(found);
+    if (found)
+    {
+        CHECK_EQ(std::string(e.pseudocode, e.pseudocode_len), std::string("int f1();"));
+        CHECK_EQ(std::string(e.summary, e.summary_len), std::string("blocks=1"));
+    }
+    CHECK(!c.lookup(k2, &e));
+
+    // A second worker sees the same entries
+    decomp_cache_t other;
+    CHECK(other.open(path.c_str(), cfg));
+    CHECK(other.lookup(k1, &e));
+    CHECK_EQ(other.entries(), 1u);
+
+    // A full arena refuses inserts
+    std::string big(5000, 'x');
+    CHECK(!c.insert(k2, big.data(), (uint32_t)big.size(), "", 0));
+    CHECK(!c.lookup(k2, &e));
+    unlink(path.c_str());
+}
+
+// Worker processes racing to create and fill the same store
+static void test_processes()
+{
+    std::string path = temp_path();
+    decomp_cache_t::config_t cfg;
+    cfg.slots = 4096;
+    cfg.data_bytes = 1 << 20;
+    const int workers = 4;
+    const int per_worker = 200;
+
+    pid_t pids[workers];
+    for (int w = 0; w < workers; ++w)
+    {
+        pids[w] = fork();
+        if (pids[w] == 0)
+        {
+            decomp_cache_t c;
+            if (!c.open(path.c_str(), cfg))
+                _exit(1);
+            for (int i = 0; i < per_worker; ++i)
+            {
+                // Half the keys are shared by every worker
+                std::string name = i % 2 == 0 ? "shared" + std::to_string(i) : "w" + std::to_string(w) + "_" + std::to_string(i);
+                if (!c.insert(key_of("v", name.c_str(), "", ""), name.data(), (uint32_t)name.size(), "", 0))
+                    _exit(2);
+            }
+            _exit(0);
+        }
+    }
+    for (pid_t pid : pids)
+    {
+        int status = 0;
+        waitpid(pid, &status, 0);
+        CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+
+    decomp_cache_t c;
+    CHECK(c.open(path.c_str(), cfg));
+    decomp_cache_t::entry_t e = {};
+    for (int w = 0; w < workers; ++w)
+    {
+        for (int i = 0; i < per_worker; ++i)
+        {
+            std::string name = i % 2 == 0 ? "shared" + std::to_string(i) : "w" + std::to_string(w) + "_" + std::to_string(i);
+            bool found = c.lookup(key_of("v", name.c_str(), "", ""), &e);
+            CHECK(found);
+            if (found)
+                CHECK_EQ(std::string(e.pseudocode, e.pseudocode_len), name);
+        }
+    }
+    // Racing inserts of a shared key may each claim a slot, but never lose one
+    CHECK(c.entries() >= (uint64_t)(workers * per_worker / 2 + per_worker / 2));
+    unlink(path.c_str());
+}
+
+int main()
+{
+    test_key_parts();
+    test_store();
+    test_processes();
+    return test_result("test_decomp_cache");
+}
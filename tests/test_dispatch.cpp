@@ -0,0 +1,100 @@
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include "idahost_dispatch.h"
+#include "test_util.h"
+
+// Throws on the copy that hands out the result a second time
+static int s_copies = 0;
+
+struct fragile_t
+{
+    int v = 0;
+
+    fragile_t() = default;
+    explicit fragile_t(int x) : v(x) { }
+    fragile_t(fragile_t&& o) noexcept : v(o.v) { }
+    fragile_t& operator=(fragile_t&& o) noexcept { v = o.v; return *this; }
+    fragile_t& operator=(const fragile_t& o) { v = o.v; return *this; }
+
+    fragile_t(const fragile_t& o) : v(o.v)
+    {
+        if (++s_copies == 2)
+            throw std::runtime_error("copy");
+    }
+};
+
+static void test_coalesced_copy_throws()
+{
+    dispatcher_t d;
+    std::vector<std::future<fragile_t>> fs;
+    for (int i = 0; i < 4; ++i)
+        fs.push_back(d.submit([i] { return fragile_t(i); }, dispatcher_t::prio_normal, 7));
+    CHECK_EQ(d.pump(), 1u);
+    CHECK_EQ(d.stats().coalesced, 3u);
+
+    // The first copy went out, the second threw: the rest report the error
+    CHECK_EQ(fs[0].get().v, 3);
+    for (size_t i = 1; i < fs.size(); ++i)
+    {
+        bool threw = false;
+        try
+        {
+            fs[i].get();
+        }
+        catch (const std::runtime_error&)
+        {
+            threw = true;
+        }
+        CHECK(threw);
+    }
+}
+
+static void test_pending_never_wraps()
+{
+    dispatcher_t d;
+    std::atomic<bool> done{ false };
+    std::vector<std::thread> producers;
+    for (int t = 0; t < 4; ++t)
+    {
+        producers.emplace_back([&d]
+        {
+            for (int i = 0; i < 20000; ++i)
+                d.submit([] { });
+        });
+    }
+    std::thread watcher([&]
+    {
+        while (!done.load())
+            CHECK(d.pending() < (1u << 20));
+    });
+    size_t ran = 0;
+    while (ran < 80000)
+        ran += d.pump();
+    for (std::thread& p : producers)
+        p.join();
+    done.store(true);
+    watcher.join();
+    CHECK_EQ(d.pending(), 0u);
+    CHECK_EQ(d.stats().executed, 80000u);
+}
+
+static void test_priority_order()
+{
+    dispatcher_t d;
+    std::string order;
+    d.submit([&] { order += 'l'; }, dispatcher_t::prio_low);
+    d.submit([&] { order += 'n'; });
+    d.submit([&] { order += 'h'; }, dispatcher_t::prio_high);
+    d.submit([&] { order += 'm'; });
+    d.pump();
+    CHECK_EQ(order, std::string("hnml"));
+}
+
+int main()
+{
+    test_coalesced_copy_throws();
+    test_pending_never_wraps();
+    test_priority_order();
+    return test_result("test_dispatch");
+}
@@ -0,0 +1,110 @@
+#include <stdint.h>
+#include <vector>
+#include "idahost_large_pages.h"
+#include "test_util.h"
+
+using intervals_t = std::vector<std::pair<uint64_t, uint64_t>>;
+using ranges_t = std::vector<large_pages::range_t>;
+
+static const uint64_t MB = 1ull << 20;
+static const uint64_t L = 2 * MB;
+
+static bool same(const ranges_t& got, const ranges_t& want)
+{
+    if (got.size() != want.size())
+        return false;
+    for (size_t i = 0; i < got.size(); ++i)
+    {
+        if (got[i].offset != want[i].offset || got[i].size != want[i].size || got[i].large != want[i].large)
+            return false;
+    }
+    return true;
+}
+
+static void test_cases()
+{
+    CHECK(same(large_pages::plan({}, 9 * MB, L), { { 0, 9 * MB, false } }));
+
+    // Unaligned ends are rounded inwards
+    CHECK(same(large_pages::plan({ { 0x1000, 5 * MB } }, 9 * MB, L),
+        { { 0, 2 * MB, false }, { 2 * MB, 2 * MB, true }, { 4 * MB, 5 * MB, false } }));
+
+    // Shorter than a large page once aligned
+    CHECK(same(large_pages::plan({ { 1 * MB, 3 * MB } }, 9 * MB, L), { { 0, 9 * MB, false } }));
+
+    // Overlapping, adjacent and unsorted intervals merge first
+    CHECK(same(large_pages::plan({ { 2 * MB, 6 * MB }, { 0, 3 * MB } }, 9 * MB, L),
+        { { 0, 6 * MB, true }, { 6 * MB, 3 * MB, false } }));
+    CHECK(same(large_pages::plan({ { 2 * MB, 4 * MB }, { 1 * MB, 2 * MB } }, 9 * MB, L),
+        { { 0, 2 * MB, false }, { 2 * MB, 2 * MB, true }, { 4 * MB, 5 * MB, false } }));
+    CHECK(same(large_pages::plan({ { 6 * MB, 8 * MB }, { 0, 2 * MB }, { 2 * MB, 4 * MB } }, 9 * MB, L),
+        { { 0, 4 * MB, true }, { 4 * MB, 2 * MB, false }, { 6 * MB, 2 * MB, true }, { 8 * MB, 1 * MB, false } }));
+
+    // Past the image: clamped, or dropped
+    CHECK(same(large_pages::plan({ { 4 * MB, 100 * MB } }, 9 * MB, L),
+        { { 0, 4 * MB, false }, { 4 * MB, 4 * MB, true }, { 8 * MB, 1 * MB, false } }));
+    CHECK(same(large_pages::plan({ { 20 * MB, 30 * MB } }, 9 * MB, L), { { 0, 9 * MB, false } }));
+    CHECK(same(large_pages::plan({ { 0, 8 * MB } }, 8 * MB, L), { { 0, 8 * MB, true } }));
+    CHECK(large_pages::plan({}, 0, L).empty());
+}
+
+// Against a page-by-page reference: ranges tile the image in order, and a
+// large page is marked large exactly when the intervals cover it whole
+static void test_random()
+{
+    uint64_t rng = 11;
+    auto next = [&rng](uint64_t n)
+    {
+        rng = rng * 6364136223846793005ull + 1442695040888963407ull;
+        return (rng >> 33) % n;
+    };
+    const uint64_t unit = 64 * 1024;
+    for (int round = 0; round < 2000; ++round)
+    {
+        uint64_t image = (1 + next(300)) * unit;
+        intervals_t eligible;
+        size_t count = next(5);
+        for (size_t i = 0; i < count; ++i)
+        {
+            uint64_t s = next(350) * unit;
+            eligible.push_back({ s, s + (1 + next(120)) * unit });
+        }
+        ranges_t r = large_pages::plan(eligible, image, L);
+
+        uint64_t pos = 0;
+        bool ok = true;
+        for (const large_pages::range_t& x : r)
+        {
+            ok &= x.offset == pos && x.size != 0;
+            if (x.large)
+                ok &= x.offset % L == 0 && x.size % L == 0;
+            pos += x.size;
+        }
+        ok &= pos == image;
+
+        for (uint64_t p = 0; p + L <= image; p += L)
+        {
+            // Covered unit by unit
+            bool covered = true;
+            for (uint64_t u = p; u < p + L && covered; u += unit)
+            {
+                bool in = false;
+                for (const auto& e : eligible)
+                    in |= e.first <= u && u + unit <= e.second;
+                covered = in;
+            }
+            bool large = false;
+            for (const large_pages::range_t& x : r)
+                large |= x.large && x.offset <= p && p + L <= x.offset + x.size;
+            ok &= large == covered;
+        }
+        CHECK(ok);
+    }
+}
+
+int main()
+{
+    test_cases();
+    test_random();
+    return test_result("test_large_pages");
+}
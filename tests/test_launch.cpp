@@ -0,0 +1,191 @@
+#include <stdlib.h>
+#include <new>
+#include "idahost_launch.h"
+#include "test_util.h"
+
+// Counts every allocation, to check that relaunching reuses the block
+static size_t g_allocs = 0;
+
+void* operator new(size_t n)
+{
+    ++g_allocs;
+    void* p = malloc(n);
+    if (p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t n)
+{
+    return operator new(n);
+}
+
+void* operator new[](size_t n, const std::nothrow_t&) noexcept
+{
+    ++g_allocs;
+    return malloc(n);
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+// The arguments after the program name, split by CommandLineToArgvW's rules
+static std::vector<std::wstring> split(const wchar_t* s)
+{
+    std::vector<std::wstring> out;
+    // The program name is quoted without escapes
+    if (*s == L'"')
+    {
+        ++s;
+        while (*s != L'\0' && *s != L'"')
+            ++s;
+        if (*s != L'\0')
+            ++s;
+    }
+    else
+    {
+        while (*s != L'\0' && *s != L' ' && *s != L'\t')
+            ++s;
+    }
+    for (;;)
+    {
+        while (*s == L' ' || *s == L'\t')
+            ++s;
+        if (*s == L'\0')
+            break;
+        std::wstring a;
+        bool quoted = false;
+        for (;;)
+        {
+            size_t slashes = 0;
+            while (*s == L'\\')
+            {
+                ++slashes;
+                ++s;
+            }
+            if (*s == L'"')
+            {
+                a.append(slashes / 2, L'\\');
+                if (slashes % 2 != 0)
+                    a.push_back(L'"');
+                else if (quoted && s[1] == L'"')
+                    a.push_back(*++s);
+                else
+                    quoted = !quoted;
+                ++s;
+                continue;
+            }
+            a.append(slashes, L'\\');
+            if (*s == L'\0' || (!quoted && (*s == L' ' || *s == L'\t')))
+                break;
+            a.push_back(*s++);
+        }
+        out.push_back(a);
+    }
+    return out;
+}
+
+static void test_command_line()
+{
+    const std::vector<std::wstring> args = {
+        L"-A", L"", L"C:\\My Files\\a.exe", L"say \"hi\"", L"tail\\", L"sp ace\\",
+        L"a\\\\\"b", L"\\\\server\\share", L"tab\there", L"-Lc:\\logs\\x y.log",
+    };
+    launch_desc_t d;
+    CHECK(d.build(L"C:\\Program Files\\IDA", L"idat64.exe", args));
+    CHECK(split(d.command_line()) == args);
+    CHECK(wcsncmp(d.command_line(), L"\"C:\\Program Files\\IDA\\idat64.exe\" -A \"\" ", 40) == 0);
+
+    CHECK_EQ(d.argc(), (int)args.size() + 1);
+    CHECK(wcscmp(d.arg(0), L"C:\\Program Files\\IDA\\idat64.exe") == 0);
+    for (int i = 1; i < d.argc(); ++i)
+        CHECK(args[i - 1] == d.arg(i));
+    CHECK((*d.p_argv())[d.argc()] == nullptr);
+    CHECK_EQ(*d.p_argc(), d.argc());
+
+    // No separator is added after one already there
+    CHECK(d.build(L"C:\\IDA\\", L"idat64.exe", {}));
+    CHECK(wcscmp(d.module_path(), L"C:\\IDA\\idat64.exe") == 0);
+    CHECK(wcscmp(d.command_line(), L"\"C:\\IDA\\idat64.exe\"") == 0);
+}
+
+static void test_env()
+{
+    launch_desc_t d;
+    CHECK(d.build(L"C:\\IDA", L"idat64.exe", {},
+        { { L"TVHEADLESS", L"1" }, { L"IDADIR", L"C:\\Program Files\\IDA" } }));
+    CHECK_EQ(d.env_count(), 2u);
+    CHECK(wcscmp(d.env(0), L"TVHEADLESS=1") == 0);
+    CHECK(wcscmp(d.find_env(L"TVHEADLESS"), L"1") == 0);
+    CHECK(wcscmp(d.find_env(L"idadir"), L"C:\\Program Files\\IDA") == 0);
+    CHECK(d.find_env(L"IDA") == nullptr);
+    CHECK(d.find_env(L"IDADIRX") == nullptr);
+}
+
+// GetModuleFileNameW semantics
+static void test_module_path()
+{
+    launch_desc_t d;
+    CHECK(d.build(L"C:\\IDA", L"idat64.exe", {}));
+    const size_t len = d.module_path_length();
+    CHECK_EQ(len, wcslen(L"C:\\IDA\\idat64.exe"));
+
+    wchar_t buf[64];
+    bool truncated;
+    CHECK_EQ(d.copy_module_path(buf, (uint32_t)len + 1, &truncated), (uint32_t)len);
+    CHECK(!truncated);
+    CHECK(wcscmp(buf, d.module_path()) == 0);
+
+    // No room for the terminator: truncated, and still terminated
+    CHECK_EQ(d.copy_module_path(buf, (uint32_t)len, &truncated), (uint32_t)len);
+    CHECK(truncated);
+    CHECK_EQ(wcslen(buf), len - 1);
+
+    CHECK_EQ(d.copy_module_path(buf, 5, &truncated), 5u);
+    CHECK(truncated);
+    CHECK(wcscmp(buf, L"C:\\I") == 0);
+
+    CHECK_EQ(d.copy_module_path(buf, 0, &truncated), 0u);
+    CHECK(truncated);
+}
+
+// Relaunching with arguments of similar length allocates nothing
+static void test_rebuild()
+{
+    std::vector<std::vector<std::wstring>> variants;
+    for (int i = 0; i < 8; ++i)
+    {
+        variants.push_back({ L"-A",
+            L"-Lc:\\logs\\run" + std::to_wstring(i) + L".log",
+            L"C:\\jobs\\sample " + std::to_wstring(i) + L".bin" });
+    }
+    const std::wstring dir = L"C:\\IDA";
+    const std::wstring bin = L"idat64.exe";
+    launch_desc_t d;
+    CHECK(d.build(dir, bin, variants[0]));
+    size_t capacity = d.capacity_bytes();
+    size_t before = g_allocs;
+    for (int i = 0; i < 10000; ++i)
+        CHECK(d.build(dir, bin, variants[i & 7]));
+    CHECK_EQ(g_allocs, before);
+    CHECK_EQ(d.capacity_bytes(), capacity);
+    CHECK(d.used_bytes() <= capacity);
+
+    // A longer launch grows the block once
+    std::vector<std::wstring> longer = variants[0];
+    longer.push_back(std::wstring(4096, L'x'));
+    CHECK(d.build(dir, bin, longer));
+    CHECK(d.capacity_bytes() > capacity);
+    CHECK(split(d.command_line()) == longer);
+}
+
+int main()
+{
+    test_command_line();
+    test_env();
+    test_module_path();
+    test_rebuild();
+    return test_result("test_launch");
+}
@@ -0,0 +1,147 @@
+#include <stdlib.h>
+#include <sstream>
+#include "idahost_metrics.h"
+#include "test_util.h"
+
+using hist_t = latency_histogram_t;
+
+static void test_buckets()
+{
+    // Exact below SUB_COUNT, then SUB_COUNT sub-buckets per power of two
+    for (uint64_t v = 0; v < 16; ++v)
+    {
+        CHECK_EQ(hist_t::bucket_of(v), (int)v);
+        CHECK_EQ(hist_t::bucket_upper((int)v), v);
+    }
+    CHECK_EQ(hist_t::bucket_of(16), 16);
+    CHECK_EQ(hist_t::bucket_upper(16), 16u);
+    CHECK_EQ(hist_t::bucket_of(31), 31);
+    CHECK_EQ(hist_t::bucket_of(32), 32);
+    CHECK_EQ(hist_t::bucket_upper(32), 33u);
+    CHECK_EQ(hist_t::bucket_of(33), 32);
+    CHECK_EQ(hist_t::bucket_of(UINT64_MAX), hist_t::BUCKETS - 1);
+    CHECK_EQ(hist_t::bucket_upper(hist_t::BUCKETS - 1), UINT64_MAX);
+
+    // Buckets tile the range: each starts right after the previous one ends
+    for (int b = 1; b < hist_t::BUCKETS; ++b)
+    {
+        uint64_t lower = hist_t::bucket_upper(b - 1) + 1;
+        CHECK_EQ(hist_t::bucket_of(lower), b);
+        CHECK_EQ(hist_t::bucket_of(hist_t::bucket_upper(b)), b);
+    }
+
+    // Powers of two and their neighbours land in a bucket within 1/16
+    for (int k = 4; k < 64; ++k)
+    {
+        uint64_t p = (uint64_t)1 << k;
+        for (uint64_t v : { p - 1, p, p + 1 })
+        {
+            int b = hist_t::bucket_of(v);
+            uint64_t upper = hist_t::bucket_upper(b);
+            CHECK(upper >= v);
+            CHECK(upper - v <= v / 16);
+        }
+    }
+}
+
+static void test_quantiles()
+{
+    hist_t h;
+    for (uint64_t v = 1; v <= 1000; ++v)
+        h.record(v * 1000);
+    auto s = std::make_unique<hist_t::snapshot_t>();
+    h.snapshot(s.get());
+    CHECK_EQ(s->count, 1000u);
+    CHECK_EQ(s->max, 1000000u);
+    CHECK_EQ(s->sum, 500500000u);
+
+    // Within a bucket's width of the exact quantile, never above max
+    for (double q : { 0.0, 0.5, 0.9, 0.99, 1.0 })
+    {
+        uint64_t exact = (uint64_t)(q * 999 + 1) * 1000;
+        uint64_t got = s->quantile(q);
+        CHECK(got >= exact);
+        CHECK(got - exact <= exact / 16);
+        CHECK(got <= s->max);
+    }
+    CHECK_EQ(s->quantile(1.0), 1000000u);
+
+    // count_le counts whole buckets below the limit
+    CHECK_EQ(s->count_le(0), 0u);
+    CHECK_EQ(s->count_le(UINT64_MAX), 1000u);
+    uint64_t le = s->count_le(500000);
+    CHECK(le <= 500);
+    CHECK(le >= 500 - 500 / 16);
+
+    hist_t empty;
+    empty.snapshot(s.get());
+    CHECK_EQ(s->quantile(0.5), 0u);
+    CHECK_EQ(s->count_le(UINT64_MAX), 0u);
+}
+
+static void test_prometheus()
+{
+    counter_t requests;
+    gauge_t ratio;
+    hist_t latency;
+    requests.add(3);
+    ratio.set(0.25);
+    for (uint64_t v : { 500ull, 3000ull, 40000ull, 2000000ull, 7000000000ull })
+        latency.record(v);
+
+    metrics_registry_t reg;
+    reg.add("t_requests", "Requests", &requests);
+    reg.add("t_ratio", "Ratio", &ratio);
+    reg.add("t_latency", "Latency", &latency);
+    std::string text = reg.prometheus_text();
+    CHECK(text.find("# TYPE t_requests counter\nt_requests 3\n") != std::string::npos);
+    CHECK(text.find("# TYPE t_ratio gauge\nt_ratio 0.25\n") != std::string::npos);
+    CHECK(text.find("# TYPE t_latency histogram\n") != std::string::npos);
+
+    std::istringstream in(text);
+    std::string line;
+    uint64_t prev = 0;
+    uint64_t inf = UINT64_MAX;
+    uint64_t count = 0;
+    int buckets = 0;
+    int quantiles = 0;
+    double max = 0;
+    while (std::getline(in, line))
+    {
+        size_t sp = line.rfind(' ');
+        if (line.rfind("t_latency_bucket{le=\"+Inf\"}", 0) == 0)
+            inf = strtoull(line.c_str() + sp + 1, nullptr, 10);
+        else if (line.rfind("t_latency_bucket", 0) == 0)
+        {
+            uint64_t n = strtoull(line.c_str() + sp + 1, nullptr, 10);
+            CHECK(n >= prev);
+            prev = n;
+            ++buckets;
+        }
+        else if (line.rfind("t_latency_count ", 0) == 0)
+            count = strtoull(line.c_str() + sp + 1, nullptr, 10);
+        else if (line.rfind("t_latency_quantile{", 0) == 0)
+        {
+            ++quantiles;
+            if (line.find("quantile=\"1\"") != std::string::npos)
+                max = strtod(line.c_str() + sp + 1, nullptr);
+        }
+    }
+    CHECK_EQ(buckets, 15);
+    // 7 s lies past the last finite bucket
+    CHECK_EQ(prev, 4u);
+    CHECK_EQ(inf, 5u);
+    CHECK_EQ(count, inf);
+    CHECK_EQ(quantiles, 5);
+    CHECK(max == 7.0);
+    CHECK(text.find("t_latency_bucket{le=\"1e-06\"} 1\n") != std::string::npos);
+    CHECK(text.find("t_latency_bucket{le=\"5e-06\"} 2\n") != std::string::npos);
+}
+
+int main()
+{
+    test_buckets();
+    test_quantiles();
+    test_prometheus();
+    return test_result("test_metrics");
+}
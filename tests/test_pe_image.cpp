@@ -0,0 +1,106 @@
+#include <string>
+#include "pe_test_image.h"
+#include "test_util.h"
+
+using namespace pe_image;
+
+template <typename Traits>
+static void test_map_and_relocate()
+{
+    using thunk_t = typename Traits::thunk_t;
+    const uint32_t pages = 64;
+    const uint32_t per_page = pe_test::PAGE / sizeof(thunk_t);
+    std::vector<uint8_t> f = pe_test::build<Traits>(pages, 20);
+
+    layout_t<Traits> l;
+    CHECK(parse(f.data(), f.size(), &l));
+    CHECK_EQ(l.sections.size(), 3u);
+    CHECK_EQ(l.image_size, (uint32_t)f.size());
+    std::vector<uint8_t> img(l.image_size);
+    CHECK(map_sections(l, f.data(), f.size(), img.data()));
+
+    const uint64_t delta = 0x10000;
+    relocate(l, img.data(), l.image_base + delta);
+    int wrong = 0;
+    for (uint32_t pg = 0; pg < pages; ++pg)
+    {
+        for (uint32_t k = 0; k < per_page; ++k)
+        {
+            thunk_t v;
+            memcpy(&v, &img[pe_test::HEADER_SIZE + pg * pe_test::PAGE + k * sizeof(thunk_t)], sizeof(v));
+            thunk_t orig = (thunk_t)l.image_base + (thunk_t)(pg * per_page + k);
+            thunk_t want = k % pe_test::SKIPPED_EVERY == pe_test::SKIPPED_AT ? orig : (thunk_t)(orig + delta);
+            wrong += v != want;
+        }
+    }
+    CHECK_EQ(wrong, 0);
+
+    std::string library;
+    int names = 0;
+    int ordinals = 0;
+    uint16_t last_ordinal = 0;
+    bool ok = walk_imports(l, img.data(), false,
+        [&](const char* name) -> void*
+        {
+            library = name;
+            return &library;
+        },
+        [&](void* ctx, const char* name, uint16_t ordinal, thunk_t* iat)
+        {
+            CHECK(ctx == &library);
+            if (name != nullptr)
+            {
+                CHECK_EQ(std::string(name), "Func" + std::to_string(names + ordinals));
+                ++names;
+            }
+            else
+            {
+                last_ordinal = ordinal;
+                ++ordinals;
+            }
+            *iat = 1;
+            return true;
+        });
+    CHECK(ok);
+    CHECK_EQ(library, std::string("kernel32.dll"));
+    CHECK_EQ(names, 18);
+    CHECK_EQ(ordinals, 2);
+    CHECK_EQ(last_ordinal, 20);
+}
+
+// Each flavour only accepts its own machine and optional header
+static void test_flavours()
+{
+    std::vector<uint8_t> x64 = pe_test::build<pe32plus_x64_traits>(1, 1);
+    std::vector<uint8_t> x86 = pe_test::build<pe32_traits>(1, 1);
+    layout_t<pe32plus_x64_traits> l64;
+    layout_t<pe32plus_arm64_traits> la64;
+    layout_t<pe32_traits> l32;
+    CHECK(parse(x64.data(), x64.size(), &l64));
+    CHECK(!parse(x64.data(), x64.size(), &la64));
+    CHECK(!parse(x64.data(), x64.size(), &l32));
+    CHECK(parse(x86.data(), x86.size(), &l32));
+    CHECK(!parse(x86.data(), x86.size(), &l64));
+}
+
+static void test_truncated()
+{
+    std::vector<uint8_t> f = pe_test::build<pe32plus_x64_traits>(1, 1);
+    layout_t<pe32plus_x64_traits> l;
+    CHECK(!parse(f.data(), 0x100, &l));
+    CHECK(!parse(f.data(), 0x3C, &l));
+
+    // A section whose raw data runs past the file
+    CHECK(parse(f.data(), f.size(), &l));
+    std::vector<uint8_t> img(l.image_size);
+    CHECK(!map_sections(l, f.data(), f.size() - 1, img.data()));
+}
+
+int main()
+{
+    test_map_and_relocate<pe32plus_x64_traits>();
+    test_map_and_relocate<pe32_traits>();
+    test_flavours();
+    test_truncated();
+    return test_result("test_pe_image");
+}
@@ -0,0 +1,76 @@
+#include "idahost_pipeline.h"
+#include "test_util.h"
+
+struct job_t
+{
+    int id;
+    bool cached;
+    std::atomic<int> prepared{ 0 };
+    std::atomic<int> ran{ 0 };
+    std::atomic<int> finished{ 0 };
+
+    job_t(int i, bool c) : id(i), cached(c) {}
+    job_t(const job_t& o) : id(o.id), cached(o.cached) {}
+};
+
+// Every job goes through prepare and finish once, through run unless
+// prepare reported a cache hit, and run stays on the calling thread
+static void test_stages(size_t depth)
+{
+    using namespace std::chrono_literals;
+    std::vector<job_t> jobs;
+    for (int i = 0; i < 40; ++i)
+        jobs.emplace_back(i, i % 5 == 0);
+
+    const std::thread::id owner = std::this_thread::get_id();
+    std::atomic<int> wrong_thread{ 0 };
+    job_pipeline_t<job_t>::options_t opt;
+    opt.queue_depth = depth;
+    job_pipeline_t<job_t> p(
+        [](job_t& j)
+        {
+            std::this_thread::sleep_for(1ms);
+            ++j.prepared;
+            return !j.cached;
+        },
+        [&](job_t& j)
+        {
+            wrong_thread += std::this_thread::get_id() != owner;
+            ++j.ran;
+        },
+        [](job_t& j) { ++j.finished; },
+        opt);
+    p.run(jobs);
+
+    int wrong = 0;
+    for (const job_t& j : jobs)
+        wrong += j.prepared != 1 || j.finished != 1 || j.ran != (j.cached ? 0 : 1);
+    CHECK_EQ(wrong, 0);
+    CHECK_EQ(wrong_thread.load(), 0);
+
+    using pipeline_t = job_pipeline_t<job_t>;
+    pipeline_t::stats_t st = p.stats();
+    CHECK_EQ(st.skipped, 8u);
+    CHECK_EQ(st.stages[pipeline_t::stage_prepare].jobs, 40u);
+    CHECK_EQ(st.stages[pipeline_t::stage_run].jobs, 32u);
+    CHECK_EQ(st.stages[pipeline_t::stage_finish].jobs, 40u);
+    CHECK_EQ(st.stages[pipeline_t::stage_run].threads, 1u);
+    CHECK(st.stages[pipeline_t::stage_run].max_queued <= depth);
+    CHECK(st.wall_seconds > 0);
+}
+
+static void test_empty()
+{
+    std::vector<job_t> none;
+    job_pipeline_t<job_t> p([](job_t&) { return true; }, [](job_t&) {}, [](job_t&) {});
+    p.run(none);
+    CHECK_EQ(p.stats().skipped, 0u);
+}
+
+int main()
+{
+    test_stages(1);
+    test_stages(4);
+    test_empty();
+    return test_result("test_pipeline");
+}
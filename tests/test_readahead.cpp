@@ -0,0 +1,160 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <fstream>
+#include <string>
+#include "idahost_readahead.h"
+#include "test_util.h"
+
+namespace fs = std::filesystem;
+
+static fs::path make_dir()
+{
+    char tmpl[] = "/tmp/idahost_readahead_XXXXXX";
+    CHECK(mkdtemp(tmpl) != nullptr);
+    return tmpl;
+}
+
+static void write_file(const fs::path& p, size_t size)
+{
+    std::ofstream out(p, std::ios::binary);
+    std::string chunk(4096, 'r');
+    for (size_t done = 0; done < size; done += chunk.size())
+        out.write(chunk.data(), (std::streamsize)(std::min)(chunk.size(), size - done));
+}
+
+// A sparse file reads as zeros without taking disk space
+static void make_sparse(const fs::path& p, uint64_t size)
+{
+    { std::ofstream out(p, std::ios::binary); }
+    fs::resize_file(p, size);
+}
+
+static void test_database_files()
+{
+    fs::path dir = make_dir();
+    for (const char* name : { "a.exe", "a.exe.id0", "a.exe.nam", "a.id1", "a.i64", "b", "b.id0", "b.til" })
+        write_file(dir / name, 10);
+    fs::create_directory(dir / "a.exe.id2");    // not a regular file
+
+    // Both "name.ext.*" and "name.*", in that order, missing ones skipped
+    std::vector<fs::path> got = readahead_t::database_files(dir / "a.exe");
+    std::vector<fs::path> want = { dir / "a.exe", dir / "a.exe.id0", dir / "a.exe.nam", dir / "a.id1", dir / "a.i64" };
+    CHECK(got == want);
+
+    // Without an extension both schemes name the same files
+    got = readahead_t::database_files(dir / "b");
+    want = { dir / "b", dir / "b.id0", dir / "b.til" };
+    CHECK(got == want);
+
+    // A database as input is listed once
+    got = readahead_t::database_files(dir / "a.i64");
+    CHECK(got.size() == 2 && got[0] == dir / "a.i64" && got[1] == dir / "a.id1");
+
+    // A missing input still finds its database
+    fs::remove(dir / "a.exe");
+    got = readahead_t::database_files(dir / "a.exe");
+    CHECK(!got.empty() && got[0] == dir / "a.exe.id0");
+    CHECK(readahead_t::database_files(dir / "none").empty());
+
+    // Relative inputs come back absolute
+    fs::path cwd = fs::current_path();
+    fs::current_path(dir);
+    got = readahead_t::database_files("b");
+    CHECK(!got.empty() && got[0] == dir / "b");
+    fs::current_path(cwd);
+    fs::remove_all(dir);
+}
+
+// Waits for the background thread to read all of `file`
+static bool wait_read(const readahead_t& ra, size_t file)
+{
+    for (int i = 0; i < 5000; ++i)
+    {
+        readahead_t::file_stats_t st = ra.stats()[file];
+        if (st.read >= st.size)
+            return true;
+        usleep(1000);
+    }
+    return false;
+}
+
+static void test_note_open()
+{
+    fs::path dir = make_dir();
+    write_file(dir / "small", 100000);
+    write_file(dir / "empty", 0);
+    readahead_t ra;
+    ra.start({ dir / "small", dir / "empty", dir / "missing" }, 4096);
+    CHECK(wait_read(ra, 0));
+
+    double resident = -1;
+    CHECK_EQ(ra.note_open(dir / "small", &resident), 0);
+    CHECK(resident == 1.0);
+    // Only the first open counts
+    resident = -1;
+    CHECK_EQ(ra.note_open(dir / "small", &resident), -1);
+    CHECK(resident == -1);
+    CHECK(ra.stats()[0].resident_at_open == 1.0);
+
+    // An empty file is fully resident; a missing one has nothing read
+    CHECK_EQ(ra.note_open(dir / "empty", &resident), 1);
+    CHECK(resident == 1.0);
+    CHECK_EQ(ra.note_open(dir / "missing", &resident), 2);
+    CHECK(resident == 1.0);
+    CHECK_EQ(ra.stats()[2].read, 0u);
+
+    CHECK_EQ(ra.note_open(dir / "other", &resident), -1);
+    ra.stop();
+    CHECK_EQ(ra.bytes_read(), 100000u);
+    fs::remove_all(dir);
+}
+
+// Once opened, a file is no longer read ahead; the next one still is
+static void test_opened_file_skipped()
+{
+    fs::path dir = make_dir();
+    const uint64_t big = 1ull << 30;
+    make_sparse(dir / "big", big);
+    write_file(dir / "next", 50000);
+    readahead_t ra;
+    ra.start({ dir / "big", dir / "next" }, 4096);
+    double resident = -1;
+    CHECK_EQ(ra.note_open(dir / "big", &resident), 0);
+    CHECK(resident >= 0 && resident < 1);
+    CHECK(wait_read(ra, 1));
+    CHECK(ra.stats()[0].read < big);
+    ra.stop();
+    fs::remove_all(dir);
+}
+
+// stop() ends a read in progress without waiting for the file
+static void test_stop()
+{
+    fs::path dir = make_dir();
+    const uint64_t big = 1ull << 32;
+    make_sparse(dir / "big", big);
+    readahead_t ra;
+    ra.start({ dir / "big" }, 4096);
+    usleep(10000);
+    auto t0 = std::chrono::steady_clock::now();
+    ra.stop();
+    CHECK(bench_seconds_since(t0) < 1);
+    uint64_t read = ra.bytes_read();
+    CHECK(read < big);
+    usleep(10000);
+    CHECK_EQ(ra.bytes_read(), read);
+
+    // And the reader can be started again
+    ra.start({ dir / "big" }, 1 << 20);
+    ra.stop();
+    fs::remove_all(dir);
+}
+
+int main()
+{
+    test_database_files();
+    test_note_open();
+    test_opened_file_skipped();
+    test_stop();
+    return test_result("test_readahead");
+}
@@ -0,0 +1,230 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "idahost_scan.h"
+#include "test_util.h"
+
+using match_t = multi_scanner_t::match_t;
+
+struct naive_pattern_t
+{
+    std::vector<uint8_t> bytes;
+    std::vector<uint8_t> mask;
+};
+
+static std::vector<naive_pattern_t> g_patterns;
+
+// Registers `hex` with both the scanner and the reference
+static int add(multi_scanner_t& s, const char* hex)
+{
+    int idx = s.add_hex(hex);
+    CHECK_EQ(idx, (int)g_patterns.size());
+    naive_pattern_t p;
+    for (const char* c = hex; *c != '\0'; )
+    {
+        if (*c == ' ')
+        {
+            ++c;
+        }
+        else if (*c == '?')
+        {
+            c += 2;
+            p.bytes.push_back(0);
+            p.mask.push_back(0);
+        }
+        else
+        {
+            p.bytes.push_back((uint8_t)strtoul(std::string(c, 2).c_str(), nullptr, 16));
+            p.mask.push_back(0xFF);
+            c += 2;
+        }
+    }
+    g_patterns.push_back(p);
+    return idx;
+}
+
+// Every pattern at every position, in (offset, pattern) order
+static std::vector<match_t> naive(const std::vector<uint8_t>& d)
+{
+    std::vector<match_t> out;
+    for (size_t i = 0; i < d.size(); ++i)
+    {
+        for (size_t p = 0; p < g_patterns.size(); ++p)
+        {
+            const naive_pattern_t& np = g_patterns[p];
+            if (i + np.bytes.size() > d.size())
+                continue;
+            size_t k = 0;
+            while (k < np.bytes.size() && ((d[i + k] ^ np.bytes[k]) & np.mask[k]) == 0)
+                ++k;
+            if (k == np.bytes.size())
+                out.push_back({ (uint64_t)i, (uint32_t)p });
+        }
+    }
+    return out;
+}
+
+static bool same(const std::vector<match_t>& a, const std::vector<match_t>& b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); ++i)
+    {
+        if (a[i].offset != b[i].offset || a[i].pattern != b[i].pattern)
+            return false;
+    }
+    return true;
+}
+
+// Bytes from a small alphabet, so patterns match often
+static std::vector<uint8_t> make_data(size_t n, const uint8_t* alphabet, size_t count, uint64_t seed)
+{
+    std::vector<uint8_t> d(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+        d[i] = alphabet[(seed >> 33) % count];
+    }
+    return d;
+}
+
+static void check_all(multi_scanner_t& s, const std::vector<uint8_t>& d)
+{
+    std::vector<match_t> want = naive(d);
+    for (unsigned threads : { 1u, 3u, 4u })
+        CHECK(same(s.scan(d.data(), d.size(), threads), want));
+}
+
+// Few anchor first bytes: the SSE2 prefilter path
+static void test_few_first_bytes()
+{
+    g_patterns.clear();
+    multi_scanner_t s;
+    add(s, "48 8B ?? 24");
+    add(s, "48 89");
+    add(s, "E8 ?? ?? 00");
+    add(s, "C3 CC");
+    add(s, "?? 48 8B");     // anchored past a wildcard
+    static const uint8_t alphabet[] = { 0x48, 0x8B, 0x89, 0x24, 0xE8, 0x00, 0xC3, 0xCC, 0x11 };
+    std::vector<uint8_t> d = make_data(300000, alphabet, sizeof(alphabet), 1);
+    CHECK(naive(d).size() > 1000);
+    check_all(s, d);
+}
+
+// Many anchor first bytes: the pair table alone
+static void test_many_first_bytes()
+{
+    g_patterns.clear();
+    multi_scanner_t s;
+    const char* hex[] = { "01 02", "03 04 ??", "05 06", "07 08", "09 0A", "0B 0C", "0D 0E 0F", "10 ?? 11" };
+    for (const char* h : hex)
+        add(s, h);
+    uint8_t alphabet[17];
+    for (int i = 0; i < 17; ++i)
+        alphabet[i] = (uint8_t)(i + 1);
+    check_all(s, make_data(300000, alphabet, sizeof(alphabet), 2));
+}
+
+// Patterns with one fixed byte are anchored on it alone
+static void test_single_byte_anchor()
+{
+    g_patterns.clear();
+    multi_scanner_t s;
+    add(s, "C3");
+    add(s, "?? E8 ??");
+    add(s, "90 ?? 90");
+    static const uint8_t alphabet[] = { 0xC3, 0xE8, 0x90, 0x00 };
+    std::vector<uint8_t> d = make_data(300000, alphabet, sizeof(alphabet), 3);
+    check_all(s, d);
+
+    // Matches in the last byte and the last two bytes
+    std::vector<uint8_t> tail = { 0x00, 0x00, 0x00, 0xE8, 0x00, 0xC3 };
+    std::vector<match_t> m = s.scan(tail.data(), tail.size(), 1);
+    CHECK(same(m, naive(tail)));
+    CHECK(!m.empty() && m.back().offset == 5 && m.back().pattern == 0);
+    std::vector<uint8_t> one = { 0xC3 };
+    CHECK_EQ(s.scan(one.data(), one.size()).size(), 1u);
+}
+
+static void test_tail()
+{
+    g_patterns.clear();
+    multi_scanner_t s;
+    add(s, "AA BB");
+    add(s, "BB ?? ?? CC");
+    add(s, "CC");
+    std::vector<uint8_t> d(40, 0x00);
+    d[38] = 0xAA;
+    d[39] = 0xBB;
+    std::vector<match_t> m = s.scan(d.data(), d.size());
+    CHECK_EQ(m.size(), 1u);
+    CHECK(same(m, naive(d)));
+    d[39] = 0xCC;
+    CHECK(same(s.scan(d.data(), d.size()), naive(d)));
+    // A pattern longer than what is left does not match past the end
+    d[36] = 0xBB;
+    CHECK(same(s.scan(d.data(), d.size()), naive(d)));
+}
+
+// Matches whose bytes span the ranges given to different threads
+static void test_thread_boundaries()
+{
+    g_patterns.clear();
+    multi_scanner_t s;
+    add(s, "DE AD BE EF");
+    add(s, "?? ?? AD BE");
+    add(s, "EF");
+    const size_t n = 4 * 64 * 1024 + 3;
+    static const uint8_t sig[] = { 0xDE, 0xAD, 0xBE, 0xEF };
+    for (unsigned threads : { 2u, 3u, 4u })
+    {
+        size_t step = (n + threads - 1) / threads;
+        // Starting on each split, and 1, 2 and 3 bytes before it
+        for (size_t back = 0; back < 4; ++back)
+        {
+            std::vector<uint8_t> d(n, 0x55);
+            for (unsigned t = 1; t < threads; ++t)
+                memcpy(&d[t * step - back], sig, sizeof(sig));
+            memcpy(&d[n - 4], sig, sizeof(sig));
+            std::vector<match_t> want = naive(d);
+            CHECK_EQ(want.size(), (size_t)threads * 3);
+            CHECK(same(s.scan(d.data(), d.size(), threads), want));
+        }
+    }
+}
+
+static void test_add_errors()
+{
+    multi_scanner_t s;
+    CHECK_EQ(s.add_hex(""), -1);
+    CHECK_EQ(s.add_hex("?? ??"), -1);
+    CHECK_EQ(s.add_hex("? ?"), -1);
+    CHECK_EQ(s.add_hex("4"), -1);
+    CHECK_EQ(s.add_hex("48 8"), -1);
+    CHECK_EQ(s.add_hex("4G"), -1);
+    CHECK_EQ(s.add_hex("48 XY"), -1);
+    CHECK_EQ(s.size(), 0u);
+    CHECK(s.scan("\x48", 1).empty());
+
+    CHECK_EQ(s.add_hex("48 ? 8b"), 0);
+    CHECK_EQ(s.add(nullptr, 0), -1);
+    const uint8_t zero_mask[2] = { 0, 0 };
+    CHECK_EQ(s.add("ab", 2, zero_mask), -1);
+    CHECK_EQ(s.size(), 1u);
+    std::vector<uint8_t> d = { 0x48, 0x00, 0x8B };
+    CHECK_EQ(s.scan(d.data(), d.size()).size(), 1u);
+    CHECK(s.scan(d.data(), 0).empty());
+}
+
+int main()
+{
+    test_few_first_bytes();
+    test_many_first_bytes();
+    test_single_byte_anchor();
+    test_tail();
+    test_thread_boundaries();
+    test_add_errors();
+    return test_result("test_scan");
+}
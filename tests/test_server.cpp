@@ -0,0 +1,373 @@
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <thread>
+#include "idahost_ipc.h"
+#include "test_util.h"
+
+using namespace idahost_proto;
+
+// One database at a time, like the hosted kernel
+struct mock_provider_t : idahost_server_t::provider_t
+{
+    uint32_t db_id = 0;
+    uint32_t next_id = 1;
+    std::string path;
+    int opens = 0;
+    int closes = 0;
+
+    uint16_t open_database(const std::string& p, uint32_t* db) override
+    {
+        if (db_id != 0)
+        {
+            if (!p.empty() && p != path)
+                return st_busy;
+            *db = db_id;
+            return st_ok;
+        }
+        if (p.empty())
+            return st_no_database;
+        ++opens;
+        db_id = next_id++;
+        path = p;
+        *db = db_id;
+        return st_ok;
+    }
+
+    uint16_t run_query(uint32_t db, const std::string& name, const std::string& args, std::string* out) override
+    {
+        if (db_id == 0 || db != db_id)
+            return st_no_database;
+        if (name == "echo")
+            *out = path + ":" + args;
+        else if (name == "big")
+            out->assign(INLINE_RESULT * 2 + 100, 'x');
+        else
+            return st_unknown_query;
+        return st_ok;
+    }
+
+    uint16_t close_database(uint32_t db) override
+    {
+        if (db_id == 0 || db != db_id)
+            return st_no_database;
+        ++closes;
+        db_id = 0;
+        path.clear();
+        return st_ok;
+    }
+};
+
+// Everything the client wrote, handed to the server in one read
+struct memory_stream_t : idahost_server_t::stream_t
+{
+    std::string in;
+    size_t pos = 0;
+    std::string out;
+
+    ptrdiff_t read(void* buf, size_t size) override
+    {
+        size_t n = (std::min)(size, in.size() - pos);
+        memcpy(buf, in.data() + pos, n);
+        pos += n;
+        return (ptrdiff_t)n;
+    }
+
+    bool write(const void* buf, size_t size) override
+    {
+        out.append((const char*)buf, size);
+        return true;
+    }
+};
+
+static std::string str_payload(const std::string& s)
+{
+    std::string p;
+    writer_t(p).str(s);
+    return p;
+}
+
+static std::string u32_payload(uint32_t v)
+{
+    std::string p;
+    writer_t(p).u32(v);
+    return p;
+}
+
+static std::string query_payload(uint32_t db, const std::string& name, const std::string& args)
+{
+    std::string p;
+    writer_t w(p);
+    w.u32(db);
+    w.str(name);
+    w.str(args);
+    return p;
+}
+
+static std::vector<std::pair<frame_header_t, std::string>> parse_frames(const std::string& out)
+{
+    std::vector<std::pair<frame_header_t, std::string>> frames;
+    size_t pos = 0;
+    while (out.size() - pos >= sizeof(frame_header_t))
+    {
+        frame_header_t hdr;
+        memcpy(&hdr, out.data() + pos, sizeof(hdr));
+        pos += sizeof(hdr);
+        frames.push_back({ hdr, out.substr(pos, hdr.size) });
+        pos += hdr.size;
+    }
+    CHECK_EQ(pos, out.size());
+    return frames;
+}
+
+static void test_pipelined_batch()
+{
+    mock_provider_t provider;
+    idahost_server_t server(&provider);
+    memory_stream_t s;
+
+    put_frame(s.in, 1, op_open, st_ok, str_payload("a.i64").data(), str_payload("a.i64").size());
+    put_frame(s.in, 2, op_open, st_ok, str_payload("b.i64").data(), str_payload("b.i64").size());
+    std::string q = query_payload(1, "echo", "hi");
+    put_frame(s.in, 3, op_query, st_ok, q.data(), q.size());
+    q = query_payload(1, "big", "");
+    put_frame(s.in, 4, op_query, st_ok, q.data(), q.size());
+    std::string f;
+    writer_t(f).u32(1);
+    writer_t(f).u64(INLINE_RESULT);
+    writer_t(f).u32(0xFFFFFFFF);
+    put_frame(s.in, 5, op_fetch, st_ok, f.data(), f.size());
+    put_frame(s.in, 6, op_release, st_ok, u32_payload(1).data(), 4);
+    put_frame(s.in, 7, op_release, st_ok, u32_payload(1).data(), 4);
+    put_frame(s.in, 8, op_close, st_ok, u32_payload(1).data(), 4);
+    put_frame(s.in, 9, op_open, st_ok, str_payload("b.i64").data(), str_payload("b.i64").size());
+    q = query_payload(2, "echo", "x");
+    put_frame(s.in, 10, op_query, st_ok, q.data(), q.size());
+    q = query_payload(1, "echo", "x");
+    put_frame(s.in, 11, op_query, st_ok, q.data(), q.size());
+    put_frame(s.in, 12, op_shutdown, st_ok, nullptr, 0);
+    put_frame(s.in, 13, op_ping, st_ok, "p", 1);
+    put_frame(s.in, 14, op_close, st_ok, u32_payload(2).data(), 4);
+
+    CHECK(server.serve(s));
+    CHECK(server.shutdown_requested());
+    CHECK_EQ(server.stats().batches, 1u);
+
+    auto frames = parse_frames(s.out);
+    CHECK_EQ(frames.size(), 14u);
+    if (frames.size() != 14)
+        return;
+    for (size_t i = 0; i < frames.size(); ++i)
+        CHECK_EQ(frames[i].first.id, (uint32_t)i + 1);
+
+    CHECK_EQ(frames[0].first.status, st_ok);
+    CHECK_EQ(frames[1].first.status, st_busy);
+    CHECK_EQ(frames[2].first.status, st_ok);
+    {
+        reader_t rd(frames[2].second.data(), frames[2].second.size());
+        CHECK_EQ(rd.u32(), 0u);
+        CHECK_EQ(rd.u64(), 8u);
+    }
+    CHECK_EQ(frames[3].first.status, st_ok);
+    {
+        reader_t rd(frames[3].second.data(), frames[3].second.size());
+        CHECK_EQ(rd.u32(), 1u);
+        CHECK_EQ(rd.u64(), INLINE_RESULT * 2 + 100ull);
+    }
+    CHECK_EQ(frames[4].first.status, st_ok);
+    CHECK_EQ(frames[4].second.size(), INLINE_RESULT + 100u);
+    CHECK_EQ(frames[5].first.status, st_ok);
+    CHECK_EQ(frames[6].first.status, st_no_result);
+    CHECK_EQ(frames[7].first.status, st_ok);
+
+    // Reopened with a new id; the old one is gone
+    CHECK_EQ(frames[8].first.status, st_ok);
+    {
+        reader_t rd(frames[8].second.data(), frames[8].second.size());
+        CHECK_EQ(rd.u32(), 2u);
+    }
+    CHECK_EQ(frames[9].first.status, st_ok);
+    CHECK(frames[9].second.find("b.i64:x") != std::string::npos);
+    CHECK_EQ(frames[10].first.status, st_no_database);
+    CHECK_EQ(provider.opens, 2);
+    CHECK_EQ(provider.closes, 1);
+
+    // Everything behind the shutdown is answered, not executed
+    CHECK_EQ(frames[11].first.status, st_ok);
+    CHECK_EQ(frames[12].first.status, st_shutting_down);
+    CHECK_EQ(frames[13].first.status, st_shutting_down);
+    CHECK_EQ(provider.db_id, 2u);
+}
+
+static void test_bad_frame()
+{
+    mock_provider_t provider;
+    idahost_server_t server(&provider);
+    memory_stream_t s;
+    frame_header_t hdr = { 0xDEADBEEF, 0, 1, op_ping, st_ok };
+    s.in.assign((const char*)&hdr, sizeof(hdr));
+    CHECK(!server.serve(s));
+}
+
+static std::string make_private_dir(mode_t mode)
+{
+    char tmpl[] = "/tmp/idahost_test_XXXXXX";
+    CHECK(mkdtemp(tmpl) != nullptr);
+    chmod(tmpl, mode);
+    return tmpl;
+}
+
+static void test_socket_round_trip()
+{
+    std::string dir = make_private_dir(0700);
+    setenv("XDG_RUNTIME_DIR", dir.c_str(), 1);
+
+    ipc_listener_t listener;
+    CHECK(listener.listen("rt"));
+    std::string path = dir + "/rt.sock";
+    struct stat st;
+    CHECK(lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode));
+
+    mock_provider_t provider;
+    idahost_server_t server(&provider);
+    std::thread srv([&]
+    {
+        ipc_stream_t c;
+        while (!server.shutdown_requested() && listener.accept(&c))
+        {
+            server.serve(c);
+            c.close();
+        }
+    });
+
+    ipc_stream_t s;
+    CHECK(s.connect("rt"));
+    idahost_client_t client(&s);
+    std::string reply;
+    CHECK_EQ(client.call(op_open, str_payload("c.i64"), &reply), st_ok);
+    uint32_t ids[3];
+    for (uint32_t& id : ids)
+        id = client.post(op_ping, "abc");
+    client.post(op_shutdown);
+    CHECK(client.flush());
+    for (uint32_t id : ids)
+    {
+        frame_header_t hdr;
+        CHECK(client.recv(&hdr, &reply));
+        CHECK_EQ(hdr.id, id);
+        CHECK_EQ(reply, std::string("abc"));
+    }
+    frame_header_t hdr;
+    CHECK(client.recv(&hdr, &reply));
+    CHECK_EQ(hdr.op, op_shutdown);
+    srv.join();
+
+    listener.close();
+    CHECK(lstat(path.c_str(), &st) != 0);
+    rmdir(dir.c_str());
+}
+
+// A client that hangs up before reading its reply ends that connection
+// only, not the server (no SIGPIPE)
+static void test_socket_client_gone()
+{
+    std::string dir = make_private_dir(0700);
+    setenv("XDG_RUNTIME_DIR", dir.c_str(), 1);
+
+    ipc_listener_t listener;
+    CHECK(listener.listen("gone"));
+    mock_provider_t provider;
+    idahost_server_t server(&provider);
+    int served = 0;
+    std::thread srv([&]
+    {
+        ipc_stream_t c;
+        while (!server.shutdown_requested() && listener.accept(&c))
+        {
+            server.serve(c);
+            c.close();
+            ++served;
+        }
+    });
+
+    {
+        // A reply far larger than the socket buffer is still being written
+        // when the client goes
+        ipc_stream_t s;
+        CHECK(s.connect("gone"));
+        idahost_client_t client(&s);
+        client.post(op_ping, std::string(8 << 20, 'p'));
+        CHECK(client.flush());
+        s.close();
+    }
+
+    ipc_stream_t s;
+    CHECK(s.connect("gone"));
+    idahost_client_t client(&s);
+    std::string reply;
+    CHECK_EQ(client.call(op_ping, "alive", &reply), st_ok);
+    CHECK_EQ(reply, std::string("alive"));
+    client.post(op_shutdown);
+    CHECK(client.flush());
+    frame_header_t hdr;
+    CHECK(client.recv(&hdr, &reply));
+    srv.join();
+    CHECK_EQ(served, 2);
+
+    listener.close();
+    rmdir(dir.c_str());
+}
+
+static void test_socket_dir_checks()
+{
+    // A directory others can enter is refused
+    std::string open_dir = make_private_dir(0755);
+    setenv("XDG_RUNTIME_DIR", open_dir.c_str(), 1);
+    ipc_listener_t listener;
+    CHECK(!listener.listen("open"));
+    ipc_stream_t s;
+    CHECK(!s.connect("open"));
+    rmdir(open_dir.c_str());
+
+    // Something else at the socket's path is left alone
+    std::string dir = make_private_dir(0700);
+    setenv("XDG_RUNTIME_DIR", dir.c_str(), 1);
+    std::string path = dir + "/taken.sock";
+    FILE* fp = fopen(path.c_str(), "w");
+    CHECK(fp != nullptr);
+    if (fp != nullptr)
+        fclose(fp);
+    CHECK(!listener.listen("taken"));
+    listener.close();
+    struct stat st;
+    CHECK(lstat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode));
+    unlink(path.c_str());
+
+    // A stale socket of ours is replaced
+    {
+        ipc_listener_t first;
+        CHECK(first.listen("stale"));
+        ipc_listener_t second;
+        CHECK(second.listen("stale"));
+    }
+    rmdir(dir.c_str());
+
+    // The fallback directory is created private
+    unsetenv("XDG_RUNTIME_DIR");
+    std::string fallback = ipc_stream_t::runtime_dir();
+    CHECK(fallback.find("/tmp/idahost-") == 0);
+    ipc_listener_t fb;
+    char name[64];
+    snprintf(name, sizeof(name), "test_%d", (int)getpid());
+    CHECK(fb.listen(name));
+    CHECK(lstat(fallback.c_str(), &st) == 0 && (st.st_mode & 077) == 0);
+}
+
+int main()
+{
+    test_pipelined_batch();
+    test_bad_frame();
+    test_socket_round_trip();
+    test_socket_client_gone();
+    test_socket_dir_checks();
+    return test_result("test_server");
+}
@@ -0,0 +1,146 @@
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "idahost_shared_region.h"
+#include "test_util.h"
+
+static void* const BASE = (void*)0x5E0000000000ull;
+static const size_t SIZE = 256 * 1024;
+static const uint64_t TOTAL = 64 * 1024 + SIZE;
+
+static std::string unique_name(const char* tag)
+{
+    return std::string("/idahost_test_") + tag + "_" + std::to_string((int)getpid());
+}
+
+static bool fill(void* ud, void* dst, size_t size)
+{
+    memset(dst, *(int*)ud, size);
+    return true;
+}
+
+// Fails cleanly with a status instead of killing the process with SIGBUS
+static int child_open(const std::string& name, size_t size, int timeout_ms)
+{
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        shared_region_t r;
+        int v = 0x11;
+        if (!r.open(name.c_str(), size, BASE, fill, &v, timeout_ms))
+            _exit(2);
+        _exit(((uint8_t*)r.base())[size - 1] == 0x5A ? 0 : 3);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (WIFSIGNALED(status))
+        return -WTERMSIG(status);
+    return WEXITSTATUS(status);
+}
+
+// A joiner sees the creator's content
+static void test_join()
+{
+    std::string name = unique_name("region");
+    shared_region_t::remove(name.c_str());
+    shared_region_t r;
+    int v = 0x5A;
+    CHECK(r.open(name.c_str(), SIZE, BASE, fill, &v));
+    CHECK(r.created());
+    // The name outlives the creator; closing frees the address for the child
+    r.close();
+    CHECK_EQ(child_open(name, SIZE, 1000), 0);
+    // A different size is refused
+    CHECK_EQ(child_open(name, SIZE * 2, 1000), 2);
+    shared_region_t::remove(name.c_str());
+}
+
+// A joiner that writes one page: that page becomes private to it, the
+// pages it only read stay shared, and the region's content is unchanged
+static void test_sharing()
+{
+    std::string name = unique_name("sharing");
+    shared_region_t::remove(name.c_str());
+    shared_region_t r;
+    int v = 0x5A;
+    CHECK(r.open(name.c_str(), SIZE, BASE, fill, &v));
+    r.close();
+
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        shared_region_t j;
+        int unused = 0;
+        if (!j.open(name.c_str(), SIZE, BASE, fill, &unused, 1000))
+            _exit(2);
+        volatile uint8_t* b = (volatile uint8_t*)j.base();
+        unsigned sum = 0;
+        for (size_t off = 0; off < SIZE; off += page)
+            sum += b[off];
+        b[page * 3] = 0xEE;
+        shared_region_t::sharing_t sh;
+        if (!shared_region_t::query_sharing(j.base(), SIZE, &sh))
+            _exit(3);
+        if (sh.private_bytes != page)
+            _exit(4);
+        if (sh.shared_bytes != SIZE - page || sh.nonresident_bytes != 0)
+            _exit(5);
+        _exit(sum == 0x5A * (SIZE / page) ? 0 : 6);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    CHECK(WIFEXITED(status));
+    CHECK_EQ(WEXITSTATUS(status), 0);
+
+    // Copy-on-write: the creator's bytes are as they were
+    shared_region_t again;
+    int unused = 0;
+    CHECK(again.open(name.c_str(), SIZE, BASE, fill, &unused, 1000));
+    CHECK(!again.created());
+    const uint8_t* b = (const uint8_t*)again.base();
+    CHECK_EQ(b[page * 3], 0x5A);
+    CHECK_EQ(b[SIZE - 1], 0x5A);
+    again.close();
+    shared_region_t::remove(name.c_str());
+}
+
+// The creator died between shm_open and ftruncate
+static void test_unsized()
+{
+    std::string name = unique_name("unsized");
+    shared_region_t::remove(name.c_str());
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    CHECK(fd != -1);
+    CHECK_EQ(child_open(name, SIZE, 50), 2);
+    close(fd);
+    shared_region_t::remove(name.c_str());
+}
+
+// The creator sizes the object after the joiner opened it, then dies
+// before marking it ready
+static void test_late_size()
+{
+    std::string name = unique_name("late");
+    shared_region_t::remove(name.c_str());
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    CHECK(fd != -1);
+    std::thread creator([fd]
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(30));
+        CHECK(ftruncate(fd, (off_t)TOTAL) == 0);
+    });
+    CHECK_EQ(child_open(name, SIZE, 200), 2);
+    creator.join();
+    close(fd);
+    shared_region_t::remove(name.c_str());
+}
+
+int main()
+{
+    test_join();
+    test_sharing();
+    test_unsized();
+    test_late_size();
+    return test_result("test_shared_region");
+}
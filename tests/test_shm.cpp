@@ -0,0 +1,164 @@
+#include <unistd.h>
+#include "idahost_shm_ring.h"
+#include "test_util.h"
+
+static std::string unique_name(const char* tag)
+{
+    return std::string("/idahost_test_") + tag + "_" + std::to_string((int)getpid());
+}
+
+// A second create() maps the existing segment with its real size
+static void test_create_existing()
+{
+    std::string name = unique_name("seg");
+    shm_segment_t a;
+    bool created = false;
+    CHECK(a.create(name.c_str(), 8192, &created));
+    CHECK(created);
+
+    shm_segment_t b;
+    CHECK(b.create(name.c_str(), 1 << 20, &created));
+    CHECK(!created);
+    CHECK_EQ(b.size(), 8192u);
+    ((volatile uint8_t*)b.data())[b.size() - 1] = 1;
+    CHECK_EQ(((uint8_t*)a.data())[8191], 1);
+}
+
+// Attaching to a smaller ring checks the ring's own capacity
+static void test_ring_existing()
+{
+    std::string name = unique_name("ring");
+    shm_ring_t a;
+    CHECK(a.create(name.c_str(), 4096));
+    shm_ring_t b;
+    CHECK(b.create(name.c_str(), 1 << 20));
+    CHECK_EQ(b.capacity(), 4096u);
+    CHECK(b.write("abc", 3));
+
+    shm_ring_t::view_t v;
+    CHECK(a.try_peek(&v));
+    CHECK_EQ(v.size, 3u);
+    a.release();
+}
+
+// A producer gives up once the consumer stops freeing space
+static void test_stalled_consumer()
+{
+    std::string name = unique_name("stall");
+    shm_ring_t ring;
+    CHECK(ring.create(name.c_str(), 4096));
+    ring.set_stall_timeout(std::chrono::milliseconds(50));
+    char buf[1000] = {};
+    int written = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    while (ring.write(buf, sizeof(buf)) && written < 100)
+        ++written;
+    CHECK(written < 100);
+    CHECK_EQ(ring.stats().timeouts, 1u);
+    CHECK(bench_seconds_since(t0) < 5);
+}
+
+// Ring header fields as laid out in the segment
+struct ring_header_t
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;
+    alignas(64) uint64_t head;
+    alignas(64) uint64_t tail;
+    alignas(64) uint32_t closed;
+};
+static const size_t DATA_OFFSET = 256;
+
+// A joiner refuses a header it cannot index safely
+static void test_bad_header()
+{
+    std::string name = unique_name("hdr");
+    shm_ring_t a;
+    CHECK(a.create(name.c_str(), 4096));
+    shm_segment_t seg;
+    CHECK(seg.open(name.c_str()));
+    ring_header_t* h = (ring_header_t*)seg.data();
+    CHECK_EQ(h->capacity, 4096u);
+
+    const uint64_t bad_capacities[] = { 0, 3000, 2048 + 4096, 1ull << 40 };
+    for (uint64_t cap : bad_capacities)
+    {
+        h->capacity = cap;
+        shm_ring_t b;
+        CHECK(!b.open(name.c_str()));
+    }
+    h->capacity = 2048;
+    shm_ring_t smaller;
+    CHECK(smaller.open(name.c_str()));
+    CHECK_EQ(smaller.capacity(), 2048u);
+
+    h->capacity = 4096;
+    h->version = 2;
+    shm_ring_t b;
+    CHECK(!b.open(name.c_str()));
+    h->version = 1;
+    CHECK(b.open(name.c_str()));
+}
+
+// Records whose size runs past the published data or the ring are refused
+static void test_bad_record()
+{
+    std::string name = unique_name("rec");
+    shm_ring_t ring;
+    CHECK(ring.create(name.c_str(), 4096));
+    shm_segment_t seg;
+    CHECK(seg.open(name.c_str()));
+    ring_header_t* h = (ring_header_t*)seg.data();
+    uint8_t* data = (uint8_t*)seg.data() + DATA_OFFSET;
+    shm_ring_t::view_t v;
+
+    const uint32_t bad_sizes[] = { 17, 5000, 0xFFFFFFF8u };
+    for (uint32_t size : bad_sizes)
+    {
+        shm_ring_t c;
+        CHECK(c.open(name.c_str()));
+        shm_record_t* rec = (shm_record_t*)(data + (h->tail & 4095));
+        CHECK(ring.write("0123456789", 10));
+        rec->size = size;
+        CHECK(!c.try_peek(&v));
+        CHECK(c.corrupt());
+        CHECK(!c.peek(&v));
+        rec->size = 10;
+        // The intact record is still there for a fresh consumer
+        shm_ring_t d;
+        CHECK(d.open(name.c_str()));
+        CHECK(d.try_peek(&v));
+        CHECK_EQ(v.size, 10u);
+        d.release();
+    }
+
+    // A padding record may not skip past the end of the ring
+    CHECK(ring.write("x", 1));
+    shm_record_t* next = (shm_record_t*)(data + (h->tail & 4095));
+    next->type = 0xFFFFFFFFu;
+    next->size = 8192;
+    shm_ring_t c;
+    CHECK(c.open(name.c_str()));
+    CHECK(!c.try_peek(&v));
+    CHECK(c.corrupt());
+
+    // Nor can a head that claims more than the capacity
+    next->type = shm_ring_t::rec_user;
+    next->size = 1;
+    h->head = h->tail + 8192;
+    shm_ring_t e;
+    CHECK(e.open(name.c_str()));
+    CHECK(!e.try_peek(&v));
+    CHECK(e.corrupt());
+}
+
+int main()
+{
+    test_create_existing();
+    test_ring_existing();
+    test_stalled_consumer();
+    test_bad_header();
+    test_bad_record();
+    return test_result("test_shm");
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+
+// Minimal checks for the tests: a failed CHECK reports and counts, and
+// test_result() turns the count into the exit code
+inline int g_test_failures = 0;
+
+#define CHECK(cond)                                                         \
+    do                                                                      \
+    {                                                                       \
+        if (!(cond))                                                        \
+        {                                                                   \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            ++g_test_failures;                                              \
+        }                                                                   \
+    } while (false)
+
+#define CHECK_EQ(a, b) CHECK((a) == (b))
+
+inline int test_result(const char* name)
+{
+    if (g_test_failures != 0)
+        fprintf(stderr, "%s: %d check(s) failed\n", name, g_test_failures);
+    else
+        printf("%s: ok\n", name);
+    return g_test_failures != 0 ? 1 : 0;
+}
+
+// Benchmarks take --quick to run a short pass under ctest
+inline bool bench_quick(int argc, char** argv)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--quick") == 0)
+            return true;
+    }
+    return false;
+}
+
+inline double bench_seconds_since(std::chrono::steady_clock::time_point t0)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
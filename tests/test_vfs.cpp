@@ -0,0 +1,101 @@
+#include "idahost_vfs.h"
+#include "test_util.h"
+
+static void test_prefix_boundaries()
+{
+    vfs_store_t vfs;
+    vfs.add_prefix(L"C:\\jobs\\db");
+    vfs.add_prefix(L"D:/scratch/");
+    CHECK(vfs.matches(L"c:\\jobs\\db\\x.i64"));
+    CHECK(vfs.matches(L"C:/Jobs/DB//sub/x.i64"));
+    CHECK(vfs.matches(L"c:\\jobs\\db"));
+    CHECK(!vfs.matches(L"c:\\jobs\\db2\\x.i64"));
+    CHECK(!vfs.matches(L"c:\\jobs\\dbx"));
+    CHECK(!vfs.matches(L"c:\\jobs\\d"));
+    CHECK(vfs.matches(L"d:\\scratch\\a"));
+    CHECK(!vfs.matches(L"d:\\scratchpad\\a"));
+}
+
+static void test_read_write()
+{
+    vfs_store_t vfs;
+    uint32_t h;
+    CHECK_EQ(vfs.open(L"c:\\db\\a.id0", vfs_store_t::open_existing, true, true, false, false, &h), vfs_store_t::st_not_found);
+    CHECK_EQ(vfs.open(L"c:\\db\\a.id0", vfs_store_t::create_new, true, true, false, false, &h), vfs_store_t::st_ok);
+
+    // Spans a block boundary
+    std::vector<uint8_t> data(vfs_store_t::BLOCK_SIZE + 100);
+    for (size_t i = 0; i < data.size(); ++i)
+        data[i] = (uint8_t)(i * 7);
+    CHECK_EQ(vfs.write(h, data.data(), data.size()), vfs_store_t::st_ok);
+    uint64_t pos;
+    CHECK_EQ(vfs.seek(h, -200, 1, &pos), vfs_store_t::st_ok);
+    CHECK_EQ(pos, data.size() - 200);
+    uint8_t buf[300];
+    size_t got;
+    CHECK_EQ(vfs.read(h, buf, sizeof(buf), &got), vfs_store_t::st_ok);
+    CHECK_EQ(got, 200u);
+    CHECK(memcmp(buf, data.data() + data.size() - 200, 200) == 0);
+
+    // Truncated and extended tails read as zeros
+    CHECK_EQ(vfs.seek(h, 10, 0, nullptr), vfs_store_t::st_ok);
+    CHECK_EQ(vfs.set_end(h), vfs_store_t::st_ok);
+    uint64_t at = 20;
+    CHECK_EQ(vfs.write(h, "x", 1, &at), vfs_store_t::st_ok);
+    at = 0;
+    CHECK_EQ(vfs.read(h, buf, sizeof(buf), &got, &at), vfs_store_t::st_ok);
+    CHECK_EQ(got, 21u);
+    CHECK_EQ(buf[15], 0);
+    CHECK_EQ(buf[20], 'x');
+    CHECK_EQ(vfs.close(h), vfs_store_t::st_ok);
+    CHECK_EQ(vfs.close(h), vfs_store_t::st_bad_handle);
+
+    std::vector<uint8_t> out;
+    CHECK(vfs.extract(L"C:/DB/A.ID0", &out));
+    CHECK_EQ(out.size(), 21u);
+    CHECK_EQ(vfs.rename(L"c:\\db\\a.id0", L"c:\\db\\b.id0", false), vfs_store_t::st_ok);
+    CHECK(!vfs.exists(L"c:\\db\\a.id0"));
+    CHECK(vfs.exists(L"c:\\db\\b.id0"));
+}
+
+// Duplicates share the position; delete-on-close waits for the last one
+static void test_duplicate()
+{
+    vfs_store_t vfs;
+    uint32_t a;
+    CHECK_EQ(vfs.open(L"c:\\db\\tmp", vfs_store_t::create_always, true, true, false, true, &a), vfs_store_t::st_ok);
+    uint32_t b;
+    CHECK_EQ(vfs.duplicate(a, &b), vfs_store_t::st_ok);
+    CHECK(a != b);
+    CHECK_EQ(vfs.write(a, "abcdef", 6), vfs_store_t::st_ok);
+    uint64_t pos;
+    CHECK_EQ(vfs.seek(b, 0, 1, &pos), vfs_store_t::st_ok);
+    CHECK_EQ(pos, 6u);
+
+    std::wstring path;
+    bool can_write = false;
+    CHECK_EQ(vfs.info(b, &path, &can_write), vfs_store_t::st_ok);
+    CHECK(path == L"c:\\db\\tmp");
+    CHECK(can_write);
+    char buf[8];
+    size_t got;
+    CHECK_EQ(vfs.read_snapshot(b, 2, buf, sizeof(buf), &got), vfs_store_t::st_ok);
+    CHECK_EQ(got, 4u);
+    CHECK(memcmp(buf, "cdef", 4) == 0);
+    CHECK_EQ(vfs.seek(a, 0, 1, &pos), vfs_store_t::st_ok);
+    CHECK_EQ(pos, 6u);
+
+    CHECK_EQ(vfs.close(a), vfs_store_t::st_ok);
+    CHECK(vfs.exists(L"c:\\db\\tmp"));
+    CHECK_EQ(vfs.close(b), vfs_store_t::st_ok);
+    CHECK(!vfs.exists(L"c:\\db\\tmp"));
+    CHECK_EQ(vfs.duplicate(a, &b), vfs_store_t::st_bad_handle);
+}
+
+int main()
+{
+    test_prefix_boundaries();
+    test_read_write();
+    test_duplicate();
+    return test_result("test_vfs");
+}